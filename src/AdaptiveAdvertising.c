@@ -0,0 +1,435 @@
+/*
+* Copyright (c) 2016 Academia Sinica, Institute of Information Science
+*
+* License:
+*
+*      GPL 3.0 : The content of this file is subject to the terms and
+*      conditions defined in file 'COPYING.txt', which is part of this source
+*      code package.
+*
+* Project Name:
+*
+*      BeDIPS
+*
+* File Description:
+*
+*      This file contains the controller adapting the advertising interval and
+*      TX power of the beacon to the rate at which devices are discovered.
+*
+* File Name:
+*
+*      AdaptiveAdvertising.c
+*
+* Abstract:
+*
+*      BeDIPS uses LBeacons to deliver 3D coordinates and textual
+*      descriptions of their locations to users' devices. Basically, a LBeacon
+*      is an inexpensive, Bluetooth Smart Ready device. The 3D coordinates and
+*      location description of every LBeacon are retrieved from BeDIS
+*      (Building/environment Data and Information System) and stored locally
+*      during deployment and maintenance times. Once initialized, each LBeacon
+*      broadcasts its coordinates and location description to Bluetooth
+*      enabled user devices within its coverage area.
+*
+* Authors:
+*
+*      Jake Lee, jakelee@iis.sinica.edu.tw
+*      Johnson Su, johnsonsu@iis.sinica.edu.tw
+*      Shirley Huang, shirley.huang.93@gmail.com
+*      Han Hu, hhu14@illinois.edu
+*      Jeffrey Lin, lin.jeff03@gmail.com
+*      Howard Hsu, haohsu0823@gmail.com
+*      Han Wang, hollywang@iis.sinica.edu.tw
+*/
+
+
+#include "AdaptiveAdvertising.h"
+
+
+/*
+*  get_level_settings:
+*
+*  This helper function computes the interval and TX power of a level. The
+*  interval shrinks geometrically and the power grows linearly from the
+*  quietest level to the busiest one.
+*
+*  Parameters:
+*
+*  adaptive - the adaptive advertising controller
+*  level - the level
+*  interval - receives the interval in units of 0.625 milliseconds
+*  tx_power - receives the TX power in dBm
+*
+*  Return value:
+*
+*  None
+*/
+static void get_level_settings(AdaptiveAdvertising *adaptive, int level,
+                               int *interval, int *tx_power) {
+
+    double step = (double)level / (ADAPTIVE_NUMBER_OF_LEVELS - 1);
+
+    *interval = (int)lround(adaptive->maximum_interval *
+                            pow((double)adaptive->minimum_interval /
+                                adaptive->maximum_interval, step));
+    *tx_power = (int)lround(adaptive->minimum_tx_power +
+                            (adaptive->maximum_tx_power -
+                             adaptive->minimum_tx_power) * step);
+}
+
+
+/*
+*  get_threshold:
+*
+*  This helper function returns the discovery rate reaching a level.
+*
+*  Parameters:
+*
+*  adaptive - the adaptive advertising controller
+*  level - the level
+*
+*  Return value:
+*
+*  Discovery rate per second
+*/
+static double get_threshold(AdaptiveAdvertising *adaptive, int level) {
+
+    return adaptive->full_rate * level / (ADAPTIVE_NUMBER_OF_LEVELS - 1);
+}
+
+
+/*
+*  adaptive_advertising_init:
+*
+*  This function initializes the controller at the quietest level.
+*
+*  Parameters:
+*
+*  adaptive - the adaptive advertising controller
+*  minimum_interval - shortest interval in units of 0.625 milliseconds
+*  maximum_interval - longest interval in units of 0.625 milliseconds
+*  minimum_tx_power - lowest TX power in dBm
+*  maximum_tx_power - highest TX power in dBm
+*  full_rate - discovery rate per second reaching the busiest level
+*  hysteresis - fraction of its threshold the rate falls below to leave a
+*               level
+*  hold_time - time in milliseconds a level is kept before going down
+*
+*  Return value:
+*
+*  0 - success
+*  -1 - invalid bounds
+*/
+int adaptive_advertising_init(AdaptiveAdvertising *adaptive,
+                              int minimum_interval, int maximum_interval,
+                              int minimum_tx_power, int maximum_tx_power,
+                              double full_rate, double hysteresis,
+                              long long hold_time) {
+
+    memset(adaptive, 0, sizeof(AdaptiveAdvertising));
+    pthread_mutex_init(&adaptive->lock, NULL);
+
+    return adaptive_advertising_set_bounds(adaptive, minimum_interval,
+                                           maximum_interval,
+                                           minimum_tx_power,
+                                           maximum_tx_power, full_rate,
+                                           hysteresis, hold_time);
+}
+
+
+/*
+*  adaptive_advertising_set_bounds:
+*
+*  This function changes the bounds and tuning of the controller while it
+*  runs. The level is kept, and its settings are applied again with the
+*  new bounds.
+*
+*  Parameters:
+*
+*  adaptive - the adaptive advertising controller
+*  minimum_interval - shortest interval in units of 0.625 milliseconds
+*  maximum_interval - longest interval in units of 0.625 milliseconds
+*  minimum_tx_power - lowest TX power in dBm
+*  maximum_tx_power - highest TX power in dBm
+*  full_rate - discovery rate per second reaching the busiest level
+*  hysteresis - fraction of its threshold the rate falls below to leave a
+*               level
+*  hold_time - time in milliseconds a level is kept before going down
+*
+*  Return value:
+*
+*  0 - success
+*  -1 - invalid bounds, the previous bounds are kept
+*/
+int adaptive_advertising_set_bounds(AdaptiveAdvertising *adaptive,
+                                    int minimum_interval,
+                                    int maximum_interval,
+                                    int minimum_tx_power,
+                                    int maximum_tx_power, double full_rate,
+                                    double hysteresis, long long hold_time) {
+
+    if (0 >= minimum_interval || minimum_interval > maximum_interval ||
+        minimum_tx_power > maximum_tx_power || 0 >= full_rate ||
+        0 > hysteresis || 1 <= hysteresis) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    pthread_mutex_lock(&adaptive->lock);
+    adaptive->minimum_interval = minimum_interval;
+    adaptive->maximum_interval = maximum_interval;
+    adaptive->minimum_tx_power = minimum_tx_power;
+    adaptive->maximum_tx_power = maximum_tx_power;
+    adaptive->full_rate = full_rate;
+    adaptive->hysteresis = hysteresis;
+    adaptive->hold_time = hold_time;
+    adaptive->is_changed = true;
+    pthread_mutex_unlock(&adaptive->lock);
+
+    return 0;
+}
+
+
+/*
+*  adaptive_advertising_record_discovery:
+*
+*  This function counts one inquiry result.
+*
+*  Parameters:
+*
+*  adaptive - the adaptive advertising controller
+*
+*  Return value:
+*
+*  None
+*/
+void adaptive_advertising_record_discovery(AdaptiveAdvertising *adaptive) {
+
+    pthread_mutex_lock(&adaptive->lock);
+    adaptive->number_of_discoveries++;
+    pthread_mutex_unlock(&adaptive->lock);
+}
+
+
+/*
+*  adaptive_advertising_update:
+*
+*  This function folds the discoveries since the last update into the
+*  moving average of the rate, and moves to the level the rate calls for.
+*  The level goes up as soon as the rate reaches the next threshold, and
+*  down only after the hold time and once the rate is below the threshold
+*  of the current level by the hysteresis fraction.
+*
+*  Parameters:
+*
+*  adaptive - the adaptive advertising controller
+*  now - current time in milliseconds
+*
+*  Return value:
+*
+*  true - the level changed
+*  false - the level is unchanged
+*/
+bool adaptive_advertising_update(AdaptiveAdvertising *adaptive,
+                                 long long now) {
+
+    double sample;
+    int level;
+
+    pthread_mutex_lock(&adaptive->lock);
+
+    if (0 == adaptive->last_update_time) {
+        adaptive->last_update_time = now;
+        adaptive->last_change_time = now;
+        adaptive->number_of_discoveries = 0;
+        pthread_mutex_unlock(&adaptive->lock);
+        return false;
+    }
+
+    if (now <= adaptive->last_update_time) {
+        pthread_mutex_unlock(&adaptive->lock);
+        return false;
+    }
+
+    sample = adaptive->number_of_discoveries * 1000.0 /
+             (now - adaptive->last_update_time);
+    adaptive->rate = ADAPTIVE_RATE_WEIGHT * sample +
+                     (1 - ADAPTIVE_RATE_WEIGHT) * adaptive->rate;
+    adaptive->number_of_discoveries = 0;
+    adaptive->last_update_time = now;
+
+    level = adaptive->level;
+
+    while (level < ADAPTIVE_NUMBER_OF_LEVELS - 1 &&
+           adaptive->rate >= get_threshold(adaptive, level + 1)) {
+        level++;
+    }
+
+    if (level == adaptive->level &&
+        now - adaptive->last_change_time >= adaptive->hold_time) {
+
+        while (level > 0 &&
+               adaptive->rate < get_threshold(adaptive, level) *
+                                (1 - adaptive->hysteresis)) {
+            level--;
+        }
+
+    }
+
+    if (level == adaptive->level) {
+        pthread_mutex_unlock(&adaptive->lock);
+        return false;
+    }
+
+    if (level > adaptive->level) {
+        adaptive->number_of_raises++;
+    }
+    else {
+        adaptive->number_of_drops++;
+    }
+
+    adaptive->level = level;
+    adaptive->last_change_time = now;
+    adaptive->is_changed = true;
+
+    pthread_mutex_unlock(&adaptive->lock);
+
+    return true;
+}
+
+
+/*
+*  adaptive_advertising_get_settings:
+*
+*  This function returns the interval and TX power of the current level.
+*
+*  Parameters:
+*
+*  adaptive - the adaptive advertising controller
+*  interval - receives the interval in units of 0.625 milliseconds
+*  tx_power - receives the TX power in dBm
+*
+*  Return value:
+*
+*  true - the level changed since the settings were last returned
+*  false - the settings are the ones returned last time
+*/
+bool adaptive_advertising_get_settings(AdaptiveAdvertising *adaptive,
+                                       int *interval, int *tx_power) {
+
+    bool is_changed;
+
+    pthread_mutex_lock(&adaptive->lock);
+
+    get_level_settings(adaptive, adaptive->level, interval, tx_power);
+    is_changed = adaptive->is_changed;
+    adaptive->is_changed = false;
+
+    pthread_mutex_unlock(&adaptive->lock);
+
+    return is_changed;
+}
+
+
+/*
+*  adaptive_advertising_write_metrics:
+*
+*  This function writes the chosen interval and TX power and the discovery
+*  rate to a file, one "name value" line each. The file is written aside
+*  and renamed, so a reader never sees half of it.
+*
+*  Parameters:
+*
+*  adaptive - the adaptive advertising controller
+*  file_name - name of the metrics file
+*
+*  Return value:
+*
+*  0 - success
+*  -1 - the file could not be written
+*/
+int adaptive_advertising_write_metrics(AdaptiveAdvertising *adaptive,
+                                       char *file_name) {
+
+    char temporary_file_name[FILENAME_MAX];
+    FILE *file;
+    int interval;
+    int tx_power;
+    int level;
+    double rate;
+
+    pthread_mutex_lock(&adaptive->lock);
+    get_level_settings(adaptive, adaptive->level, &interval, &tx_power);
+    level = adaptive->level;
+    rate = adaptive->rate;
+    pthread_mutex_unlock(&adaptive->lock);
+
+    snprintf(temporary_file_name, sizeof(temporary_file_name), "%s.tmp",
+             file_name);
+
+    file = fopen(temporary_file_name, "w");
+
+    if (NULL == file) {
+        return -1;
+    }
+
+    fprintf(file, "advertising_interval_ms %.1f\n", interval * 0.625);
+    fprintf(file, "advertising_tx_power_dbm %d\n", tx_power);
+    fprintf(file, "advertising_level %d\n", level);
+    fprintf(file, "discovery_rate_per_second %.2f\n", rate);
+
+    if (0 != fclose(file)) {
+        return -1;
+    }
+
+    return rename(temporary_file_name, file_name);
+}
+
+
+/*
+*  adaptive_advertising_print_statistics:
+*
+*  This function prints the current settings and the level changes.
+*
+*  Parameters:
+*
+*  adaptive - the adaptive advertising controller
+*
+*  Return value:
+*
+*  None
+*/
+void adaptive_advertising_print_statistics(AdaptiveAdvertising *adaptive) {
+
+    int interval;
+    int tx_power;
+
+    pthread_mutex_lock(&adaptive->lock);
+
+    get_level_settings(adaptive, adaptive->level, &interval, &tx_power);
+    printf("Adaptive advertising: interval %.1f ms, TX power %d dBm, "
+           "level %d, %.2f discoveries/s, %lld raises, %lld drops\n",
+           interval * 0.625, tx_power, adaptive->level, adaptive->rate,
+           adaptive->number_of_raises, adaptive->number_of_drops);
+
+    pthread_mutex_unlock(&adaptive->lock);
+}
+
+
+/*
+*  adaptive_advertising_free:
+*
+*  This function releases the lock of the controller.
+*
+*  Parameters:
+*
+*  adaptive - the adaptive advertising controller
+*
+*  Return value:
+*
+*  None
+*/
+void adaptive_advertising_free(AdaptiveAdvertising *adaptive) {
+
+    pthread_mutex_destroy(&adaptive->lock);
+}
@@ -0,0 +1,151 @@
+/*
+* Copyright (c) 2016 Academia Sinica, Institute of Information Science
+*
+* License:
+*
+*      GPL 3.0 : The content of this file is subject to the terms and
+*      conditions defined in file 'COPYING.txt', which is part of this source
+*      code package.
+*
+* Project Name:
+*
+*      BeDIPS
+*
+* File Description:
+*
+*      This header file contains the function declarations and variables used
+*      in the AdaptiveAdvertising.c file.
+*
+* File Name:
+*
+*      AdaptiveAdvertising.h
+*
+* Abstract:
+*
+*      BeDIPS uses LBeacons to deliver 3D coordinates and textual
+*      descriptions of their locations to users' devices. Basically, a LBeacon
+*      is an inexpensive, Bluetooth Smart Ready device. The 3D coordinates and
+*      location description of every LBeacon are retrieved from BeDIS
+*      (Building/environment Data and Information System) and stored locally
+*      during deployment and maintenance times. Once initialized, each LBeacon
+*      broadcasts its coordinates and location description to Bluetooth
+*      enabled user devices within its coverage area.
+*
+* Authors:
+*
+*      Jake Lee, jakelee@iis.sinica.edu.tw
+*      Johnson Su, johnsonsu@iis.sinica.edu.tw
+*      Shirley Huang, shirley.huang.93@gmail.com
+*      Han Hu, hhu14@illinois.edu
+*      Jeffrey Lin, lin.jeff03@gmail.com
+*      Howard Hsu, haohsu0823@gmail.com
+*      Han Wang, hollywang@iis.sinica.edu.tw
+*/
+
+
+#ifndef ADAPTIVEADVERTISING_H
+#define ADAPTIVEADVERTISING_H
+
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+/*
+* CONSTANTS
+*/
+
+/* Number of steps between the quietest and the busiest settings */
+#define ADAPTIVE_NUMBER_OF_LEVELS 4
+
+/* Weight of the newest sample in the moving average of the discovery
+ * rate */
+#define ADAPTIVE_RATE_WEIGHT 0.3
+
+
+
+/*
+* TYPEDEF STRUCTS
+*/
+
+/* Controller choosing the advertising interval and TX power from the rate
+ * at which the scanner discovers devices. The range between the quietest
+ * setting (longest interval, lowest power) and the busiest one (shortest
+ * interval, highest power) is split in levels. Level i is reached when the
+ * rate rises to i / (levels - 1) of full_rate, and only left when the rate
+ * falls below that threshold by the hysteresis fraction and the level has
+ * been kept for the hold time, so a crowd going by does not make the
+ * settings flap. */
+typedef struct AdaptiveAdvertising {
+    /* Bounds of the interval in units of 0.625 milliseconds */
+    int minimum_interval;
+    int maximum_interval;
+
+    /* Bounds of the TX power in dBm */
+    int minimum_tx_power;
+    int maximum_tx_power;
+
+    /* Discovery rate per second at which the busiest level is reached */
+    double full_rate;
+
+    /* Fraction of its threshold the rate has to fall below to leave a
+     * level */
+    double hysteresis;
+
+    /* Time in milliseconds a level is kept at least before going down */
+    long long hold_time;
+
+    /* Moving average of the discovery rate per second */
+    double rate;
+
+    /* Discoveries since the last update, and time of that update */
+    int number_of_discoveries;
+    long long last_update_time;
+
+    /* Current level and the time it was entered */
+    int level;
+    long long last_change_time;
+
+    /* Whether the level changed since the settings were last taken */
+    bool is_changed;
+
+    /* Number of level changes up and down */
+    long long number_of_raises;
+    long long number_of_drops;
+
+    /* Lock protecting every field */
+    pthread_mutex_t lock;
+} AdaptiveAdvertising;
+
+
+
+/*
+* FUNCTIONS
+*/
+
+int adaptive_advertising_init(AdaptiveAdvertising *adaptive,
+                              int minimum_interval, int maximum_interval,
+                              int minimum_tx_power, int maximum_tx_power,
+                              double full_rate, double hysteresis,
+                              long long hold_time);
+int adaptive_advertising_set_bounds(AdaptiveAdvertising *adaptive,
+                                    int minimum_interval,
+                                    int maximum_interval,
+                                    int minimum_tx_power,
+                                    int maximum_tx_power, double full_rate,
+                                    double hysteresis, long long hold_time);
+void adaptive_advertising_record_discovery(AdaptiveAdvertising *adaptive);
+bool adaptive_advertising_update(AdaptiveAdvertising *adaptive,
+                                 long long now);
+bool adaptive_advertising_get_settings(AdaptiveAdvertising *adaptive,
+                                       int *interval, int *tx_power);
+int adaptive_advertising_write_metrics(AdaptiveAdvertising *adaptive,
+                                       char *file_name);
+void adaptive_advertising_print_statistics(AdaptiveAdvertising *adaptive);
+void adaptive_advertising_free(AdaptiveAdvertising *adaptive);
+
+#endif
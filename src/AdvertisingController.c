@@ -0,0 +1,764 @@
+/*
+* Copyright (c) 2016 Academia Sinica, Institute of Information Science
+*
+* License:
+*
+*      GPL 3.0 : The content of this file is subject to the terms and
+*      conditions defined in file 'COPYING.txt', which is part of this source
+*      code package.
+*
+* Project Name:
+*
+*      BeDIPS
+*
+* File Description:
+*
+*      This file contains the controller of the LE advertisements of the
+*      beacon. It compiles the advertising data once, keeps the HCI socket of
+*      the dongle open and only sends the commands that change what is
+*      advertised.
+*
+* File Name:
+*
+*      AdvertisingController.c
+*
+* Abstract:
+*
+*      BeDIPS uses LBeacons to deliver 3D coordinates and textual
+*      descriptions of their locations to users' devices. Basically, a LBeacon
+*      is an inexpensive, Bluetooth Smart Ready device. The 3D coordinates and
+*      location description of every LBeacon are retrieved from BeDIS
+*      (Building/environment Data and Information System) and stored locally
+*      during deployment and maintenance times. Once initialized, each LBeacon
+*      broadcasts its coordinates and location description to Bluetooth
+*      enabled user devices within its coverage area.
+*
+* Authors:
+*
+*      Jake Lee, jakelee@iis.sinica.edu.tw
+*      Johnson Su, johnsonsu@iis.sinica.edu.tw
+*      Shirley Huang, shirley.huang.93@gmail.com
+*      Han Hu, hhu14@illinois.edu
+*      Jeffrey Lin, lin.jeff03@gmail.com
+*      Howard Hsu, haohsu0823@gmail.com
+*      Han Wang, hollywang@iis.sinica.edu.tw
+*/
+
+
+#include "AdvertisingController.h"
+
+
+/*
+*  decode_hex_digit:
+*
+*  This helper function decodes one hexadecimal digit.
+*
+*  Parameters:
+*
+*  digit - the character
+*
+*  Return value:
+*
+*  Value of the digit, -1 if the character is not a hexadecimal digit
+*/
+static int decode_hex_digit(char digit) {
+
+    if (digit >= '0' && digit <= '9') {
+        return digit - '0';
+    }
+
+    if (digit >= 'a' && digit <= 'f') {
+        return digit - 'a' + 10;
+    }
+
+    if (digit >= 'A' && digit <= 'F') {
+        return digit - 'A' + 10;
+    }
+
+    return -1;
+}
+
+
+/* URL scheme prefixes of Eddystone-URL frames, in the order of their
+ * codes */
+static char *eddystone_schemes[] = {
+    "http://www.", "https://www.", "http://", "https://"
+};
+
+/* Text expansions of Eddystone-URL frames, in the order of their codes */
+static char *eddystone_expansions[] = {
+    ".com/", ".org/", ".edu/", ".net/", ".info/", ".biz/", ".gov/",
+    ".com", ".org", ".edu", ".net", ".info", ".biz", ".gov"
+};
+
+
+/*
+*  compile_flags:
+*
+*  This helper function starts advertising data with the flags structure
+*  every frame of the beacon begins with.
+*
+*  Parameters:
+*
+*  data - the advertising data
+*
+*  Return value:
+*
+*  Number of bytes written
+*/
+static int compile_flags(uint8_t *data) {
+
+    data[0] = 2;
+    data[1] = EIR_FLAGS;
+    data[2] = ADVERTISING_FLAGS;
+
+    return 3;
+}
+
+
+/*
+*  compile_eddystone_header:
+*
+*  This helper function writes the flags, the list of 16-bit service UUIDs
+*  holding the Eddystone UUID, and the header of the Eddystone service
+*  data: its type, UUID, frame type and calibrated power at 0 meter.
+*
+*  Parameters:
+*
+*  data - the advertising data
+*  frame_length - number of bytes of the frame after the power byte
+*  frame_type - Eddystone frame type
+*  rssi_value - RSSI in dBm at one meter from the beacon
+*
+*  Return value:
+*
+*  Number of bytes written
+*/
+static int compile_eddystone_header(uint8_t *data, int frame_length,
+                                    int frame_type, int rssi_value) {
+
+    int length = compile_flags(data);
+    int power = rssi_value + EDDYSTONE_POWER_OFFSET;
+
+    if (power > 127) {
+        power = 127;
+    }
+
+    data[length++] = 3;
+    data[length++] = EIR_UUID16_ALL;
+    data[length++] = EDDYSTONE_SERVICE_UUID & 0xff;
+    data[length++] = EDDYSTONE_SERVICE_UUID >> 8;
+
+    data[length++] = 5 + frame_length;
+    data[length++] = EIR_SERVICE_DATA;
+    data[length++] = EDDYSTONE_SERVICE_UUID & 0xff;
+    data[length++] = EDDYSTONE_SERVICE_UUID >> 8;
+    data[length++] = frame_type;
+    data[length++] = twoc(power, 8);
+
+    return length;
+}
+
+
+/*
+*  decode_hex:
+*
+*  This helper function decodes hexadecimal digits into bytes, skipping
+*  the dashes of a UUID. It stops at the end of the text, at its length or
+*  at the first blank, and fails on any other character.
+*
+*  Parameters:
+*
+*  text - the hexadecimal digits
+*  text_length - maximum number of characters to read
+*  bytes - buffer receiving the bytes
+*  number_of_bytes - number of bytes expected
+*
+*  Return value:
+*
+*  0 - exactly number_of_bytes bytes were decoded
+*  -1 - invalid character or wrong number of digits
+*/
+static int decode_hex(char *text, int text_length, uint8_t *bytes,
+                      int number_of_bytes) {
+
+    int number_of_digits = 0;
+    int digit;
+    int text_id;
+
+    for (text_id = 0; text_id < text_length && '\0' != text[text_id];
+         text_id++) {
+
+        if ('-' == text[text_id]) {
+            continue;
+        }
+
+        if (isspace(text[text_id])) {
+            break;
+        }
+
+        digit = decode_hex_digit(text[text_id]);
+
+        if (0 > digit || number_of_digits == number_of_bytes * 2) {
+            errno = EINVAL;
+            return -1;
+        }
+
+        if (number_of_digits % 2 == 0) {
+            bytes[number_of_digits / 2] = digit << 4;
+        }
+        else {
+            bytes[number_of_digits / 2] |= digit;
+        }
+
+        number_of_digits++;
+
+    }
+
+    if (number_of_digits != number_of_bytes * 2) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/*
+*  advertising_parse_uuid:
+*
+*  This function decodes a UUID written as 32 hexadecimal digits, with or
+*  without dashes, like the uuid line of the config file.
+*
+*  Parameters:
+*
+*  text - the UUID
+*  text_length - maximum number of characters to read
+*  uuid - buffer receiving the 16 bytes of the UUID
+*
+*  Return value:
+*
+*  0 - success
+*  -1 - the text is not a UUID
+*/
+int advertising_parse_uuid(char *text, int text_length, uint8_t *uuid) {
+
+    return decode_hex(text, text_length, uuid, UUID_SIZE);
+}
+
+
+/*
+*  advertising_compile_ibeacon:
+*
+*  This function compiles the advertising data of an iBeacon: a flags
+*  structure, then the manufacturer specific data holding the company
+*  identifier, the iBeacon type, the UUID, major and minor, and the
+*  calibrated RSSI at one meter.
+*
+*  Parameters:
+*
+*  payload - the advertising data compiled
+*  beacon_data - the UUID, major and minor as 40 hexadecimal digits
+*  rssi_value - RSSI in dBm at one meter from the beacon
+*
+*  Return value:
+*
+*  0 - success
+*  -1 - beacon_data is not 40 hexadecimal digits
+*/
+int advertising_compile_ibeacon(le_set_advertising_data_cp *payload,
+                                char *beacon_data, int rssi_value) {
+
+    uint8_t *data = payload->data;
+    int length;
+
+    memset(payload, 0, sizeof(le_set_advertising_data_cp));
+
+    length = compile_flags(data);
+
+    data[length++] = 6 + IBEACON_DATA_SIZE;
+    data[length++] = EIR_MANUFACTURE_SPECIFIC_DATA;
+    data[length++] = IBEACON_COMPANY_ID & 0xff;
+    data[length++] = IBEACON_COMPANY_ID >> 8;
+    data[length++] = IBEACON_TYPE;
+    data[length++] = IBEACON_LENGTH;
+
+    if (0 > decode_hex(beacon_data, IBEACON_DATA_SIZE * 2 + 1,
+                       &data[length], IBEACON_DATA_SIZE)) {
+        return -1;
+    }
+
+    length += IBEACON_DATA_SIZE;
+
+    /* RSSI calibration */
+    data[length++] = twoc(rssi_value, 8);
+
+    payload->length = length;
+
+    return 0;
+}
+
+
+/*
+*  advertising_compile_altbeacon:
+*
+*  This function compiles the advertising data of an AltBeacon: the flags,
+*  then the manufacturer specific data holding the company identifier, the
+*  beacon code, the beacon identifier and the RSSI at one meter.
+*
+*  Parameters:
+*
+*  payload - the advertising data compiled
+*  beacon_id - the 20 bytes of the beacon identifier
+*  rssi_value - RSSI in dBm at one meter from the beacon
+*
+*  Return value:
+*
+*  0 - success
+*/
+int advertising_compile_altbeacon(le_set_advertising_data_cp *payload,
+                                  uint8_t *beacon_id, int rssi_value) {
+
+    uint8_t *data = payload->data;
+    int length;
+
+    memset(payload, 0, sizeof(le_set_advertising_data_cp));
+
+    length = compile_flags(data);
+
+    data[length++] = 7 + ALTBEACON_ID_SIZE;
+    data[length++] = EIR_MANUFACTURE_SPECIFIC_DATA;
+    data[length++] = ALTBEACON_COMPANY_ID & 0xff;
+    data[length++] = ALTBEACON_COMPANY_ID >> 8;
+    data[length++] = ALTBEACON_CODE >> 8;
+    data[length++] = ALTBEACON_CODE & 0xff;
+    memcpy(&data[length], beacon_id, ALTBEACON_ID_SIZE);
+    length += ALTBEACON_ID_SIZE;
+    data[length++] = twoc(rssi_value, 8);
+
+    /* Reserved for the manufacturer */
+    data[length++] = 0;
+
+    payload->length = length;
+
+    return 0;
+}
+
+
+/*
+*  advertising_compile_eddystone_uid:
+*
+*  This function compiles the advertising data of an Eddystone-UID frame.
+*
+*  Parameters:
+*
+*  payload - the advertising data compiled
+*  namespace_id - the 10 bytes of the namespace
+*  instance_id - the 6 bytes of the instance
+*  rssi_value - RSSI in dBm at one meter from the beacon
+*
+*  Return value:
+*
+*  0 - success
+*/
+int advertising_compile_eddystone_uid(le_set_advertising_data_cp *payload,
+                                      uint8_t *namespace_id,
+                                      uint8_t *instance_id, int rssi_value) {
+
+    uint8_t *data = payload->data;
+    int length;
+
+    memset(payload, 0, sizeof(le_set_advertising_data_cp));
+
+    length = compile_eddystone_header(data, EDDYSTONE_NAMESPACE_SIZE +
+                                      EDDYSTONE_INSTANCE_SIZE + 2,
+                                      EDDYSTONE_FRAME_UID, rssi_value);
+
+    memcpy(&data[length], namespace_id, EDDYSTONE_NAMESPACE_SIZE);
+    length += EDDYSTONE_NAMESPACE_SIZE;
+    memcpy(&data[length], instance_id, EDDYSTONE_INSTANCE_SIZE);
+    length += EDDYSTONE_INSTANCE_SIZE;
+
+    /* Reserved for future use */
+    data[length++] = 0;
+    data[length++] = 0;
+
+    payload->length = length;
+
+    return 0;
+}
+
+
+/*
+*  advertising_compile_eddystone_url:
+*
+*  This function compiles the advertising data of an Eddystone-URL frame.
+*  The scheme and the common domain endings of the URL are replaced by
+*  their one byte codes.
+*
+*  Parameters:
+*
+*  payload - the advertising data compiled
+*  url - the URL, starting with http:// or https://
+*  rssi_value - RSSI in dBm at one meter from the beacon
+*
+*  Return value:
+*
+*  0 - success
+*  -1 - unknown scheme, or the URL does not fit in a frame
+*/
+int advertising_compile_eddystone_url(le_set_advertising_data_cp *payload,
+                                      char *url, int rssi_value) {
+
+    uint8_t encoded[EDDYSTONE_MAXIMUM_URL_SIZE + 1];
+    int number_of_schemes = sizeof(eddystone_schemes) / sizeof(char *);
+    int number_of_expansions = sizeof(eddystone_expansions) / sizeof(char *);
+    int encoded_length = 0;
+    int scheme = -1;
+    int code;
+    int expansion_length;
+
+    for (code = 0; code < number_of_schemes; code++) {
+
+        /* The www schemes are listed first so they win over their
+         * prefixes */
+        if (0 == strncmp(url, eddystone_schemes[code],
+                         strlen(eddystone_schemes[code]))) {
+            scheme = code;
+            break;
+        }
+
+    }
+
+    if (0 > scheme) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    encoded[encoded_length++] = scheme;
+    url += strlen(eddystone_schemes[scheme]);
+
+    while ('\0' != *url && !isspace(*url)) {
+
+        if (encoded_length > EDDYSTONE_MAXIMUM_URL_SIZE) {
+            errno = EMSGSIZE;
+            return -1;
+        }
+
+        for (code = 0; code < number_of_expansions; code++) {
+
+            expansion_length = strlen(eddystone_expansions[code]);
+
+            if (0 == strncmp(url, eddystone_expansions[code],
+                             expansion_length)) {
+                break;
+            }
+
+        }
+
+        if (code < number_of_expansions) {
+            encoded[encoded_length++] = code;
+            url += expansion_length;
+        }
+        else {
+            encoded[encoded_length++] = *url;
+            url++;
+        }
+
+    }
+
+    memset(payload, 0, sizeof(le_set_advertising_data_cp));
+
+    payload->length = compile_eddystone_header(payload->data, encoded_length,
+                                               EDDYSTONE_FRAME_URL,
+                                               rssi_value);
+    memcpy(&payload->data[payload->length], encoded, encoded_length);
+    payload->length += encoded_length;
+
+    return 0;
+}
+
+
+/*
+*  advertising_send_command:
+*
+*  This function sends an LE controller command on the HCI socket and
+*  checks its status. The socket is opened again if an earlier error
+*  closed it, and closed when the dongle is gone.
+*
+*  Parameters:
+*
+*  controller - the advertising controller
+*  ocf - the command
+*  parameters - parameters of the command
+*  parameters_length - length of the parameters
+*  response - buffer receiving the return parameters, status first, or
+*             NULL when only the status is needed
+*  response_length - size of the response buffer
+*
+*  Return value:
+*
+*  0 - success
+*  -1 - the command could not be sent or failed
+*/
+int advertising_send_command(AdvertisingController *controller,
+                             uint16_t ocf, void *parameters,
+                             int parameters_length, uint8_t *response,
+                             int response_length) {
+
+    struct hci_request request;
+    uint8_t status;
+
+    if (NULL == response) {
+        response = &status;
+        response_length = 1;
+    }
+
+    if (0 > controller->device_handle) {
+
+        controller->device_handle =
+            hci_open_dev(controller->dongle_device_id);
+
+        if (0 > controller->device_handle) {
+            /* Error handling */
+            perror("Error opening device");
+            return -1;
+        }
+
+        controller->number_of_opens++;
+
+    }
+
+    memset(&request, 0, sizeof(request));
+    request.ogf = OGF_LE_CTL;
+    request.ocf = ocf;
+    request.cparam = parameters;
+    request.clen = parameters_length;
+    request.rparam = response;
+    request.rlen = response_length;
+
+    controller->number_of_commands++;
+
+    if (0 > hci_send_req(controller->device_handle, &request,
+                         HCI_SEND_REQUEST_TIMEOUT)) {
+
+        /* Error handling */
+        fprintf(stderr, "Can't send request %s (%d)\n", strerror(errno),
+                errno);
+
+        if (ENODEV == errno || EBADF == errno || ENETDOWN == errno) {
+            hci_close_dev(controller->device_handle);
+            controller->device_handle = -1;
+        }
+
+        return -1;
+
+    }
+
+    if (response[0]) {
+        /* Error handling */
+        fprintf(stderr, "LE command 0x%04x returned status %d\n", ocf,
+                response[0]);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/*
+*  advertising_init:
+*
+*  This function opens the HCI socket of the dongle that advertises.
+*
+*  Parameters:
+*
+*  controller - the advertising controller
+*  dongle_device_id - ID of the dongle, negative for the first one
+*
+*  Return value:
+*
+*  0 - success
+*  -1 - the dongle could not be opened
+*/
+int advertising_init(AdvertisingController *controller,
+                     int dongle_device_id) {
+
+    memset(controller, 0, sizeof(AdvertisingController));
+
+    if (0 > dongle_device_id) {
+        dongle_device_id = hci_get_route(NULL);
+    }
+
+    controller->dongle_device_id = dongle_device_id;
+    controller->device_handle = hci_open_dev(dongle_device_id);
+
+    if (0 > controller->device_handle) {
+        /* Error handling */
+        perror("Error opening device");
+        return -1;
+    }
+
+    controller->number_of_opens = 1;
+
+    return 0;
+}
+
+
+/*
+*  advertising_set_interval:
+*
+*  This function sets the advertising interval of the dongle.
+*
+*  Parameters:
+*
+*  controller - the advertising controller
+*  advertising_interval - interval in units of 0.625 milliseconds
+*
+*  Return value:
+*
+*  0 - success
+*  -1 - the command failed
+*/
+int advertising_set_interval(AdvertisingController *controller,
+                             int advertising_interval) {
+
+    le_set_advertising_parameters_cp parameters;
+
+    memset(&parameters, 0, sizeof(parameters));
+    parameters.min_interval = htobs(advertising_interval);
+    parameters.max_interval = htobs(advertising_interval);
+    parameters.chan_map = ADVERTISING_CHANNEL_MAP;
+
+    return advertising_send_command(controller,
+                                    OCF_LE_SET_ADVERTISING_PARAMETERS,
+                                    &parameters,
+                                    LE_SET_ADVERTISING_PARAMETERS_CP_SIZE,
+                                    NULL, 0);
+}
+
+
+/*
+*  advertising_set_payload:
+*
+*  This function advertises the compiled advertising data with a single
+*  command, while advertising stays enabled. Nothing is sent when the
+*  payload is the one already advertised.
+*
+*  Parameters:
+*
+*  controller - the advertising controller
+*  payload - the compiled advertising data
+*
+*  Return value:
+*
+*  0 - success
+*  -1 - the command failed
+*/
+int advertising_set_payload(AdvertisingController *controller,
+                            le_set_advertising_data_cp *payload) {
+
+    if (controller->has_payload == true &&
+        0 == memcmp(&controller->payload, payload,
+                    sizeof(le_set_advertising_data_cp))) {
+        controller->number_of_unchanged++;
+        return 0;
+    }
+
+    if (0 > advertising_send_command(controller, OCF_LE_SET_ADVERTISING_DATA,
+                                     payload, LE_SET_ADVERTISING_DATA_CP_SIZE,
+                                     NULL, 0)) {
+        return -1;
+    }
+
+    memcpy(&controller->payload, payload, sizeof(le_set_advertising_data_cp));
+    controller->has_payload = true;
+    controller->number_of_updates++;
+
+    return 0;
+}
+
+
+/*
+*  advertising_set_enable:
+*
+*  This function starts or stops advertising.
+*
+*  Parameters:
+*
+*  controller - the advertising controller
+*  enable - whether to advertise
+*
+*  Return value:
+*
+*  0 - success
+*  -1 - the command failed
+*/
+int advertising_set_enable(AdvertisingController *controller, bool enable) {
+
+    le_set_advertise_enable_cp parameters;
+
+    memset(&parameters, 0, sizeof(parameters));
+    parameters.enable = enable == true ? 0x01 : 0x00;
+
+    if (0 > advertising_send_command(controller, OCF_LE_SET_ADVERTISE_ENABLE,
+                                     &parameters,
+                                     LE_SET_ADVERTISE_ENABLE_CP_SIZE,
+                                     NULL, 0)) {
+        return -1;
+    }
+
+    controller->is_enabled = enable;
+
+    return 0;
+}
+
+
+/*
+*  advertising_print_statistics:
+*
+*  This function prints the number of commands sent to the dongle.
+*
+*  Parameters:
+*
+*  controller - the advertising controller
+*
+*  Return value:
+*
+*  None
+*/
+void advertising_print_statistics(AdvertisingController *controller) {
+
+    printf("Advertising: %lld HCI commands, %lld payload updates, "
+           "%lld unchanged, %lld device opens\n",
+           controller->number_of_commands, controller->number_of_updates,
+           controller->number_of_unchanged, controller->number_of_opens);
+}
+
+
+/*
+*  advertising_free:
+*
+*  This function stops advertising and closes the HCI socket.
+*
+*  Parameters:
+*
+*  controller - the advertising controller
+*
+*  Return value:
+*
+*  None
+*/
+void advertising_free(AdvertisingController *controller) {
+
+    if (0 > controller->device_handle) {
+        return;
+    }
+
+    if (controller->is_enabled == true) {
+        advertising_set_enable(controller, false);
+    }
+
+    hci_close_dev(controller->device_handle);
+    controller->device_handle = -1;
+}
@@ -0,0 +1,195 @@
+/*
+* Copyright (c) 2016 Academia Sinica, Institute of Information Science
+*
+* License:
+*
+*      GPL 3.0 : The content of this file is subject to the terms and
+*      conditions defined in file 'COPYING.txt', which is part of this source
+*      code package.
+*
+* Project Name:
+*
+*      BeDIPS
+*
+* File Description:
+*
+*      This header file contains the function declarations and variables used
+*      in the AdvertisingController.c file.
+*
+* File Name:
+*
+*      AdvertisingController.h
+*
+* Abstract:
+*
+*      BeDIPS uses LBeacons to deliver 3D coordinates and textual
+*      descriptions of their locations to users' devices. Basically, a LBeacon
+*      is an inexpensive, Bluetooth Smart Ready device. The 3D coordinates and
+*      location description of every LBeacon are retrieved from BeDIS
+*      (Building/environment Data and Information System) and stored locally
+*      during deployment and maintenance times. Once initialized, each LBeacon
+*      broadcasts its coordinates and location description to Bluetooth
+*      enabled user devices within its coverage area.
+*
+* Authors:
+*
+*      Jake Lee, jakelee@iis.sinica.edu.tw
+*      Johnson Su, johnsonsu@iis.sinica.edu.tw
+*      Shirley Huang, shirley.huang.93@gmail.com
+*      Han Hu, hhu14@illinois.edu
+*      Jeffrey Lin, lin.jeff03@gmail.com
+*      Howard Hsu, haohsu0823@gmail.com
+*      Han Wang, hollywang@iis.sinica.edu.tw
+*/
+
+
+#ifndef ADVERTISINGCONTROLLER_H
+#define ADVERTISINGCONTROLLER_H
+
+#include <bluetooth/bluetooth.h>
+#include <bluetooth/hci.h>
+#include <bluetooth/hci_lib.h>
+#include <ctype.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "Utilities.h"
+
+
+/*
+* CONSTANTS
+*/
+
+/* BlueZ bluetooth extended inquiry response protocol: flags */
+#define EIR_FLAGS 0X01
+
+/* BlueZ bluetooth extended inquiry response protocol: Manufacturer Specific
+ * Data */
+#define EIR_MANUFACTURE_SPECIFIC_DATA 0xFF
+
+/* BlueZ bluetooth extended inquiry response protocol: complete local name */
+#define EIR_NAME_COMPLETE 0x09
+
+/* BlueZ bluetooth extended inquiry response protocol: shorten local name */
+#define EIR_NAME_SHORT 0x08
+
+/* Timeout of hci_send_req  */
+#define HCI_SEND_REQUEST_TIMEOUT 1000
+
+/* Flags advertised by the beacon: LE general discoverable, BR/EDR
+ * controller and host */
+#define ADVERTISING_FLAGS 0x1A
+
+/* Advertising channels 37, 38 and 39 */
+#define ADVERTISING_CHANNEL_MAP 0x07
+
+/* Company identifier and iBeacon type and length bytes that start the
+ * manufacturer specific data of an iBeacon */
+#define IBEACON_COMPANY_ID 0x004C
+#define IBEACON_TYPE 0x02
+#define IBEACON_LENGTH 0x15
+
+/* Number of bytes of the UUID, major and minor of an iBeacon */
+#define IBEACON_DATA_SIZE 20
+
+/* Company identifier and beacon code that start the manufacturer specific
+ * data of an AltBeacon, and number of bytes of its beacon identifier */
+#define ALTBEACON_COMPANY_ID 0x0118
+#define ALTBEACON_CODE 0xBEAC
+#define ALTBEACON_ID_SIZE 20
+
+/* BlueZ bluetooth extended inquiry response protocol: complete list of
+ * 16-bit service UUIDs */
+#define EIR_UUID16_ALL 0x03
+
+/* BlueZ bluetooth extended inquiry response protocol: service data */
+#define EIR_SERVICE_DATA 0x16
+
+/* Service UUID and frame types of Eddystone */
+#define EDDYSTONE_SERVICE_UUID 0xFEAA
+#define EDDYSTONE_FRAME_UID 0x00
+#define EDDYSTONE_FRAME_URL 0x10
+
+/* Number of bytes of the namespace and instance of an Eddystone-UID */
+#define EDDYSTONE_NAMESPACE_SIZE 10
+#define EDDYSTONE_INSTANCE_SIZE 6
+
+/* Maximum number of bytes of an encoded Eddystone URL after its scheme */
+#define EDDYSTONE_MAXIMUM_URL_SIZE 17
+
+/* Eddystone frames carry the power at 0 meter, which is about 41 dB above
+ * the RSSI at one meter */
+#define EDDYSTONE_POWER_OFFSET 41
+
+/* Number of bytes of a UUID */
+#define UUID_SIZE 16
+
+
+
+/*
+* TYPEDEF STRUCTS
+*/
+
+/* Controller of the advertisements of the LE dongle. The HCI socket is
+ * opened once and kept, and the advertising data is compiled once into
+ * the parameters of the LE Set Advertising Data command, so changing what
+ * is advertised costs that one command. */
+typedef struct AdvertisingController {
+    /* ID of the dongle and its HCI socket, negative while closed */
+    int dongle_device_id;
+    int device_handle;
+
+    /* Advertising data last sent to the controller */
+    le_set_advertising_data_cp payload;
+
+    /* Whether the controller has been sent a payload */
+    bool has_payload;
+
+    /* Whether advertising is enabled */
+    bool is_enabled;
+
+    /* Number of HCI commands sent, of payload changes and of payloads
+     * skipped because they were already advertised */
+    long long number_of_commands;
+    long long number_of_updates;
+    long long number_of_unchanged;
+
+    /* Number of times the HCI socket was opened */
+    long long number_of_opens;
+} AdvertisingController;
+
+
+
+/*
+* FUNCTIONS
+*/
+
+int advertising_parse_uuid(char *text, int text_length, uint8_t *uuid);
+int advertising_compile_ibeacon(le_set_advertising_data_cp *payload,
+                                char *beacon_data, int rssi_value);
+int advertising_compile_altbeacon(le_set_advertising_data_cp *payload,
+                                  uint8_t *beacon_id, int rssi_value);
+int advertising_compile_eddystone_uid(le_set_advertising_data_cp *payload,
+                                      uint8_t *namespace_id,
+                                      uint8_t *instance_id, int rssi_value);
+int advertising_compile_eddystone_url(le_set_advertising_data_cp *payload,
+                                      char *url, int rssi_value);
+int advertising_init(AdvertisingController *controller,
+                     int dongle_device_id);
+int advertising_send_command(AdvertisingController *controller,
+                             uint16_t ocf, void *parameters,
+                             int parameters_length, uint8_t *response,
+                             int response_length);
+int advertising_set_interval(AdvertisingController *controller,
+                             int advertising_interval);
+int advertising_set_payload(AdvertisingController *controller,
+                            le_set_advertising_data_cp *payload);
+int advertising_set_enable(AdvertisingController *controller, bool enable);
+void advertising_print_statistics(AdvertisingController *controller);
+void advertising_free(AdvertisingController *controller);
+
+#endif
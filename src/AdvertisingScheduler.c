@@ -0,0 +1,707 @@
+/*
+* Copyright (c) 2016 Academia Sinica, Institute of Information Science
+*
+* License:
+*
+*      GPL 3.0 : The content of this file is subject to the terms and
+*      conditions defined in file 'COPYING.txt', which is part of this source
+*      code package.
+*
+* Project Name:
+*
+*      BeDIPS
+*
+* File Description:
+*
+*      This file contains the scheduler sharing the LE dongle between several
+*      advertising frames, with extended advertising sets when the controller
+*      supports them and by rotating the legacy payload otherwise.
+*
+* File Name:
+*
+*      AdvertisingScheduler.c
+*
+* Abstract:
+*
+*      BeDIPS uses LBeacons to deliver 3D coordinates and textual
+*      descriptions of their locations to users' devices. Basically, a LBeacon
+*      is an inexpensive, Bluetooth Smart Ready device. The 3D coordinates and
+*      location description of every LBeacon are retrieved from BeDIS
+*      (Building/environment Data and Information System) and stored locally
+*      during deployment and maintenance times. Once initialized, each LBeacon
+*      broadcasts its coordinates and location description to Bluetooth
+*      enabled user devices within its coverage area.
+*
+* Authors:
+*
+*      Jake Lee, jakelee@iis.sinica.edu.tw
+*      Johnson Su, johnsonsu@iis.sinica.edu.tw
+*      Shirley Huang, shirley.huang.93@gmail.com
+*      Han Hu, hhu14@illinois.edu
+*      Jeffrey Lin, lin.jeff03@gmail.com
+*      Howard Hsu, haohsu0823@gmail.com
+*      Han Wang, hollywang@iis.sinica.edu.tw
+*/
+
+
+#include "AdvertisingScheduler.h"
+
+
+/*
+*  supports_extended_advertising:
+*
+*  This helper function asks the controller whether it supports extended
+*  advertising. A controller may refuse the legacy advertising commands
+*  once extended ones were sent, so this feature bit alone decides which
+*  commands the scheduler uses.
+*
+*  Parameters:
+*
+*  scheduler - the advertising scheduler
+*
+*  Return value:
+*
+*  true - the frames are advertised with advertising sets
+*  false - the frames have to share the legacy payload
+*/
+static bool supports_extended_advertising(AdvertisingScheduler *scheduler) {
+
+    uint8_t features[9]; /* Status, then the 8 bytes of LE features */
+
+    if (0 > advertising_send_command(scheduler->controller,
+                                     OCF_LE_READ_FEATURES, NULL, 0,
+                                     features, sizeof(features))) {
+        return false;
+    }
+
+    return (features[1 + LE_EXTENDED_ADVERTISING_BYTE] &
+            LE_EXTENDED_ADVERTISING_BIT) != 0;
+}
+
+
+/*
+*  count_extended_sets:
+*
+*  This helper function finds how many advertising sets the scheduler
+*  uses: one per frame when the controller has enough of them, or a single
+*  set through which the frames are rotated otherwise.
+*
+*  Parameters:
+*
+*  scheduler - the advertising scheduler
+*
+*  Return value:
+*
+*  Number of advertising sets to use
+*/
+static int count_extended_sets(AdvertisingScheduler *scheduler) {
+
+    uint8_t sets[2]; /* Status, then the number of advertising sets */
+
+    if (0 > advertising_send_command(scheduler->controller,
+                                     OCF_LE_READ_NUMBER_OF_ADVERTISING_SETS,
+                                     NULL, 0, sets, sizeof(sets)) ||
+        sets[1] < scheduler->number_of_frames) {
+        return 1;
+    }
+
+    return scheduler->number_of_frames;
+}
+
+
+/*
+*  send_extended_data:
+*
+*  This helper function sends a frame to an advertising set.
+*
+*  Parameters:
+*
+*  scheduler - the advertising scheduler
+*  handle - handle of the advertising set
+*  frame_id - index of the frame
+*
+*  Return value:
+*
+*  0 - success
+*  -1 - the command failed
+*/
+static int send_extended_data(AdvertisingScheduler *scheduler, int handle,
+                              int frame_id) {
+
+    ExtendedAdvertisingData data;
+    le_set_advertising_data_cp *frame = &scheduler->frames[frame_id];
+
+    memset(&data, 0, sizeof(data));
+    data.handle = handle;
+    data.operation = EXTENDED_ADVERTISING_COMPLETE_DATA;
+    data.fragment_preference = EXTENDED_ADVERTISING_NO_FRAGMENT_PREFERENCE;
+    data.length = frame->length;
+    memcpy(data.data, frame->data, frame->length);
+
+    return advertising_send_command(scheduler->controller,
+                                    OCF_LE_SET_EXTENDED_ADVERTISING_DATA,
+                                    &data, 4 + frame->length, NULL, 0);
+}
+
+
+/*
+*  send_extended_parameters:
+*
+*  This helper function sets an advertising set to send legacy
+*  advertisements at the interval and TX power of the scheduler.
+*
+*  Parameters:
+*
+*  scheduler - the advertising scheduler
+*  handle - handle of the advertising set
+*
+*  Return value:
+*
+*  0 - success
+*  -1 - the command failed
+*/
+static int send_extended_parameters(AdvertisingScheduler *scheduler,
+                                    int handle) {
+
+    ExtendedAdvertisingParameters parameters;
+    uint8_t response[2]; /* Status, then the TX power selected */
+    int interval = scheduler->advertising_interval;
+
+    memset(&parameters, 0, sizeof(parameters));
+    parameters.handle = handle;
+    parameters.properties = htobs(EXTENDED_ADVERTISING_LEGACY_NONCONNECTABLE);
+    parameters.minimum_interval[0] = interval & 0xff;
+    parameters.minimum_interval[1] = (interval >> 8) & 0xff;
+    parameters.minimum_interval[2] = (interval >> 16) & 0xff;
+    memcpy(parameters.maximum_interval, parameters.minimum_interval, 3);
+    parameters.channel_map = ADVERTISING_CHANNEL_MAP;
+    parameters.tx_power = scheduler->tx_power;
+    parameters.primary_phy = EXTENDED_ADVERTISING_PHY_1M;
+    parameters.secondary_phy = EXTENDED_ADVERTISING_PHY_1M;
+    parameters.sid = handle;
+
+    if (0 > advertising_send_command(
+                scheduler->controller,
+                OCF_LE_SET_EXTENDED_ADVERTISING_PARAMETERS,
+                &parameters, sizeof(parameters),
+                response, sizeof(response))) {
+        return -1;
+    }
+
+    scheduler->selected_tx_power = (int8_t)response[1];
+
+    return 0;
+}
+
+
+/*
+*  enable_extended:
+*
+*  This helper function enables every advertising set at once, or
+*  disables them all.
+*
+*  Parameters:
+*
+*  scheduler - the advertising scheduler
+*  is_enabled - whether to enable the sets
+*
+*  Return value:
+*
+*  0 - success
+*  -1 - the command failed
+*/
+static int enable_extended(AdvertisingScheduler *scheduler,
+                           bool is_enabled) {
+
+    ExtendedAdvertisingEnable enable;
+    int handle;
+
+    /* Disabling with no set disables every set */
+    memset(&enable, 0, sizeof(enable));
+
+    if (is_enabled == true) {
+
+        enable.enable = 0x01;
+        enable.number_of_sets = scheduler->number_of_sets;
+
+        for (handle = 0; handle < scheduler->number_of_sets; handle++) {
+            enable.sets[handle].handle = handle;
+        }
+
+    }
+
+    return advertising_send_command(scheduler->controller,
+                                    OCF_LE_SET_EXTENDED_ADVERTISING_ENABLE,
+                                    &enable, 2 + enable.number_of_sets *
+                                    sizeof(ExtendedAdvertisingSet),
+                                    NULL, 0);
+}
+
+
+/*
+*  start_extended:
+*
+*  This helper function creates the advertising sets, each with the frame
+*  of the same index, and enables them all at once. The sets are cleared
+*  if any command fails.
+*
+*  Parameters:
+*
+*  scheduler - the advertising scheduler
+*
+*  Return value:
+*
+*  0 - success
+*  -1 - a command failed
+*/
+static int start_extended(AdvertisingScheduler *scheduler) {
+
+    int handle;
+
+    for (handle = 0; handle < scheduler->number_of_sets; handle++) {
+
+        if (0 > send_extended_parameters(scheduler, handle) ||
+            0 > send_extended_data(scheduler, handle, handle)) {
+            break;
+        }
+
+    }
+
+    if (handle < scheduler->number_of_sets ||
+        0 > enable_extended(scheduler, true)) {
+
+        advertising_send_command(scheduler->controller,
+                                 OCF_LE_CLEAR_ADVERTISING_SETS, NULL, 0,
+                                 NULL, 0);
+        return -1;
+
+    }
+
+    return 0;
+}
+
+
+/*
+*  advertising_scheduler_init:
+*
+*  This function initializes a scheduler without frames.
+*
+*  Parameters:
+*
+*  scheduler - the advertising scheduler
+*  controller - controller of the dongle, already initialized
+*  advertising_interval - interval in units of 0.625 milliseconds
+*
+*  Return value:
+*
+*  0 - success
+*/
+int advertising_scheduler_init(AdvertisingScheduler *scheduler,
+                               AdvertisingController *controller,
+                               int advertising_interval) {
+
+    memset(scheduler, 0, sizeof(AdvertisingScheduler));
+    scheduler->controller = controller;
+    scheduler->advertising_interval = advertising_interval;
+    scheduler->tx_power = EXTENDED_ADVERTISING_NO_TX_POWER;
+    scheduler->selected_tx_power = EXTENDED_ADVERTISING_NO_TX_POWER;
+    pthread_mutex_init(&scheduler->lock, NULL);
+
+    return 0;
+}
+
+
+/*
+*  advertising_scheduler_add_frame:
+*
+*  This function adds a frame to advertise. Frames are added before the
+*  scheduler is started.
+*
+*  Parameters:
+*
+*  scheduler - the advertising scheduler
+*  payload - the compiled advertising data of the frame
+*
+*  Return value:
+*
+*  Index of the frame, -1 if the scheduler is full or started
+*/
+int advertising_scheduler_add_frame(AdvertisingScheduler *scheduler,
+                                    le_set_advertising_data_cp *payload) {
+
+    int frame_id;
+
+    pthread_mutex_lock(&scheduler->lock);
+
+    if (scheduler->is_started == true ||
+        scheduler->number_of_frames == ADVERTISING_MAXIMUM_FRAMES) {
+        pthread_mutex_unlock(&scheduler->lock);
+        errno = ENOSPC;
+        return -1;
+    }
+
+    frame_id = scheduler->number_of_frames++;
+    memcpy(&scheduler->frames[frame_id], payload,
+           sizeof(le_set_advertising_data_cp));
+
+    pthread_mutex_unlock(&scheduler->lock);
+
+    return frame_id;
+}
+
+
+/*
+*  advertising_scheduler_start:
+*
+*  This function starts advertising the frames, with extended advertising
+*  sets when the controller supports them, and otherwise with the first
+*  frame in the legacy payload until the next rotation. A controller with
+*  fewer sets than frames advertises them in turn through one set.
+*
+*  Parameters:
+*
+*  scheduler - the advertising scheduler
+*
+*  Return value:
+*
+*  0 - success
+*  -1 - no frame, or advertising could not be started
+*/
+int advertising_scheduler_start(AdvertisingScheduler *scheduler) {
+
+    AdvertisingController *controller = scheduler->controller;
+    int return_value = 0;
+
+    pthread_mutex_lock(&scheduler->lock);
+
+    if (0 == scheduler->number_of_frames) {
+        pthread_mutex_unlock(&scheduler->lock);
+        errno = EINVAL;
+        return -1;
+    }
+
+    /* The commands are picked once, with no fallback to the legacy ones
+     * the controller may refuse after extended ones */
+    scheduler->current_frame = 0;
+    scheduler->number_of_sets = 1;
+    scheduler->use_extended = supports_extended_advertising(scheduler);
+
+    if (scheduler->use_extended == true) {
+
+        scheduler->number_of_sets = count_extended_sets(scheduler);
+        return_value = start_extended(scheduler);
+
+    }
+    else {
+
+        if (0 > advertising_set_interval(controller,
+                                         scheduler->advertising_interval) ||
+            0 > advertising_set_payload(controller, &scheduler->frames[0]) ||
+            0 > advertising_set_enable(controller, true)) {
+            return_value = -1;
+        }
+
+    }
+
+    scheduler->is_started = return_value == 0;
+
+    pthread_mutex_unlock(&scheduler->lock);
+
+    return return_value;
+}
+
+
+/*
+*  advertising_scheduler_set_frame:
+*
+*  This function replaces the content of a frame. A frame with its own
+*  advertising set, or the one advertised in turn, is sent right away;
+*  otherwise the new frame is advertised at its next turn.
+*
+*  Parameters:
+*
+*  scheduler - the advertising scheduler
+*  frame_id - index of the frame
+*  payload - the compiled advertising data of the frame
+*
+*  Return value:
+*
+*  0 - success
+*  -1 - unknown frame or the command failed
+*/
+int advertising_scheduler_set_frame(AdvertisingScheduler *scheduler,
+                                    int frame_id,
+                                    le_set_advertising_data_cp *payload) {
+
+    int return_value = 0;
+
+    pthread_mutex_lock(&scheduler->lock);
+
+    if (0 > frame_id || frame_id >= scheduler->number_of_frames) {
+        pthread_mutex_unlock(&scheduler->lock);
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (0 == memcmp(&scheduler->frames[frame_id], payload,
+                    sizeof(le_set_advertising_data_cp))) {
+        pthread_mutex_unlock(&scheduler->lock);
+        return 0;
+    }
+
+    memcpy(&scheduler->frames[frame_id], payload,
+           sizeof(le_set_advertising_data_cp));
+    scheduler->number_of_frame_updates++;
+
+    if (scheduler->is_started == true) {
+
+        if (scheduler->use_extended == true &&
+            scheduler->number_of_sets == scheduler->number_of_frames) {
+            return_value = send_extended_data(scheduler, frame_id,
+                                              frame_id);
+        }
+        else if (scheduler->use_extended == true &&
+                 scheduler->current_frame == frame_id) {
+            return_value = send_extended_data(scheduler, 0, frame_id);
+        }
+        else if (scheduler->current_frame == frame_id) {
+            return_value = advertising_set_payload(scheduler->controller,
+                                                   payload);
+        }
+
+    }
+
+    pthread_mutex_unlock(&scheduler->lock);
+
+    return return_value;
+}
+
+
+/*
+*  advertising_scheduler_rotate:
+*
+*  This function puts the next frame in the legacy payload, or in the
+*  single advertising set the frames share. It is called periodically, and
+*  does nothing when every frame has its own set.
+*
+*  Parameters:
+*
+*  scheduler - the advertising scheduler
+*
+*  Return value:
+*
+*  0 - success
+*  -1 - the command failed
+*/
+int advertising_scheduler_rotate(AdvertisingScheduler *scheduler) {
+
+    int return_value = 0;
+
+    pthread_mutex_lock(&scheduler->lock);
+
+    if (scheduler->is_started == true &&
+        scheduler->number_of_sets < scheduler->number_of_frames) {
+
+        scheduler->current_frame =
+            (scheduler->current_frame + 1) % scheduler->number_of_frames;
+        scheduler->number_of_rotations++;
+
+        if (scheduler->use_extended == true) {
+            return_value = send_extended_data(scheduler, 0,
+                                              scheduler->current_frame);
+        }
+        else {
+            return_value = advertising_set_payload(
+                scheduler->controller,
+                &scheduler->frames[scheduler->current_frame]);
+        }
+
+    }
+
+    pthread_mutex_unlock(&scheduler->lock);
+
+    return return_value;
+}
+
+
+/*
+*  advertising_scheduler_set_parameters:
+*
+*  This function changes the advertising interval, and the TX power of the
+*  advertising sets. Advertising is stopped while the parameters change,
+*  as controllers refuse to change them during advertising. The legacy
+*  commands have no TX power, so it is only applied to advertising sets.
+*
+*  Parameters:
+*
+*  scheduler - the advertising scheduler
+*  advertising_interval - interval in units of 0.625 milliseconds
+*  tx_power - TX power in dBm
+*
+*  Return value:
+*
+*  0 - success
+*  -1 - a command failed
+*/
+int advertising_scheduler_set_parameters(AdvertisingScheduler *scheduler,
+                                         int advertising_interval,
+                                         int tx_power) {
+
+    AdvertisingController *controller = scheduler->controller;
+    int return_value = 0;
+    int handle;
+
+    pthread_mutex_lock(&scheduler->lock);
+
+    if (scheduler->advertising_interval == advertising_interval &&
+        scheduler->tx_power == tx_power) {
+        pthread_mutex_unlock(&scheduler->lock);
+        return 0;
+    }
+
+    scheduler->advertising_interval = advertising_interval;
+    scheduler->tx_power = tx_power;
+    scheduler->number_of_parameter_changes++;
+
+    if (scheduler->is_started == true &&
+        scheduler->use_extended == true) {
+
+        return_value = enable_extended(scheduler, false);
+
+        for (handle = 0; handle < scheduler->number_of_sets &&
+             0 == return_value; handle++) {
+            return_value = send_extended_parameters(scheduler, handle);
+        }
+
+        /* Advertising goes on even with the old parameters */
+        if (0 > enable_extended(scheduler, true)) {
+            return_value = -1;
+        }
+
+    }
+    else if (scheduler->is_started == true) {
+
+        if (0 > advertising_set_enable(controller, false) ||
+            0 > advertising_set_interval(controller, advertising_interval)) {
+            return_value = -1;
+        }
+
+        if (0 > advertising_set_enable(controller, true)) {
+            return_value = -1;
+        }
+
+    }
+
+    pthread_mutex_unlock(&scheduler->lock);
+
+    return return_value;
+}
+
+
+/*
+*  advertising_scheduler_stop:
+*
+*  This function stops advertising the frames and removes the advertising
+*  sets.
+*
+*  Parameters:
+*
+*  scheduler - the advertising scheduler
+*
+*  Return value:
+*
+*  0 - success
+*  -1 - the command failed
+*/
+int advertising_scheduler_stop(AdvertisingScheduler *scheduler) {
+
+    int return_value = 0;
+
+    pthread_mutex_lock(&scheduler->lock);
+
+    if (scheduler->is_started == true) {
+
+        if (scheduler->use_extended == true) {
+
+            return_value = enable_extended(scheduler, false);
+            advertising_send_command(scheduler->controller,
+                                     OCF_LE_CLEAR_ADVERTISING_SETS, NULL, 0,
+                                     NULL, 0);
+
+        }
+        else {
+
+            return_value = advertising_set_enable(scheduler->controller,
+                                                  false);
+
+        }
+
+        scheduler->is_started = false;
+
+    }
+
+    pthread_mutex_unlock(&scheduler->lock);
+
+    return return_value;
+}
+
+
+/*
+*  advertising_scheduler_print_statistics:
+*
+*  This function prints how the frames are advertised and how often they
+*  were rotated and changed.
+*
+*  Parameters:
+*
+*  scheduler - the advertising scheduler
+*
+*  Return value:
+*
+*  None
+*/
+void advertising_scheduler_print_statistics(AdvertisingScheduler *scheduler) {
+
+    char *method = "legacy payload rotation";
+
+    if (scheduler->use_extended == true &&
+        scheduler->number_of_sets < scheduler->number_of_frames) {
+        method = "advertising set rotation";
+    }
+    else if (scheduler->use_extended == true) {
+        method = "extended advertising sets";
+    }
+
+    printf("Advertising frames: %d with %s, %lld rotations, "
+           "%lld frame updates, %lld parameter changes\n",
+           scheduler->number_of_frames, method,
+           scheduler->number_of_rotations,
+           scheduler->number_of_frame_updates,
+           scheduler->number_of_parameter_changes);
+
+    if (scheduler->use_extended == true &&
+        EXTENDED_ADVERTISING_NO_TX_POWER != scheduler->selected_tx_power) {
+        printf("Advertising TX power selected by the controller: %d dBm\n",
+               scheduler->selected_tx_power);
+    }
+}
+
+
+/*
+*  advertising_scheduler_free:
+*
+*  This function stops advertising and releases the lock of the scheduler.
+*
+*  Parameters:
+*
+*  scheduler - the advertising scheduler
+*
+*  Return value:
+*
+*  None
+*/
+void advertising_scheduler_free(AdvertisingScheduler *scheduler) {
+
+    advertising_scheduler_stop(scheduler);
+    pthread_mutex_destroy(&scheduler->lock);
+}
@@ -0,0 +1,218 @@
+/*
+* Copyright (c) 2016 Academia Sinica, Institute of Information Science
+*
+* License:
+*
+*      GPL 3.0 : The content of this file is subject to the terms and
+*      conditions defined in file 'COPYING.txt', which is part of this source
+*      code package.
+*
+* Project Name:
+*
+*      BeDIPS
+*
+* File Description:
+*
+*      This header file contains the function declarations and variables used
+*      in the AdvertisingScheduler.c file.
+*
+* File Name:
+*
+*      AdvertisingScheduler.h
+*
+* Abstract:
+*
+*      BeDIPS uses LBeacons to deliver 3D coordinates and textual
+*      descriptions of their locations to users' devices. Basically, a LBeacon
+*      is an inexpensive, Bluetooth Smart Ready device. The 3D coordinates and
+*      location description of every LBeacon are retrieved from BeDIS
+*      (Building/environment Data and Information System) and stored locally
+*      during deployment and maintenance times. Once initialized, each LBeacon
+*      broadcasts its coordinates and location description to Bluetooth
+*      enabled user devices within its coverage area.
+*
+* Authors:
+*
+*      Jake Lee, jakelee@iis.sinica.edu.tw
+*      Johnson Su, johnsonsu@iis.sinica.edu.tw
+*      Shirley Huang, shirley.huang.93@gmail.com
+*      Han Hu, hhu14@illinois.edu
+*      Jeffrey Lin, lin.jeff03@gmail.com
+*      Howard Hsu, haohsu0823@gmail.com
+*      Han Wang, hollywang@iis.sinica.edu.tw
+*/
+
+
+#ifndef ADVERTISINGSCHEDULER_H
+#define ADVERTISINGSCHEDULER_H
+
+#include <bluetooth/bluetooth.h>
+#include <bluetooth/hci.h>
+#include <bluetooth/hci_lib.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "AdvertisingController.h"
+
+
+/*
+* CONSTANTS
+*/
+
+/* Maximum number of frames advertised by the scheduler */
+#define ADVERTISING_MAXIMUM_FRAMES 4
+
+/* LE controller commands of the extended advertising feature */
+#define OCF_LE_READ_FEATURES 0x0003
+#define OCF_LE_SET_EXTENDED_ADVERTISING_PARAMETERS 0x0036
+#define OCF_LE_SET_EXTENDED_ADVERTISING_DATA 0x0037
+#define OCF_LE_SET_EXTENDED_ADVERTISING_ENABLE 0x0039
+#define OCF_LE_READ_NUMBER_OF_ADVERTISING_SETS 0x003B
+#define OCF_LE_CLEAR_ADVERTISING_SETS 0x003D
+
+/* Byte and bit of the LE extended advertising feature in the features
+ * returned by the controller */
+#define LE_EXTENDED_ADVERTISING_BYTE 1
+#define LE_EXTENDED_ADVERTISING_BIT 0x10
+
+/* Event properties of an advertising set sending legacy non-connectable,
+ * non-scannable advertisements, which every phone can receive */
+#define EXTENDED_ADVERTISING_LEGACY_NONCONNECTABLE 0x0010
+
+/* Operation of the extended advertising data command sending the whole
+ * data at once, and preference letting the controller fragment it */
+#define EXTENDED_ADVERTISING_COMPLETE_DATA 0x03
+#define EXTENDED_ADVERTISING_NO_FRAGMENT_PREFERENCE 0x01
+
+/* LE 1M physical layer */
+#define EXTENDED_ADVERTISING_PHY_1M 0x01
+
+/* TX power value leaving the choice to the controller */
+#define EXTENDED_ADVERTISING_NO_TX_POWER 0x7F
+
+
+
+/*
+* TYPEDEF STRUCTS
+*/
+
+/* Parameters of the LE Set Extended Advertising Parameters command */
+typedef struct ExtendedAdvertisingParameters {
+    uint8_t handle;
+    uint16_t properties;
+    uint8_t minimum_interval[3];
+    uint8_t maximum_interval[3];
+    uint8_t channel_map;
+    uint8_t own_address_type;
+    uint8_t peer_address_type;
+    bdaddr_t peer_address;
+    uint8_t filter_policy;
+    int8_t tx_power;
+    uint8_t primary_phy;
+    uint8_t secondary_maximum_skip;
+    uint8_t secondary_phy;
+    uint8_t sid;
+    uint8_t scan_request_notify;
+} __attribute__((packed)) ExtendedAdvertisingParameters;
+
+
+/* Parameters of the LE Set Extended Advertising Data command */
+typedef struct ExtendedAdvertisingData {
+    uint8_t handle;
+    uint8_t operation;
+    uint8_t fragment_preference;
+    uint8_t length;
+    uint8_t data[31];
+} __attribute__((packed)) ExtendedAdvertisingData;
+
+
+/* One set of the LE Set Extended Advertising Enable command */
+typedef struct ExtendedAdvertisingSet {
+    uint8_t handle;
+    uint16_t duration;
+    uint8_t maximum_events;
+} __attribute__((packed)) ExtendedAdvertisingSet;
+
+
+/* Parameters of the LE Set Extended Advertising Enable command */
+typedef struct ExtendedAdvertisingEnable {
+    uint8_t enable;
+    uint8_t number_of_sets;
+    ExtendedAdvertisingSet sets[ADVERTISING_MAXIMUM_FRAMES];
+} __attribute__((packed)) ExtendedAdvertisingEnable;
+
+
+/* Scheduler sharing one LE dongle between several advertising frames.
+ * When the controller supports extended advertising with enough sets,
+ * every frame gets its own advertising set and the controller interleaves
+ * them. Otherwise the frames take turns in a single advertising set, or in
+ * the legacy advertising payload without extended advertising, and each
+ * turn costs one command. */
+typedef struct AdvertisingScheduler {
+    /* Controller of the dongle */
+    AdvertisingController *controller;
+
+    /* Frames advertised, in the order they were added */
+    le_set_advertising_data_cp frames[ADVERTISING_MAXIMUM_FRAMES];
+    int number_of_frames;
+
+    /* Advertising interval in units of 0.625 milliseconds */
+    int advertising_interval;
+
+    /* TX power in dBm asked for the advertising sets, and the one the
+     * controller selected */
+    int tx_power;
+    int selected_tx_power;
+
+    /* Whether the frames are advertised with extended advertising sets */
+    bool use_extended;
+
+    /* Number of advertising sets, one for the legacy payload. The frames
+     * take turns when there are fewer sets than frames. */
+    int number_of_sets;
+
+    /* Whether the frames are being advertised */
+    bool is_started;
+
+    /* Frame advertised in turn while rotating */
+    int current_frame;
+
+    /* Number of rotations and of frames changed while advertised */
+    long long number_of_rotations;
+    long long number_of_frame_updates;
+
+    /* Number of changes of the interval or TX power */
+    long long number_of_parameter_changes;
+
+    /* Lock protecting the frames and the commands sent */
+    pthread_mutex_t lock;
+} AdvertisingScheduler;
+
+
+
+/*
+* FUNCTIONS
+*/
+
+int advertising_scheduler_init(AdvertisingScheduler *scheduler,
+                               AdvertisingController *controller,
+                               int advertising_interval);
+int advertising_scheduler_add_frame(AdvertisingScheduler *scheduler,
+                                    le_set_advertising_data_cp *payload);
+int advertising_scheduler_start(AdvertisingScheduler *scheduler);
+int advertising_scheduler_set_frame(AdvertisingScheduler *scheduler,
+                                    int frame_id,
+                                    le_set_advertising_data_cp *payload);
+int advertising_scheduler_set_parameters(AdvertisingScheduler *scheduler,
+                                         int advertising_interval,
+                                         int tx_power);
+int advertising_scheduler_rotate(AdvertisingScheduler *scheduler);
+int advertising_scheduler_stop(AdvertisingScheduler *scheduler);
+void advertising_scheduler_print_statistics(AdvertisingScheduler *scheduler);
+void advertising_scheduler_free(AdvertisingScheduler *scheduler);
+
+#endif
@@ -0,0 +1,382 @@
+/*
+* Copyright (c) 2016 Academia Sinica, Institute of Information Science
+*
+* License:
+*
+*      GPL 3.0 : The content of this file is subject to the terms and
+*      conditions defined in file 'COPYING.txt', which is part of this source
+*      code package.
+*
+* Project Name:
+*
+*      BeDIPS
+*
+* File Description:
+*
+*      This file contains the implementation of a decaying blocklist of
+*      devices whose pushes failed. A device is skipped for a time that
+*      doubles with each consecutive failure of the same class, and is
+*      forgiven after a successful push or a day without failures, so dongles
+*      do not spend their time on phones refusing OBEX Object Push over and
+*      over.
+*
+* File Name:
+*
+*      Blocklist.c
+*
+* Abstract:
+*
+*      BeDIPS uses LBeacons to deliver 3D coordinates and textual
+*      descriptions of their locations to users' devices. Basically, a LBeacon
+*      is an inexpensive, Bluetooth Smart Ready device. The 3D coordinates and
+*      location description of every LBeacon are retrieved from BeDIS
+*      (Building/environment Data and Information System) and stored locally
+*      during deployment and maintenance times. Once initialized, each LBeacon
+*      broadcasts its coordinates and location description to Bluetooth
+*      enabled user devices within its coverage area.
+*
+* Authors:
+*
+*      Jake Lee, jakelee@iis.sinica.edu.tw
+*      Johnson Su, johnsonsu@iis.sinica.edu.tw
+*      Shirley Huang, shirley.huang.93@gmail.com
+*      Han Hu, hhu14@illinois.edu
+*      Jeffrey Lin, lin.jeff03@gmail.com
+*      Howard Hsu, haohsu0823@gmail.com
+*      Han Wang, hollywang@iis.sinica.edu.tw
+*/
+
+#include "Blocklist.h"
+
+
+/* Time a device is skipped after its first failure of each class */
+static const long long base_backoff[NUMBER_OF_FAILURE_CLASSES] = {
+    BLOCKLIST_NO_CHANNEL_BACKOFF,
+    BLOCKLIST_CONNECT_BACKOFF,
+    BLOCKLIST_PUT_BACKOFF
+};
+
+/* Names of the failure classes used in the output */
+static const char *failure_class_names[NUMBER_OF_FAILURE_CLASSES] = {
+    "no channel",
+    "connect",
+    "put"
+};
+
+
+/*
+*  forgive_entry:
+*
+*  This helper function drops the entry of a device, so it is pushed to
+*  again. The blocklist must be locked.
+*
+*  Parameters:
+*
+*  blocklist - the blocklist
+*  entry - the entry to be dropped
+*
+*  Return value:
+*
+*  None
+*/
+static void forgive_entry(Blocklist *blocklist, BlocklistEntry *entry) {
+
+    device_table_remove(&blocklist->table, entry->key);
+
+    /* Put the entry at the head so it is reused first */
+    list_remove_node(&entry->ptrs);
+    list_insert_(&entry->ptrs, &blocklist->lru_list,
+                 blocklist->lru_list.next);
+    entry->key = 0;
+    blocklist->number_of_forgiven++;
+}
+
+
+/*
+*  blocklist_init:
+*
+*  This function allocates the entries of the blocklist.
+*
+*  Parameters:
+*
+*  blocklist - the blocklist to be initialized
+*  capacity - maximum number of devices remembered
+*
+*  Return value:
+*
+*  0 - success
+*  -1 - memory allocation failed
+*/
+int blocklist_init(Blocklist *blocklist, int capacity) {
+
+    memset(blocklist, 0, sizeof(Blocklist));
+
+    blocklist->entries =
+        (BlocklistEntry *)malloc(capacity * sizeof(BlocklistEntry));
+
+    if (blocklist->entries == NULL) {
+
+        /* Error handling */
+        perror("Failed to allocate memory");
+        return -1;
+
+    }
+
+    if (device_table_init(&blocklist->table, capacity * 2) != 0) {
+
+        free(blocklist->entries);
+        blocklist->entries = NULL;
+        return -1;
+
+    }
+
+    blocklist->capacity = capacity;
+    blocklist->lru_list.next = &blocklist->lru_list;
+    blocklist->lru_list.prev = &blocklist->lru_list;
+    pthread_mutex_init(&blocklist->lock, NULL);
+
+    return 0;
+}
+
+
+/*
+*  blocklist_is_blocked:
+*
+*  This function tells whether pushes to the device are skipped for now.
+*  The failures of a device that has not failed for BLOCKLIST_DECAY_TIME
+*  are forgotten.
+*
+*  Parameters:
+*
+*  blocklist - the blocklist
+*  address - bluetooth device address
+*  now - current time in milliseconds
+*
+*  Return value:
+*
+*  true - the device is skipped until its backoff is over
+*  false - the device may be pushed to
+*/
+bool blocklist_is_blocked(Blocklist *blocklist, bdaddr_t *address,
+                          long long now) {
+
+    uint64_t key = bdaddr_to_key(address);
+    BlocklistEntry *entry;
+    bool is_blocked = false;
+
+    pthread_mutex_lock(&blocklist->lock);
+
+    blocklist->number_of_checks++;
+    entry = (BlocklistEntry *)device_table_lookup(&blocklist->table, key);
+
+    if (entry != NULL) {
+
+        if (BLOCKLIST_DECAY_TIME <= now - entry->last_failure_time) {
+
+            forgive_entry(blocklist, entry);
+
+        }
+        else if (now < entry->blocked_until) {
+
+            is_blocked = true;
+            blocklist->number_of_skipped++;
+
+        }
+
+    }
+
+    pthread_mutex_unlock(&blocklist->lock);
+
+    return is_blocked;
+}
+
+
+/*
+*  blocklist_record_failure:
+*
+*  This function records a failed push and blocks the device for the base
+*  backoff of the failure class, doubled for each earlier consecutive
+*  failure of the same class. When the blocklist is full, the entry of the
+*  device that failed least recently is reused.
+*
+*  Parameters:
+*
+*  blocklist - the blocklist
+*  address - bluetooth device address
+*  failure_class - the reason the push failed
+*  now - current time in milliseconds
+*
+*  Return value:
+*
+*  backoff - time in milliseconds the device is skipped
+*/
+long long blocklist_record_failure(Blocklist *blocklist, bdaddr_t *address,
+                                   FailureClass failure_class,
+                                   long long now) {
+
+    uint64_t key = bdaddr_to_key(address);
+    BlocklistEntry *entry;
+    long long backoff;
+    int shift;
+
+    pthread_mutex_lock(&blocklist->lock);
+
+    blocklist->number_of_failures[failure_class]++;
+    entry = (BlocklistEntry *)device_table_lookup(&blocklist->table, key);
+
+    if (entry != NULL &&
+        BLOCKLIST_DECAY_TIME <= now - entry->last_failure_time) {
+
+        forgive_entry(blocklist, entry);
+        entry = NULL;
+
+    }
+
+    if (entry == NULL) {
+
+        if (blocklist->number_of_used < blocklist->capacity) {
+
+            entry = &blocklist->entries[blocklist->number_of_used];
+            blocklist->number_of_used++;
+
+        }
+        else {
+
+            /* Reuse the entry of the device that failed least recently */
+            entry = ListEntry(blocklist->lru_list.next, BlocklistEntry,
+                              ptrs);
+            list_remove_node(&entry->ptrs);
+
+            if (entry->key != 0) {
+                device_table_remove(&blocklist->table, entry->key);
+            }
+
+        }
+
+        memset(entry->number_of_failures, 0,
+               sizeof(entry->number_of_failures));
+        entry->key = key;
+        entry->blocked_until = now;
+        device_table_insert(&blocklist->table, key, entry);
+
+    }
+    else {
+
+        list_remove_node(&entry->ptrs);
+
+    }
+
+    /* Double the backoff for each consecutive failure, without shifting
+     * past the maximum */
+    shift = entry->number_of_failures[failure_class];
+    entry->number_of_failures[failure_class]++;
+    backoff = base_backoff[failure_class];
+
+    while (0 < shift && backoff < BLOCKLIST_MAXIMUM_BACKOFF) {
+        backoff *= 2;
+        shift--;
+    }
+
+    if (BLOCKLIST_MAXIMUM_BACKOFF < backoff) {
+        backoff = BLOCKLIST_MAXIMUM_BACKOFF;
+    }
+
+    entry->last_failure_time = now;
+
+    if (entry->blocked_until < now + backoff) {
+        entry->blocked_until = now + backoff;
+    }
+
+    list_insert_tail(&entry->ptrs, &blocklist->lru_list);
+
+    pthread_mutex_unlock(&blocklist->lock);
+
+    return backoff;
+}
+
+
+/*
+*  blocklist_record_success:
+*
+*  This function forgets the failures of a device the message was sent to.
+*
+*  Parameters:
+*
+*  blocklist - the blocklist
+*  address - bluetooth device address
+*
+*  Return value:
+*
+*  None
+*/
+void blocklist_record_success(Blocklist *blocklist, bdaddr_t *address) {
+
+    uint64_t key = bdaddr_to_key(address);
+    BlocklistEntry *entry;
+
+    pthread_mutex_lock(&blocklist->lock);
+
+    entry = (BlocklistEntry *)device_table_lookup(&blocklist->table, key);
+
+    if (entry != NULL) {
+        forgive_entry(blocklist, entry);
+    }
+
+    pthread_mutex_unlock(&blocklist->lock);
+}
+
+
+/*
+*  blocklist_print_statistics:
+*
+*  This function prints the counters of the blocklist.
+*
+*  Parameters:
+*
+*  blocklist - the blocklist
+*
+*  Return value:
+*
+*  None
+*/
+void blocklist_print_statistics(Blocklist *blocklist) {
+
+    int failure_class;
+
+    pthread_mutex_lock(&blocklist->lock);
+
+    printf("Blocklist: %lld checks, %lld skipped, %lld forgiven, "
+           "%d listed\n", blocklist->number_of_checks,
+           blocklist->number_of_skipped, blocklist->number_of_forgiven,
+           blocklist->table.size);
+
+    for (failure_class = 0; failure_class < NUMBER_OF_FAILURE_CLASSES;
+         failure_class++) {
+        printf("  %s failures: %lld\n", failure_class_names[failure_class],
+               blocklist->number_of_failures[failure_class]);
+    }
+
+    pthread_mutex_unlock(&blocklist->lock);
+}
+
+
+/*
+*  blocklist_free:
+*
+*  This function frees the entries of the blocklist.
+*
+*  Parameters:
+*
+*  blocklist - the blocklist
+*
+*  Return value:
+*
+*  None
+*/
+void blocklist_free(Blocklist *blocklist) {
+
+    device_table_free(&blocklist->table);
+    free(blocklist->entries);
+    blocklist->entries = NULL;
+    pthread_mutex_destroy(&blocklist->lock);
+}
@@ -0,0 +1,165 @@
+/*
+* Copyright (c) 2016 Academia Sinica, Institute of Information Science
+*
+* License:
+*
+*      GPL 3.0 : The content of this file is subject to the terms and
+*      conditions defined in file 'COPYING.txt', which is part of this source
+*      code package.
+*
+* Project Name:
+*
+*      BeDIPS
+*
+* File Description:
+*
+*      This header file contains the function declarations and variables used
+*      in the Blocklist.c file.
+*
+* File Name:
+*
+*      Blocklist.h
+*
+* Abstract:
+*
+*      BeDIPS uses LBeacons to deliver 3D coordinates and textual
+*      descriptions of their locations to users' devices. Basically, a LBeacon
+*      is an inexpensive, Bluetooth Smart Ready device. The 3D coordinates and
+*      location description of every LBeacon are retrieved from BeDIS
+*      (Building/environment Data and Information System) and stored locally
+*      during deployment and maintenance times. Once initialized, each LBeacon
+*      broadcasts its coordinates and location description to Bluetooth
+*      enabled user devices within its coverage area.
+*
+* Authors:
+*
+*      Jake Lee, jakelee@iis.sinica.edu.tw
+*      Johnson Su, johnsonsu@iis.sinica.edu.tw
+*      Shirley Huang, shirley.huang.93@gmail.com
+*      Han Hu, hhu14@illinois.edu
+*      Jeffrey Lin, lin.jeff03@gmail.com
+*      Howard Hsu, haohsu0823@gmail.com
+*      Han Wang, hollywang@iis.sinica.edu.tw
+*/
+
+#ifndef BLOCKLIST_H
+#define BLOCKLIST_H
+
+#include <bluetooth/bluetooth.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "DeviceTable.h"
+#include "LinkedList.h"
+
+
+/*
+* CONSTANTS
+*/
+
+/* Time in milliseconds a device is skipped after its first failure of each
+ * class. Each further failure of the same class doubles the time. */
+#define BLOCKLIST_NO_CHANNEL_BACKOFF 600000
+#define BLOCKLIST_CONNECT_BACKOFF 60000
+#define BLOCKLIST_PUT_BACKOFF 120000
+
+/* Longest time in milliseconds a device is skipped after a failure */
+#define BLOCKLIST_MAXIMUM_BACKOFF 21600000
+
+/* Time in milliseconds without a failure after which the failures of a
+ * device are forgotten */
+#define BLOCKLIST_DECAY_TIME 86400000
+
+
+
+/*
+* TYPEDEF STRUCTS
+*/
+
+/* Reasons a push to a device fails */
+typedef enum FailureClass {
+    /* The device has no OBEX Object Push service */
+    FAILURE_NO_CHANNEL = 0,
+
+    /* The device refused or did not answer the OBEX connection */
+    FAILURE_CONNECT = 1,
+
+    /* The device refused the message or the transfer broke */
+    FAILURE_PUT = 2,
+
+    NUMBER_OF_FAILURE_CLASSES = 3
+} FailureClass;
+
+
+/* Failures of one device */
+typedef struct BlocklistEntry {
+    /* Packed address of the device */
+    uint64_t key;
+
+    /* Consecutive failures of each class */
+    int number_of_failures[NUMBER_OF_FAILURE_CLASSES];
+
+    /* Time in milliseconds of the last failure */
+    long long last_failure_time;
+
+    /* Time in milliseconds until which the device is skipped */
+    long long blocked_until;
+
+    /* Links of the entry in the least recently used list */
+    List_Entry ptrs;
+} BlocklistEntry;
+
+
+/* Devices whose pushes failed, skipped for a time growing exponentially
+ * with their consecutive failures of each class. Entries come from a fixed
+ * array, and the least recently failed entry is reused when the list is
+ * full. */
+typedef struct Blocklist {
+    /* Array of capacity entries */
+    BlocklistEntry *entries;
+
+    /* Maximum number of devices remembered */
+    int capacity;
+
+    /* Number of entries taken from the array so far */
+    int number_of_used;
+
+    /* Entries indexed by device address */
+    DeviceTable table;
+
+    /* Entries in use, least recently failed first */
+    List_Entry lru_list;
+
+    /* Lock protecting the list, which is shared by the push threads */
+    pthread_mutex_t lock;
+
+    /* Number of checks, and of devices skipped by them */
+    long long number_of_checks;
+    long long number_of_skipped;
+
+    /* Number of failures of each class */
+    long long number_of_failures[NUMBER_OF_FAILURE_CLASSES];
+
+    /* Number of devices forgiven after a successful push or after
+     * BLOCKLIST_DECAY_TIME without a failure */
+    long long number_of_forgiven;
+} Blocklist;
+
+
+
+/*
+* FUNCTIONS
+*/
+
+int blocklist_init(Blocklist *blocklist, int capacity);
+bool blocklist_is_blocked(Blocklist *blocklist, bdaddr_t *address,
+                          long long now);
+long long blocklist_record_failure(Blocklist *blocklist, bdaddr_t *address,
+                                   FailureClass failure_class, long long now);
+void blocklist_record_success(Blocklist *blocklist, bdaddr_t *address);
+void blocklist_print_statistics(Blocklist *blocklist);
+void blocklist_free(Blocklist *blocklist);
+
+#endif
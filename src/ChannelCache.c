@@ -0,0 +1,419 @@
+/*
+* Copyright (c) 2016 Academia Sinica, Institute of Information Science
+*
+* License:
+*
+*      GPL 3.0 : The content of this file is subject to the terms and
+*      conditions defined in file 'COPYING.txt', which is part of this source
+*      code package.
+*
+* Project Name:
+*
+*      BeDIPS
+*
+* File Description:
+*
+*      This file contains the implementation of a least recently used cache
+*      mapping the address of a device to the RFCOMM channel of its OBEX
+*      Object Push service, so returning visitors are pushed to without a new
+*      SDP search. Entries expire after a time to live and are dropped when
+*      connecting on the cached channel fails.
+*
+* File Name:
+*
+*      ChannelCache.c
+*
+* Abstract:
+*
+*      BeDIPS uses LBeacons to deliver 3D coordinates and textual
+*      descriptions of their locations to users' devices. Basically, a LBeacon
+*      is an inexpensive, Bluetooth Smart Ready device. The 3D coordinates and
+*      location description of every LBeacon are retrieved from BeDIS
+*      (Building/environment Data and Information System) and stored locally
+*      during deployment and maintenance times. Once initialized, each LBeacon
+*      broadcasts its coordinates and location description to Bluetooth
+*      enabled user devices within its coverage area.
+*
+* Authors:
+*
+*      Jake Lee, jakelee@iis.sinica.edu.tw
+*      Johnson Su, johnsonsu@iis.sinica.edu.tw
+*      Shirley Huang, shirley.huang.93@gmail.com
+*      Han Hu, hhu14@illinois.edu
+*      Jeffrey Lin, lin.jeff03@gmail.com
+*      Howard Hsu, haohsu0823@gmail.com
+*      Han Wang, hollywang@iis.sinica.edu.tw
+*/
+
+#include "ChannelCache.h"
+
+
+/*
+*  channel_cache_init:
+*
+*  This function allocates the entries of an empty cache.
+*
+*  Parameters:
+*
+*  cache - the cache to be initialized
+*  capacity - maximum number of cached devices
+*  time_to_live - time in milliseconds a channel is trusted after a search
+*
+*  Return value:
+*
+*  0 - success
+*  -1 - memory allocation failed
+*/
+int channel_cache_init(ChannelCache *cache, int capacity,
+                       long long time_to_live) {
+
+    memset(cache, 0, sizeof(ChannelCache));
+
+    cache->entries = (ChannelCacheEntry *)malloc(capacity *
+                                                 sizeof(ChannelCacheEntry));
+
+    if (cache->entries == NULL) {
+
+        /* Error handling */
+        perror("Failed to allocate memory");
+        return -1;
+
+    }
+
+    if (device_table_init(&cache->table, capacity * 2) != 0) {
+
+        free(cache->entries);
+        cache->entries = NULL;
+        return -1;
+
+    }
+
+    cache->capacity = capacity;
+    cache->time_to_live = time_to_live;
+    cache->lru_list.next = &cache->lru_list;
+    cache->lru_list.prev = &cache->lru_list;
+    pthread_mutex_init(&cache->lock, NULL);
+
+    return 0;
+}
+
+
+/*
+*  channel_cache_lookup:
+*
+*  This function returns the cached channel of the device and marks the
+*  entry as the most recently used one. An entry past its time to live is
+*  dropped and counted as a miss.
+*
+*  Parameters:
+*
+*  cache - the cache
+*  address - bluetooth device address
+*  now - current time in milliseconds
+*
+*  Return value:
+*
+*  channel - the cached channel, -1 if the device has to be searched
+*/
+int channel_cache_lookup(ChannelCache *cache, bdaddr_t *address,
+                         long long now) {
+
+    uint64_t key = bdaddr_to_key(address);
+    ChannelCacheEntry *entry;
+    int channel = -1;
+
+    pthread_mutex_lock(&cache->lock);
+
+    entry = (ChannelCacheEntry *)device_table_lookup(&cache->table, key);
+
+    if (entry != NULL && entry->expiry_time <= now) {
+
+        /* Put the expired entry at the head so it is reused first */
+        device_table_remove(&cache->table, key);
+        list_remove_node(&entry->ptrs);
+        list_insert_(&entry->ptrs, &cache->lru_list, cache->lru_list.next);
+        entry->key = 0;
+        cache->number_of_expirations++;
+        entry = NULL;
+
+    }
+
+    if (entry != NULL) {
+
+        list_remove_node(&entry->ptrs);
+        list_insert_tail(&entry->ptrs, &cache->lru_list);
+        channel = entry->channel;
+        cache->number_of_hits++;
+
+    }
+    else {
+
+        cache->number_of_misses++;
+
+    }
+
+    pthread_mutex_unlock(&cache->lock);
+
+    return channel;
+}
+
+
+/*
+*  store_channel:
+*
+*  This helper function stores the channel of a device with its expiry
+*  time as the most recently used entry. When the cache is full, the least
+*  recently used entry is replaced. The caller holds the lock.
+*
+*  Parameters:
+*
+*  cache - the cache
+*  key - packed address of the device
+*  channel - channel of the device
+*  expiry_time - time in milliseconds the entry expires
+*
+*  Return value:
+*
+*  None
+*/
+static void store_channel(ChannelCache *cache, uint64_t key, int channel,
+                          long long expiry_time) {
+
+    ChannelCacheEntry *entry;
+
+    entry = (ChannelCacheEntry *)device_table_lookup(&cache->table, key);
+
+    if (entry == NULL) {
+
+        if (cache->number_of_used < cache->capacity) {
+
+            entry = &cache->entries[cache->number_of_used];
+            cache->number_of_used++;
+
+        }
+        else {
+
+            /* Reuse the least recently used entry */
+            entry = ListEntry(cache->lru_list.next, ChannelCacheEntry, ptrs);
+            list_remove_node(&entry->ptrs);
+
+            if (entry->key != 0) {
+                device_table_remove(&cache->table, entry->key);
+            }
+
+        }
+
+        entry->key = key;
+        device_table_insert(&cache->table, key, entry);
+
+    }
+    else {
+
+        list_remove_node(&entry->ptrs);
+
+    }
+
+    entry->channel = channel;
+    entry->expiry_time = expiry_time;
+    list_insert_tail(&entry->ptrs, &cache->lru_list);
+}
+
+
+/*
+*  channel_cache_insert:
+*
+*  This function records the result of an SDP search. When the cache is
+*  full, the least recently used entry is replaced.
+*
+*  Parameters:
+*
+*  cache - the cache
+*  address - bluetooth device address
+*  channel - channel found by the search, negative if there was none
+*  now - current time in milliseconds
+*  search_time - time in milliseconds the search took
+*
+*  Return value:
+*
+*  None
+*/
+void channel_cache_insert(ChannelCache *cache, bdaddr_t *address,
+                          int channel, long long now, long long search_time) {
+
+    pthread_mutex_lock(&cache->lock);
+
+    cache->number_of_searches++;
+    cache->total_search_time += search_time;
+
+    /* Devices without an Object Push service are not cached */
+    if (0 <= channel) {
+        store_channel(cache, bdaddr_to_key(address), channel,
+                      now + cache->time_to_live);
+    }
+
+    pthread_mutex_unlock(&cache->lock);
+}
+
+
+/*
+*  channel_cache_restore:
+*
+*  This function puts back an entry saved by an earlier run, keeping its
+*  expiry time. It does not count as a search.
+*
+*  Parameters:
+*
+*  cache - the cache
+*  address - bluetooth device address
+*  channel - channel of the device
+*  expiry_time - time in milliseconds the entry expires
+*
+*  Return value:
+*
+*  None
+*/
+void channel_cache_restore(ChannelCache *cache, bdaddr_t *address,
+                           int channel, long long expiry_time) {
+
+    pthread_mutex_lock(&cache->lock);
+    store_channel(cache, bdaddr_to_key(address), channel, expiry_time);
+    pthread_mutex_unlock(&cache->lock);
+}
+
+
+/*
+*  channel_cache_for_each:
+*
+*  This function calls a function on every entry of the cache that has
+*  not expired, from the least recently used to the most recently used,
+*  so restoring them in that order keeps the order of the cache.
+*
+*  Parameters:
+*
+*  cache - the cache
+*  visit - the function called on each entry
+*  context - passed to visit
+*  now - current time in milliseconds
+*
+*  Return value:
+*
+*  None
+*/
+void channel_cache_for_each(ChannelCache *cache, ChannelCacheVisit visit,
+                            void *context, long long now) {
+
+    List_Entry *position;
+    ChannelCacheEntry *entry;
+
+    pthread_mutex_lock(&cache->lock);
+
+    for (position = cache->lru_list.next; position != &cache->lru_list;
+         position = position->next) {
+
+        entry = ListEntry(position, ChannelCacheEntry, ptrs);
+
+        if (entry->key != 0 && entry->expiry_time > now) {
+            visit(entry->key, entry->channel, entry->expiry_time, context);
+        }
+
+    }
+
+    pthread_mutex_unlock(&cache->lock);
+}
+
+
+/*
+*  channel_cache_invalidate:
+*
+*  This function drops the cached channel of the device, so the next push
+*  searches it again.
+*
+*  Parameters:
+*
+*  cache - the cache
+*  address - bluetooth device address
+*
+*  Return value:
+*
+*  None
+*/
+void channel_cache_invalidate(ChannelCache *cache, bdaddr_t *address) {
+
+    uint64_t key = bdaddr_to_key(address);
+    ChannelCacheEntry *entry;
+
+    pthread_mutex_lock(&cache->lock);
+
+    entry = (ChannelCacheEntry *)device_table_remove(&cache->table, key);
+
+    if (entry != NULL) {
+
+        /* Put the entry at the head so it is reused first */
+        list_remove_node(&entry->ptrs);
+        list_insert_(&entry->ptrs, &cache->lru_list, cache->lru_list.next);
+        entry->key = 0;
+        cache->number_of_invalidations++;
+
+    }
+
+    pthread_mutex_unlock(&cache->lock);
+}
+
+
+/*
+*  channel_cache_print_statistics:
+*
+*  This function prints the hit and miss counters of the cache, and an
+*  estimate of the connection setup time saved by the hits based on the
+*  average time of an SDP search.
+*
+*  Parameters:
+*
+*  cache - the cache
+*
+*  Return value:
+*
+*  None
+*/
+void channel_cache_print_statistics(ChannelCache *cache) {
+
+    long long average_search_time = 0;
+
+    pthread_mutex_lock(&cache->lock);
+
+    if (cache->number_of_searches > 0) {
+        average_search_time =
+            cache->total_search_time / cache->number_of_searches;
+    }
+
+    printf("Channel cache: %lld hits, %lld misses, %lld invalidated, "
+           "%lld expired, %d cached\n", cache->number_of_hits,
+           cache->number_of_misses, cache->number_of_invalidations,
+           cache->number_of_expirations, cache->table.size);
+    printf("  average SDP search %lld ms, about %lld ms saved by hits\n",
+           average_search_time, average_search_time * cache->number_of_hits);
+
+    pthread_mutex_unlock(&cache->lock);
+}
+
+
+/*
+*  channel_cache_free:
+*
+*  This function frees the entries of the cache.
+*
+*  Parameters:
+*
+*  cache - the cache
+*
+*  Return value:
+*
+*  None
+*/
+void channel_cache_free(ChannelCache *cache) {
+
+    device_table_free(&cache->table);
+    free(cache->entries);
+    cache->entries = NULL;
+    pthread_mutex_destroy(&cache->lock);
+}
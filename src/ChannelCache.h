@@ -0,0 +1,145 @@
+/*
+* Copyright (c) 2016 Academia Sinica, Institute of Information Science
+*
+* License:
+*
+*      GPL 3.0 : The content of this file is subject to the terms and
+*      conditions defined in file 'COPYING.txt', which is part of this source
+*      code package.
+*
+* Project Name:
+*
+*      BeDIPS
+*
+* File Description:
+*
+*      This header file contains the function declarations and
+*      variables used in the ChannelCache.c file.
+*
+* File Name:
+*
+*      ChannelCache.h
+*
+* Abstract:
+*
+*      BeDIPS uses LBeacons to deliver 3D coordinates and textual
+*      descriptions of their locations to users' devices. Basically, a LBeacon
+*      is an inexpensive, Bluetooth Smart Ready device. The 3D coordinates and
+*      location description of every LBeacon are retrieved from BeDIS
+*      (Building/environment Data and Information System) and stored locally
+*      during deployment and maintenance times. Once initialized, each LBeacon
+*      broadcasts its coordinates and location description to Bluetooth
+*      enabled user devices within its coverage area.
+*
+* Authors:
+*
+*      Jake Lee, jakelee@iis.sinica.edu.tw
+*      Johnson Su, johnsonsu@iis.sinica.edu.tw
+*      Shirley Huang, shirley.huang.93@gmail.com
+*      Han Hu, hhu14@illinois.edu
+*      Jeffrey Lin, lin.jeff03@gmail.com
+*      Howard Hsu, haohsu0823@gmail.com
+*      Han Wang, hollywang@iis.sinica.edu.tw
+*/
+
+#ifndef CHANNELCACHE_H
+#define CHANNELCACHE_H
+
+#include <bluetooth/bluetooth.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "DeviceTable.h"
+#include "LinkedList.h"
+
+
+/*
+* TYPEDEF STRUCTS
+*/
+
+/* Function called on each entry of the cache with the packed address of
+ * the device, its channel, the expiry time of the entry and a context */
+typedef void (*ChannelCacheVisit)(uint64_t key, int channel,
+                                  long long expiry_time, void *context);
+
+
+/* Cached result of the SDP search for the Object Push channel of a device */
+typedef struct ChannelCacheEntry {
+    /* Packed address of the device */
+    uint64_t key;
+
+    /* RFCOMM channel of the OBEX Object Push service */
+    int channel;
+
+    /* Time in milliseconds after which the entry is no longer used */
+    long long expiry_time;
+
+    /* Links of the entry in the least recently used list */
+    List_Entry ptrs;
+} ChannelCacheEntry;
+
+
+/* Least recently used cache of Object Push channels with a time to live.
+ * Entries come from a fixed array, and the least recently used entry is
+ * reused when the cache is full. */
+typedef struct ChannelCache {
+    /* Array of capacity entries */
+    ChannelCacheEntry *entries;
+
+    /* Maximum number of cached devices */
+    int capacity;
+
+    /* Number of entries taken from the array so far */
+    int number_of_used;
+
+    /* Time to live of an entry in milliseconds */
+    long long time_to_live;
+
+    /* Entries indexed by device address */
+    DeviceTable table;
+
+    /* Entries in use, least recently used first */
+    List_Entry lru_list;
+
+    /* Lock protecting the cache, which is shared by the send_file threads */
+    pthread_mutex_t lock;
+
+    /* Number of lookups answered from the cache */
+    long long number_of_hits;
+
+    /* Number of lookups that needed an SDP search */
+    long long number_of_misses;
+
+    /* Number of entries dropped because connecting on the channel failed */
+    long long number_of_invalidations;
+
+    /* Number of entries dropped because their time to live was over */
+    long long number_of_expirations;
+
+    /* Number of SDP searches recorded and their total time in milliseconds */
+    long long number_of_searches;
+    long long total_search_time;
+} ChannelCache;
+
+
+
+/*
+* FUNCTIONS
+*/
+
+int channel_cache_init(ChannelCache *cache, int capacity,
+                       long long time_to_live);
+int channel_cache_lookup(ChannelCache *cache, bdaddr_t *address,
+                         long long now);
+void channel_cache_insert(ChannelCache *cache, bdaddr_t *address,
+                          int channel, long long now, long long search_time);
+void channel_cache_restore(ChannelCache *cache, bdaddr_t *address,
+                           int channel, long long expiry_time);
+void channel_cache_for_each(ChannelCache *cache, ChannelCacheVisit visit,
+                            void *context, long long now);
+void channel_cache_invalidate(ChannelCache *cache, bdaddr_t *address);
+void channel_cache_print_statistics(ChannelCache *cache);
+void channel_cache_free(ChannelCache *cache);
+
+#endif
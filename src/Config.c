@@ -0,0 +1,676 @@
+/*
+* Copyright (c) 2016 Academia Sinica, Institute of Information Science
+*
+* License:
+*
+*      GPL 3.0 : The content of this file is subject to the terms and
+*      conditions defined in file 'COPYING.txt', which is part of this source
+*      code package.
+*
+* Project Name:
+*
+*      BeDIPS
+*
+* File Description:
+*
+*      This file contains the parser of the config file of the LBeacon. Each
+*      line holds one key and its value separated by an equal sign, in any
+*      order. Values are converted to the fields of a Config struct and
+*      checked against the bounds of their key, and the config in use can be
+*      reloaded while the LBeacon runs.
+*
+* File Name:
+*
+*      Config.c
+*
+* Abstract:
+*
+*      BeDIPS uses LBeacons to deliver 3D coordinates and textual
+*      descriptions of their locations to users' devices. Basically, a LBeacon
+*      is an inexpensive, Bluetooth Smart Ready device. The 3D coordinates and
+*      location description of every LBeacon are retrieved from BeDIS
+*      (Building/environment Data and Information System) and stored locally
+*      during deployment and maintenance times. Once initialized, each LBeacon
+*      broadcasts its coordinates and location description to Bluetooth
+*      enabled user devices within its coverage area.
+*
+* Authors:
+*
+*      Jake Lee, jakelee@iis.sinica.edu.tw
+*      Johnson Su, johnsonsu@iis.sinica.edu.tw
+*      Shirley Huang, shirley.huang.93@gmail.com
+*      Han Hu, hhu14@illinois.edu
+*      Jeffrey Lin, lin.jeff03@gmail.com
+*      Howard Hsu, haohsu0823@gmail.com
+*      Han Wang, hollywang@iis.sinica.edu.tw
+*/
+
+#include "Config.h"
+
+
+/* Keys of the config file */
+static const ConfigKey config_keys[] = {
+    {"coordinate_X", CONFIG_FLOAT, offsetof(Config, coordinate_X),
+     -1000000, 1000000, NULL, true},
+    {"coordinate_Y", CONFIG_FLOAT, offsetof(Config, coordinate_Y),
+     -1000000, 1000000, NULL, true},
+    {"coordinate_Z", CONFIG_FLOAT, offsetof(Config, coordinate_Z),
+     -1000000, 1000000, NULL, true},
+    {"filename", CONFIG_STRING, offsetof(Config, file_name),
+     1, CONFIG_BUFFER_SIZE - 1, NULL, false},
+    {"filepath", CONFIG_STRING, offsetof(Config, file_path),
+     1, CONFIG_BUFFER_SIZE - 1, NULL, false},
+    {"maximum_number_of_devices", CONFIG_INTEGER,
+     offsetof(Config, maximum_number_of_devices), 1, 1000, NULL, true},
+    {"number_of_groups", CONFIG_INTEGER, offsetof(Config, number_of_groups),
+     0, 1000, NULL, false},
+    {"number_of_messages", CONFIG_INTEGER,
+     offsetof(Config, number_of_messages), 0, 100000, NULL, false},
+    {"number_of_push_dongles", CONFIG_INTEGER,
+     offsetof(Config, number_of_push_dongles), 1, 16, NULL, false},
+    {"RSSI_coverage", CONFIG_INTEGER, offsetof(Config, rssi_coverage),
+     -127, 127, NULL, true},
+    {"uuid", CONFIG_STRING, offsetof(Config, uuid),
+     32, CONFIG_BUFFER_SIZE - 1, NULL, false},
+    {"location_url", CONFIG_STRING, offsetof(Config, location_url),
+     0, CONFIG_BUFFER_SIZE - 1, "", true},
+    {"minimum_advertising_interval", CONFIG_INTEGER,
+     offsetof(Config, minimum_advertising_interval), 20, 10240, "100",
+     true},
+    {"maximum_advertising_interval", CONFIG_INTEGER,
+     offsetof(Config, maximum_advertising_interval), 20, 10240, "1000",
+     true},
+    {"minimum_tx_power", CONFIG_INTEGER, offsetof(Config, minimum_tx_power),
+     -127, 20, "-12", true},
+    {"maximum_tx_power", CONFIG_INTEGER, offsetof(Config, maximum_tx_power),
+     -127, 20, "4", true},
+    {"full_discovery_rate", CONFIG_REAL,
+     offsetof(Config, full_discovery_rate), 0.01, 10000, "5.0", true},
+    {"advertising_hysteresis", CONFIG_REAL,
+     offsetof(Config, advertising_hysteresis), 0, 0.99, "0.3", true},
+    {"advertising_hold_time", CONFIG_INTEGER,
+     offsetof(Config, advertising_hold_time), 0, 86400000, "60000", true},
+    {"state_snapshot_interval", CONFIG_INTEGER,
+     offsetof(Config, state_snapshot_interval), 1000, 86400000, "10000",
+     true}
+};
+
+#define NUMBER_OF_CONFIG_KEYS ((int)(sizeof(config_keys) / sizeof(ConfigKey)))
+
+
+/*
+*  trim:
+*
+*  This helper function removes the white space around a string.
+*
+*  Parameters:
+*
+*  text - the string, changed in place
+*
+*  Return value:
+*
+*  The first character of the string that is not white space
+*/
+static char *trim(char *text) {
+
+    char *end;
+
+    while (isspace((unsigned char)*text)) {
+        text++;
+    }
+
+    end = text + strlen(text);
+
+    while (end > text && isspace((unsigned char)end[-1])) {
+        end--;
+    }
+
+    *end = '\0';
+
+    return text;
+}
+
+
+/*
+*  get_field_size:
+*
+*  This helper function returns the size of the field set by a key.
+*
+*  Parameters:
+*
+*  key - the key
+*
+*  Return value:
+*
+*  Size of the field in bytes
+*/
+static size_t get_field_size(const ConfigKey *key) {
+
+    switch (key->type) {
+
+        case CONFIG_INTEGER:
+            return sizeof(int);
+
+        case CONFIG_FLOAT:
+            return sizeof(float);
+
+        case CONFIG_REAL:
+            return sizeof(double);
+
+        default:
+            return CONFIG_BUFFER_SIZE;
+
+    }
+}
+
+
+/*
+*  parse_value:
+*
+*  This helper function converts the value of a key and stores it in its
+*  field of the config. Numbers have to be written in full and lie within
+*  the bounds of the key, and so does the length of strings.
+*
+*  Parameters:
+*
+*  config - the config
+*  key - the key
+*  value - the value as written in the config file
+*
+*  Return value:
+*
+*  0 - success
+*  -1 - the value is not a number or is out of bounds
+*/
+static int parse_value(Config *config, const ConfigKey *key, char *value) {
+
+    char *field = (char *)config + key->offset;
+    char *end;
+    double number;
+
+    if (key->type == CONFIG_STRING) {
+
+        if (strlen(value) < key->minimum || strlen(value) > key->maximum) {
+            return -1;
+        }
+
+        strcpy(field, value);
+        return 0;
+
+    }
+
+    errno = 0;
+
+    if (key->type == CONFIG_INTEGER) {
+        number = (double)strtol(value, &end, 10);
+    }
+    else {
+        number = strtod(value, &end);
+    }
+
+    if (errno != 0 || end == value || *end != '\0' ||
+        number < key->minimum || number > key->maximum) {
+        return -1;
+    }
+
+    switch (key->type) {
+
+        case CONFIG_INTEGER:
+            *(int *)field = (int)number;
+            break;
+
+        case CONFIG_FLOAT:
+            *(float *)field = (float)number;
+            break;
+
+        default:
+            *(double *)field = number;
+            break;
+
+    }
+
+    return 0;
+}
+
+
+/*
+*  is_valid_uuid:
+*
+*  This helper function checks that a uuid holds 32 hexadecimal digits,
+*  optionally separated by dashes.
+*
+*  Parameters:
+*
+*  uuid - the uuid
+*
+*  Return value:
+*
+*  true - the uuid is valid
+*  false - otherwise
+*/
+static bool is_valid_uuid(char *uuid) {
+
+    int number_of_digits = 0;
+
+    for (; *uuid != '\0'; uuid++) {
+
+        if (isxdigit((unsigned char)*uuid)) {
+            number_of_digits++;
+        }
+        else if (*uuid != '-') {
+            return false;
+        }
+
+    }
+
+    return number_of_digits == 32;
+}
+
+
+/*
+*  check_config:
+*
+*  This helper function checks the values that depend on each other or
+*  on a format, once every key is read.
+*
+*  Parameters:
+*
+*  config - the config
+*  file_name - name of the config file, for the error messages
+*
+*  Return value:
+*
+*  Number of errors found
+*/
+static int check_config(Config *config, char *file_name) {
+
+    int number_of_errors = 0;
+
+    if (!is_valid_uuid(config->uuid)) {
+        fprintf(stderr, "%s: uuid is not 32 hexadecimal digits\n",
+                file_name);
+        number_of_errors++;
+    }
+
+    if (config->location_url[0] != '\0' &&
+        strncmp(config->location_url, "http://", 7) != 0 &&
+        strncmp(config->location_url, "https://", 8) != 0) {
+        fprintf(stderr, "%s: location_url is not an http or https URL\n",
+                file_name);
+        number_of_errors++;
+    }
+
+    if (config->minimum_advertising_interval >
+        config->maximum_advertising_interval) {
+        fprintf(stderr, "%s: minimum_advertising_interval is above "
+                "maximum_advertising_interval\n", file_name);
+        number_of_errors++;
+    }
+
+    if (config->minimum_tx_power > config->maximum_tx_power) {
+        fprintf(stderr, "%s: minimum_tx_power is above maximum_tx_power\n",
+                file_name);
+        number_of_errors++;
+    }
+
+    return number_of_errors;
+}
+
+
+/*
+*  config_load:
+*
+*  This function reads a config file. Each line holds a key, an equal
+*  sign and a value; blank lines and lines starting with # are skipped.
+*  Every error of the file is reported on stderr with its line, and the
+*  config is only valid when there is none.
+*
+*  Parameters:
+*
+*  config - the config to fill
+*  file_name - name of the config file
+*
+*  Return value:
+*
+*  0 - success
+*  -1 - the file could not be opened or holds errors
+*/
+int config_load(Config *config, char *file_name) {
+
+    char line[CONFIG_LINE_LENGTH]; /* Line being read */
+    bool is_set[NUMBER_OF_CONFIG_KEYS]; /* Keys found in the file */
+    const ConfigKey *key;
+    char *name;
+    char *value;
+    char *delimiter;
+    int line_number = 0;
+    int number_of_errors = 0;
+    int key_id;
+    FILE *file;
+
+    memset(config, 0, sizeof(Config));
+    memset(is_set, 0, sizeof(is_set));
+
+    for (key_id = 0; key_id < NUMBER_OF_CONFIG_KEYS; key_id++) {
+
+        key = &config_keys[key_id];
+
+        if (key->default_value != NULL) {
+            parse_value(config, key, key->default_value);
+        }
+
+    }
+
+    file = fopen(file_name, "r");
+
+    if (file == NULL) {
+
+        /* Error handling */
+        perror(file_name);
+        return -1;
+
+    }
+
+    while (fgets(line, sizeof(line), file) != NULL) {
+
+        line_number++;
+
+        if (strchr(line, '\n') == NULL && !feof(file)) {
+
+            fprintf(stderr, "%s:%d: line is too long\n", file_name,
+                    line_number);
+            number_of_errors++;
+
+            /* Skip the rest of the line */
+            while (fgets(line, sizeof(line), file) != NULL &&
+                   strchr(line, '\n') == NULL) {
+            }
+            continue;
+
+        }
+
+        name = trim(line);
+
+        if (*name == '\0' || *name == CONFIG_COMMENT) {
+            continue;
+        }
+
+        delimiter = strchr(name, CONFIG_DELIMITER);
+
+        if (delimiter == NULL) {
+            fprintf(stderr, "%s:%d: missing %c\n", file_name, line_number,
+                    CONFIG_DELIMITER);
+            number_of_errors++;
+            continue;
+        }
+
+        *delimiter = '\0';
+        name = trim(name);
+        value = trim(delimiter + 1);
+
+        for (key_id = 0; key_id < NUMBER_OF_CONFIG_KEYS; key_id++) {
+            if (strcmp(config_keys[key_id].name, name) == 0) {
+                break;
+            }
+        }
+
+        if (key_id == NUMBER_OF_CONFIG_KEYS) {
+            fprintf(stderr, "%s:%d: unknown key %s\n", file_name,
+                    line_number, name);
+            number_of_errors++;
+            continue;
+        }
+
+        key = &config_keys[key_id];
+
+        if (is_set[key_id]) {
+            fprintf(stderr, "%s:%d: %s is set twice\n", file_name,
+                    line_number, name);
+            number_of_errors++;
+            continue;
+        }
+
+        is_set[key_id] = true;
+
+        if (parse_value(config, key, value) != 0) {
+
+            if (key->type == CONFIG_STRING) {
+                fprintf(stderr, "%s:%d: %s must have %g to %g characters\n",
+                        file_name, line_number, name, key->minimum,
+                        key->maximum);
+            }
+            else {
+                fprintf(stderr, "%s:%d: %s must be a number from %g to "
+                        "%g\n", file_name, line_number, name, key->minimum,
+                        key->maximum);
+            }
+            number_of_errors++;
+
+        }
+
+    }
+
+    fclose(file);
+
+    for (key_id = 0; key_id < NUMBER_OF_CONFIG_KEYS; key_id++) {
+
+        if (!is_set[key_id] && config_keys[key_id].default_value == NULL) {
+            fprintf(stderr, "%s: %s is missing\n", file_name,
+                    config_keys[key_id].name);
+            number_of_errors++;
+        }
+
+    }
+
+    /* The coverage is a signal strength, also written without its sign */
+    if (config->rssi_coverage > 0) {
+        config->rssi_coverage = -config->rssi_coverage;
+    }
+
+    number_of_errors += check_config(config, file_name);
+
+    if (number_of_errors > 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/*
+*  config_store_init:
+*
+*  This function loads the config used at startup.
+*
+*  Parameters:
+*
+*  store - the store
+*  file_name - name of the config file
+*
+*  Return value:
+*
+*  0 - success
+*  -1 - the config file is invalid or memory allocation failed
+*/
+int config_store_init(ConfigStore *store, char *file_name) {
+
+    memset(store, 0, sizeof(ConfigStore));
+
+    store->current = (Config *)malloc(sizeof(Config));
+
+    if (store->current == NULL) {
+
+        /* Error handling */
+        perror("Failed to allocate memory");
+        return -1;
+
+    }
+
+    if (config_load(store->current, file_name) != 0) {
+        free(store->current);
+        store->current = NULL;
+        return -1;
+    }
+
+    pthread_mutex_init(&store->lock, NULL);
+
+    return 0;
+}
+
+
+/*
+*  config_store_get:
+*
+*  This function returns the config in use. It stays valid until the
+*  store is freed, but a reload may replace it by a newer one.
+*
+*  Parameters:
+*
+*  store - the store
+*
+*  Return value:
+*
+*  The config in use
+*/
+Config *config_store_get(ConfigStore *store) {
+
+    return __atomic_load_n(&store->current, __ATOMIC_ACQUIRE);
+}
+
+
+/*
+*  config_store_reload:
+*
+*  This function reads the config file again and swaps the new config in
+*  when it is valid. Keys that cannot change while the LBeacon runs keep
+*  their value, with a message. An invalid file leaves the config in use.
+*
+*  Parameters:
+*
+*  store - the store
+*  file_name - name of the config file
+*
+*  Return value:
+*
+*  0 - the new config is in use
+*  -1 - the config file is invalid or memory allocation failed
+*/
+int config_store_reload(ConfigStore *store, char *file_name) {
+
+    Config *config;
+    Config **retired;
+    const ConfigKey *key;
+    char *old_field;
+    char *new_field;
+    int key_id;
+
+    pthread_mutex_lock(&store->lock);
+
+    config = (Config *)malloc(sizeof(Config));
+    retired = (Config **)realloc(store->retired,
+                                 (store->number_of_retired + 1) *
+                                 sizeof(Config *));
+
+    if (retired != NULL) {
+        store->retired = retired;
+    }
+
+    if (config == NULL || retired == NULL) {
+
+        /* Error handling */
+        perror("Failed to allocate memory");
+        free(config);
+        store->number_of_rejected++;
+        pthread_mutex_unlock(&store->lock);
+        return -1;
+
+    }
+
+    if (config_load(config, file_name) != 0) {
+
+        printf("Keeping the config in use\n");
+        free(config);
+        store->number_of_rejected++;
+        pthread_mutex_unlock(&store->lock);
+        return -1;
+
+    }
+
+    for (key_id = 0; key_id < NUMBER_OF_CONFIG_KEYS; key_id++) {
+
+        key = &config_keys[key_id];
+        old_field = (char *)store->current + key->offset;
+        new_field = (char *)config + key->offset;
+
+        if (!key->is_reloadable &&
+            memcmp(old_field, new_field, get_field_size(key)) != 0) {
+            printf("%s only changes on restart\n", key->name);
+            memcpy(new_field, old_field, get_field_size(key));
+        }
+
+    }
+
+    store->retired[store->number_of_retired] = store->current;
+    store->number_of_retired++;
+    __atomic_store_n(&store->current, config, __ATOMIC_RELEASE);
+    store->number_of_reloads++;
+
+    pthread_mutex_unlock(&store->lock);
+
+    return 0;
+}
+
+
+/*
+*  config_store_print_statistics:
+*
+*  This function prints the number of reloads of the config.
+*
+*  Parameters:
+*
+*  store - the store
+*
+*  Return value:
+*
+*  None
+*/
+void config_store_print_statistics(ConfigStore *store) {
+
+    pthread_mutex_lock(&store->lock);
+    printf("Config: %lld reloads, %lld rejected\n", store->number_of_reloads,
+           store->number_of_rejected);
+    pthread_mutex_unlock(&store->lock);
+}
+
+
+/*
+*  config_store_free:
+*
+*  This function frees the config in use and the configs it replaced.
+*
+*  Parameters:
+*
+*  store - the store
+*
+*  Return value:
+*
+*  None
+*/
+void config_store_free(ConfigStore *store) {
+
+    int config_id;
+
+    if (store->current == NULL) {
+        return;
+    }
+
+    for (config_id = 0; config_id < store->number_of_retired; config_id++) {
+        free(store->retired[config_id]);
+    }
+
+    free(store->retired);
+    free(store->current);
+    store->current = NULL;
+    pthread_mutex_destroy(&store->lock);
+}
@@ -0,0 +1,194 @@
+/*
+* Copyright (c) 2016 Academia Sinica, Institute of Information Science
+*
+* License:
+*
+*      GPL 3.0 : The content of this file is subject to the terms and
+*      conditions defined in file 'COPYING.txt', which is part of this source
+*      code package.
+*
+* Project Name:
+*
+*      BeDIPS
+*
+* File Description:
+*
+*      This header file contains the function declarations and variables used
+*      in the Config.c file.
+*
+* File Name:
+*
+*      Config.h
+*
+* Abstract:
+*
+*      BeDIPS uses LBeacons to deliver 3D coordinates and textual
+*      descriptions of their locations to users' devices. Basically, a LBeacon
+*      is an inexpensive, Bluetooth Smart Ready device. The 3D coordinates and
+*      location description of every LBeacon are retrieved from BeDIS
+*      (Building/environment Data and Information System) and stored locally
+*      during deployment and maintenance times. Once initialized, each LBeacon
+*      broadcasts its coordinates and location description to Bluetooth
+*      enabled user devices within its coverage area.
+*
+* Authors:
+*
+*      Jake Lee, jakelee@iis.sinica.edu.tw
+*      Johnson Su, johnsonsu@iis.sinica.edu.tw
+*      Shirley Huang, shirley.huang.93@gmail.com
+*      Han Hu, hhu14@illinois.edu
+*      Jeffrey Lin, lin.jeff03@gmail.com
+*      Howard Hsu, haohsu0823@gmail.com
+*      Han Wang, hollywang@iis.sinica.edu.tw
+*/
+
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <ctype.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+/*
+* CONSTANTS
+*/
+
+/* Maximum number of characters of a string value and of a line of the
+ * config file */
+#define CONFIG_BUFFER_SIZE 64
+#define CONFIG_LINE_LENGTH 256
+
+/* Character separating the key from the value and starting a comment */
+#define CONFIG_DELIMITER '='
+#define CONFIG_COMMENT '#'
+
+
+
+/*
+* TYPEDEF STRUCTS
+*/
+
+/* Type of the value of a key */
+typedef enum ConfigType {
+    CONFIG_INTEGER,
+    CONFIG_FLOAT,
+    CONFIG_REAL,
+    CONFIG_STRING
+} ConfigType;
+
+
+/* A key of the config file and the field of the Config struct it sets */
+typedef struct ConfigKey {
+    /* Name of the key in the config file */
+    char *name;
+
+    ConfigType type;
+
+    /* Offset of the field in the Config struct */
+    size_t offset;
+
+    /* Bounds of a number, or of the length of a string */
+    double minimum;
+    double maximum;
+
+    /* Value used when the key is missing, NULL if the key is required */
+    char *default_value;
+
+    /* Whether a reload may change the value; other keys keep the value
+     * they had at startup */
+    bool is_reloadable;
+} ConfigKey;
+
+
+/* Settings of the beacon read from the config file. Every value is parsed
+ * and checked once, so the code using it never converts text. */
+typedef struct Config {
+    /* Coordinates of the beacon location */
+    float coordinate_X;
+    float coordinate_Y;
+    float coordinate_Z;
+
+    /* Name and directory of the message file pushed by default */
+    char file_name[CONFIG_BUFFER_SIZE];
+    char file_path[CONFIG_BUFFER_SIZE];
+
+    /* Maximum number of devices handled at once by all push dongles */
+    int maximum_number_of_devices;
+
+    /* Number of message groups and of messages */
+    int number_of_groups;
+    int number_of_messages;
+
+    /* Number of push dongles */
+    int number_of_push_dongles;
+
+    /* Signal strength in dBm a device needs to be pushed a message */
+    int rssi_coverage;
+
+    /* Universally unique identifier of the beacon */
+    char uuid[CONFIG_BUFFER_SIZE];
+
+    /* URL of the description of the location, empty if none */
+    char location_url[CONFIG_BUFFER_SIZE];
+
+    /* Bounds in milliseconds of the advertising interval */
+    int minimum_advertising_interval;
+    int maximum_advertising_interval;
+
+    /* Bounds in dBm of the TX power of the advertising sets */
+    int minimum_tx_power;
+    int maximum_tx_power;
+
+    /* Inquiry results per second calling for the shortest interval */
+    double full_discovery_rate;
+
+    /* Fraction below a threshold the discovery rate falls to before the
+     * advertising level goes down, and time in milliseconds a level is
+     * held at least */
+    double advertising_hysteresis;
+    int advertising_hold_time;
+
+    /* Time in milliseconds between two snapshots of the state */
+    int state_snapshot_interval;
+} Config;
+
+
+/* The config in use. Readers take the current config without a lock; a
+ * reload swaps in a new config, and the configs it replaces are kept
+ * until the store is freed because threads may still be reading them. */
+typedef struct ConfigStore {
+    /* Config in use, read and swapped atomically */
+    Config *current;
+
+    /* Configs replaced by reloads */
+    Config **retired;
+    int number_of_retired;
+
+    /* Number of reloads swapped in and rejected */
+    long long number_of_reloads;
+    long long number_of_rejected;
+
+    /* Lock serializing reloads */
+    pthread_mutex_t lock;
+} ConfigStore;
+
+
+
+/*
+* FUNCTIONS
+*/
+
+int config_load(Config *config, char *file_name);
+int config_store_init(ConfigStore *store, char *file_name);
+Config *config_store_get(ConfigStore *store);
+int config_store_reload(ConfigStore *store, char *file_name);
+void config_store_print_statistics(ConfigStore *store);
+void config_store_free(ConfigStore *store);
+
+#endif
@@ -0,0 +1,1042 @@
+/*
+* Copyright (c) 2016 Academia Sinica, Institute of Information Science
+*
+* License:
+*
+*      GPL 3.0 : The content of this file is subject to the terms and
+*      conditions defined in file 'COPYING.txt', which is part of this source
+*      code package.
+*
+* Project Name:
+*
+*      BeDIPS
+*
+* File Description:
+*
+*      This file contains the HCI backend simulating a crowd of devices
+*      walking past the beacon. It answers the inquiries of the scanner with
+*      the inquiry results of the devices in the area, and measures how long
+*      the devices wait for their push and how many of them get one.
+*
+* File Name:
+*
+*      CrowdSimulator.c
+*
+* Abstract:
+*
+*      BeDIPS uses LBeacons to deliver 3D coordinates and textual
+*      descriptions of their locations to users' devices. Basically, a LBeacon
+*      is an inexpensive, Bluetooth Smart Ready device. The 3D coordinates and
+*      location description of every LBeacon are retrieved from BeDIS
+*      (Building/environment Data and Information System) and stored locally
+*      during deployment and maintenance times. Once initialized, each LBeacon
+*      broadcasts its coordinates and location description to Bluetooth
+*      enabled user devices within its coverage area.
+*
+* Authors:
+*
+*      Jake Lee, jakelee@iis.sinica.edu.tw
+*      Johnson Su, johnsonsu@iis.sinica.edu.tw
+*      Shirley Huang, shirley.huang.93@gmail.com
+*      Han Hu, hhu14@illinois.edu
+*      Jeffrey Lin, lin.jeff03@gmail.com
+*      Howard Hsu, haohsu0823@gmail.com
+*      Han Wang, hollywang@iis.sinica.edu.tw
+*/
+
+
+#include "CrowdSimulator.h"
+
+
+/* State of the simulator backend */
+static CrowdSimulator crowd = {0};
+
+
+/*
+*  get_time_in_microseconds:
+*
+*  This helper function returns the wall clock time in microseconds.
+*
+*  Parameters:
+*
+*  None
+*
+*  Return value:
+*
+*  Current time in microseconds
+*/
+static long long get_time_in_microseconds() {
+
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+
+    return (long long)now.tv_sec * 1000000 + now.tv_usec;
+}
+
+
+/*
+*  get_simulated_time:
+*
+*  This helper function converts a wall clock time into simulated time.
+*
+*  Parameters:
+*
+*  wall_time - wall clock time in microseconds
+*
+*  Return value:
+*
+*  Simulated time in seconds
+*/
+static double get_simulated_time(long long wall_time) {
+
+    return (wall_time - crowd.start_time) * crowd.speed / 1000000.0;
+}
+
+
+/*
+*  draw_uniform:
+*
+*  This helper function draws a random number in (0, 1).
+*
+*  Parameters:
+*
+*  None
+*
+*  Return value:
+*
+*  The random number
+*/
+static double draw_uniform() {
+
+    return (rand_r(&crowd.seed) + 1.0) / (RAND_MAX + 2.0);
+}
+
+
+/*
+*  draw_gaussian:
+*
+*  This helper function draws a random number from the standard normal
+*  distribution with the Box-Muller transform.
+*
+*  Parameters:
+*
+*  None
+*
+*  Return value:
+*
+*  The random number
+*/
+static double draw_gaussian() {
+
+    return sqrt(-2 * log(draw_uniform())) * cos(2 * M_PI * draw_uniform());
+}
+
+
+/*
+*  compute_rssi:
+*
+*  This function computes the RSSI of a device at a given time from its
+*  distance to the beacon with the log-distance path loss model, plus a
+*  random shadowing.
+*
+*  Parameters:
+*
+*  device - the device
+*  time - simulated time in seconds
+*
+*  Return value:
+*
+*  RSSI in dBm
+*/
+static int compute_rssi(SimulatedDevice *device, double time) {
+
+    double x = device->entry_x +
+               device->velocity_x * (time - device->arrival_time);
+    double y = device->entry_y +
+               device->velocity_y * (time - device->arrival_time);
+    double distance = sqrt(x * x + y * y);
+    double rssi;
+
+    if (distance < 1) {
+        distance = 1;
+    }
+
+    rssi = SIMULATOR_RSSI_AT_ONE_METER -
+           10 * SIMULATOR_PATH_LOSS_EXPONENT * log10(distance) +
+           SIMULATOR_SHADOWING * draw_gaussian();
+
+    if (rssi < -127) {
+        rssi = -127;
+    }
+
+    if (rssi > 20) {
+        rssi = 20;
+    }
+
+    return (int)lround(rssi);
+}
+
+
+/*
+*  compare_results:
+*
+*  This helper function orders inquiry results by time for qsort.
+*
+*  Parameters:
+*
+*  first - the first result
+*  second - the second result
+*
+*  Return value:
+*
+*  A negative, zero or positive value as first is due before, with or
+*  after second
+*/
+static int compare_results(const void *first, const void *second) {
+
+    double first_time = ((SimulatedResult *)first)->due_time;
+    double second_time = ((SimulatedResult *)second)->due_time;
+
+    return (first_time > second_time) - (first_time < second_time);
+}
+
+
+/*
+*  start_inquiry:
+*
+*  This function starts an inquiry at the given time. Every device in the
+*  area during the inquiry is found at most once, at a random time while
+*  both last, like a controller reports each device once per inquiry. When
+*  the inquiry would start after the last device has left, the stream ends.
+*
+*  Parameters:
+*
+*  start_time - simulated time in seconds at which the inquiry starts
+*
+*  Return value:
+*
+*  None
+*/
+static void start_inquiry(double start_time) {
+
+    SimulatedDevice *device;
+    double end_time = start_time + crowd.inquiry_length;
+    double from_time;
+    double to_time;
+    int device_id;
+
+    crowd.number_of_results = 0;
+    crowd.next_result = 0;
+
+    if (start_time > crowd.end_time) {
+        crowd.is_inquiring = false;
+        crowd.finished = true;
+        return;
+    }
+
+    for (device_id = 0; device_id < crowd.number_of_devices; device_id++) {
+
+        device = &crowd.devices[device_id];
+
+        /* The devices are sorted by arrival time */
+        if (device->arrival_time >= end_time) {
+            break;
+        }
+
+        if (device->departure_time <= start_time ||
+            draw_uniform() > SIMULATOR_DISCOVERY_PROBABILITY) {
+            continue;
+        }
+
+        from_time = device->arrival_time > start_time ?
+                    device->arrival_time : start_time;
+        to_time = device->departure_time < end_time ?
+                  device->departure_time : end_time;
+
+        crowd.results[crowd.number_of_results].due_time =
+            from_time + (to_time - from_time) * draw_uniform();
+        crowd.results[crowd.number_of_results].device_id = device_id;
+        crowd.number_of_results++;
+
+    }
+
+    qsort(crowd.results, crowd.number_of_results, sizeof(SimulatedResult),
+          compare_results);
+
+    crowd.is_inquiring = true;
+    crowd.inquiry_start_time = start_time;
+    crowd.inquiry_end_time = end_time;
+}
+
+
+/*
+*  simulator_next_event:
+*
+*  This function builds the next event of the controller and stores it as
+*  the pending event together with the time at which it is due: the answer
+*  to the last command, the next inquiry result whose RSSI is within the
+*  sensitivity, or the end of the inquiry. In periodic inquiry mode the
+*  end of an inquiry schedules the next one after a random period.
+*
+*  Parameters:
+*
+*  None
+*
+*  Return value:
+*
+*  true - an event is pending
+*  false - no inquiry is running or the stream has ended
+*/
+static bool simulator_next_event() {
+
+    unsigned char *packet = crowd.pending;
+    inquiry_info_with_rssi *info;
+    SimulatedResult *result;
+    SimulatedDevice *device;
+    double due_time;
+    int rssi;
+
+    if (0 < crowd.command_event_length) {
+
+        memcpy(packet, crowd.command_event, crowd.command_event_length);
+        crowd.pending_length = crowd.command_event_length;
+        crowd.pending_due_time = 0;
+        crowd.command_event_length = 0;
+        return true;
+
+    }
+
+    if (crowd.is_inquiring == false || crowd.finished == true) {
+        return false;
+    }
+
+    while (crowd.next_result < crowd.number_of_results) {
+
+        result = &crowd.results[crowd.next_result];
+        device = &crowd.devices[result->device_id];
+        crowd.next_result++;
+        rssi = compute_rssi(device, result->due_time);
+
+        if (rssi < SIMULATOR_SENSITIVITY) {
+            continue;
+        }
+
+        /* The scanner pushes to the devices above the threshold, so the
+         * first of those results is when the device is discovered */
+        if (rssi > crowd.rssi_threshold && device->discovery_time < 0) {
+            device->discovery_time = result->due_time;
+        }
+
+        packet[0] = HCI_EVENT_PKT;
+        packet[1] = EVT_INQUIRY_RESULT_WITH_RSSI;
+        packet[2] = 1 + sizeof(inquiry_info_with_rssi);
+        packet[3] = 1;
+
+        info = (inquiry_info_with_rssi *)(packet + 4);
+        memset(info, 0, sizeof(inquiry_info_with_rssi));
+        bacpy(&info->bdaddr, &device->address);
+        info->pscan_rep_mode = 0x01;
+        info->rssi = (int8_t)rssi;
+
+        crowd.pending_length = 3 + packet[2];
+        due_time = result->due_time;
+        crowd.number_of_results_sent++;
+
+        crowd.pending_due_time = crowd.start_time +
+                                 (long long)(due_time * 1000000 / crowd.speed);
+        return true;
+
+    }
+
+    packet[0] = HCI_EVENT_PKT;
+    packet[1] = EVT_INQUIRY_COMPLETE;
+    packet[2] = 1;
+    packet[3] = 0;
+    crowd.pending_length = 4;
+    due_time = crowd.inquiry_end_time;
+    crowd.is_inquiring = false;
+
+    if (crowd.is_periodic == true) {
+        start_inquiry(crowd.inquiry_start_time + crowd.minimum_period +
+                      (crowd.maximum_period - crowd.minimum_period) *
+                      draw_uniform());
+    }
+
+    crowd.pending_due_time = crowd.start_time +
+                             (long long)(due_time * 1000000 / crowd.speed);
+
+    return true;
+}
+
+
+/*
+*  crowd_simulator_configure:
+*
+*  This function generates the crowd played by the simulator backend. The
+*  arrival rate grows linearly from 0 to arrival_rate, so the n devices
+*  arrive during 2 * n / arrival_rate seconds. Each device walks from a
+*  random point of the edge of the area through a random point of its
+*  inner half to the opposite edge.
+*
+*  Parameters:
+*
+*  number_of_devices - number of devices of the whole run
+*  arrival_rate - arrival rate in devices per second at the end
+*  mean_dwell_time - mean time in seconds a device stays in the area
+*  speed - simulation speed, 1.0 is real time
+*  rssi_threshold - RSSI above which the scanner pushes to a device
+*
+*  Return value:
+*
+*  0 - success
+*  -1 - invalid settings or out of memory
+*/
+int crowd_simulator_configure(int number_of_devices, double arrival_rate,
+                              double mean_dwell_time, double speed,
+                              int rssi_threshold) {
+
+    SimulatedDevice *device;
+    double ramp_time = 2.0 * number_of_devices / arrival_rate;
+    double cumulative = 0; /* Arrivals of a unit rate Poisson process */
+    double dwell_time;
+    double angle;
+    double radius;
+    double direction_x;
+    double direction_y;
+    double length;
+    int device_id;
+
+    if (0 >= number_of_devices || 0 >= arrival_rate ||
+        0 >= mean_dwell_time || 0 >= speed ||
+        number_of_devices >= (1 << 24)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    crowd.devices = calloc(number_of_devices, sizeof(SimulatedDevice));
+    crowd.results = calloc(number_of_devices, sizeof(SimulatedResult));
+
+    if (NULL == crowd.devices || NULL == crowd.results) {
+        free(crowd.devices);
+        free(crowd.results);
+        crowd.devices = NULL;
+        crowd.results = NULL;
+        return -1;
+    }
+
+    crowd.number_of_devices = number_of_devices;
+    crowd.arrival_rate = arrival_rate;
+    crowd.mean_dwell_time = mean_dwell_time;
+    crowd.speed = speed;
+    crowd.rssi_threshold = rssi_threshold;
+    crowd.seed = SIMULATOR_SEED;
+    crowd.end_time = 0;
+    pthread_mutex_init(&crowd.lock, NULL);
+
+    crowd.crowd_bucket_width =
+        (int)ceil(arrival_rate * mean_dwell_time / SIMULATOR_CROWD_BUCKETS);
+
+    if (crowd.crowd_bucket_width < 1) {
+        crowd.crowd_bucket_width = 1;
+    }
+
+    for (device_id = 0; device_id < number_of_devices; device_id++) {
+
+        device = &crowd.devices[device_id];
+
+        /* Addresses 00:1A:7D:xx:xx:xx hold the index of the device */
+        device->address.b[0] = device_id & 0xff;
+        device->address.b[1] = (device_id >> 8) & 0xff;
+        device->address.b[2] = (device_id >> 16) & 0xff;
+        device->address.b[3] = 0x7d;
+        device->address.b[4] = 0x1a;
+        device->address.b[5] = 0x00;
+
+        /* The cumulative rate of the ramp is arrival_rate * t^2 /
+         * (2 * ramp_time), inverting it maps unit rate arrivals to the
+         * arrivals of the ramp */
+        cumulative -= log(draw_uniform());
+        device->arrival_time = sqrt(2 * ramp_time * cumulative /
+                                    arrival_rate);
+
+        dwell_time = -mean_dwell_time * log(draw_uniform());
+
+        if (dwell_time < SIMULATOR_MINIMUM_DWELL_TIME) {
+            dwell_time = SIMULATOR_MINIMUM_DWELL_TIME;
+        }
+
+        device->departure_time = device->arrival_time + dwell_time;
+
+        angle = 2 * M_PI * draw_uniform();
+        device->entry_x = SIMULATOR_AREA_RADIUS * cos(angle);
+        device->entry_y = SIMULATOR_AREA_RADIUS * sin(angle);
+
+        angle = 2 * M_PI * draw_uniform();
+        radius = SIMULATOR_AREA_RADIUS / 2 * sqrt(draw_uniform());
+        direction_x = radius * cos(angle) - device->entry_x;
+        direction_y = radius * sin(angle) - device->entry_y;
+        length = sqrt(direction_x * direction_x + direction_y * direction_y);
+        direction_x /= length;
+        direction_y /= length;
+
+        /* Length of the chord from the entry point along the direction */
+        length = -2 * (device->entry_x * direction_x +
+                       device->entry_y * direction_y);
+
+        device->velocity_x = direction_x * length / dwell_time;
+        device->velocity_y = direction_y * length / dwell_time;
+        device->discovery_time = -1;
+        device->push_time = -1;
+
+        if (device->departure_time > crowd.end_time) {
+            crowd.end_time = device->departure_time;
+        }
+
+    }
+
+    return 0;
+}
+
+
+/*
+*  crowd_simulator_record_push:
+*
+*  This function records a successful push to a simulated device.
+*
+*  Parameters:
+*
+*  address - address of the device
+*  now - wall clock time in milliseconds of the end of the push
+*
+*  Return value:
+*
+*  None
+*/
+void crowd_simulator_record_push(bdaddr_t *address, long long now) {
+
+    SimulatedDevice *device;
+    int device_id = address->b[0] | (address->b[1] << 8) |
+                    (address->b[2] << 16);
+
+    if (NULL == crowd.devices || device_id >= crowd.number_of_devices) {
+        return;
+    }
+
+    device = &crowd.devices[device_id];
+
+    if (bacmp(address, &device->address) != 0) {
+        return;
+    }
+
+    pthread_mutex_lock(&crowd.lock);
+
+    if (device->push_time < 0) {
+
+        device->push_time = get_simulated_time(now * 1000);
+
+        if (device->push_time > device->departure_time) {
+            crowd.number_of_late_pushes++;
+        }
+
+    }
+
+    pthread_mutex_unlock(&crowd.lock);
+}
+
+
+/*
+*  crowd_simulator_record_queue_depth:
+*
+*  This function records the number of devices waiting for a push, grouped
+*  by the number of devices in the area at the time.
+*
+*  Parameters:
+*
+*  depth - number of devices waiting for a push
+*
+*  Return value:
+*
+*  None
+*/
+void crowd_simulator_record_queue_depth(int depth) {
+
+    double now = get_simulated_time(get_time_in_microseconds());
+    int crowd_size = 0;
+    int bucket;
+    int device_id;
+
+    if (NULL == crowd.devices) {
+        return;
+    }
+
+    for (device_id = 0; device_id < crowd.number_of_devices; device_id++) {
+
+        if (crowd.devices[device_id].arrival_time > now) {
+            break;
+        }
+
+        if (crowd.devices[device_id].departure_time > now) {
+            crowd_size++;
+        }
+
+    }
+
+    bucket = crowd_size / crowd.crowd_bucket_width;
+
+    if (bucket >= SIMULATOR_CROWD_BUCKETS) {
+        bucket = SIMULATOR_CROWD_BUCKETS - 1;
+    }
+
+    pthread_mutex_lock(&crowd.lock);
+
+    crowd.number_of_samples[bucket]++;
+    crowd.total_depth[bucket] += depth;
+
+    if (depth > crowd.maximum_depth[bucket]) {
+        crowd.maximum_depth[bucket] = depth;
+    }
+
+    pthread_mutex_unlock(&crowd.lock);
+}
+
+
+/*
+*  compare_times:
+*
+*  This helper function orders latencies for qsort.
+*
+*  Parameters:
+*
+*  first - the first latency
+*  second - the second latency
+*
+*  Return value:
+*
+*  A negative, zero or positive value as first is shorter than, equal to or
+*  longer than second
+*/
+static int compare_times(const void *first, const void *second) {
+
+    double first_time = *(double *)first;
+    double second_time = *(double *)second;
+
+    return (first_time > second_time) - (first_time < second_time);
+}
+
+
+/*
+*  crowd_simulator_print_report:
+*
+*  This function prints how many devices came within range and how many of
+*  them were pushed before they left, the time from their discovery to the
+*  end of their push, and the depth of the queues for each crowd size.
+*
+*  Parameters:
+*
+*  None
+*
+*  Return value:
+*
+*  None
+*/
+void crowd_simulator_print_report() {
+
+    SimulatedDevice *device;
+    double *latencies;
+    int number_of_discovered = 0;
+    int number_of_served = 0;
+    int device_id;
+    int bucket;
+
+    if (NULL == crowd.devices) {
+        return;
+    }
+
+    latencies = malloc(crowd.number_of_devices * sizeof(double));
+
+    if (NULL == latencies) {
+        return;
+    }
+
+    pthread_mutex_lock(&crowd.lock);
+
+    for (device_id = 0; device_id < crowd.number_of_devices; device_id++) {
+
+        device = &crowd.devices[device_id];
+
+        if (device->discovery_time < 0) {
+            continue;
+        }
+
+        number_of_discovered++;
+
+        if (device->push_time >= device->discovery_time &&
+            device->push_time <= device->departure_time) {
+            latencies[number_of_served++] =
+                device->push_time - device->discovery_time;
+        }
+
+    }
+
+    printf("Crowd simulation: %d devices, %d within range, %d served "
+           "(%.1f%%), %lld pushed after leaving, %lld inquiry results\n",
+           crowd.number_of_devices, number_of_discovered, number_of_served,
+           number_of_discovered > 0 ?
+           100.0 * number_of_served / number_of_discovered : 0,
+           crowd.number_of_late_pushes, crowd.number_of_results_sent);
+
+    if (number_of_served > 0) {
+
+        qsort(latencies, number_of_served, sizeof(double), compare_times);
+        printf("  discovery to push: 50%% %.0f ms, 90%% %.0f ms, "
+               "99%% %.0f ms, maximum %.0f ms\n",
+               1000 * latencies[number_of_served / 2],
+               1000 * latencies[number_of_served * 9 / 10],
+               1000 * latencies[number_of_served * 99 / 100],
+               1000 * latencies[number_of_served - 1]);
+
+    }
+
+    for (bucket = 0; bucket < SIMULATOR_CROWD_BUCKETS; bucket++) {
+
+        if (crowd.number_of_samples[bucket] == 0) {
+            continue;
+        }
+
+        printf("  %d to %d devices in the area: waiting pushes average "
+               "%.1f, maximum %d\n", bucket * crowd.crowd_bucket_width,
+               bucket == SIMULATOR_CROWD_BUCKETS - 1 ?
+               crowd.number_of_devices :
+               (bucket + 1) * crowd.crowd_bucket_width - 1,
+               (double)crowd.total_depth[bucket] /
+               crowd.number_of_samples[bucket],
+               crowd.maximum_depth[bucket]);
+
+    }
+
+    pthread_mutex_unlock(&crowd.lock);
+
+    free(latencies);
+}
+
+
+/*
+*  crowd_simulator_free:
+*
+*  This function releases the devices of the simulated crowd.
+*
+*  Parameters:
+*
+*  None
+*
+*  Return value:
+*
+*  None
+*/
+void crowd_simulator_free() {
+
+    free(crowd.devices);
+    free(crowd.results);
+    crowd.devices = NULL;
+    crowd.results = NULL;
+}
+
+
+/*
+*  simulator_open_dev:
+*
+*  This function starts the simulated clock the first time the scanner
+*  opens the device. Once the crowd has left, it fails so the scanner
+*  stops.
+*
+*  Parameters:
+*
+*  dongle_device_id - ignored
+*
+*  Return value:
+*
+*  SIMULATOR_HANDLE - success, negative on error
+*/
+static int simulator_open_dev(int dongle_device_id) {
+
+    if (NULL == crowd.devices || crowd.finished == true) {
+        errno = ENODEV;
+        return -1;
+    }
+
+    if (0 == crowd.start_time) {
+        crowd.start_time = get_time_in_microseconds();
+    }
+
+    crowd.is_inquiring = false;
+    crowd.is_periodic = false;
+    crowd.command_event_length = 0;
+    crowd.pending_length = 0;
+
+    return SIMULATOR_HANDLE;
+}
+
+
+/*
+*  simulator_set_filter:
+*
+*  The simulator only produces the events of interest, so there is nothing
+*  to filter.
+*
+*  Parameters:
+*
+*  handle - ignored
+*  filter - ignored
+*
+*  Return value:
+*
+*  0 - success
+*/
+static int simulator_set_filter(int handle, struct hci_filter *filter) {
+
+    return 0;
+}
+
+
+/*
+*  simulator_write_inquiry_mode:
+*
+*  The simulated controller always reports the RSSI.
+*
+*  Parameters:
+*
+*  handle - ignored
+*  mode - ignored
+*  timeout - ignored
+*
+*  Return value:
+*
+*  0 - success
+*/
+static int simulator_write_inquiry_mode(int handle, uint8_t mode,
+                                        int timeout) {
+
+    return 0;
+}
+
+
+/*
+*  simulator_send_cmd:
+*
+*  This function starts and stops the inquiries like a controller, and
+*  prepares the command status or command complete event answering an
+*  inquiry or periodic inquiry command. Other commands are accepted and
+*  dropped.
+*
+*  Parameters:
+*
+*  handle - ignored
+*  ogf - command group
+*  ocf - command
+*  plen - length of the parameters
+*  param - parameters of the command
+*
+*  Return value:
+*
+*  0 - success
+*/
+static int simulator_send_cmd(int handle, uint16_t ogf, uint16_t ocf,
+                              uint8_t plen, void *param) {
+
+    unsigned char *event = crowd.command_event;
+    uint16_t opcode = htobs(cmd_opcode_pack(ogf, ocf));
+    double now = get_simulated_time(get_time_in_microseconds());
+    inquiry_cp *inquiry_copy;
+    periodic_inquiry_cp *periodic_inquiry_copy;
+
+    if (OGF_LINK_CTL != ogf) {
+        return 0;
+    }
+
+    switch (ocf) {
+
+        case OCF_INQUIRY:
+
+            inquiry_copy = param;
+            crowd.is_periodic = false;
+            crowd.inquiry_length =
+                inquiry_copy->length * SIMULATOR_INQUIRY_UNIT;
+
+            event[0] = HCI_EVENT_PKT;
+            event[1] = EVT_CMD_STATUS;
+            event[2] = EVT_CMD_STATUS_SIZE;
+            event[3] = 0;
+            event[4] = 1;
+            memcpy(&event[5], &opcode, 2);
+            crowd.command_event_length = 3 + EVT_CMD_STATUS_SIZE;
+
+            start_inquiry(now);
+            break;
+
+        case OCF_PERIODIC_INQUIRY:
+
+            periodic_inquiry_copy = param;
+            crowd.is_periodic = true;
+            crowd.inquiry_length =
+                periodic_inquiry_copy->length * SIMULATOR_INQUIRY_UNIT;
+            crowd.minimum_period = btohs(periodic_inquiry_copy->min_period) *
+                                   SIMULATOR_INQUIRY_UNIT;
+            crowd.maximum_period = btohs(periodic_inquiry_copy->max_period) *
+                                   SIMULATOR_INQUIRY_UNIT;
+
+            event[0] = HCI_EVENT_PKT;
+            event[1] = EVT_CMD_COMPLETE;
+            event[2] = EVT_CMD_COMPLETE_SIZE + 1;
+            event[3] = 1;
+            memcpy(&event[4], &opcode, 2);
+            event[6] = 0;
+            crowd.command_event_length = 3 + EVT_CMD_COMPLETE_SIZE + 1;
+
+            start_inquiry(now);
+            break;
+
+        case OCF_INQUIRY_CANCEL:
+        case OCF_EXIT_PERIODIC_INQUIRY:
+
+            crowd.is_inquiring = false;
+            crowd.is_periodic = false;
+            break;
+
+        default:
+
+            break;
+
+    }
+
+    return 0;
+}
+
+
+/*
+*  simulator_poll_event:
+*
+*  This function waits until the next event of the controller is due. Once
+*  the crowd has left, it reports the handle as readable so the scanner
+*  reads the end of the stream.
+*
+*  Parameters:
+*
+*  handle - ignored
+*  timeout - time in milliseconds to wait, -1 waits forever
+*
+*  Return value:
+*
+*  1 - an event or the end of the stream can be read
+*  0 - timeout
+*/
+static int simulator_poll_event(int handle, int timeout) {
+
+    long long wait_time; /* Time in microseconds until the event is due */
+
+    if (0 == crowd.pending_length && simulator_next_event() == false) {
+
+        if (crowd.finished == true) {
+            return 1;
+        }
+
+        /* Nothing happens until the scanner starts an inquiry */
+        if (0 <= timeout) {
+            usleep(timeout * 1000);
+        }
+
+        return 0;
+
+    }
+
+    wait_time = crowd.pending_due_time - get_time_in_microseconds();
+
+    if (0 < wait_time) {
+
+        if (0 <= timeout && (long long)timeout * 1000 < wait_time) {
+            usleep(timeout * 1000);
+            return 0;
+        }
+
+        usleep(wait_time);
+
+    }
+
+    return 1;
+}
+
+
+/*
+*  simulator_read_event:
+*
+*  This function hands the pending event to the scanner.
+*
+*  Parameters:
+*
+*  handle - ignored
+*  buffer - buffer receiving the event
+*  buffer_length - size of the buffer
+*
+*  Return value:
+*
+*  Length of the event, 0 once the crowd has left, -1 when no event is
+*  pending
+*/
+static int simulator_read_event(int handle, unsigned char *buffer,
+                                int buffer_length) {
+
+    int length = crowd.pending_length;
+
+    if (0 == length && simulator_next_event() == false) {
+
+        if (crowd.finished == true) {
+            return 0;
+        }
+
+        errno = EAGAIN;
+        return -1;
+
+    }
+
+    length = crowd.pending_length;
+
+    if (length > buffer_length) {
+        length = buffer_length;
+    }
+
+    memcpy(buffer, crowd.pending, length);
+    crowd.pending_length = 0;
+
+    return length;
+}
+
+
+/*
+*  simulator_close_dev:
+*
+*  The crowd is kept for the report, so there is nothing to release.
+*
+*  Parameters:
+*
+*  handle - ignored
+*
+*  Return value:
+*
+*  0 - success
+*/
+static int simulator_close_dev(int handle) {
+
+    return 0;
+}
+
+
+HCITransport simulator_transport = {
+    "simulator",
+    simulator_open_dev,
+    simulator_set_filter,
+    simulator_write_inquiry_mode,
+    simulator_send_cmd,
+    simulator_poll_event,
+    simulator_read_event,
+    simulator_close_dev
+};
@@ -0,0 +1,263 @@
+/*
+* Copyright (c) 2016 Academia Sinica, Institute of Information Science
+*
+* License:
+*
+*      GPL 3.0 : The content of this file is subject to the terms and
+*      conditions defined in file 'COPYING.txt', which is part of this source
+*      code package.
+*
+* Project Name:
+*
+*      BeDIPS
+*
+* File Description:
+*
+*      This header file contains the function declarations and variables used
+*      in the CrowdSimulator.c file.
+*
+* File Name:
+*
+*      CrowdSimulator.h
+*
+* Abstract:
+*
+*      BeDIPS uses LBeacons to deliver 3D coordinates and textual
+*      descriptions of their locations to users' devices. Basically, a LBeacon
+*      is an inexpensive, Bluetooth Smart Ready device. The 3D coordinates and
+*      location description of every LBeacon are retrieved from BeDIS
+*      (Building/environment Data and Information System) and stored locally
+*      during deployment and maintenance times. Once initialized, each LBeacon
+*      broadcasts its coordinates and location description to Bluetooth
+*      enabled user devices within its coverage area.
+*
+* Authors:
+*
+*      Jake Lee, jakelee@iis.sinica.edu.tw
+*      Johnson Su, johnsonsu@iis.sinica.edu.tw
+*      Shirley Huang, shirley.huang.93@gmail.com
+*      Han Hu, hhu14@illinois.edu
+*      Jeffrey Lin, lin.jeff03@gmail.com
+*      Howard Hsu, haohsu0823@gmail.com
+*      Han Wang, hollywang@iis.sinica.edu.tw
+*/
+
+
+#ifndef CROWDSIMULATOR_H
+#define CROWDSIMULATOR_H
+
+#include <bluetooth/bluetooth.h>
+#include <bluetooth/hci.h>
+#include <bluetooth/hci_lib.h>
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include "HCITransport.h"
+
+
+/*
+* CONSTANTS
+*/
+
+/* Handle returned by the simulator backend, there is only one crowd */
+#define SIMULATOR_HANDLE 0
+
+/* Radius in meters of the area the simulated devices walk through. The
+ * beacon stands at its center */
+#define SIMULATOR_AREA_RADIUS 30.0
+
+/* RSSI in dBm of a device one meter away from the beacon */
+#define SIMULATOR_RSSI_AT_ONE_METER -40.0
+
+/* Path loss exponent of the log-distance model, 2 in free space and higher
+ * indoors */
+#define SIMULATOR_PATH_LOSS_EXPONENT 2.5
+
+/* Standard deviation in dB of the shadowing added to every RSSI */
+#define SIMULATOR_SHADOWING 4.0
+
+/* Lowest RSSI in dBm at which an inquiry can find a device */
+#define SIMULATOR_SENSITIVITY -90
+
+/* Chance that an inquiry finds a device within the sensitivity */
+#define SIMULATOR_DISCOVERY_PROBABILITY 0.9
+
+/* Shortest time in seconds a device stays in the area */
+#define SIMULATOR_MINIMUM_DWELL_TIME 1.0
+
+/* Duration in seconds of one unit of the inquiry length and period */
+#define SIMULATOR_INQUIRY_UNIT 1.28
+
+/* Number of crowd sizes the queue depth samples are grouped in */
+#define SIMULATOR_CROWD_BUCKETS 10
+
+/* Arrival rate in devices per second reached at the end of the arrivals,
+ * and mean time in seconds a device stays in the area, when -c only gives
+ * the number of devices */
+#define SIMULATOR_DEFAULT_ARRIVAL_RATE 2.0
+#define SIMULATOR_DEFAULT_DWELL_TIME 60.0
+
+/* Seed of the arrivals, paths and radio of the simulated crowd */
+#define SIMULATOR_SEED 1
+
+
+
+/*
+* TYPEDEF STRUCTS
+*/
+
+/* A device walking through the area on a straight line, from a point on
+ * the edge to the opposite edge, at the speed that keeps it in the area
+ * for its dwell time */
+typedef struct SimulatedDevice {
+    /* Address reported by the inquiries */
+    bdaddr_t address;
+
+    /* Simulated times in seconds at which it enters and leaves the area */
+    double arrival_time;
+    double departure_time;
+
+    /* Point in meters where it enters, relative to the beacon */
+    double entry_x;
+    double entry_y;
+
+    /* Velocity in meters per second */
+    double velocity_x;
+    double velocity_y;
+
+    /* Simulated time of the first inquiry result above the RSSI threshold,
+     * negative while it has not been seen within range */
+    double discovery_time;
+
+    /* Simulated time of the first successful push, negative while it has
+     * not been pushed */
+    double push_time;
+} SimulatedDevice;
+
+
+/* Inquiry result due during the running inquiry */
+typedef struct SimulatedResult {
+    /* Simulated time in seconds at which the device is found */
+    double due_time;
+
+    /* Index of the device in the crowd */
+    int device_id;
+} SimulatedResult;
+
+
+/* Settings and state of the simulator backend. It plays a controller
+ * running the inquiries asked by the scanner, and answers them with the
+ * events start_scanning() parses: inquiry results with the RSSI of the
+ * devices in the area, and an inquiry complete event at the end of each
+ * inquiry. The devices arrive by a Poisson process whose rate grows
+ * linearly from 0, so the crowd builds up during the run, and each one
+ * stays an exponentially distributed time. */
+typedef struct CrowdSimulator {
+    /* Number of devices of the whole run */
+    int number_of_devices;
+
+    /* Arrival rate in devices per second reached at the end of the run */
+    double arrival_rate;
+
+    /* Mean time in seconds a device stays in the area */
+    double mean_dwell_time;
+
+    /* Simulation speed, 1.0 is real time */
+    double speed;
+
+    /* RSSI above which the scanner pushes to a device */
+    int rssi_threshold;
+
+    /* Devices of the crowd, in the order of their arrival */
+    SimulatedDevice *devices;
+
+    /* Simulated time at which the last device leaves */
+    double end_time;
+
+    /* Whether the scanner has read the end of the stream */
+    bool finished;
+
+    /* Wall clock time in microseconds at simulated time 0 */
+    long long start_time;
+
+    /* Seed of the random numbers */
+    unsigned int seed;
+
+    /* Inquiry state: whether one is running, whether the controller starts
+     * them by itself, the length and bounds of the period in seconds, and
+     * the start and end of the current or next inquiry */
+    bool is_inquiring;
+    bool is_periodic;
+    double inquiry_length;
+    double minimum_period;
+    double maximum_period;
+    double inquiry_start_time;
+    double inquiry_end_time;
+
+    /* Results of the running inquiry sorted by time, and the next one */
+    SimulatedResult *results;
+    int number_of_results;
+    int next_result;
+
+    /* Event answering the last command, 0 long when there is none */
+    unsigned char command_event[HCI_MAX_EVENT_SIZE + 1];
+    int command_event_length;
+
+    /* Event waiting to be read, packet type byte first */
+    unsigned char pending[HCI_MAX_EVENT_SIZE + 1];
+
+    /* Length of the pending event, 0 when nothing is pending */
+    int pending_length;
+
+    /* Wall clock time in microseconds at which the pending event is due */
+    long long pending_due_time;
+
+    /* Lock protecting the push times and the samples, which are written by
+     * the push threads */
+    pthread_mutex_t lock;
+
+    /* Number of inquiry results sent and of pushes after the device left */
+    long long number_of_results_sent;
+    long long number_of_late_pushes;
+
+    /* Number of devices in the area covered by each bucket of samples */
+    int crowd_bucket_width;
+
+    /* Number, sum and maximum of the queue depth samples taken while the
+     * crowd size fell in each bucket */
+    long long number_of_samples[SIMULATOR_CROWD_BUCKETS];
+    long long total_depth[SIMULATOR_CROWD_BUCKETS];
+    int maximum_depth[SIMULATOR_CROWD_BUCKETS];
+} CrowdSimulator;
+
+
+
+/*
+* GLOBAL VARIABLES
+*/
+
+/* Backend simulating a crowd walking past the beacon */
+extern HCITransport simulator_transport;
+
+
+
+/*
+* FUNCTIONS
+*/
+
+int crowd_simulator_configure(int number_of_devices, double arrival_rate,
+                              double mean_dwell_time, double speed,
+                              int rssi_threshold);
+void crowd_simulator_record_push(bdaddr_t *address, long long now);
+void crowd_simulator_record_queue_depth(int depth);
+void crowd_simulator_print_report();
+void crowd_simulator_free();
+
+#endif
@@ -0,0 +1,412 @@
+/*
+* Copyright (c) 2016 Academia Sinica, Institute of Information Science
+*
+* License:
+*
+*      GPL 3.0 : The content of this file is subject to the terms and
+*      conditions defined in file 'COPYING.txt', which is part of this source
+*      code package.
+*
+* Project Name:
+*
+*      BeDIPS
+*
+* File Description:
+*
+*      This file contains the implementation of an open addressing hash
+*      table keyed by the 6-byte Bluetooth device address packed into an
+*      integer. Slots are stored in one flat array and probed linearly, so
+*      a lookup usually touches a single cache line instead of walking a
+*      linked list. The table is not synchronized; callers hold their own
+*      lock.
+*
+* File Name:
+*
+*      DeviceTable.c
+*
+* Abstract:
+*
+*      BeDIPS uses LBeacons to deliver 3D coordinates and textual
+*      descriptions of their locations to users' devices. Basically, a LBeacon
+*      is an inexpensive, Bluetooth Smart Ready device. The 3D coordinates and
+*      location description of every LBeacon are retrieved from BeDIS
+*      (Building/environment Data and Information System) and stored locally
+*      during deployment and maintenance times. Once initialized, each LBeacon
+*      broadcasts its coordinates and location description to Bluetooth
+*      enabled user devices within its coverage area.
+*
+* Authors:
+*
+*      Jake Lee, jakelee@iis.sinica.edu.tw
+*      Johnson Su, johnsonsu@iis.sinica.edu.tw
+*      Shirley Huang, shirley.huang.93@gmail.com
+*      Han Hu, hhu14@illinois.edu
+*      Jeffrey Lin, lin.jeff03@gmail.com
+*      Howard Hsu, haohsu0823@gmail.com
+*      Han Wang, hollywang@iis.sinica.edu.tw
+*/
+
+#include "DeviceTable.h"
+
+
+/*
+*  bdaddr_to_key:
+*
+*  This function packs the 6 bytes of a Bluetooth device address into the
+*  low 48 bits of an integer used as the key of the table.
+*
+*  Parameters:
+*
+*  bluetooth_device_address - bluetooth device address
+*
+*  Return value:
+*
+*  key - the packed address
+*/
+uint64_t bdaddr_to_key(bdaddr_t *bluetooth_device_address) {
+
+    uint64_t key = 0;
+    int byte_id;
+
+    for (byte_id = 5; byte_id >= 0; byte_id--) {
+        key = (key << 8) | bluetooth_device_address->b[byte_id];
+    }
+
+    return key;
+}
+
+
+/*
+*  key_to_bdaddr:
+*
+*  This function unpacks a key made by bdaddr_to_key into a Bluetooth
+*  device address.
+*
+*  Parameters:
+*
+*  key - the packed address
+*  bluetooth_device_address - the address unpacked
+*
+*  Return value:
+*
+*  None
+*/
+void key_to_bdaddr(uint64_t key, bdaddr_t *bluetooth_device_address) {
+
+    int byte_id;
+
+    for (byte_id = 0; byte_id < 6; byte_id++) {
+        bluetooth_device_address->b[byte_id] = key & 0xff;
+        key >>= 8;
+    }
+}
+
+
+/*
+*  get_home_slot:
+*
+*  This helper function scrambles the key and returns the slot where probing
+*  for the key starts. Vendors hand out addresses in sequence, so the bits
+*  are mixed before masking.
+*
+*  Parameters:
+*
+*  table - the table
+*  key - the packed address
+*
+*  Return value:
+*
+*  Index of the home slot
+*/
+static int get_home_slot(DeviceTable *table, uint64_t key) {
+
+    uint64_t hash = key & ~DEVICE_TABLE_USED_SLOT;
+
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+
+    return (int)(hash & (uint64_t)(table->capacity - 1));
+}
+
+
+/*
+*  device_table_init:
+*
+*  This function allocates an empty table with room for at least the given
+*  number of slots.
+*
+*  Parameters:
+*
+*  table - the table to be initialized
+*  capacity - initial number of slots, rounded up to a power of two
+*
+*  Return value:
+*
+*  0 - success
+*  -1 - memory allocation failed
+*/
+int device_table_init(DeviceTable *table, int capacity) {
+
+    int slots = DEVICE_TABLE_MINIMUM_CAPACITY;
+
+    while (slots < capacity) {
+        slots *= 2;
+    }
+
+    table->slots = (DeviceTableSlot *)calloc(slots, sizeof(DeviceTableSlot));
+
+    if (table->slots == NULL) {
+
+        /* Error handling */
+        perror("Failed to allocate memory");
+        return -1;
+
+    }
+
+    table->capacity = slots;
+    table->size = 0;
+
+    return 0;
+}
+
+
+/*
+*  device_table_lookup:
+*
+*  This function finds the data stored for the specified address.
+*
+*  Parameters:
+*
+*  table - the table
+*  key - the packed address
+*
+*  Return value:
+*
+*  data - data stored for the address, NULL if the address is not in the
+*  table
+*/
+void *device_table_lookup(DeviceTable *table, uint64_t key) {
+
+    uint64_t used_key = key | DEVICE_TABLE_USED_SLOT;
+    int mask = table->capacity - 1;
+    int slot_id = get_home_slot(table, key);
+
+    while (table->slots[slot_id].key != 0) {
+
+        if (table->slots[slot_id].key == used_key) {
+            return table->slots[slot_id].data;
+        }
+
+        slot_id = (slot_id + 1) & mask;
+
+    }
+
+    return NULL;
+}
+
+
+/*
+*  device_table_grow:
+*
+*  This helper function doubles the number of slots and re-inserts every
+*  entry.
+*
+*  Parameters:
+*
+*  table - the table
+*
+*  Return value:
+*
+*  0 - success
+*  -1 - memory allocation failed
+*/
+static int device_table_grow(DeviceTable *table) {
+
+    DeviceTable larger;
+    int slot_id;
+
+    if (device_table_init(&larger, table->capacity * 2) != 0) {
+        return -1;
+    }
+
+    for (slot_id = 0; slot_id < table->capacity; slot_id++) {
+
+        if (table->slots[slot_id].key != 0) {
+            device_table_insert(&larger, table->slots[slot_id].key,
+                                table->slots[slot_id].data);
+        }
+
+    }
+
+    free(table->slots);
+    *table = larger;
+
+    return 0;
+}
+
+
+/*
+*  device_table_insert:
+*
+*  This function stores the data for the specified address, replacing the
+*  data already stored for it.
+*
+*  Parameters:
+*
+*  table - the table
+*  key - the packed address
+*  data - data to be stored for the address
+*
+*  Return value:
+*
+*  0 - success
+*  -1 - the table is full and could not be grown
+*/
+int device_table_insert(DeviceTable *table, uint64_t key, void *data) {
+
+    uint64_t used_key = key | DEVICE_TABLE_USED_SLOT;
+    int mask;
+    int slot_id;
+
+    if ((table->size + 1) * 100 > table->capacity * DEVICE_TABLE_MAXIMUM_LOAD
+        && device_table_grow(table) != 0 && table->size + 1 >= table->capacity) {
+        return -1;
+    }
+
+    mask = table->capacity - 1;
+    slot_id = get_home_slot(table, key);
+
+    while (table->slots[slot_id].key != 0) {
+
+        if (table->slots[slot_id].key == used_key) {
+            table->slots[slot_id].data = data;
+            return 0;
+        }
+
+        slot_id = (slot_id + 1) & mask;
+
+    }
+
+    table->slots[slot_id].key = used_key;
+    table->slots[slot_id].data = data;
+    table->size++;
+
+    return 0;
+}
+
+
+/*
+*  device_table_remove:
+*
+*  This function removes the specified address from the table. The entries
+*  probed after it are shifted back so every remaining entry can still be
+*  reached from its home slot.
+*
+*  Parameters:
+*
+*  table - the table
+*  key - the packed address
+*
+*  Return value:
+*
+*  data - data that was stored for the address, NULL if the address was not
+*  in the table
+*/
+void *device_table_remove(DeviceTable *table, uint64_t key) {
+
+    uint64_t used_key = key | DEVICE_TABLE_USED_SLOT;
+    int mask = table->capacity - 1;
+    int slot_id = get_home_slot(table, key);
+    int next_id;
+    int home_id;
+    void *data;
+
+    while (table->slots[slot_id].key != used_key) {
+
+        if (table->slots[slot_id].key == 0) {
+            return NULL;
+        }
+
+        slot_id = (slot_id + 1) & mask;
+
+    }
+
+    data = table->slots[slot_id].data;
+
+    /* Shift back every entry whose home slot is not between the hole and
+     * the entry itself */
+    for (next_id = (slot_id + 1) & mask; table->slots[next_id].key != 0;
+         next_id = (next_id + 1) & mask) {
+
+        home_id = get_home_slot(table, table->slots[next_id].key);
+
+        if (((next_id - home_id) & mask) >= ((next_id - slot_id) & mask)) {
+            table->slots[slot_id] = table->slots[next_id];
+            slot_id = next_id;
+        }
+
+    }
+
+    table->slots[slot_id].key = 0;
+    table->slots[slot_id].data = NULL;
+    table->size--;
+
+    return data;
+}
+
+
+/*
+*  device_table_get_next:
+*
+*  This function iterates over the data stored in the table, in no
+*  particular order. The table must not be modified during the iteration.
+*
+*  Parameters:
+*
+*  table - the table
+*  position - slot at which the iteration continues, 0 to start it
+*
+*  Return value:
+*
+*  data - the next data stored in the table, NULL at the end
+*/
+void *device_table_get_next(DeviceTable *table, int *position) {
+
+    while (*position < table->capacity) {
+
+        DeviceTableSlot *slot = &table->slots[*position];
+
+        (*position)++;
+
+        if (slot->key != 0) {
+            return slot->data;
+        }
+
+    }
+
+    return NULL;
+}
+
+
+/*
+*  device_table_free:
+*
+*  This function frees the slots of the table. The stored data is owned by
+*  the caller and is not freed.
+*
+*  Parameters:
+*
+*  table - the table
+*
+*  Return value:
+*
+*  None
+*/
+void device_table_free(DeviceTable *table) {
+
+    free(table->slots);
+    table->slots = NULL;
+    table->capacity = 0;
+    table->size = 0;
+}
@@ -0,0 +1,112 @@
+/*
+* Copyright (c) 2016 Academia Sinica, Institute of Information Science
+*
+* License:
+*
+*      GPL 3.0 : The content of this file is subject to the terms and
+*      conditions defined in file 'COPYING.txt', which is part of this source
+*      code package.
+*
+* Project Name:
+*
+*      BeDIPS
+*
+* File Description:
+*
+*      This header file contains the function declarations and
+*      variables used in the DeviceTable.c file.
+*
+* File Name:
+*
+*      DeviceTable.h
+*
+* Abstract:
+*
+*      BeDIPS uses LBeacons to deliver 3D coordinates and textual
+*      descriptions of their locations to users' devices. Basically, a LBeacon
+*      is an inexpensive, Bluetooth Smart Ready device. The 3D coordinates and
+*      location description of every LBeacon are retrieved from BeDIS
+*      (Building/environment Data and Information System) and stored locally
+*      during deployment and maintenance times. Once initialized, each LBeacon
+*      broadcasts its coordinates and location description to Bluetooth
+*      enabled user devices within its coverage area.
+*
+* Authors:
+*
+*      Jake Lee, jakelee@iis.sinica.edu.tw
+*      Johnson Su, johnsonsu@iis.sinica.edu.tw
+*      Shirley Huang, shirley.huang.93@gmail.com
+*      Han Hu, hhu14@illinois.edu
+*      Jeffrey Lin, lin.jeff03@gmail.com
+*      Howard Hsu, haohsu0823@gmail.com
+*      Han Wang, hollywang@iis.sinica.edu.tw
+*/
+
+#ifndef DEVICETABLE_H
+#define DEVICETABLE_H
+
+#include <bluetooth/bluetooth.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+/*
+* CONSTANTS
+*/
+
+/* Bit set in the key of every used slot. A packed bdaddr only takes the low
+ * 48 bits, so a zero key always means an empty slot */
+#define DEVICE_TABLE_USED_SLOT (1ULL << 48)
+
+/* Smallest number of slots in a table, must be a power of two */
+#define DEVICE_TABLE_MINIMUM_CAPACITY 16
+
+/* The table doubles once more than this percentage of slots are used */
+#define DEVICE_TABLE_MAXIMUM_LOAD 50
+
+
+
+/*
+* TYPEDEF STRUCTS
+*/
+
+/* Slot of the table: the packed address and the data stored for it */
+typedef struct DeviceTableSlot {
+    uint64_t key;
+    void *data;
+} DeviceTableSlot;
+
+
+/* Open addressing hash table keyed by the 48-bit Bluetooth device address.
+ * Collisions are resolved by linear probing, and removal shifts the
+ * following entries back so no tombstones are left behind. */
+typedef struct DeviceTable {
+    /* Array of slots, capacity is always a power of two */
+    DeviceTableSlot *slots;
+
+    /* Number of slots in the array */
+    int capacity;
+
+    /* Number of used slots */
+    int size;
+} DeviceTable;
+
+
+
+/*
+* FUNCTIONS
+*/
+
+uint64_t bdaddr_to_key(bdaddr_t *bluetooth_device_address);
+void key_to_bdaddr(uint64_t key, bdaddr_t *bluetooth_device_address);
+int device_table_init(DeviceTable *table, int capacity);
+void *device_table_lookup(DeviceTable *table, uint64_t key);
+int device_table_insert(DeviceTable *table, uint64_t key, void *data);
+void *device_table_remove(DeviceTable *table, uint64_t key);
+void *device_table_get_next(DeviceTable *table, int *position);
+void device_table_free(DeviceTable *table);
+
+#endif
@@ -0,0 +1,515 @@
+/*
+* Copyright (c) 2016 Academia Sinica, Institute of Information Science
+*
+* License:
+*
+*      GPL 3.0 : The content of this file is subject to the terms and
+*      conditions defined in file 'COPYING.txt', which is part of this source
+*      code package.
+*
+* Project Name:
+*
+*      BeDIPS
+*
+* File Description:
+*
+*      This file contains the balancer spreading the pushes over the push
+*      dongles. Each device is assigned to the dongle with the fewest pushes
+*      in flight and the best recent latency, and the threads of the other
+*      dongles take over the waiting devices of a dongle that stalls.
+*
+* File Name:
+*
+*      DongleBalancer.c
+*
+* Abstract:
+*
+*      BeDIPS uses LBeacons to deliver 3D coordinates and textual
+*      descriptions of their locations to users' devices. Basically, a LBeacon
+*      is an inexpensive, Bluetooth Smart Ready device. The 3D coordinates and
+*      location description of every LBeacon are retrieved from BeDIS
+*      (Building/environment Data and Information System) and stored locally
+*      during deployment and maintenance times. Once initialized, each LBeacon
+*      broadcasts its coordinates and location description to Bluetooth
+*      enabled user devices within its coverage area.
+*
+* Authors:
+*
+*      Jake Lee, jakelee@iis.sinica.edu.tw
+*      Johnson Su, johnsonsu@iis.sinica.edu.tw
+*      Shirley Huang, shirley.huang.93@gmail.com
+*      Han Hu, hhu14@illinois.edu
+*      Jeffrey Lin, lin.jeff03@gmail.com
+*      Howard Hsu, haohsu0823@gmail.com
+*      Han Wang, hollywang@iis.sinica.edu.tw
+*/
+
+#include "DongleBalancer.h"
+
+
+/*
+*  get_time_in_milliseconds:
+*
+*  This helper function returns the time of the realtime clock, the clock
+*  of the times given to the balancer by its callers.
+*
+*  Parameters:
+*
+*  None
+*
+*  Return value:
+*
+*  Time in milliseconds since the Epoch
+*/
+static long long get_time_in_milliseconds() {
+
+    struct timespec now;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    return (long long)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+
+/*
+*  signal_dongle:
+*
+*  This helper function wakes up the push engine of a dongle waiting on the
+*  wakeup eventfd of the dongle.
+*
+*  Parameters:
+*
+*  dongle - the dongle
+*
+*  Return value:
+*
+*  None
+*/
+static void signal_dongle(PushDongle *dongle) {
+
+    uint64_t increment = 1;
+
+    /* A full counter already wakes the engine up, so EAGAIN is ignored */
+    if (0 > write(dongle->wakeup_fd, &increment, sizeof(increment)) &&
+        errno != EAGAIN) {
+        perror("Failed to signal a dongle");
+    }
+}
+
+
+/*
+*  balancer_init:
+*
+*  This function creates the queue and the wakeup eventfd of every push
+*  dongle.
+*
+*  Parameters:
+*
+*  balancer - the balancer to be initialized
+*  dongle_device_ids - HCI device ID of each push dongle
+*  number_of_dongles - number of push dongles
+*  capacity - maximum number of devices waiting for each dongle at each
+*             priority level
+*  item_size - size in bytes of the item describing a device
+*  number_of_levels - number of priority levels of the queues
+*
+*  Return value:
+*
+*  0 - success
+*  -1 - memory allocation or the creation of an eventfd failed
+*/
+int balancer_init(DongleBalancer *balancer, int *dongle_device_ids,
+                  int number_of_dongles, int capacity, int item_size,
+                  int number_of_levels) {
+
+    int dongle_id;
+    PushDongle *dongle;
+
+    memset(balancer, 0, sizeof(DongleBalancer));
+
+    balancer->dongles = (PushDongle *)calloc(number_of_dongles,
+                                             sizeof(PushDongle));
+
+    if (balancer->dongles == NULL) {
+
+        /* Error handling */
+        perror("Failed to allocate memory");
+        return -1;
+
+    }
+
+    for (dongle_id = 0; dongle_id < number_of_dongles; dongle_id++) {
+
+        dongle = &balancer->dongles[dongle_id];
+
+        if (queue_init(&dongle->queue, capacity, item_size,
+                       number_of_levels) != 0) {
+            balancer_free(balancer);
+            return -1;
+        }
+
+        dongle->wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+        if (0 > dongle->wakeup_fd) {
+
+            /* Error handling */
+            perror("Failed to create the eventfd of a dongle");
+            queue_free(&dongle->queue);
+            balancer_free(balancer);
+            return -1;
+
+        }
+
+        dongle->dongle_device_id = dongle_device_ids[dongle_id];
+        dongle->average_latency = DONGLE_INITIAL_LATENCY;
+        balancer->number_of_dongles++;
+
+    }
+
+    pthread_mutex_init(&balancer->lock, NULL);
+
+    return 0;
+}
+
+
+/*
+*  balancer_dispatch:
+*
+*  This function assigns a device to the dongle expected to serve it first
+*  and puts it in the queue of the dongle, waiting for room if the queue is
+*  full, then signals the wakeup eventfd of the dongle.
+*
+*  Parameters:
+*
+*  balancer - the balancer
+*  item - the item describing the device
+*  priority - priority level of the device
+*
+*  Return value:
+*
+*  0 - success
+*  -1 - the queues have been closed
+*/
+int balancer_dispatch(DongleBalancer *balancer, void *item, int priority) {
+
+    int dongle_id;
+    int best_dongle_id = 0;
+    double score;
+    double best_score = 0;
+    PushDongle *dongle;
+
+    pthread_mutex_lock(&balancer->lock);
+
+    for (dongle_id = 0; dongle_id < balancer->number_of_dongles;
+         dongle_id++) {
+
+        dongle = &balancer->dongles[dongle_id];
+        score = (dongle->in_flight + queue_get_length(&dongle->queue, -1) +
+                 1) * dongle->average_latency;
+
+        if (dongle_id == 0 || score < best_score) {
+            best_dongle_id = dongle_id;
+            best_score = score;
+        }
+
+    }
+
+    pthread_mutex_unlock(&balancer->lock);
+
+    dongle = &balancer->dongles[best_dongle_id];
+
+    if (queue_enqueue(&dongle->queue, item, priority) != 0) {
+        return -1;
+    }
+
+    signal_dongle(dongle);
+
+    return 0;
+}
+
+
+/*
+*  balancer_try_take:
+*
+*  This function gives a thread of a dongle the next device to push
+*  without waiting. When the queue of the dongle is empty, a device
+*  waiting for a stalled dongle is taken instead.
+*
+*  Parameters:
+*
+*  balancer - the balancer
+*  dongle_id - index of the dongle of the thread
+*  item - buffer receiving the item describing the device
+*  priority - receives the priority level of the device
+*
+*  Return value:
+*
+*  0 - success
+*  1 - no device is waiting for the dongle or a stalled dongle
+*  -1 - the queue of the dongle has been closed and is empty
+*/
+int balancer_try_take(DongleBalancer *balancer, int dongle_id, void *item,
+                      int *priority) {
+
+    PushDongle *own_dongle = &balancer->dongles[dongle_id];
+    PushDongle *dongle;
+    PushDongle *stalled_dongle = NULL;
+    long long now;
+    int other_dongle_id;
+    int return_value;
+
+    return_value = queue_dequeue_timed(&own_dongle->queue, item, priority, 0);
+
+    if (return_value != 1) {
+        return return_value;
+    }
+
+    /* Look for a dongle that has not finished a push for a long time
+     * while devices are waiting for it */
+    now = get_time_in_milliseconds();
+
+    pthread_mutex_lock(&balancer->lock);
+
+    for (other_dongle_id = 0; other_dongle_id < balancer->number_of_dongles;
+         other_dongle_id++) {
+
+        dongle = &balancer->dongles[other_dongle_id];
+
+        if (other_dongle_id != dongle_id && dongle->in_flight > 0 &&
+            DONGLE_STALL_TIMEOUT < now - dongle->last_progress_time &&
+            queue_get_length(&dongle->queue, -1) > 0) {
+            stalled_dongle = dongle;
+            break;
+        }
+
+    }
+
+    pthread_mutex_unlock(&balancer->lock);
+
+    if (stalled_dongle != NULL &&
+        queue_dequeue_timed(&stalled_dongle->queue, item, priority,
+                            0) == 0) {
+
+        pthread_mutex_lock(&balancer->lock);
+        stalled_dongle->number_of_stolen++;
+        pthread_mutex_unlock(&balancer->lock);
+        return 0;
+
+    }
+
+    return 1;
+}
+
+
+/*
+*  balancer_take:
+*
+*  This function gives a thread of a dongle the next device to push, like
+*  balancer_try_take, but sleeps until a device is assigned to the dongle,
+*  checking for stalled dongles every DONGLE_STEAL_INTERVAL milliseconds.
+*
+*  Parameters:
+*
+*  balancer - the balancer
+*  dongle_id - index of the dongle of the thread
+*  item - buffer receiving the item describing the device
+*  priority - receives the priority level of the device
+*
+*  Return value:
+*
+*  0 - success
+*  -1 - the queue of the dongle has been closed and is empty
+*/
+int balancer_take(DongleBalancer *balancer, int dongle_id, void *item,
+                  int *priority) {
+
+    int return_value;
+
+    while (true) {
+
+        return_value = balancer_try_take(balancer, dongle_id, item,
+                                         priority);
+
+        if (return_value != 1) {
+            return return_value;
+        }
+
+        return_value =
+            queue_dequeue_timed(&balancer->dongles[dongle_id].queue, item,
+                                priority, DONGLE_STEAL_INTERVAL);
+
+        if (return_value != 1) {
+            return return_value;
+        }
+
+    }
+}
+
+
+/*
+*  balancer_start:
+*
+*  This function counts a push started on a dongle.
+*
+*  Parameters:
+*
+*  balancer - the balancer
+*  dongle_id - index of the dongle
+*  now - current time in milliseconds
+*
+*  Return value:
+*
+*  None
+*/
+void balancer_start(DongleBalancer *balancer, int dongle_id, long long now) {
+
+    PushDongle *dongle = &balancer->dongles[dongle_id];
+
+    pthread_mutex_lock(&balancer->lock);
+
+    /* A dongle that was idle has not stalled */
+    if (dongle->in_flight == 0) {
+        dongle->last_progress_time = now;
+    }
+
+    dongle->in_flight++;
+
+    pthread_mutex_unlock(&balancer->lock);
+}
+
+
+/*
+*  balancer_finish:
+*
+*  This function counts a push finished on a dongle and adds its latency to
+*  the moving average of the dongle.
+*
+*  Parameters:
+*
+*  balancer - the balancer
+*  dongle_id - index of the dongle
+*  latency - time in milliseconds the connect and put took
+*  is_successful - whether the message was sent
+*  now - current time in milliseconds
+*
+*  Return value:
+*
+*  None
+*/
+void balancer_finish(DongleBalancer *balancer, int dongle_id,
+                     long long latency, bool is_successful, long long now) {
+
+    PushDongle *dongle = &balancer->dongles[dongle_id];
+
+    if (is_successful == false && latency < DONGLE_FAILURE_LATENCY) {
+        latency = DONGLE_FAILURE_LATENCY;
+    }
+
+    pthread_mutex_lock(&balancer->lock);
+
+    dongle->in_flight--;
+    dongle->last_progress_time = now;
+    dongle->average_latency += DONGLE_LATENCY_WEIGHT *
+                               (latency - dongle->average_latency);
+    dongle->number_of_pushes++;
+
+    if (is_successful == false) {
+        dongle->number_of_failures++;
+    }
+
+    pthread_mutex_unlock(&balancer->lock);
+}
+
+
+/*
+*  balancer_close:
+*
+*  This function closes the queues of every dongle and signals their
+*  wakeup eventfds, so their threads exit once the devices already
+*  assigned are pushed.
+*
+*  Parameters:
+*
+*  balancer - the balancer
+*
+*  Return value:
+*
+*  None
+*/
+void balancer_close(DongleBalancer *balancer) {
+
+    int dongle_id;
+
+    for (dongle_id = 0; dongle_id < balancer->number_of_dongles;
+         dongle_id++) {
+        queue_close(&balancer->dongles[dongle_id].queue);
+        signal_dongle(&balancer->dongles[dongle_id]);
+    }
+}
+
+
+/*
+*  balancer_print_statistics:
+*
+*  This function prints the number of pushes, failures and stolen devices
+*  and the average latency of every dongle.
+*
+*  Parameters:
+*
+*  balancer - the balancer
+*
+*  Return value:
+*
+*  None
+*/
+void balancer_print_statistics(DongleBalancer *balancer) {
+
+    int dongle_id;
+    PushDongle *dongle;
+
+    pthread_mutex_lock(&balancer->lock);
+
+    for (dongle_id = 0; dongle_id < balancer->number_of_dongles;
+         dongle_id++) {
+
+        dongle = &balancer->dongles[dongle_id];
+        printf("Dongle hci%d: %lld pushes, %lld failed, %lld stolen, "
+               "%d in flight, average latency %.0f ms\n",
+               dongle->dongle_device_id, dongle->number_of_pushes,
+               dongle->number_of_failures, dongle->number_of_stolen,
+               dongle->in_flight, dongle->average_latency);
+
+    }
+
+    pthread_mutex_unlock(&balancer->lock);
+}
+
+
+/*
+*  balancer_free:
+*
+*  This function frees the queues and closes the wakeup eventfds of the
+*  dongles. No thread may use the balancer any more.
+*
+*  Parameters:
+*
+*  balancer - the balancer
+*
+*  Return value:
+*
+*  None
+*/
+void balancer_free(DongleBalancer *balancer) {
+
+    int dongle_id;
+
+    for (dongle_id = 0; dongle_id < balancer->number_of_dongles;
+         dongle_id++) {
+        queue_free(&balancer->dongles[dongle_id].queue);
+        close(balancer->dongles[dongle_id].wakeup_fd);
+    }
+
+    free(balancer->dongles);
+    balancer->dongles = NULL;
+    balancer->number_of_dongles = 0;
+}
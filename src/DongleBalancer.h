@@ -0,0 +1,152 @@
+/*
+* Copyright (c) 2016 Academia Sinica, Institute of Information Science
+*
+* License:
+*
+*      GPL 3.0 : The content of this file is subject to the terms and
+*      conditions defined in file 'COPYING.txt', which is part of this source
+*      code package.
+*
+* Project Name:
+*
+*      BeDIPS
+*
+* File Description:
+*
+*      This header file contains the function declarations and variables used
+*      in the DongleBalancer.c file.
+*
+* File Name:
+*
+*      DongleBalancer.h
+*
+* Abstract:
+*
+*      BeDIPS uses LBeacons to deliver 3D coordinates and textual
+*      descriptions of their locations to users' devices. Basically, a LBeacon
+*      is an inexpensive, Bluetooth Smart Ready device. The 3D coordinates and
+*      location description of every LBeacon are retrieved from BeDIS
+*      (Building/environment Data and Information System) and stored locally
+*      during deployment and maintenance times. Once initialized, each LBeacon
+*      broadcasts its coordinates and location description to Bluetooth
+*      enabled user devices within its coverage area.
+*
+* Authors:
+*
+*      Jake Lee, jakelee@iis.sinica.edu.tw
+*      Johnson Su, johnsonsu@iis.sinica.edu.tw
+*      Shirley Huang, shirley.huang.93@gmail.com
+*      Han Hu, hhu14@illinois.edu
+*      Jeffrey Lin, lin.jeff03@gmail.com
+*      Howard Hsu, haohsu0823@gmail.com
+*      Han Wang, hollywang@iis.sinica.edu.tw
+*/
+
+#ifndef DONGLEBALANCER_H
+#define DONGLEBALANCER_H
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <time.h>
+#include <unistd.h>
+#include "Queue.h"
+
+
+/*
+* CONSTANTS
+*/
+
+/* Latency in milliseconds assumed for a dongle before its first push */
+#define DONGLE_INITIAL_LATENCY 2000
+
+/* Weight of the latest push in the moving average of the latency */
+#define DONGLE_LATENCY_WEIGHT 0.2
+
+/* Latency in milliseconds counted for a failed push, so dongles that fail
+ * are given less work */
+#define DONGLE_FAILURE_LATENCY 30000
+
+/* Length of time in milliseconds after which a dongle with pushes in
+ * flight and none finished is considered stalled, and its waiting devices
+ * are taken by the other dongles */
+#define DONGLE_STALL_TIMEOUT 10000
+
+/* Maximum length of time in milliseconds an idle thread waits for a device
+ * of its own dongle before looking for a stalled dongle */
+#define DONGLE_STEAL_INTERVAL 1000
+
+
+
+/*
+* TYPEDEF STRUCTS
+*/
+
+/* A push dongle, with the devices assigned to it and its recent latency */
+typedef struct PushDongle {
+    /* HCI device ID of the dongle */
+    int dongle_device_id;
+
+    /* Devices assigned to the dongle and waiting for one of its threads */
+    Queue queue;
+
+    /* eventfd signaled whenever a device is put in the queue or the queue
+     * is closed, so a push engine can wait for it with its sockets */
+    int wakeup_fd;
+
+    /* Number of pushes started on the dongle and not finished */
+    int in_flight;
+
+    /* Exponentially weighted moving average of the connect and put time,
+     * in milliseconds */
+    double average_latency;
+
+    /* Time in milliseconds at which a push of the dongle last finished, or
+     * at which the dongle last became busy */
+    long long last_progress_time;
+
+    /* Statistics of the dongle */
+    long long number_of_pushes;
+    long long number_of_failures;
+    long long number_of_stolen;
+} PushDongle;
+
+
+/* Balancer assigning each device to the push dongle expected to serve it
+ * first: the one with the smallest product of its number of devices in
+ * flight or waiting, plus one, and its average latency. */
+typedef struct DongleBalancer {
+    /* Array of push dongles */
+    PushDongle *dongles;
+    int number_of_dongles;
+
+    /* Lock protecting every field of the dongles except their queues */
+    pthread_mutex_t lock;
+} DongleBalancer;
+
+
+
+/*
+* FUNCTIONS
+*/
+
+int balancer_init(DongleBalancer *balancer, int *dongle_device_ids,
+                  int number_of_dongles, int capacity, int item_size,
+                  int number_of_levels);
+int balancer_dispatch(DongleBalancer *balancer, void *item, int priority);
+int balancer_try_take(DongleBalancer *balancer, int dongle_id, void *item,
+                      int *priority);
+int balancer_take(DongleBalancer *balancer, int dongle_id, void *item,
+                  int *priority);
+void balancer_start(DongleBalancer *balancer, int dongle_id, long long now);
+void balancer_finish(DongleBalancer *balancer, int dongle_id,
+                     long long latency, bool is_successful, long long now);
+void balancer_close(DongleBalancer *balancer);
+void balancer_print_statistics(DongleBalancer *balancer);
+void balancer_free(DongleBalancer *balancer);
+
+#endif
@@ -0,0 +1,639 @@
+/*
+* Copyright (c) 2016 Academia Sinica, Institute of Information Science
+*
+* License:
+*
+*      GPL 3.0 : The content of this file is subject to the terms and
+*      conditions defined in file 'COPYING.txt', which is part of this source
+*      code package.
+*
+* Project Name:
+*
+*      BeDIPS
+*
+* File Description:
+*
+*      This file contains the HCI backends used by the scanning loop. The
+*      BlueZ backend talks to a real dongle. The replay backend feeds the
+*      HCI events recorded in a btsnoop file, or a raw stream of H4 event
+*      packets, at real or accelerated speed so the scanning path can run
+*      and be profiled on a machine without a Bluetooth radio.
+*
+* File Name:
+*
+*      HCITransport.c
+*
+* Abstract:
+*
+*      BeDIPS uses LBeacons to deliver 3D coordinates and textual
+*      descriptions of their locations to users' devices. Basically, a LBeacon
+*      is an inexpensive, Bluetooth Smart Ready device. The 3D coordinates and
+*      location description of every LBeacon are retrieved from BeDIS
+*      (Building/environment Data and Information System) and stored locally
+*      during deployment and maintenance times. Once initialized, each LBeacon
+*      broadcasts its coordinates and location description to Bluetooth
+*      enabled user devices within its coverage area.
+*
+* Authors:
+*
+*      Jake Lee, jakelee@iis.sinica.edu.tw
+*      Johnson Su, johnsonsu@iis.sinica.edu.tw
+*      Shirley Huang, shirley.huang.93@gmail.com
+*      Han Hu, hhu14@illinois.edu
+*      Jeffrey Lin, lin.jeff03@gmail.com
+*      Howard Hsu, haohsu0823@gmail.com
+*      Han Wang, hollywang@iis.sinica.edu.tw
+*/
+
+#include "HCITransport.h"
+
+
+/* State of the replay backend */
+static ReplaySource replay_source = {NULL, 1.0, false, NULL, false, 0,
+                                     false, false, 0, 0, 0, {0}, 0, 0};
+
+
+/*
+*  bluez_open_dev:
+*
+*  This function opens the HCI socket of the specified dongle.
+*
+*  Parameters:
+*
+*  dongle_device_id - ID of the dongle
+*
+*  Return value:
+*
+*  handle - socket of the dongle, negative on error
+*/
+static int bluez_open_dev(int dongle_device_id) {
+
+    if (0 > dongle_device_id) {
+        return -1;
+    }
+
+    return hci_open_dev(dongle_device_id);
+}
+
+
+/*
+*  bluez_set_filter:
+*
+*  This function installs the HCI event filter on the socket.
+*
+*  Parameters:
+*
+*  handle - socket of the dongle
+*  filter - the filter to be installed
+*
+*  Return value:
+*
+*  0 - success, negative on error
+*/
+static int bluez_set_filter(int handle, struct hci_filter *filter) {
+
+    return setsockopt(handle, SOL_HCI, HCI_FILTER, filter, sizeof(*filter));
+}
+
+
+/*
+*  bluez_poll_event:
+*
+*  This function waits for the socket to become readable.
+*
+*  Parameters:
+*
+*  handle - socket of the dongle
+*  timeout - time in milliseconds to wait, -1 waits forever
+*
+*  Return value:
+*
+*  Return value of poll
+*/
+static int bluez_poll_event(int handle, int timeout) {
+
+    struct pollfd output; /* A callback event from the socket */
+
+    output.fd = handle;
+    output.events = POLLIN | POLLERR | POLLHUP;
+    output.revents = 0;
+
+    return poll(&output, 1, timeout);
+}
+
+
+/*
+*  bluez_read_event:
+*
+*  This function reads one HCI packet from the socket.
+*
+*  Parameters:
+*
+*  handle - socket of the dongle
+*  buffer - buffer receiving the packet
+*  buffer_length - size of the buffer
+*
+*  Return value:
+*
+*  Return value of read
+*/
+static int bluez_read_event(int handle, unsigned char *buffer,
+                            int buffer_length) {
+
+    return read(handle, buffer, buffer_length);
+}
+
+
+HCITransport bluez_transport = {
+    "bluez",
+    bluez_open_dev,
+    bluez_set_filter,
+    hci_write_inquiry_mode,
+    hci_send_cmd,
+    bluez_poll_event,
+    bluez_read_event,
+    hci_close_dev
+};
+
+
+/*
+*  get_time_in_microseconds:
+*
+*  This helper function returns the wall clock time in microseconds.
+*
+*  Parameters:
+*
+*  None
+*
+*  Return value:
+*
+*  Current time in microseconds
+*/
+static long long get_time_in_microseconds() {
+
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+
+    return (long long)now.tv_sec * 1000000 + now.tv_usec;
+}
+
+
+/*
+*  read_big_endian:
+*
+*  This helper function decodes an unsigned big endian integer.
+*
+*  Parameters:
+*
+*  bytes - the encoded integer
+*  length - number of bytes in the integer
+*
+*  Return value:
+*
+*  The decoded value
+*/
+static unsigned long long read_big_endian(unsigned char *bytes, int length) {
+
+    unsigned long long value = 0;
+    int byte_id;
+
+    for (byte_id = 0; byte_id < length; byte_id++) {
+        value = (value << 8) | bytes[byte_id];
+    }
+
+    return value;
+}
+
+
+/*
+*  report_bad_record:
+*
+*  This helper function reports a record of the capture file that cannot
+*  be replayed, and marks the capture as corrupt.
+*
+*  Parameters:
+*
+*  offset - offset of the record in the file
+*  length - length of the packet given by the record
+*  reason - what is wrong with the record
+*
+*  Return value:
+*
+*  None
+*/
+static void report_bad_record(long offset, unsigned int length,
+                              char *reason) {
+
+    fprintf(stderr, "%s: %s at offset %ld, packet length %u\n",
+            replay_source.file_path, reason, offset, length);
+    replay_source.is_corrupt = true;
+}
+
+
+/*
+*  replay_next_packet:
+*
+*  This function reads records from the capture file until it finds an HCI
+*  event, and stores the event as the pending packet together with the time
+*  at which it should be handed to the scanner. A record cut short by the
+*  end of the file is reported and ends the capture; a packet that is not
+*  an event or does not fit the buffer means the file is corrupt.
+*
+*  Parameters:
+*
+*  None
+*
+*  Return value:
+*
+*  1 - an event is pending
+*  0 - the end of the file has been reached
+*  -1 - the capture file is corrupt
+*/
+static int replay_next_packet() {
+
+    ReplaySource *source = &replay_source;
+    unsigned char header[BTSNOOP_RECORD_HEADER_SIZE];
+    unsigned char *packet = source->pending;
+    long long offset; /* Time offset of the packet from the first one */
+    long record_offset; /* Offset of the record in the file */
+
+    while (true) {
+
+        record_offset = ftell(source->file);
+
+        if (source->is_btsnoop == false) {
+
+            /* Raw streams contain H4 event packets back to back */
+            if (1 != fread(packet, 3, 1, source->file)) {
+                return 0;
+            }
+
+            if (HCI_EVENT_PKT != packet[0]) {
+                report_bad_record(record_offset, packet[2],
+                                  "not an HCI event packet");
+                return -1;
+            }
+
+            if (packet[2] != fread(packet + 3, 1, packet[2], source->file)) {
+                fprintf(stderr, "%s: truncated packet at offset %ld\n",
+                        source->file_path, record_offset);
+                return 0;
+            }
+
+            source->pending_length = 3 + packet[2];
+            offset = source->packets * REPLAY_RAW_PACKET_INTERVAL * 1000;
+            break;
+
+        }
+
+        if (1 != fread(header, sizeof(header), 1, source->file)) {
+            return 0;
+        }
+
+        unsigned int included_length = read_big_endian(&header[4], 4);
+        unsigned int flags = read_big_endian(&header[8], 4);
+        long long timestamp = read_big_endian(&header[16], 8);
+        int data_offset = 0;
+
+        if (sizeof(source->pending) < included_length + 1) {
+            report_bad_record(record_offset, included_length,
+                              "packet longer than an HCI event");
+            return -1;
+        }
+
+        /* Un-encapsulated captures carry the packet type in the flags, so
+         * put the type byte in front to keep the H4 layout */
+        if (BTSNOOP_DATALINK_HCI == source->datalink) {
+            packet[0] = HCI_EVENT_PKT;
+            data_offset = 1;
+        }
+
+        if (included_length !=
+            fread(packet + data_offset, 1, included_length, source->file)) {
+            fprintf(stderr, "%s: truncated packet at offset %ld\n",
+                    source->file_path, record_offset);
+            return 0;
+        }
+
+        /* Only events sent by the controller are replayed */
+        if (BTSNOOP_DATALINK_HCI == source->datalink) {
+            if ((flags & BTSNOOP_FLAG_RECEIVED) == 0 ||
+                (flags & BTSNOOP_FLAG_COMMAND_OR_EVENT) == 0) {
+                continue;
+            }
+        }
+        else if (0 == included_length || HCI_EVENT_PKT != packet[0]) {
+            continue;
+        }
+
+        if (0 == source->packets) {
+            source->first_timestamp = timestamp;
+        }
+
+        source->pending_length = included_length + data_offset;
+        offset = timestamp - source->first_timestamp;
+        break;
+
+    }
+
+    if (0 == source->packets) {
+        source->start_time = get_time_in_microseconds();
+    }
+
+    if (0 < source->speed) {
+        source->pending_due_time =
+            source->start_time + (long long)(offset / source->speed);
+    }
+    else {
+        source->pending_due_time = 0;
+    }
+
+    source->packets++;
+
+    return 1;
+}
+
+
+/*
+*  hci_replay_configure:
+*
+*  This function selects the capture file replayed by the replay backend.
+*
+*  Parameters:
+*
+*  file_path - path of the btsnoop or raw capture file
+*  speed - replay speed, 1.0 is real time and 0 is as fast as possible
+*  loop - whether to start over at the end of the file
+*
+*  Return value:
+*
+*  None
+*/
+void hci_replay_configure(char *file_path, double speed, bool loop) {
+
+    replay_source.file_path = file_path;
+    replay_source.speed = speed;
+    replay_source.loop = loop;
+    replay_source.finished = false;
+    replay_source.is_corrupt = false;
+}
+
+
+/*
+*  replay_open_dev:
+*
+*  This function opens the capture file and checks whether it is a btsnoop
+*  file. Once the file has been replayed, it can only be opened again in
+*  loop mode so the scanner stops at the end of a capture.
+*
+*  Parameters:
+*
+*  dongle_device_id - ignored
+*
+*  Return value:
+*
+*  REPLAY_HANDLE - success, negative on error
+*/
+static int replay_open_dev(int dongle_device_id) {
+
+    ReplaySource *source = &replay_source;
+    unsigned char header[BTSNOOP_FILE_HEADER_SIZE];
+
+    if (NULL == source->file_path || source->is_corrupt == true ||
+        (source->finished == true && source->loop == false)) {
+        errno = ENODEV;
+        return -1;
+    }
+
+    source->file = fopen(source->file_path, "rb");
+
+    if (NULL == source->file) {
+        return -1;
+    }
+
+    source->is_btsnoop = false;
+    source->packets = 0;
+    source->pending_length = 0;
+
+    if (1 == fread(header, sizeof(header), 1, source->file) &&
+        0 == memcmp(header, BTSNOOP_MAGIC, 8)) {
+
+        source->is_btsnoop = true;
+        source->datalink = read_big_endian(&header[12], 4);
+
+        if (BTSNOOP_DATALINK_HCI != source->datalink &&
+            BTSNOOP_DATALINK_H4 != source->datalink) {
+            fclose(source->file);
+            source->file = NULL;
+            errno = EPROTONOSUPPORT;
+            return -1;
+        }
+
+    }
+    else {
+
+        rewind(source->file);
+
+    }
+
+    return REPLAY_HANDLE;
+}
+
+
+/*
+*  replay_set_filter:
+*
+*  The capture already contains only the events of interest, so there is
+*  nothing to filter.
+*
+*  Parameters:
+*
+*  handle - ignored
+*  filter - ignored
+*
+*  Return value:
+*
+*  0 - success
+*/
+static int replay_set_filter(int handle, struct hci_filter *filter) {
+
+    return 0;
+}
+
+
+/*
+*  replay_write_inquiry_mode:
+*
+*  The replayed controller has no inquiry mode to configure.
+*
+*  Parameters:
+*
+*  handle - ignored
+*  mode - ignored
+*  timeout - ignored
+*
+*  Return value:
+*
+*  0 - success
+*/
+static int replay_write_inquiry_mode(int handle, uint8_t mode, int timeout) {
+
+    return 0;
+}
+
+
+/*
+*  replay_send_cmd:
+*
+*  Commands are accepted and dropped, since the events that would answer
+*  them are already in the capture file.
+*
+*  Parameters:
+*
+*  handle - ignored
+*  ogf - ignored
+*  ocf - ignored
+*  plen - ignored
+*  param - ignored
+*
+*  Return value:
+*
+*  0 - success
+*/
+static int replay_send_cmd(int handle, uint16_t ogf, uint16_t ocf,
+                           uint8_t plen, void *param) {
+
+    return 0;
+}
+
+
+/*
+*  replay_poll_event:
+*
+*  This function waits until the next event of the capture is due. At the
+*  end of the file it reports the handle as readable so the scanner reads
+*  the end of the stream.
+*
+*  Parameters:
+*
+*  handle - ignored
+*  timeout - time in milliseconds to wait, -1 waits forever
+*
+*  Return value:
+*
+*  1 - an event or the end of the stream can be read
+*  0 - timeout
+*/
+static int replay_poll_event(int handle, int timeout) {
+
+    ReplaySource *source = &replay_source;
+    long long wait_time; /* Time in microseconds until the event is due */
+
+    if (0 == source->pending_length &&
+        (source->is_corrupt == true || replay_next_packet() != 1)) {
+        return 1;
+    }
+
+    wait_time = source->pending_due_time - get_time_in_microseconds();
+
+    if (0 < wait_time) {
+
+        if (0 <= timeout && (long long)timeout * 1000 < wait_time) {
+            usleep(timeout * 1000);
+            return 0;
+        }
+
+        usleep(wait_time);
+
+    }
+
+    return 1;
+}
+
+
+/*
+*  replay_read_event:
+*
+*  This function hands the pending event to the scanner.
+*
+*  Parameters:
+*
+*  handle - ignored
+*  buffer - buffer receiving the event
+*  buffer_length - size of the buffer
+*
+*  Return value:
+*
+*  Length of the event, 0 at the end of the file, -1 with errno set to
+*  EBADMSG when the capture file is corrupt
+*/
+static int replay_read_event(int handle, unsigned char *buffer,
+                             int buffer_length) {
+
+    ReplaySource *source = &replay_source;
+    int length = source->pending_length;
+
+    if (0 == length &&
+        (source->is_corrupt == true || replay_next_packet() != 1)) {
+
+        source->finished = true;
+
+        if (source->is_corrupt == true) {
+            errno = EBADMSG;
+            return -1;
+        }
+
+        return 0;
+
+    }
+
+    length = source->pending_length;
+
+    if (length > buffer_length) {
+        length = buffer_length;
+    }
+
+    memcpy(buffer, source->pending, length);
+    source->pending_length = 0;
+
+    return length;
+}
+
+
+/*
+*  replay_close_dev:
+*
+*  This function closes the capture file.
+*
+*  Parameters:
+*
+*  handle - ignored
+*
+*  Return value:
+*
+*  0 - success
+*/
+static int replay_close_dev(int handle) {
+
+    ReplaySource *source = &replay_source;
+
+    if (NULL != source->file) {
+        fclose(source->file);
+        source->file = NULL;
+    }
+
+    return 0;
+}
+
+
+HCITransport replay_transport = {
+    "replay",
+    replay_open_dev,
+    replay_set_filter,
+    replay_write_inquiry_mode,
+    replay_send_cmd,
+    replay_poll_event,
+    replay_read_event,
+    replay_close_dev
+};
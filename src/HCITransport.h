@@ -0,0 +1,205 @@
+/*
+* Copyright (c) 2016 Academia Sinica, Institute of Information Science
+*
+* License:
+*
+*      GPL 3.0 : The content of this file is subject to the terms and
+*      conditions defined in file 'COPYING.txt', which is part of this source
+*      code package.
+*
+* Project Name:
+*
+*      BeDIPS
+*
+* File Description:
+*
+*      This header file contains the function declarations and
+*      variables used in the HCITransport.c file.
+*
+* File Name:
+*
+*      HCITransport.h
+*
+* Abstract:
+*
+*      BeDIPS uses LBeacons to deliver 3D coordinates and textual
+*      descriptions of their locations to users' devices. Basically, a LBeacon
+*      is an inexpensive, Bluetooth Smart Ready device. The 3D coordinates and
+*      location description of every LBeacon are retrieved from BeDIS
+*      (Building/environment Data and Information System) and stored locally
+*      during deployment and maintenance times. Once initialized, each LBeacon
+*      broadcasts its coordinates and location description to Bluetooth
+*      enabled user devices within its coverage area.
+*
+* Authors:
+*
+*      Jake Lee, jakelee@iis.sinica.edu.tw
+*      Johnson Su, johnsonsu@iis.sinica.edu.tw
+*      Shirley Huang, shirley.huang.93@gmail.com
+*      Han Hu, hhu14@illinois.edu
+*      Jeffrey Lin, lin.jeff03@gmail.com
+*      Howard Hsu, haohsu0823@gmail.com
+*      Han Wang, hollywang@iis.sinica.edu.tw
+*/
+
+#ifndef HCITRANSPORT_H
+#define HCITRANSPORT_H
+
+#include <bluetooth/bluetooth.h>
+#include <bluetooth/hci.h>
+#include <bluetooth/hci_lib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+
+/*
+* CONSTANTS
+*/
+
+/* Magic bytes at the start of every btsnoop capture file */
+#define BTSNOOP_MAGIC "btsnoop\0"
+
+/* Length of the btsnoop file header (magic, version, datalink type) */
+#define BTSNOOP_FILE_HEADER_SIZE 16
+
+/* Length of the header in front of every btsnoop packet record */
+#define BTSNOOP_RECORD_HEADER_SIZE 24
+
+/* btsnoop datalink type for un-encapsulated HCI packets */
+#define BTSNOOP_DATALINK_HCI 1001
+
+/* btsnoop datalink type for HCI UART (H4) packets */
+#define BTSNOOP_DATALINK_H4 1002
+
+/* btsnoop record flag: packet was received by the host */
+#define BTSNOOP_FLAG_RECEIVED 0x01
+
+/* btsnoop record flag: packet is a command or an event */
+#define BTSNOOP_FLAG_COMMAND_OR_EVENT 0x02
+
+/* Microseconds between 0 AD and the Unix epoch, used by btsnoop timestamps */
+#define BTSNOOP_EPOCH_DELTA 0x00dcddb30f2f8000LL
+
+/* Time in milliseconds between two packets of a raw capture file replayed at
+ * normal speed, since raw files carry no timestamps */
+#define REPLAY_RAW_PACKET_INTERVAL 10
+
+/* Handle returned by the replay backend, there is only one replay source */
+#define REPLAY_HANDLE 0
+
+
+
+/*
+* TYPEDEF STRUCTS
+*/
+
+/* Operations used by start_scanning() to talk to a Bluetooth controller.
+ * Every HCI backend fills in one of these so the scanning loop does not
+ * depend on where the HCI events come from. */
+typedef struct HCITransport {
+    /* Name of the backend, used in log messages */
+    char *name;
+
+    /* Open the device and return a handle, or a negative value on error */
+    int (*open_dev)(int dongle_device_id);
+
+    /* Install the event filter on the handle */
+    int (*set_filter)(int handle, struct hci_filter *filter);
+
+    /* Configure the inquiry mode of the controller */
+    int (*write_inquiry_mode)(int handle, uint8_t mode, int timeout);
+
+    /* Send an HCI command to the controller */
+    int (*send_cmd)(int handle, uint16_t ogf, uint16_t ocf, uint8_t plen,
+                    void *param);
+
+    /* Wait at most timeout milliseconds (-1 forever) for an event. Returns
+     * a positive value when an event can be read, 0 on timeout */
+    int (*poll_event)(int handle, int timeout);
+
+    /* Copy the next event, packet type byte first, into the buffer. Returns
+     * its length, 0 at the end of the stream, or a negative value on error */
+    int (*read_event)(int handle, unsigned char *buffer, int buffer_length);
+
+    /* Release the handle */
+    int (*close_dev)(int handle);
+} HCITransport;
+
+
+/* Settings and state of the replay backend */
+typedef struct ReplaySource {
+    /* Path of the btsnoop or raw capture file */
+    char *file_path;
+
+    /* Replay speed, 1.0 is real time, 0 replays as fast as possible */
+    double speed;
+
+    /* Start again from the first packet at the end of the file */
+    bool loop;
+
+    /* Capture file being replayed */
+    FILE *file;
+
+    /* True for btsnoop files, false for raw H4 event streams */
+    bool is_btsnoop;
+
+    /* btsnoop datalink type of the file */
+    unsigned int datalink;
+
+    /* Whether the file has been replayed once already */
+    bool finished;
+
+    /* Whether a corrupt record was found, which ends the replay even in
+     * loop mode */
+    bool is_corrupt;
+
+    /* Capture timestamp of the first packet in microseconds */
+    long long first_timestamp;
+
+    /* Wall clock time in microseconds when the first packet was replayed */
+    long long start_time;
+
+    /* Number of packets replayed so far from the current pass */
+    long long packets;
+
+    /* Event waiting to be read, packet type byte first */
+    unsigned char pending[HCI_MAX_EVENT_SIZE + 1];
+
+    /* Length of the pending event, 0 when nothing is pending */
+    int pending_length;
+
+    /* Wall clock time in microseconds at which the pending event is due */
+    long long pending_due_time;
+} ReplaySource;
+
+
+
+/*
+* GLOBAL VARIABLES
+*/
+
+/* Backend talking to a real dongle through BlueZ */
+extern HCITransport bluez_transport;
+
+/* Backend replaying a recorded or synthetic capture file */
+extern HCITransport replay_transport;
+
+
+
+/*
+* FUNCTIONS
+*/
+
+void hci_replay_configure(char *file_path, double speed, bool loop);
+
+#endif
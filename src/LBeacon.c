@@ -49,121 +49,6 @@
 #include "LBeacon.h"
 
 
-/*
-*  get_config:
-*
-*  This function goes through the config file, reads line by line until the
-*  end of file, and stores the data into the global variable of a Config 
-*  struct.
-*
-*  Parameters:
-*
-*  file_name - the name of the config file that stores all the beacon data
-*
-*  Return value:
-*
-*  config - Config struct including file path, coordinates, etc.
-*/
-Config get_config(char *file_name) {
-    
-    /* Return value that contains a struct of all config information */
-    Config config;
-
-    FILE *file = fopen(file_name, "r");
-    if (file == NULL) {
-        
-        /* Error handling */
-        perror(errordesc[E_OPEN_FILE].message);
-        cleanup_exit();
-        return;
-    
-    }
-    else {
-    /* Create spaces for storing the string of the current line being read */
-    char config_setting[CONFIG_BUFFER_SIZE];
-    char *config_message[11];
-
-     /* Keep reading each line and store into the config struct */
-    fgets(config_setting, sizeof(config_setting), file);
-    config_message[0] = strstr((char *)config_setting, DELIMITER);
-    config_message[0] = config_message[0] + strlen(DELIMITER);
-    memcpy(config.coordinate_X, config_message[0],
-           strlen(config_message[0]));
-    config.coordinate_X_length = strlen(config_message[0]);
-    
-    fgets(config_setting, sizeof(config_setting), file);
-    config_message[1] = strstr((char *)config_setting, DELIMITER);
-    config_message[1] = config_message[1] + strlen(DELIMITER);
-    memcpy(config.coordinate_Y, config_message[1],
-           strlen(config_message[1]));
-    config.coordinate_Y_length = strlen(config_message[1]);
-    
-    fgets(config_setting, sizeof(config_setting), file);
-    config_message[2] = strstr((char *)config_setting, DELIMITER);
-    config_message[2] = config_message[2] + strlen(DELIMITER);
-    memcpy(config.coordinate_Z, config_message[2],
-           strlen(config_message[2]));
-    config.coordinate_Z_length = strlen(config_message[2]);
-    
-    fgets(config_setting, sizeof(config_setting), file);
-    config_message[3] = strstr((char *)config_setting, DELIMITER);
-    config_message[3] = config_message[3] + strlen(DELIMITER);
-    memcpy(config.file_name, config_message[3], strlen(config_message[3]));
-    config.file_name_length = strlen(config_message[3]);
-    
-    fgets(config_setting, sizeof(config_setting), file);
-    config_message[4] = strstr((char *)config_setting, DELIMITER);
-    config_message[4] = config_message[4] + strlen(DELIMITER);
-    memcpy(config.file_path, config_message[4], strlen(config_message[4]));
-    config.file_path_length = strlen(config_message[4]);
-    
-    fgets(config_setting, sizeof(config_setting), file);
-    config_message[5] = strstr((char *)config_setting, DELIMITER);
-    config_message[5] = config_message[5] + strlen(DELIMITER);
-    memcpy(config.maximum_number_of_devices, config_message[5],
-           strlen(config_message[5]));
-    config.maximum_number_of_devices_length = strlen(config_message[5]);
-    
-    fgets(config_setting, sizeof(config_setting), file);
-    config_message[6] = strstr((char *)config_setting, DELIMITER);
-    config_message[6] = config_message[6] + strlen(DELIMITER);
-    memcpy(config.number_of_groups, config_message[6],
-           strlen(config_message[6]));
-    config.number_of_groups_length = strlen(config_message[6]);
-    
-    fgets(config_setting, sizeof(config_setting), file);
-    config_message[7] = strstr((char *)config_setting, DELIMITER);
-    config_message[7] = config_message[7] + strlen(DELIMITER);
-    memcpy(config.number_of_messages, config_message[7],
-           strlen(config_message[7]));
-    config.number_of_messages_length = strlen(config_message[7]);
-    
-    fgets(config_setting, sizeof(config_setting), file);
-    config_message[8] = strstr((char *)config_setting, DELIMITER);
-    config_message[8] = config_message[8] + strlen(DELIMITER);
-    memcpy(config.number_of_push_dongles, config_message[8],
-           strlen(config_message[8]));
-    config.number_of_push_dongles_length = strlen(config_message[8]);
-    
-    fgets(config_setting, sizeof(config_setting), file);
-    config_message[9] = strstr((char *)config_setting, DELIMITER);
-    config_message[9] = config_message[9] + strlen(DELIMITER);
-    memcpy(config.rssi_coverage, config_message[9],
-           strlen(config_message[9]));
-    config.rssi_coverage_length = strlen(config_message[9]);
-    
-    fgets(config_setting, sizeof(config_setting), file);
-    config_message[10] = strstr((char *)config_setting, DELIMITER);
-    config_message[10] = config_message[10] + strlen(DELIMITER);
-    memcpy(config.uuid, config_message[10], strlen(config_message[10]));
-    config.uuid_length = strlen(config_message[10]);
-    
-    fclose(file);
-    }
-
-    return config;
-}
-
 /*
 *  get_system_time:
 *
@@ -198,9 +83,9 @@ long long get_system_time() {
 *
 *  For each newly scanned bluetooth device, this function adds the Scanned 
 *  Device struct of the device to the scanned list of ScannedDevice struct 
-*  that stores  its scanned timestamp and MAC address and to the waiting list 
-*  of MAC addresses  waiting for an available thread to send a message to the 
-*  device with the address.
+*  that stores  its scanned timestamp and MAC address and puts a PushJob in 
+*  the waiting queue, where it waits for an available thread to send a 
+*  message to the device with the address.
 *
 *  Parameters:
 *
@@ -212,29 +97,94 @@ long long get_system_time() {
 */
 void send_to_push_dongle(bdaddr_t *bluetooth_device_address) {
     
-    /* Stores the MAC address as a string */
-    char address[LENGTH_OF_MAC_ADDRESS];
-    
-    /* Converts the bluetooth device address to a string */
-    ba2str(bluetooth_device_address, address);
-    strcat(address, "\0");
+    /* The packed address used as the key of the scanned table */
+    uint64_t key = bdaddr_to_key(bluetooth_device_address);
     
+    pthread_mutex_lock(&scanned_list_lock);
+
+    ScannedDevice *data = device_table_lookup(&scanned_table, key);
+
+    /* During an emergency broadcast, a device queued before the broadcast
+     * started is queued again */
+    if (data != NULL) {
+
+        if (broadcast.is_active == true && data->epoch != broadcast.epoch) {
+            queue_broadcast_push(data);
+        }
+
+    }
+
     /* Add newly scanned devices to the scanned list and waiting list for new
      * scanned devices */
-    if (check_is_in_list(scanned_list, address) == false) {       
+    else {       
         
-        ScannedDevice data;
-        data.initial_scanned_time = get_system_time();
-        strncpy(data.scanned_mac_address, address, LENGTH_OF_MAC_ADDRESS); 
-        struct Node *node_s, *node_w;
-        node_s = (struct Node*)malloc(sizeof(struct Node));
-        node_w = (struct Node*)malloc(sizeof(struct Node));
-        list_insert_first(&node_s->ptrs, scanned_list);
-        list_insert_first(&node_w->ptrs, waiting_list);
-        node_s->data = &data;
-        node_w->data = &data;
+        PushJob job;
+        int priority;
+        data = (ScannedDevice *)memory_pool_alloc(&scanned_device_pool);
+
+        /* In fail-fast mode the pool does not grow; the device is queued
+         * again the next time it is scanned after a record is released */
+        if (data == NULL) {
+
+            pthread_mutex_unlock(&scanned_list_lock);
+            return;
+
+        }
+
+        data->initial_scanned_time = get_system_time();
+        bacpy(&data->scanned_device_address, bluetooth_device_address);
+        data->epoch = broadcast.epoch;
+        job.initial_scanned_time = data->initial_scanned_time;
+        bacpy(&job.scanned_device_address, bluetooth_device_address);
+        job.epoch = broadcast.epoch;
+        job.attempts = 0;
+
+        /* The scanner never waits for the push pipeline. When the
+         * waiting queue is full, the device is not recorded, so it is
+         * queued again the next time it is scanned. A device refusing
+         * advertisements is recorded without being queued, so it is
+         * checked again once it has been out of range for TIMEOUT. */
+        get_active_message(&priority);
+
+        if (priority == PRIORITY_ADVERTISEMENT &&
+            blocklist_is_blocked(&blocklist, bluetooth_device_address,
+                                 data->initial_scanned_time) == true) {
+
+            /* Skip the push, but remember the device as seen */
+            data->pending_priority = STATE_SNAPSHOT_NOT_PENDING;
+
+        }
+        else if (queue_try_enqueue(&waiting_queue, &job, priority) != 0) {
+
+            memory_pool_release(&scanned_device_pool, data);
+            pthread_mutex_unlock(&scanned_list_lock);
+            return;
+
+        }
+        else {
+
+            data->pending_priority = priority;
+
+        }
+
+        if (broadcast.is_active == true) {
+            broadcast.number_of_targets++;
+        }
+
+        device_table_insert(&scanned_table, key, data);
+        mark_state_changed();
+
+        /* Wake up the cleanup thread if it is waiting for a first device */
+        if (scanned_wheel.size == 0) {
+            pthread_cond_signal(&scanned_list_cond);
+        }
+
+        timing_wheel_add(&scanned_wheel, &data->timer,
+                         data->initial_scanned_time + TIMEOUT);
         
     }
+
+    pthread_mutex_unlock(&scanned_list_lock);
 }
 
 
@@ -288,264 +238,200 @@ void print_RSSI_value(bdaddr_t *bluetooth_device_address, bool has_rssi,
 *
 *  This function tracks the MAC addresses of scanned bluetooth devices under
 *  the beacon. An output file will contain for each timestamp and the MAC
-*  addresses of the scanned bluetooth devices at the given timestamp.
+*  addresses of the scanned bluetooth devices at the given timestamp. The
+*  file is written by the tracking writer thread, so the scanning thread
+*  never touches the file.
 *
 *  Parameters:
 *
 *  bluetooth_device_address - bluetooth device address
-*  file_name - name of the file where all the data will be stored
 *
 *  Return value:
 *
 *  None
 */
-void track_devices(bdaddr_t *bluetooth_device_address, char *file_name) {
-    /* Scanned MAC address */
-    char address[LENGTH_OF_MAC_ADDRESS];
+void track_devices(bdaddr_t *bluetooth_device_address) {
 
-    /* Converts long long type to a string */
-    char long_long_to_string[LENGTH_OF_TIME];
-    char long_long_to_string_init[LENGTH_OF_TIME];
- 
     /* Get current timestamp when tracking bluetooth devices */
     unsigned timestamp = (unsigned)time(NULL);
-    sprintf(long_long_to_string, "%u", timestamp);
 
-    /* If file is empty, create new file with LBeacon UUID */
-    if (0 == g_size_of_file) {
-    
-        FILE *output = fopen(file_name, "w+"); /* w+ overwrites the file */
-    
-        if (output == NULL) {
-    
-            /* Error handling */
-            perror(errordesc[E_OPEN_FILE].message);
-            return;
-    
-        }
-    
-        fputs("LBeacon UUID: ", output);
-        fputs(g_config.uuid, output);
-        fclose(output);
-        g_size_of_file++;
-        g_initial_timestamp_of_tracking_file = timestamp;
-        sprintf(long_long_to_string_init, "%u",
-                g_initial_timestamp_of_tracking_file);
-        memset(&address[0], 0, sizeof(address));
-    
-    }
+    tracking_writer_record(&tracking_writer, bluetooth_device_address,
+                           timestamp);
+}
 
-    /* Converts the bluetooth device address to a string */
-    ba2str(bluetooth_device_address, address);
-    strcat(address, "\0");
+/*
+*  compile_message_group_frame:
+*
+*  This function compiles the Eddystone-UID frame of the beacon. Its
+*  namespace is the first 10 bytes of the uuid of the config file, and its
+*  instance holds the floor, then the priority level and the index of the
+*  message every push sends at the moment.
+*
+*  Parameters:
+*
+*  payload - the advertising data compiled
+*
+*  Return value:
+*
+*  0 - success
+*  -1 - the uuid of the config file is invalid
+*/
+int compile_message_group_frame(le_set_advertising_data_cp *payload) {
+
+    uint8_t uuid[UUID_SIZE]; /* UUID of the config file */
+    uint8_t instance[EDDYSTONE_INSTANCE_SIZE]; /* Instance of the frame */
+    Message *message; /* Message pushed at the moment */
+    int priority; /* Priority level of the message */
+    int floor = (int)coordinate_Z.f;
+    int message_id = 0xffffff; /* Index of the message, all ones if none */
+    Config *config = config_store_get(&config_store);
+
+    if (0 > advertising_parse_uuid(config->uuid, strlen(config->uuid),
+                                   uuid)) {
+        return -1;
+    }
 
-    FILE *output;
-    char line[TRACKING_FILE_LINE_LENGTH ];
-    output = fopen(file_name, "a+"); /* a+ appends to the file */
+    message = get_active_message(&priority);
 
-    if (output == NULL) {
-    
-        /* Error handling */
-        perror(errordesc[E_OPEN_FILE].message);
-        return;
-    
+    if (message != NULL) {
+        message_id = message - message_store.messages;
     }
 
-    /* Go through the whole file to get to the last line */
-    while (fgets(line, TRACKING_FILE_LINE_LENGTH , output) != NULL) {
-    }
+    instance[0] = (floor >> 8) & 0xff;
+    instance[1] = floor & 0xff;
+    instance[2] = priority;
+    instance[3] = (message_id >> 16) & 0xff;
+    instance[4] = (message_id >> 8) & 0xff;
+    instance[5] = message_id & 0xff;
 
-    /* If timestamp already exists, add MAC address to end of the previous 
-     * line otherwise create a new line */
-    if (timestamp != g_most_recent_timestamp_of_tracking_file) {
-        fputs("\n", output);
-        fputs(long_long_to_string, output);
-        fputs(" - ", output);
-        fputs(long_long_to_string_init, output);
-        fputs(" - ", output);
-        fputs(address, output);
-        fclose(output);
+    return advertising_compile_eddystone_uid(payload, uuid, instance,
+                                             RSSI_VALUE);
+}
 
-        g_most_recent_timestamp_of_tracking_file = timestamp;
-        g_size_of_file++;
-    }
-    else {
-    
-        /* Double check that the MAC address is not already added at a given
-        * timestamp */
-        if (strstr(line, address) == NULL) {
-    
-            fputs(", ", output);
-            fputs(address, output);
-        }
-        fclose(output);
-    }
 
-    /* Send to gateway every TIME_INTERVAL_OF_SEND_TO_GATEWAY minutes */
-    if (TIME_INTERVAL_OF_SEND_TO_GATEWAY <=
-        timestamp - g_initial_timestamp_of_tracking_file) {
-        
-        g_size_of_file = 0;
-        g_most_recent_timestamp_of_tracking_file = 0;
-        /* @todo: send to gateway function */
-    
+/*
+*  update_message_group_frame:
+*
+*  This function advertises the message that is active now in the
+*  Eddystone-UID frame, with at most one HCI command.
+*
+*  Parameters:
+*
+*  None
+*
+*  Return value:
+*
+*  None
+*/
+void update_message_group_frame() {
+
+    le_set_advertising_data_cp payload; /* New Eddystone-UID frame */
+
+    if (message_group_frame < 0 ||
+        0 > compile_message_group_frame(&payload)) {
+        return;
     }
+
+    advertising_scheduler_set_frame(&advertising_scheduler,
+                                    message_group_frame, &payload);
 }
 
+
 /*
-*  check_is_in_list:
+*  format_beacon_location:
 *
-*  This helper function checks whether the specified MAC address given as 
-*  input is in the scanned list with recently scanned bluetooth devices. If 
-*  it is, the function returns true, else the function returns false.
+*  This function writes the UUID, major and minor of the iBeacon frame:
+*  a fixed prefix followed by the bytes of the X and Y coordinates.
 *
 *  Parameters:
 *
-*  list - the list is goning to check 
-*  address - scanned MAC address of bluetooth device
-* 
+*  beacon_location - buffer receiving 40 hexadecimal digits
+*
 *  Return value:
 *
-*  true - used MAC address
-*  false - new MAC address
+*  None
 */
-bool check_is_in_list(List_Entry *list, char address[]) {
-    
-    /* Create a temporary node and set as the head */
-    struct List_Entry *listptrs;
-    Node *temp;
-
-    /* Go through list */
-    list_for_each(listptrs, list) {
-
-        /* Input MAC address exists in the linked list */
-        temp = ListEntry(listptrs, Node, ptrs);       
-        int len = strlen(address);
-        ScannedDevice *temp_data; 
-        temp_data = (struct ScannedDevice *)temp->data;
-        
-        if (strcmp(address, &temp_data->scanned_mac_address[len + 10]) > 0) {
-        
-            return true;
-        
-        }
-               
-    }
+void format_beacon_location(char *beacon_location) {
 
-    /* Input MAC address is new and unused */
-    return false;
+    sprintf(beacon_location,
+            "E2C56DB5DFFB48D2B060D0F5%02x%02x%02x%02x%02x%02x%02x%02x",
+            coordinate_X.b[0], coordinate_X.b[1], coordinate_X.b[2],
+            coordinate_X.b[3], coordinate_Y.b[0], coordinate_Y.b[1],
+            coordinate_Y.b[2], coordinate_Y.b[3]);
 }
 
 
-
 /*
- *  print_linked_list:
- *
- *  This function prints all the MAC addresses in the list. When printing, 
- *  the MAC addresses will be in the order of starting from the first node
- *  to the last in the list.
- *
- *  Parameters:
- *
- *  entry - the head of the list for determining which list is goning to be
- *  printed.
- *
- *  Return value:
- *
- *  None
- */
-void print_list(List_Entry *entry) {
-
-    /*Check whether the list is empty */
-    if (get_list_length(entry) == 0 ) {
+*  update_location_frames:
+*
+*  This function advertises the coordinates and location URL of the config
+*  in use, after a reload changed them. The Eddystone-URL frame can only
+*  be added or removed on restart.
+*
+*  Parameters:
+*
+*  None
+*
+*  Return value:
+*
+*  None
+*/
+void update_location_frames() {
+
+    char beacon_location[CONFIG_BUFFER_SIZE]; /* iBeacon UUID, major, minor */
+    uint8_t beacon_id[ALTBEACON_ID_SIZE]; /* Identifier of the AltBeacon */
+    le_set_advertising_data_cp payload;   /* Frame compiled again */
+    Config *config = config_store_get(&config_store);
+
+    coordinate_X.f = config->coordinate_X;
+    coordinate_Y.f = config->coordinate_Y;
+    coordinate_Z.f = config->coordinate_Z;
+
+    if (ibeacon_frame < 0) {
         return;
     }
 
-    struct List_Entry *listptrs = NULL;
-    struct Node *node;
-    
-    for (listptrs = (entry)->next; listptrs != (entry);
-        listptrs = listptrs->next) {
-        
-        node = ListEntry(listptrs, Node, ptrs);
-        ScannedDevice *data;
-        data = (struct ScannedDevice *)node->data;
-        printf("%s ", &data->scanned_mac_address[0]);
-    
+    format_beacon_location(beacon_location);
+
+    if (0 == advertising_compile_ibeacon(&payload, beacon_location,
+                                         RSSI_VALUE)) {
+        advertising_scheduler_set_frame(&advertising_scheduler,
+                                        ibeacon_frame, &payload);
     }
-    
-    printf("\n");
 
-}
+    if (altbeacon_frame >= 0 &&
+        0 == advertising_parse_uuid(config->uuid, strlen(config->uuid),
+                                    beacon_id)) {
 
+        memcpy(&beacon_id[UUID_SIZE], coordinate_Z.b, sizeof(float));
+        advertising_compile_altbeacon(&payload, beacon_id, RSSI_VALUE);
+        advertising_scheduler_set_frame(&advertising_scheduler,
+                                        altbeacon_frame, &payload);
 
-/*
- *  get_head_content:
- *
- *  This function peeks at the head of the list. If the list is empty, it 
- *  returns NULL because it doesn't exist. Otherwise, this function returns
- *  the MAC address of the node at the head of the list.
- *
- *  Parameters:
- *
- *  entry - the head of the list for determining which list is goning to be 
- *  modified.
- *
- *  Return value:
- *
- *  return_value - MAC address of the fist node.
- */
-char *get_head_entry(List_Entry *entry) {
-
-    /*Check whether the list is empty */
-    if (get_list_length(entry) == 0 ) {
-        return NULL;
     }
 
-    struct Node *node = ListEntry(entry->next, Node, ptrs);
-    ScannedDevice *data;
-    data = (struct ScannedDevice *) node->data;
-    char *address = &data->scanned_mac_address[0];
-    
-
-    return address;
-}
+    /* The floor is part of the Eddystone-UID frame */
+    update_message_group_frame();
 
+    if (location_url_frame < 0 || config->location_url[0] == '\0') {
 
-/*
- *  free_list:
- *
- *  This function frees the resources of the list.
- *
- *  Parameters:
- *
- *  entry - the head of the list for determining which list is goning to be 
- *  modified.
- *
- *  Return value:
- *
- *  None
- */
-void free_list(List_Entry *entry){
-
-    /*Check whether the list is empty */
-    if (get_list_length(entry) == 0 ) {
+        if ((location_url_frame < 0) != (config->location_url[0] == '\0')) {
+            printf("location_url is only added or removed on restart\n");
+        }
         return;
-    }
-
-    struct List_Entry *listptrs;
-    Node *temp;
-
-    list_for_each(listptrs, entry){
-        
-        temp = ListEntry(listptrs, Node, ptrs);
-        free(temp);
-        temp = NULL;
 
     }
 
-    free(entry);
-
+    if (0 == advertising_compile_eddystone_url(&payload,
+                                               config->location_url,
+                                               RSSI_VALUE)) {
+        advertising_scheduler_set_frame(&advertising_scheduler,
+                                        location_url_frame, &payload);
+    }
+    else {
+        /* Error handling */
+        perror("Location URL does not fit in an Eddystone-URL frame");
+    }
 }
 
 
@@ -553,7 +439,12 @@ void free_list(List_Entry *entry){
 *  enable_advertising:
 *
 *  This function enables the LBeacon to start advertising, sets the time
-*  interval for advertising, and calibrates the RSSI value.
+*  interval for advertising, and calibrates the RSSI value. The beacon
+*  takes turns advertising an iBeacon frame with the X and Y coordinates,
+*  an AltBeacon frame with the uuid of the config file and the Z
+*  coordinate, an Eddystone-UID frame with the floor and the active
+*  message, and an Eddystone-URL frame with the location description URL
+*  when the config file has one.
 *
 *  Parameters:
 *
@@ -567,155 +458,82 @@ void free_list(List_Entry *entry){
 *  0 - If advertising was successfullly enabled, then the function returns 0.
 */
 int enable_advertising(int advertising_interval, char *advertising_uuid,
-    
-
     int rssi_value) {
-    
-    int dongle_device_id = hci_get_route(NULL);
-    int device_handle = 0;
-    
-    if ((device_handle = hci_open_dev(dongle_device_id)) < 0) {
+
+    le_set_advertising_data_cp payload; /* Compiled advertising data */
+    uint8_t beacon_id[ALTBEACON_ID_SIZE]; /* Identifier of the AltBeacon */
+    Config *config = config_store_get(&config_store);
+
+    if (0 > advertising_compile_ibeacon(&payload, advertising_uuid,
+                                        rssi_value)) {
         /* Error handling */
-        perror("Error opening device");
+        perror("Invalid beacon data");
         return (1);
     }
-    
-    le_set_advertising_parameters_cp advertising_parameters_copy;
-    memset(&advertising_parameters_copy, 0,
-        sizeof(advertising_parameters_copy));
-    advertising_parameters_copy.min_interval = htobs(advertising_interval);
-    advertising_parameters_copy.max_interval = htobs(advertising_interval);
-    advertising_parameters_copy.chan_map = 7;
-
-    uint8_t status;
-    struct hci_request request;
-    memset(&request, 0, sizeof(request));
-    request.ogf = OGF_LE_CTL;
-    request.ocf = OCF_LE_SET_ADVERTISING_PARAMETERS;
-    request.cparam = &advertising_parameters_copy;
-    request.clen = LE_SET_ADVERTISING_PARAMETERS_CP_SIZE;
-    request.rparam = &status;
-    request.rlen = 1;
-
-     int return_value = hci_send_req(device_handle, &request,
-                                    HCI_SEND_REQUEST_TIMEOUT);
-    if (return_value < 0) {
-       
-        /* Error handling */
-        hci_close_dev(device_handle);
-        fprintf(stderr, "Can't send request %s (%d)\n", strerror(errno),
-                errno);
+
+    if (0 > advertising_init(&advertising_controller, -1)) {
         return (1);
-    
     }
 
-    le_set_advertise_enable_cp advertisement_copy;
-    memset(&advertisement_copy, 0, sizeof(advertisement_copy));
-    advertisement_copy.enable = 0x01;
+    advertising_scheduler_init(&advertising_scheduler,
+                               &advertising_controller,
+                               advertising_interval);
+    ibeacon_frame =
+        advertising_scheduler_add_frame(&advertising_scheduler, &payload);
 
-    memset(&request, 0, sizeof(request));
-    request.ogf = OGF_LE_CTL;
-    request.ocf = OCF_LE_SET_ADVERTISE_ENABLE;
-    request.cparam = &advertisement_copy;
-    request.clen = LE_SET_ADVERTISE_ENABLE_CP_SIZE;
-    request.rparam = &status;
-    request.rlen = 1;
+    if (0 == advertising_parse_uuid(config->uuid, strlen(config->uuid),
+                                    beacon_id)) {
 
-     return_value = hci_send_req(device_handle, &request,
-                                HCI_SEND_REQUEST_TIMEOUT);
+        memcpy(&beacon_id[UUID_SIZE], coordinate_Z.b, sizeof(float));
+        advertising_compile_altbeacon(&payload, beacon_id, rssi_value);
+        altbeacon_frame =
+            advertising_scheduler_add_frame(&advertising_scheduler,
+                                            &payload);
 
-    if (return_value < 0) {
-       
-        /* Error handling */
-        hci_close_dev(device_handle);
-        fprintf(stderr, "Can't send request %s (%d)\n", strerror(errno),
-                errno);
-        return (1);
-    
-    }
+        compile_message_group_frame(&payload);
+        message_group_frame =
+            advertising_scheduler_add_frame(&advertising_scheduler,
+                                            &payload);
 
-    le_set_advertising_data_cp advertisement_data_copy;
-    memset(&advertisement_data_copy, 0, sizeof(advertisement_data_copy));
-
-    uint8_t segment_length = 1;
-    advertisement_data_copy
-        .data[advertisement_data_copy.length + segment_length] =
-        htobs(EIR_FLAGS);
-    segment_length++;
-    advertisement_data_copy
-        .data[advertisement_data_copy.length + segment_length] = htobs(0x1A);
-    segment_length++;
-    advertisement_data_copy.data[advertisement_data_copy.length] =
-        htobs(segment_length - 1);
-
-    advertisement_data_copy.length += segment_length;
-
-    segment_length = 1;
-    advertisement_data_copy
-        .data[advertisement_data_copy.length + segment_length] =
-        htobs(EIR_MANUFACTURE_SPECIFIC_DATA);
-    segment_length++;
-    advertisement_data_copy
-        .data[advertisement_data_copy.length + segment_length] = htobs(0x4C);
-    segment_length++;
-    advertisement_data_copy
-        .data[advertisement_data_copy.length + segment_length] = htobs(0x00);
-    segment_length++;
-    advertisement_data_copy
-        .data[advertisement_data_copy.length + segment_length] = htobs(0x02);
-    segment_length++;
-    advertisement_data_copy
-        .data[advertisement_data_copy.length + segment_length] = htobs(0x15);
-    segment_length++;
-
-    unsigned int *uuid = uuid_str_to_data(advertising_uuid);
-    int uuid_iterator;
-    
-    for (uuid_iterator = 0; uuid_iterator < strlen(advertising_uuid) / 2;
-        uuid_iterator++) {
-        advertisement_data_copy
-            .data[advertisement_data_copy.length + segment_length] =
-            htobs(uuid[uuid_iterator]);
-        segment_length++;
-    
     }
+    else {
 
-    /* RSSI calibration */
-    advertisement_data_copy
-        .data[advertisement_data_copy.length + segment_length] =
-        htobs(twoc(rssi_value, 8));
-    segment_length++;
+        /* Error handling */
+        perror("Invalid uuid in the config file");
 
-    advertisement_data_copy.data[advertisement_data_copy.length] =
-        htobs(segment_length - 1);
+    }
 
-    advertisement_data_copy.length += segment_length;
+    if (config->location_url[0] != '\0') {
 
-    memset(&request, 0, sizeof(request));
-    request.ogf = OGF_LE_CTL;
-    request.ocf = OCF_LE_SET_ADVERTISING_DATA;
-    request.cparam = &advertisement_data_copy;
-    request.clen = LE_SET_ADVERTISING_DATA_CP_SIZE;
-    request.rparam = &status;
-    request.rlen = 1;
+        if (0 == advertising_compile_eddystone_url(&payload,
+                                                   config->location_url,
+                                                   rssi_value)) {
+            location_url_frame =
+                advertising_scheduler_add_frame(&advertising_scheduler,
+                                                &payload);
+        }
+        else {
+            /* Error handling */
+            perror("Location URL does not fit in an Eddystone-URL frame");
+        }
 
-    return_value = hci_send_req(device_handle, &request,
-                                HCI_SEND_REQUEST_TIMEOUT);
+    }
 
-    hci_close_dev(device_handle);
+    if (0 > advertising_scheduler_start(&advertising_scheduler)) {
 
-    if (return_value < 0) {
         /* Error handling */
-        fprintf(stderr, "Can't send request %s (%d)\n", strerror(errno),
-                errno);
+        ibeacon_frame = -1;
+        altbeacon_frame = -1;
+        message_group_frame = -1;
+        location_url_frame = -1;
+        advertising_free(&advertising_controller);
         return (1);
-    }
 
-    if (status) {
-        /* Error handling */
-        fprintf(stderr, "LE set advertise returned status %d\n", status);
-        return (1);
     }
+
+    advertising_scheduler_print_statistics(&advertising_scheduler);
+
+    return (0);
 }
 
 
@@ -734,59 +552,28 @@ int enable_advertising(int advertising_interval, char *advertising_uuid,
 *  0 - If advertising was successfullly disabled, 0 is returned.
 */
 int disable_advertising() {
-    
-    int dongle_device_id = hci_get_route(NULL);
-    int device_handle = 0;
-    
-    if ((device_handle = hci_open_dev(dongle_device_id)) < 0) {
-        /* Error handling */
-        perror("Could not open device");
-        return (1);
-    }
-
-    le_set_advertise_enable_cp advertisement_copy;
-    uint8_t status;
 
-    memset(&advertisement_copy, 0, sizeof(advertisement_copy));
+    int return_value = advertising_scheduler_stop(&advertising_scheduler);
 
-    struct hci_request request;
-    memset(&request, 0, sizeof(request));
-    request.ogf = OGF_LE_CTL;
-    request.ocf = OCF_LE_SET_ADVERTISE_ENABLE;
-    request.cparam = &advertisement_copy;
-    request.clen = LE_SET_ADVERTISE_ENABLE_CP_SIZE;
-    request.rparam = &status;
-    request.rlen = 1;
-
-    int return_value = hci_send_req(device_handle, &request,
-                                    HCI_SEND_REQUEST_TIMEOUT);
-
-    hci_close_dev(device_handle);
-
-    if (return_value < 0) {
-        
-        /* Error handling */
-        fprintf(stderr, "Can't set advertise mode: %s (%d)\n",
-                strerror(errno), errno);
-        return (1);
-    
-    }
+    ibeacon_frame = -1;
+    altbeacon_frame = -1;
+    message_group_frame = -1;
+    location_url_frame = -1;
+    advertising_scheduler_print_statistics(&advertising_scheduler);
+    advertising_print_statistics(&advertising_controller);
+    advertising_scheduler_free(&advertising_scheduler);
+    advertising_free(&advertising_controller);
 
-    if (status) {
-        
-        /* Error handling */
-        fprintf(stderr, "LE set advertise enable on returned status %d\n",
-            status);
-        return (1);
-    
-    }
+    return return_value < 0 ? 1 : 0;
 }
 
+
 /*
 *  ble_beacon:
 *
 *  This function allows avertising to be stopped with ctrl-c if
-*  enable_advertising was a success.
+*  enable_advertising was a success. Meanwhile it rotates the advertising
+*  frames and applies the interval and TX power chosen for the crowd.
 *
 *  Parameters:
 *
@@ -797,28 +584,36 @@ int disable_advertising() {
 *  None
 */
 void *ble_beacon(void *beacon_location) {
-    
+
+    int interval; /* Advertising interval chosen for the crowd */
+    int tx_power; /* TX power chosen for the crowd */
+
     int enable_advertising_success =
         enable_advertising(ADVERTISING_INTERVAL, beacon_location,
                            RSSI_VALUE);
 
     if (enable_advertising_success == 0) {
-        
-        struct sigaction sigint_handler;
-        sigint_handler.sa_handler = ctrlc_handler;
-        sigemptyset(&sigint_handler.sa_mask);
-        sigint_handler.sa_flags = 0;
-
-        if (sigaction(SIGINT, &sigint_handler, NULL) == -1) {
-            /* Error handling */
-            perror("sigaction error");
-            return;
-        }
 
+        /* Ctrl-C is received by the control_messages thread, which sets
+         * g_done */
         perror("Hit ctrl-c to stop advertising");
 
         while (g_done == false) {
-            sleep(1);
+
+            usleep(ADVERTISING_ROTATION_INTERVAL * 1000);
+
+            /* The main thread cancels this thread on shutdown, which must
+             * not happen in the middle of an HCI command */
+            pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+            advertising_scheduler_rotate(&advertising_scheduler);
+
+            if (adaptive_advertising_get_settings(&adaptive_advertising,
+                                                  &interval, &tx_power)) {
+                advertising_scheduler_set_parameters(&advertising_scheduler,
+                                                     interval, tx_power);
+            }
+            pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+
         }
 
         /* When signal is received, disable message advertising */
@@ -838,49 +633,406 @@ void *ble_beacon(void *beacon_location) {
 
 
 /*
-*  cleanup_scanned_list:
+*  remove_scanned_devices:
 *
-*  This function determines when scernned Device struct of each discovered
-*  device remains in the seanned list for at most TIME_IN_SCANNED_LIST sec
-*  scanned data of device in the scanned list. In the background, This work
-*  thread continuously check the scanned list. If so, the ScannedDevice
-*  struct will be removed.
+*  This helper function removes the devices of the expired list from the
+*  scanned table and frees them. The caller holds scanned_list_lock.
 *
 *  Parameters:
 *
-*  None
+*  expired - head of the list of expired timer entries
 *
 *  Return value:
 *
 *  None
 */
-void *cleanup_scanned_list(void) {
-    
+void remove_scanned_devices(List_Entry *expired) {
 
-    while (ready_to_work == true) {
-        
-        struct List_Entry *listptrs;
-        Node *temp;        
-        /* Go through list */
-        list_for_each(listptrs, scanned_list){
-            
-            temp = ListEntry(listptrs, Node, ptrs);
-            ScannedDevice *temp_data;
-            temp_data = (struct ScannedDevice *)temp->data;
-           
-            /* Device has been in the scanned list for at least 30 seconds */
-            if (get_system_time() - temp_data->initial_scanned_time > TIMEOUT) {
-                
-                list_remove_node(&temp->ptrs);
-                free(temp);
-              
-            }
-            else {
-                break;
-            }
-        }
+    ScannedDevice *temp_data;
+
+    while (expired->next != expired) {
+
+        temp_data = ListEntry(expired->next, ScannedDevice, timer.ptrs);
+        list_remove_node(&temp_data->timer.ptrs);
+
+        device_table_remove(&scanned_table, bdaddr_to_key(
+                            &temp_data->scanned_device_address));
+        memory_pool_release(&scanned_device_pool, temp_data);
+        mark_state_changed();
 
     }
+}
+
+
+/*
+*  mark_state_changed:
+*
+*  This function records a change of the state saved in the snapshots: a
+*  device added to or expired from the scanned list, a push becoming
+*  pending or no longer pending, or a channel added to the cache.
+*
+*  Parameters:
+*
+*  None
+*
+*  Return value:
+*
+*  None
+*/
+void mark_state_changed() {
+
+    __atomic_add_fetch(&state_generation, 1, __ATOMIC_RELAXED);
+}
+
+
+/*
+*  clear_pending_push:
+*
+*  This function records that the device in the scanned list no longer
+*  waits for a push, so a snapshot does not queue it again.
+*
+*  Parameters:
+*
+*  bluetooth_device_address - bluetooth device address
+*
+*  Return value:
+*
+*  None
+*/
+void clear_pending_push(bdaddr_t *bluetooth_device_address) {
+
+    ScannedDevice *data;
+
+    pthread_mutex_lock(&scanned_list_lock);
+
+    data = device_table_lookup(&scanned_table,
+                               bdaddr_to_key(bluetooth_device_address));
+
+    if (data != NULL &&
+        data->pending_priority != STATE_SNAPSHOT_NOT_PENDING) {
+        data->pending_priority = STATE_SNAPSHOT_NOT_PENDING;
+        mark_state_changed();
+    }
+
+    pthread_mutex_unlock(&scanned_list_lock);
+}
+
+
+/*
+*  add_channel_to_snapshot:
+*
+*  This function adds an entry of the channel cache to a snapshot. It is
+*  called on each entry by channel_cache_for_each.
+*
+*  Parameters:
+*
+*  key - packed address of the device
+*  channel - Object Push channel of the device
+*  expiry_time - time in milliseconds the entry expires
+*  snapshot - the StateSnapshot being taken
+*
+*  Return value:
+*
+*  None
+*/
+void add_channel_to_snapshot(uint64_t key, int channel, long long expiry_time,
+    void *snapshot) {
+
+    state_snapshot_add_channel((StateSnapshot *)snapshot, key, channel,
+                               expiry_time);
+}
+
+
+/*
+*  save_state:
+*
+*  This function writes a snapshot of the scanned list and the channel
+*  cache. The pushes waiting in the queues are saved as the devices of the
+*  scanned list whose push is pending, so a restarted LBeacon queues them
+*  again and does not push again the devices it already served. Nothing
+*  is written when the state has not changed since the last snapshot.
+*
+*  Parameters:
+*
+*  None
+*
+*  Return value:
+*
+*  0 - success, or the state has not changed
+*  -1 - the snapshot could not be taken or written
+*/
+int save_state() {
+
+    StateSnapshot snapshot;    /* Snapshot taken in memory */
+    ScannedDevice *data;       /* Device of the scanned list */
+    int position = 0;          /* Position in the scanned table */
+    int return_value;
+    unsigned int generation;   /* Generation of the state saved */
+    long long now = get_system_time();
+
+    pthread_mutex_lock(&state_snapshot_lock);
+
+    /* Changes made while the snapshot is taken bump the generation past
+     * the one read here, so they are saved by the next snapshot */
+    generation = __atomic_load_n(&state_generation, __ATOMIC_RELAXED);
+
+    if (generation == saved_state_generation) {
+        number_of_unchanged_snapshots++;
+        pthread_mutex_unlock(&state_snapshot_lock);
+        return 0;
+    }
+
+    pthread_mutex_lock(&scanned_list_lock);
+
+    if (state_snapshot_init(&snapshot, scanned_table.size,
+                            channel_cache.capacity) != 0) {
+
+        pthread_mutex_unlock(&scanned_list_lock);
+        pthread_mutex_unlock(&state_snapshot_lock);
+        return -1;
+
+    }
+
+    while ((data = device_table_get_next(&scanned_table,
+                                         &position)) != NULL) {
+
+        state_snapshot_add_device(&snapshot,
+                                  bdaddr_to_key(
+                                      &data->scanned_device_address),
+                                  data->initial_scanned_time,
+                                  data->pending_priority);
+
+    }
+
+    pthread_mutex_unlock(&scanned_list_lock);
+
+    channel_cache_for_each(&channel_cache, add_channel_to_snapshot,
+                           &snapshot, now);
+
+    return_value = state_snapshot_write(&snapshot, STATE_SNAPSHOT_FILE_NAME,
+                                        now);
+    state_snapshot_free(&snapshot);
+
+    if (return_value == 0) {
+        saved_state_generation = generation;
+        number_of_snapshots++;
+    }
+
+    pthread_mutex_unlock(&state_snapshot_lock);
+
+    return return_value;
+}
+
+
+/*
+*  restore_state:
+*
+*  This function puts back the scanned list and the channel cache saved by
+*  the last run, before any thread starts. Devices and channels that have
+*  expired since are skipped, and the devices whose push was pending are
+*  queued again in the order they were scanned. The snapshot file is read
+*  in place through a read only mapping.
+*
+*  Parameters:
+*
+*  None
+*
+*  Return value:
+*
+*  None
+*/
+void restore_state() {
+
+    StateSnapshot snapshot;        /* Snapshot of the last run */
+    StateSnapshotDevice *saved;    /* Device of the snapshot */
+    StateSnapshotChannel *channel; /* Channel of the snapshot */
+    ScannedDevice *data;           /* Device put back in the scanned list */
+    PushJob job;                   /* Pending push queued again */
+    bdaddr_t address;              /* Address of the device */
+    uint32_t record_id;
+    int number_of_devices = 0;
+    int number_of_pushes = 0;
+    int number_of_channels = 0;
+    long long now = get_system_time();
+
+    if (state_snapshot_map(&snapshot, STATE_SNAPSHOT_FILE_NAME) != 0) {
+
+        if (errno != ENOENT) {
+            /* Error handling */
+            perror("Ignoring the saved state");
+        }
+        return;
+
+    }
+
+    pthread_mutex_lock(&scanned_list_lock);
+
+    for (record_id = 0; record_id < snapshot.header.number_of_devices;
+         record_id++) {
+
+        saved = &snapshot.devices[record_id];
+
+        if (saved->scanned_time + TIMEOUT <= now ||
+            saved->scanned_time > now ||
+            device_table_lookup(&scanned_table, saved->key) != NULL) {
+            continue;
+        }
+
+        data = (ScannedDevice *)memory_pool_alloc(&scanned_device_pool);
+
+        if (data == NULL) {
+            break;
+        }
+
+        key_to_bdaddr(saved->key, &address);
+        data->initial_scanned_time = saved->scanned_time;
+        bacpy(&data->scanned_device_address, &address);
+        data->epoch = broadcast.epoch;
+        data->pending_priority = STATE_SNAPSHOT_NOT_PENDING;
+
+        if (saved->priority >= 0 && saved->priority < NUMBER_OF_PRIORITIES) {
+
+            job.initial_scanned_time = saved->scanned_time;
+            bacpy(&job.scanned_device_address, &address);
+            job.epoch = broadcast.epoch;
+            job.attempts = 0;
+
+            if (queue_try_enqueue(&waiting_queue, &job,
+                                  saved->priority) == 0) {
+                data->pending_priority = saved->priority;
+                number_of_pushes++;
+            }
+
+        }
+
+        device_table_insert(&scanned_table, saved->key, data);
+        timing_wheel_add(&scanned_wheel, &data->timer,
+                         data->initial_scanned_time + TIMEOUT);
+        number_of_devices++;
+
+    }
+
+    pthread_mutex_unlock(&scanned_list_lock);
+
+    for (record_id = 0; record_id < snapshot.header.number_of_channels;
+         record_id++) {
+
+        channel = &snapshot.channels[record_id];
+
+        if (channel->expiry_time > now) {
+            key_to_bdaddr(channel->key, &address);
+            channel_cache_restore(&channel_cache, &address,
+                                  channel->channel, channel->expiry_time);
+            number_of_channels++;
+        }
+
+    }
+
+    printf("Restored %d scanned devices, %d pending pushes and %d channels "
+           "saved %lld s ago in %lld ms\n", number_of_devices,
+           number_of_pushes, number_of_channels,
+           (now - snapshot.header.saved_time) / 1000,
+           get_system_time() - now);
+
+    state_snapshot_free(&snapshot);
+}
+
+
+/*
+*  save_state_periodically:
+*
+*  This function saves the state every state_snapshot_interval
+*  milliseconds of the config, so a crash loses little of it. The main
+*  thread cancels it on shutdown, which never happens in the middle of a
+*  snapshot.
+*
+*  Parameters:
+*
+*  arg - not used
+*
+*  Return value:
+*
+*  None
+*/
+void *save_state_periodically(void *arg) {
+
+    struct timespec delay;     /* Time until the next snapshot */
+    int interval;              /* Interval in milliseconds of the config */
+
+    while (ready_to_work == true) {
+
+        /* Read at each turn, so a reload changes the interval */
+        interval =
+            config_store_get(&config_store)->state_snapshot_interval;
+        delay.tv_sec = interval / 1000;
+        delay.tv_nsec = (long)(interval % 1000) * 1000000;
+        nanosleep(&delay, NULL);
+
+        pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+        save_state();
+        pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+
+    }
+
+    return NULL;
+}
+
+
+/*
+*  cleanup_scanned_list:
+*
+*  This function removes the ScannedDevice struct of each discovered device
+*  from the scanned list once it has been there for TIMEOUT milliseconds.
+*  The devices are kept in a timing wheel, so this work thread sleeps until
+*  the next slot of the wheel is due and then only visits the devices
+*  expiring in that slot. When the scanned list is empty, the thread sleeps
+*  until a device is added.
+*
+*  Parameters:
+*
+*  None
+*
+*  Return value:
+*
+*  None
+*/
+void *cleanup_scanned_list(void) {
+    
+    List_Entry expired;          /* Devices whose time is up */
+    long long next_deadline;     /* Time the next slot of the wheel is due */
+    struct timespec wake_up_time; /* next_deadline as a timespec */
+
+    pthread_mutex_lock(&scanned_list_lock);
+
+    while (ready_to_work == true) {
+        
+        expired.next = &expired;
+        expired.prev = &expired;
+
+        timing_wheel_expire(&scanned_wheel, get_system_time(), &expired);
+        remove_scanned_devices(&expired);
+
+        next_deadline = timing_wheel_next_deadline(&scanned_wheel);
+
+        if (next_deadline < 0) {
+
+            pthread_cond_wait(&scanned_list_cond, &scanned_list_lock);
+
+        }
+        else {
+
+            /* get_system_time() follows the realtime clock, which is the
+             * clock used by pthread_cond_timedwait */
+            wake_up_time.tv_sec = next_deadline / 1000;
+            wake_up_time.tv_nsec = (next_deadline % 1000) * 1000000;
+            pthread_cond_timedwait(&scanned_list_cond, &scanned_list_lock,
+                                   &wake_up_time);
+
+        }
+
+    }
+
+    pthread_mutex_unlock(&scanned_list_lock);
     
     /* Exiting this thread and sending message to main thread by using pthread
      * exit and join. */
@@ -891,253 +1043,1513 @@ void *cleanup_scanned_list(void) {
 
 
 /*
-*  queue_to_array:
+*  get_active_message:
+*
+*  This function returns the message of the highest active priority level,
+*  which is the message every push sends at the moment.
+*
+*  Parameters:
+*
+*  priority - receives the priority level of the message
+*
+*  Return value:
+*
+*  message - the message to be pushed
+*/
+Message *get_active_message(int *priority) {
+
+    Message *message = NULL;
+    int priority_id;
+
+    pthread_mutex_lock(&active_message_lock);
+
+    for (priority_id = 0; priority_id < NUMBER_OF_PRIORITIES;
+         priority_id++) {
+
+        if (active_messages[priority_id] != NULL) {
+            message = active_messages[priority_id];
+            break;
+        }
+
+    }
+
+    pthread_mutex_unlock(&active_message_lock);
+
+    *priority = priority_id;
+
+    return message;
+}
+
+
+/*
+*  set_active_message:
+*
+*  This function activates or deactivates the message of a priority level.
+*  When a level is activated, the devices already waiting at lower levels
+*  are moved up to it, so they are sent to before any device queued later
+*  at a lower level. Activating the evacuation level also starts an
+*  emergency broadcast.
+*
+*  Parameters:
+*
+*  priority - the priority level
+*  message - the message to be pushed at this level, NULL to deactivate it
+*
+*  Return value:
+*
+*  None
+*/
+void set_active_message(int priority, Message *message) {
+
+    int number_of_promoted = 0;
+
+    pthread_mutex_lock(&active_message_lock);
+    active_messages[priority] = message;
+    pthread_mutex_unlock(&active_message_lock);
+
+    if (message != NULL) {
+
+        number_of_promoted = queue_promote(&waiting_queue, priority);
+        printf("Activated %s message %s, %d waiting devices promoted\n",
+               priority_groups[priority], message->name, number_of_promoted);
+
+    }
+    else {
+
+        printf("Deactivated %s message\n", priority_groups[priority]);
+
+    }
+
+    /* Beacon receivers learn the message from the Eddystone-UID frame */
+    update_message_group_frame();
+
+    /* An evacuation message has to reach everyone in range */
+    if (priority == PRIORITY_EVACUATION) {
+
+        if (message != NULL) {
+            start_broadcast();
+        }
+        else {
+            stop_broadcast();
+        }
+
+    }
+}
+
+
+/*
+*  control_messages:
+*
+*  This function waits for the signals activating the messages of the
+*  emergency groups. SIGUSR1 toggles the first evacuation message and
+*  SIGUSR2 toggles the first warning message. SIGHUP reloads the config
+*  file. SIGINT and SIGTERM stop advertising and scanning, so the main
+*  thread shuts the beacon down and saves its state; a second one exits at
+*  once. The signals are blocked in every other thread.
+*
+*  Parameters:
+*
+*  arg - not used
+*
+*  Return value:
+*
+*  None
+*/
+void *control_messages(void *arg) {
+
+    sigset_t signals;   /* Signals handled by this thread */
+    int signal_number;  /* Signal received */
+    int priority;       /* Priority level toggled by the signal */
+    Message *message;
+
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGUSR1);
+    sigaddset(&signals, SIGUSR2);
+    sigaddset(&signals, SIGHUP);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+
+    /* The main thread cancels this thread once the beacon is shut down */
+    while (true) {
+
+        if (sigwait(&signals, &signal_number) != 0) {
+            continue;
+        }
+
+        if (signal_number == SIGHUP) {
+            reload_config();
+            continue;
+        }
+
+        if (signal_number == SIGINT || signal_number == SIGTERM) {
+
+            if (ready_to_work == false) {
+                printf("Exiting without finishing the shutdown\n");
+                exit(EXIT_FAILURE);
+            }
+
+            printf("Shutting down\n");
+            g_done = true;
+            ready_to_work = false;
+            continue;
+
+        }
+
+        priority = (signal_number == SIGUSR1) ?
+                   PRIORITY_EVACUATION : PRIORITY_WARNING;
+
+        pthread_mutex_lock(&active_message_lock);
+        message = active_messages[priority];
+        pthread_mutex_unlock(&active_message_lock);
+
+        if (message == NULL) {
+
+            message = message_store_find_group(&message_store,
+                                               priority_groups[priority]);
+
+            if (message == NULL) {
+                printf("No %s message to activate\n",
+                       priority_groups[priority]);
+                continue;
+            }
+
+            set_active_message(priority, message);
+
+        }
+        else {
+
+            set_active_message(priority, NULL);
+
+        }
+
+        queue_print_statistics(&waiting_queue, "waiting");
+
+    }
+
+    return NULL;
+}
+
+
+/*
+*  reload_config:
+*
+*  This function reads the config file again and applies it without
+*  stopping the scanner or the push threads. The scanner reads the RSSI
+*  coverage of the config in use for every result and the connect threads
+*  read the maximum number of devices before each push, so those apply
+*  at once; the location frames and the advertising bounds are updated
+*  here. An invalid config file is reported and ignored.
+*
+*  Parameters:
+*
+*  None
+*
+*  Return value:
+*
+*  None
+*/
+void reload_config() {
+
+    Config *config;
+
+    if (config_store_reload(&config_store, CONFIG_FILE_NAME) != 0) {
+        return;
+    }
+
+    config = config_store_get(&config_store);
+
+    if (config->maximum_number_of_devices > number_of_connect_threads &&
+        g_use_push_engine == false) {
+        printf("Only %d devices are handled at once until restart\n",
+               number_of_connect_threads);
+    }
+
+    update_location_frames();
+
+    adaptive_advertising_set_bounds(&adaptive_advertising,
+                                    config->minimum_advertising_interval *
+                                    8 / 5,
+                                    config->maximum_advertising_interval *
+                                    8 / 5,
+                                    config->minimum_tx_power,
+                                    config->maximum_tx_power,
+                                    config->full_discovery_rate,
+                                    config->advertising_hysteresis,
+                                    config->advertising_hold_time);
+
+    printf("Reloaded %s\n", CONFIG_FILE_NAME);
+}
+
+
+/*
+*  queue_broadcast_push:
+*
+*  This function queues a device of the scanned list at the evacuation
+*  priority for the current emergency broadcast. The caller holds the
+*  scanned list lock.
+*
+*  Parameters:
+*
+*  device - the device
+*
+*  Return value:
+*
+*  true - the device is queued
+*  false - the evacuation level of the waiting queue is full
+*/
+bool queue_broadcast_push(ScannedDevice *device) {
+
+    PushJob job;
+
+    job.initial_scanned_time = get_system_time();
+    bacpy(&job.scanned_device_address, &device->scanned_device_address);
+    job.epoch = broadcast.epoch;
+    job.attempts = 0;
+
+    /* If the queue is full, the device keeps its old epoch and is queued
+     * the next time it is scanned */
+    if (queue_try_enqueue(&waiting_queue, &job, PRIORITY_EVACUATION) != 0) {
+        return false;
+    }
+
+    device->epoch = broadcast.epoch;
+    device->pending_priority = PRIORITY_EVACUATION;
+    mark_state_changed();
+    broadcast.number_of_targets++;
+
+    return true;
+}
+
+
+/*
+*  start_broadcast:
+*
+*  This function starts an emergency broadcast. Every device seen during
+*  the last TIMEOUT milliseconds is queued again, and until the broadcast
+*  stops, every device scanned is pushed once even if it is in the scanned
+*  list already. All the threads of the push pipeline, and so all the push
+*  dongles, take the devices from the waiting queue.
+*
+*  Parameters:
+*
+*  None
+*
+*  Return value:
+*
+*  None
+*/
+void start_broadcast() {
+
+    ScannedDevice *device;
+    int position = 0;
+
+    pthread_mutex_lock(&scanned_list_lock);
+
+    memset(broadcast.coverage_times, 0, sizeof(broadcast.coverage_times));
+    broadcast.is_active = true;
+    broadcast.epoch++;
+    broadcast.start_time = get_system_time();
+    broadcast.number_of_targets = 0;
+    broadcast.number_of_reached = 0;
+
+    while ((device = device_table_get_next(&scanned_table, &position))
+           != NULL) {
+        queue_broadcast_push(device);
+    }
+
+    printf("Emergency broadcast started, %d devices in range queued\n",
+           broadcast.number_of_targets);
+
+    pthread_mutex_unlock(&scanned_list_lock);
+}
+
+
+/*
+*  stop_broadcast:
+*
+*  This function stops the emergency broadcast and prints its coverage.
+*
+*  Parameters:
+*
+*  None
+*
+*  Return value:
+*
+*  None
+*/
+void stop_broadcast() {
+
+    pthread_mutex_lock(&scanned_list_lock);
+    broadcast.is_active = false;
+    pthread_mutex_unlock(&scanned_list_lock);
+
+    print_broadcast_coverage();
+}
+
+
+/*
+*  is_push_superseded:
+*
+*  This function tells whether a device taken from the waiting queue was
+*  queued again by the emergency broadcast, in which case this older push
+*  is skipped.
+*
+*  Parameters:
+*
+*  job - the device taken from the waiting queue
+*
+*  Return value:
+*
+*  true - the device is waiting again for the current broadcast
+*  false - the device has to be pushed
+*/
+bool is_push_superseded(PushJob *job) {
+
+    ScannedDevice *device;
+    bool is_superseded = false;
+
+    pthread_mutex_lock(&scanned_list_lock);
+
+    if (broadcast.is_active == true && job->epoch != broadcast.epoch) {
+
+        device = device_table_lookup(&scanned_table,
+                    bdaddr_to_key(&job->scanned_device_address));
+        is_superseded = (device != NULL && device->epoch == broadcast.epoch);
+
+    }
+
+    pthread_mutex_unlock(&scanned_list_lock);
+
+    return is_superseded;
+}
+
+
+/*
+*  record_broadcast_push:
+*
+*  This function counts a device reached by the emergency broadcast and
+*  records when each coverage level is reached.
+*
+*  Parameters:
+*
+*  job - the device the message was pushed to
+*
+*  Return value:
+*
+*  None
+*/
+void record_broadcast_push(PushJob *job) {
+
+    int level_id;
+    long long elapsed_time;
+
+    pthread_mutex_lock(&scanned_list_lock);
+
+    if (broadcast.is_active == false || job->epoch != broadcast.epoch) {
+        pthread_mutex_unlock(&scanned_list_lock);
+        return;
+    }
+
+    broadcast.number_of_reached++;
+    elapsed_time = get_system_time() - broadcast.start_time;
+
+    for (level_id = 0; level_id < NUMBER_OF_COVERAGE_LEVELS; level_id++) {
+
+        if (broadcast.coverage_times[level_id] == 0 &&
+            broadcast.number_of_reached * 100 >=
+            coverage_levels[level_id] * broadcast.number_of_targets) {
+
+            /* Keep 0 for levels not reached */
+            broadcast.coverage_times[level_id] =
+                (elapsed_time > 0) ? elapsed_time : 1;
+            printf("Emergency broadcast reached %d%% of %d devices in "
+                   "%lld ms\n", coverage_levels[level_id],
+                   broadcast.number_of_targets, elapsed_time);
+
+        }
+
+    }
+
+    pthread_mutex_unlock(&scanned_list_lock);
+}
+
+
+/*
+*  print_broadcast_coverage:
+*
+*  This function prints the number of devices reached by the last
+*  emergency broadcast and the time it took to reach each coverage level.
+*
+*  Parameters:
+*
+*  None
+*
+*  Return value:
+*
+*  None
+*/
+void print_broadcast_coverage() {
+
+    int level_id;
+
+    pthread_mutex_lock(&scanned_list_lock);
+
+    if (broadcast.epoch == 0) {
+        pthread_mutex_unlock(&scanned_list_lock);
+        return;
+    }
+
+    printf("Emergency broadcast %d: %d of %d devices reached\n",
+           broadcast.epoch, broadcast.number_of_reached,
+           broadcast.number_of_targets);
+
+    for (level_id = 0; level_id < NUMBER_OF_COVERAGE_LEVELS; level_id++) {
+
+        if (broadcast.coverage_times[level_id] == 0) {
+            printf("  %d%%: not reached\n", coverage_levels[level_id]);
+        }
+        else {
+            printf("  %d%%: %lld ms\n", coverage_levels[level_id],
+                   broadcast.coverage_times[level_id]);
+        }
+
+    }
+
+    pthread_mutex_unlock(&scanned_list_lock);
+}
+
+
+/*
+*  record_stage_time:
+*
+*  This function adds the time a job spent in a stage of the push pipeline
+*  to the statistics of the stage.
+*
+*  Parameters:
+*
+*  statistics - statistics of the stage
+*  time - time in milliseconds the stage took for the job
+*  is_successful - whether the stage succeeded
+*
+*  Return value:
+*
+*  None
+*/
+void record_stage_time(StageStatistics *statistics, long long time,
+                       bool is_successful) {
+
+    int bucket = 0;                  /* Histogram bucket of the time */
+    long long now = get_system_time();
+
+    while (bucket < STAGE_HISTOGRAM_BUCKETS - 1 && (time >> bucket) != 0) {
+        bucket++;
+    }
+
+    pthread_mutex_lock(&statistics->lock);
+
+    if (statistics->number_of_jobs == 0) {
+        statistics->first_time = now;
+    }
+
+    statistics->number_of_jobs++;
+    statistics->total_time += time;
+    statistics->histogram[bucket]++;
+    statistics->last_time = now;
+
+    if (is_successful == false) {
+        statistics->number_of_failures++;
+    }
+
+    if (time > statistics->maximum_time) {
+        statistics->maximum_time = time;
+    }
+
+    pthread_mutex_unlock(&statistics->lock);
+}
+
+
+/*
+*  print_stage_statistics:
+*
+*  This function prints the number of jobs and the average and maximum time
+*  of a stage of the push pipeline. The time a stage takes divided by the
+*  time of the slowest stage tells how many threads it needs.
+*
+*  Parameters:
+*
+*  statistics - statistics of the stage
+*
+*  Return value:
+*
+*  None
+*/
+void print_stage_statistics(StageStatistics *statistics) {
+
+    int percentiles[] = {50, 90, 99};
+    int percentile_id;
+    int bucket;
+    long long number_of_jobs;        /* Jobs up to the current bucket */
+    long long elapsed_time;
+
+    pthread_mutex_lock(&statistics->lock);
+
+    if (statistics->number_of_jobs > 0) {
+
+        printf("Stage %s: %lld jobs, %lld failed, average %lld ms, "
+               "maximum %lld ms\n", statistics->name,
+               statistics->number_of_jobs, statistics->number_of_failures,
+               statistics->total_time / statistics->number_of_jobs,
+               statistics->maximum_time);
+
+        /* A percentile is bounded by the upper end of the bucket in which
+         * it falls */
+        printf("  ");
+
+        for (percentile_id = 0; percentile_id < 3; percentile_id++) {
+
+            number_of_jobs = 0;
+
+            for (bucket = 0; bucket < STAGE_HISTOGRAM_BUCKETS - 1;
+                 bucket++) {
+
+                number_of_jobs += statistics->histogram[bucket];
+
+                if (number_of_jobs * 100 >= statistics->number_of_jobs *
+                    percentiles[percentile_id]) {
+                    break;
+                }
+
+            }
+
+            printf("p%d < %lld ms, ", percentiles[percentile_id],
+                   1LL << bucket);
+
+        }
+
+        elapsed_time = statistics->last_time - statistics->first_time;
+        printf("%.2f jobs/s\n", elapsed_time > 0 ?
+               (statistics->number_of_jobs - 1) * 1000.0 / elapsed_time :
+               0.0);
+
+    }
+
+    pthread_mutex_unlock(&statistics->lock);
+}
+
+
+/*
+*  finish_push:
+*
+*  This function records the end of a push on the balancer and in the
+*  statistics of the whole push, from the start of the connection to the
+*  end of the transfer or the failure.
+*
+*  Parameters:
+*
+*  job - the device pushed to
+*  is_successful - whether the message was sent
+*
+*  Return value:
+*
+*  None
+*/
+void finish_push(PushJob *job, bool is_successful) {
+
+    long long now = get_system_time();
+
+    balancer_finish(&push_balancer, job->push_dongle,
+                    now - job->connect_start_time, is_successful, now);
+    record_stage_time(&push_statistics, now - job->connect_start_time,
+                      is_successful);
+
+    if (is_successful == true) {
+        clear_pending_push(&job->scanned_device_address);
+    }
+
+    if (is_successful == true && g_hci_transport == &simulator_transport) {
+        crowd_simulator_record_push(&job->scanned_device_address, now);
+    }
+}
+
+
+/*
+*  finish_engine_push:
+*
+*  This function is called by the push engines for each finished transfer.
+*  It records the outcome like the connect and transfer stages do.
+*
+*  Parameters:
+*
+*  item - the PushJob of the device
+*  result - outcome of the transfer
+*  connect_time - time in milliseconds the connection took
+*  transfer_time - time in milliseconds the rest of the transfer took
+*  context - not used
+*
+*  Return value:
+*
+*  None
+*/
+void finish_engine_push(void *item, PushResult result, long long connect_time,
+                        long long transfer_time, void *context) {
+
+    PushJob *job = (PushJob *)item;
+
+    record_stage_time(&connect_statistics, connect_time,
+                      result != PUSH_CONNECT_FAILED);
+
+    if (result != PUSH_CONNECT_FAILED) {
+        record_stage_time(&transfer_statistics, transfer_time,
+                          result == PUSH_SUCCEEDED);
+    }
+
+    finish_push(job, result == PUSH_SUCCEEDED);
+
+    switch (result) {
+
+        case PUSH_SUCCEEDED:
+            blocklist_record_success(&blocklist,
+                                     &job->scanned_device_address);
+            record_broadcast_push(job);
+            break;
+
+        case PUSH_CONNECT_FAILED:
+            channel_cache_invalidate(&channel_cache,
+                                     &job->scanned_device_address);
+            retry_push(job, job->priority, FAILURE_CONNECT);
+            break;
+
+        case PUSH_PUT_FAILED:
+            retry_push(job, job->priority, FAILURE_PUT);
+            break;
+
+    }
+}
+
+
+/*
+*  push_devices:
+*
+*  This function replaces the connect and transfer stages when the push
+*  engine is used. One thread per push dongle takes the devices the
+*  balancer gives to the dongle and pushes to several of them at once,
+*  up to the number of links of the dongle. The engine sleeps until one of
+*  its sockets is ready or the balancer signals the eventfd of the dongle,
+*  and at most DONGLE_STEAL_INTERVAL, so it still fails the transfers that
+*  take too long and finds the devices of stalled dongles.
+*
+*  Parameters:
+*
+*  id - index of the push dongle in the balancer
+*
+*  Return value:
+*
+*  None
+*/
+void *push_devices(void *id) {
+
+    int push_dongle = (int)(intptr_t)id; /* Index of the dongle */
+    bdaddr_t dongle_address;         /* Address the connections start from */
+    PushEngine engine;               /* Transfers of the dongle */
+    PushJob job;                     /* Device taken from the balancer */
+    Message *message;                /* Message to be sent */
+    int message_priority;            /* Priority level of the message */
+    int return_value = 0;            /* Return value of the balancer */
+    char engine_name[16];            /* Name of the engine in the output */
+    struct sockaddr_in stand_in_address; /* Address of a stand-in receiver */
+    PushConnect connect_function = push_engine_connect_rfcomm;
+    void *connect_context = &dongle_address;
+
+    if (g_stand_in_port != 0) {
+
+        memset(&stand_in_address, 0, sizeof(stand_in_address));
+        stand_in_address.sin_family = AF_INET;
+        stand_in_address.sin_port = htons(g_stand_in_port);
+        inet_pton(AF_INET, STAND_IN_ADDRESS, &stand_in_address.sin_addr);
+        connect_function = push_engine_connect_tcp;
+        connect_context = &stand_in_address;
+
+    }
+    else if (0 > hci_devba(push_balancer.dongles[push_dongle].dongle_device_id,
+                      &dongle_address)) {
+
+        /* Error handling */
+        perror(errordesc[E_SEND_OPEN_SOCKET].message);
+        bacpy(&dongle_address, BDADDR_ANY);
+
+    }
+
+    if (push_engine_init(&engine, sizeof(PushJob), connect_function,
+                         connect_context, finish_engine_push, NULL) != 0) {
+        return NULL;
+    }
+
+    if (push_engine_set_wakeup_fd(&engine,
+            push_balancer.dongles[push_dongle].wakeup_fd) != 0) {
+        push_engine_free(&engine);
+        return NULL;
+    }
+
+    /* Until the balancer is closed and every transfer is over */
+    while (return_value != -1 || engine.number_of_transfers > 0) {
+
+        /* Start a transfer for each waiting device the engine has room
+         * for, then let the transfers progress until a socket is ready or
+         * a device is assigned to the dongle */
+        while (return_value != -1 &&
+               push_engine_get_free_slots(&engine) > 0) {
+
+            return_value = balancer_try_take(&push_balancer, push_dongle,
+                                             &job, &job.priority);
+
+            if (return_value != 0) {
+                break;
+            }
+
+            job.push_dongle = push_dongle;
+            job.connect_start_time = get_system_time();
+            balancer_start(&push_balancer, push_dongle,
+                           job.connect_start_time);
+            message = get_active_message(&message_priority);
+            push_engine_start(&engine, &job, &job.scanned_device_address,
+                              job.channel, message->data, message->length,
+                              message->name, job.connect_start_time);
+
+        }
+
+        push_engine_run(&engine, DONGLE_STEAL_INTERVAL);
+
+    }
+
+    sprintf(engine_name, "hci%d",
+            push_balancer.dongles[push_dongle].dongle_device_id);
+    push_engine_print_statistics(&engine, engine_name);
+    push_engine_free(&engine);
+
+    return NULL;
+}
+
+
+/*
+*  retry_push:
+*
+*  This function schedules another attempt to push to a device after its
+*  connection or transfer failed. When the device is out of attempts or
+*  past its deadline, the failure is recorded in the blocklist instead.
+*
+*  Parameters:
+*
+*  job - the device whose push failed
+*  priority - priority level the device was queued at
+*  failure_class - the reason the push failed
+*
+*  Return value:
+*
+*  None
+*/
+void retry_push(PushJob *job, int priority, FailureClass failure_class) {
+
+    long long now = get_system_time();
+
+    job->attempts++;
+
+    if (retry_queue_schedule(&retry_queue, job, priority, job->attempts,
+                             job->initial_scanned_time + RETRY_DEADLINE,
+                             now) != 0) {
+        blocklist_record_failure(&blocklist, &job->scanned_device_address,
+                                 failure_class, now);
+        clear_pending_push(&job->scanned_device_address);
+    }
+}
+
+
+/*
+*  retry_devices:
+*
+*  This function puts the failed pushes back in the waiting queue when
+*  their retry is due. It never waits for the waiting queue: a retry that
+*  finds it full is dropped, so retries do not hold up scanned devices. A
+*  dropped device no longer waits for a push, and is counted as a failure
+*  of the retry stage.
+*
+*  Parameters:
+*
+*  arg - not used
+*
+*  Return value:
+*
+*  None
+*/
+void *retry_devices(void *arg) {
+
+    PushJob job;                     /* Device taken from the retry queue */
+    int priority;                    /* Priority level of the device */
+    int return_value;                /* Return value for error handling */
+
+    while (retry_queue_take(&retry_queue, &job, &priority) == 0) {
+
+        return_value = queue_try_enqueue(&waiting_queue, &job, priority);
+        record_stage_time(&retry_statistics,
+                          get_system_time() - job.connect_start_time,
+                          0 == return_value);
+
+        /* A dropped device is queued again when it is scanned after
+         * leaving the scanned list, so a snapshot must not queue it */
+        if (0 > return_value) {
+            clear_pending_push(&job.scanned_device_address);
+        }
+
+    }
+
+    return NULL;
+}
+
+
+/*
+*  open_push_client:
+*
+*  This function opens the HCI socket and the OBEX client of an idle client
+*  of a push dongle, unless they are still open from an earlier push. With
+*  a stand-in receiver, only an OBEX client over TCP is opened.
+*
+*  Parameters:
+*
+*  push_client - the client to be opened
+*  dongle_device_id - HCI device ID of the push dongle
+*
+*  Return value:
+*
+*  0 - success
+*  -1 - the socket or the client could not be opened
+*/
+int open_push_client(PushClient *push_client, int dongle_device_id) {
+
+    /* Pushes to a stand-in receiver do not use the dongle */
+    if (0 > push_client->socket && g_stand_in_port == 0) {
+
+        push_client->socket = hci_open_dev(dongle_device_id);
+
+        if (0 > dongle_device_id || 0 > push_client->socket) {
+
+            /* Error handling */
+            perror(errordesc[E_SEND_OPEN_SOCKET].message);
+            close_push_client(push_client);
+            return -1;
+
+        }
+
+    }
+
+    if (push_client->client == NULL) {
+
+        push_client->client =
+            obexftp_open(g_stand_in_port != 0 ? OBEX_TRANS_INET :
+                         OBEX_TRANS_BLUETOOTH, NULL, NULL, NULL);
+
+        if (push_client->client == NULL) {
+
+            /* Error handling */
+            perror(errordesc[E_SEND_OBEXFTP_CLIENT].message);
+            close_push_client(push_client);
+            return -1;
+
+        }
+
+        __sync_fetch_and_add(&number_of_opened_clients, 1);
+
+    }
+
+    return 0;
+}
+
+
+/*
+*  close_push_client:
+*
+*  This function closes the OBEX client and the HCI socket of a client of
+*  a push dongle. The client is opened again the next time it is used.
+*
+*  Parameters:
+*
+*  push_client - the client to be closed
+*
+*  Return value:
+*
+*  None
+*/
+void close_push_client(PushClient *push_client) {
+
+    if (push_client->client != NULL) {
+        obexftp_close(push_client->client);
+    }
+
+    if (0 <= push_client->socket) {
+        close(push_client->socket);
+    }
+
+    push_client->client = NULL;
+    push_client->socket = -1;
+}
+
+
+/*
+*  browse_devices:
+*
+*  This function is the first stage of the push pipeline. It takes the
+*  devices from the waiting queue, finds the Object Push channel of each
+*  one, from the channel cache or with an SDP search, and hands them to the
+*  connect stage at the same priority. While it waits for an SDP answer, the
+*  other stages keep connecting to and sending to other devices.
+*
+*  Parameters:
+*
+*  arg - not used
+*
+*  Return value:
+*
+*  None
+*/
+void *browse_devices(void *arg) {
+
+    char address[LENGTH_OF_MAC_ADDRESS]; /* Scanned MAC address as text */
+    PushJob job;                     /* Device taken from the waiting queue */
+    int priority;                    /* Priority level of the device */
+    long long start;                 /* Time the search started */
+
+    /* Sleep until a device is put in the waiting queue. The queue is closed
+     * on shutdown, which wakes every thread up. */
+    while (queue_dequeue(&waiting_queue, &job, &priority) == 0) {
+
+        /* Skip a device queued again by the emergency broadcast */
+        if (is_push_superseded(&job) == true) {
+            continue;
+        }
+
+        start = get_system_time();
+
+        /* Skip a device that failed while it was waiting. Emergency
+         * messages are still tried on every device. */
+        if (priority == PRIORITY_ADVERTISEMENT &&
+            blocklist_is_blocked(&blocklist, &job.scanned_device_address,
+                                 start) == true) {
+            continue;
+        }
+
+        /* Only search for the Object Push channel with SDP when it is not
+         * cached from an earlier visit. A stand-in receiver takes every
+         * push on its port. */
+        if (g_stand_in_port != 0) {
+            job.channel = g_stand_in_port;
+        }
+        else {
+            job.channel = channel_cache_lookup(&channel_cache,
+                                               &job.scanned_device_address,
+                                               start);
+        }
+
+        if (0 > job.channel) {
+
+            /* obexftp takes the address as text */
+            ba2str(&job.scanned_device_address, address);
+            job.channel = obexftp_browse_bt_push(address);
+            channel_cache_insert(&channel_cache, &job.scanned_device_address,
+                                 job.channel, get_system_time(),
+                                 get_system_time() - start);
+            mark_state_changed();
+
+        }
+
+        record_stage_time(&browse_statistics, get_system_time() - start,
+                          0 <= job.channel);
+
+        if (0 > job.channel) {
+            blocklist_record_failure(&blocklist, &job.scanned_device_address,
+                                     FAILURE_NO_CHANNEL, get_system_time());
+            continue;
+        }
+
+        balancer_dispatch(&push_balancer, &job, priority);
+
+    }
+
+    return NULL;
+}
+
+
+/*
+*  connect_devices:
 *
-*  This function continuously looks through the ThreadStatus array that
-*  contains all the send_file thread status. When a thread becomes available
-*  and the waiting list is not empty, the first MAC address in the waiting 
-*  list will be added to the ThreadStatus array and removed from the waiting 
-*  list.
+*  This function is the second stage of the push pipeline. It takes the
+*  devices the balancer gives to the push dongle of the thread, opens an
+*  OBEX client and connects it to the Object Push service, then hands the
+*  connected client to the transfer stage. Threads whose ID is not below
+*  the maximum number of devices of the config in use stay idle.
 *
 *  Parameters:
 *
-*  None
+*  id - ID of the thread, an index in the array of ThreadStatus. The thread
+*       serves the push dongle at index id modulo the number of dongles.
 *
 *  Return value:
 *
 *  None
 */
-void *queue_to_array() {
+void *connect_devices(void *id) {
     
-    /* Maximum number of devices to be handled by all push dongles */
-    int maximum_number_of_devices = atoi(g_config.maximum_number_of_devices);
+    int dongle_device_id = 0;        /* Device ID of each dongle */
+    int thread_id = (int)(intptr_t)id; /* Thread ID */
+    int push_dongle;                 /* Index of the dongle in the balancer */
+    char address[LENGTH_OF_MAC_ADDRESS]; /* Scanned MAC address as text */
+    int priority;                    /* Priority level of the device */
+    int return_value;                /* Return value for error handling */
+    PushJob job;                     /* Device taken from the connect queue */
+    PushClient push_client;          /* Client of the dongle used for it */
 
-    /* An iterator through the array of ScannedDevice struct */
-    int device_id;
+    push_dongle = thread_id % push_balancer.number_of_dongles;
+    dongle_device_id = g_idle_handler[thread_id].dongle_device_id;
 
+    while (true) {
 
-    while (ready_to_work == true) {
-        
-        /* Go through the array of ThreadStatus */
-        for (device_id = 0; device_id < maximum_number_of_devices;
-            device_id++) {
-        
-            char *address = get_head_entry(waiting_list);
+        /* Threads beyond the maximum number of devices of the config in
+         * use wait until a reload raises it */
+        while (thread_id >=
+               config_store_get(&config_store)->maximum_number_of_devices &&
+               ready_to_work == true) {
+            usleep(PARKED_THREAD_SLEEP * 1000);
+        }
+
+        /* Take the devices assigned to this dongle, or those waiting for
+         * a dongle that stalled */
+        if (balancer_take(&push_balancer, push_dongle, &job,
+                          &priority) != 0) {
+            break;
+        }
+
+        bacpy(&g_idle_handler[thread_id].scanned_device_address,
+              &job.scanned_device_address);
+        g_idle_handler[thread_id].idle = false;
+        g_idle_handler[thread_id].is_waiting_to_send = true;
+
+        job.push_dongle = push_dongle;
+        job.connect_start_time = get_system_time();
+        balancer_start(&push_balancer, push_dongle, job.connect_start_time);
+
+        /* obexftp takes the address as text. With a stand-in receiver,
+         * the device is reached through the loopback address instead. */
+        if (g_stand_in_port != 0) {
+            strcpy(address, STAND_IN_ADDRESS);
+        }
+        else {
+            ba2str(&job.scanned_device_address, address);
+        }
+
+        /* Take an idle client of the dongle. It is only opened the first
+         * time, or after an error closed it. The wait for a client is
+         * recorded apart from the time to open it. */
+        long long wait_start = get_system_time();
+        queue_dequeue(&idle_clients[push_dongle], &push_client, NULL);
+
+        long long start = get_system_time();
+        record_stage_time(&idle_client_statistics, start - wait_start, true);
+
+        bool is_opening = push_client.client == NULL;
+        return_value = open_push_client(&push_client, dongle_device_id);
+        long long end = get_system_time();
+
+        if (is_opening == true) {
+            printf("Time to open connection: %lld ms\n", end - start);
+        }
+
+        if (0 > return_value) {
+
+            record_stage_time(&connect_statistics, end - start, false);
+            finish_push(&job, false);
+            queue_enqueue(&idle_clients[push_dongle], &push_client, 0);
+            bacpy(&g_idle_handler[thread_id].scanned_device_address,
+                  BDADDR_ANY);
+
+            g_idle_handler[thread_id].idle = true;
+            g_idle_handler[thread_id].is_waiting_to_send = false;
+            continue;
+
+        }
+
+        job.socket = push_client.socket;
+        job.client = push_client.client;
+
+        /* Connect to the scanned device */
+        return_value = obexftp_connect_push(job.client, address, job.channel);
+        record_stage_time(&connect_statistics, get_system_time() - start,
+                          0 <= return_value);
+    
+        /* If obexftp_connect_push returns a negative integer, then it goes
+         * into error handling */
+        if (0 > return_value) {
             
-            /* Remove from waiting_list and add MAC address to the array when 
-             * a thread becomes available */
-            if (g_idle_handler[device_id].idle == true && address != NULL) {
-                strncpy(g_idle_handler[device_id].scanned_mac_address, 
-                        address,
-                        LENGTH_OF_MAC_ADDRESS);
-
-                struct Node *node = ListEntry(waiting_list->next, Node,
-                                              ptrs);
-                
-                list_remove_node(waiting_list->next);
-                free(node);
-                g_idle_handler[device_id].idle = false;
-                g_idle_handler[device_id].is_waiting_to_send = true;
-            }
+            /* Error handling */
+            perror(errordesc[E_SEND_CONNECT_DEVICE].message);
+            channel_cache_invalidate(&channel_cache,
+                                     &job.scanned_device_address);
+            retry_push(&job, priority, FAILURE_CONNECT);
+            finish_push(&job, false);
+
+            /* The state of a client that failed to connect is not known,
+             * so it is opened again for the next device */
+            close_push_client(&push_client);
+            queue_enqueue(&idle_clients[push_dongle], &push_client, 0);
+            bacpy(&g_idle_handler[thread_id].scanned_device_address,
+                  BDADDR_ANY);
+            
+            g_idle_handler[thread_id].idle = true;
+            g_idle_handler[thread_id].is_waiting_to_send = false;
+            continue;
+        
+        }
+
+        bacpy(&g_idle_handler[thread_id].scanned_device_address,
+              BDADDR_ANY);
+        g_idle_handler[thread_id].idle = true;
+        g_idle_handler[thread_id].is_waiting_to_send = false;
+
+        /* Waits while the transfer stage is busy, so no more links are
+         * open than there are transfer threads */
+        if (queue_enqueue(&transfer_queue, &job, priority) != 0) {
+
+            finish_push(&job, false);
+            obexftp_disconnect(job.client);
+            queue_enqueue(&idle_clients[push_dongle], &push_client, 0);
+
         }
-    }
-  
     
-    /* Exiting this thread and sending message to main thread by using pthread
-     * exit and join. */
-    pthread_exit(NULL);
-    return;
+    } //end while loop
+
+    return NULL;
 
 }
 
 
 /*
-*  send_file:
+*  transfer_files:
 *
-*  This function enables the caller to send the push message asynchronously 
-*  using the specified thread. 
-*  
-*  [N.B. The beacon may still be scanning for other bluetooth devices.]
+*  This function is the last stage of the push pipeline. It sends the
+*  message of the highest active priority over each connected client, then
+*  disconnects and closes the client.
 *
 *  Parameters:
 *
-*  id - ID of the thread used to send the push message 
+*  arg - not used
 *
 *  Return value:
 *
 *  None
 */
-void *send_file(void *id) {
-    
-    obexftp_client_t *client = NULL; /* ObexFTP client */
-    int dongle_device_id = 0;        /* Device ID of each dongle */
-    int socket;                      /* ObexFTP client's socket */
-    int channel = -1;                /* ObexFTP channel */
-    int thread_id = (int)id;         /* Thread ID */
-    char *address = NULL;            /* Scanned MAC address */
-    char *file_name;                  /* File name of message to be sent */
+void *transfer_files(void *arg) {
+
+    Message *message;                /* Message to be sent */
+    int priority;                    /* Priority level of the message */
     int return_value;                /* Return value for error handling */
+    PushJob job;                     /* Device taken from the transfer queue */
+    PushClient push_client;          /* Client given back to the dongle */
+    long long start;                 /* Time the transfer started */
+    int job_priority;                /* Priority level of the device */
+
+    while (queue_dequeue(&transfer_queue, &job, &job_priority) == 0) {
+
+        /* Every waiting device gets the message of the highest active
+         * priority, whatever the priority it was queued at */
+        message = get_active_message(&priority);
+        start = get_system_time();
+    
+        /* Push the message to the scanned device from memory */
+        return_value = obexftp_put_data(job.client, message->data,
+                                        message->length, message->name);
+        if (0 > return_value) {
+            
+            /* TODO: Error handling */
+            perror(errordesc[E_SEND_PUT_FILE].message);
+            retry_push(&job, job_priority, FAILURE_PUT);
+        }
+        else {
 
-    /* Get the maximum number of devices from config file. */
-    int maximum_number_of_devices = atoi(g_config.maximum_number_of_devices);
+            blocklist_record_success(&blocklist,
+                                     &job.scanned_device_address);
+            record_broadcast_push(&job);
 
-    /* An iterator through the array of ScannedDevice struct */
-    int device_id;
+        }
+
+        record_stage_time(&transfer_statistics, get_system_time() - start,
+                          0 <= return_value);
+
+        /* The latency of the dongle covers both the connect and the put */
+        finish_push(&job, 0 <= return_value);
+    
+        /* Disconnect the link only, and give the client back to the
+         * dongle for its next device */
+        push_client.socket = job.socket;
+        push_client.client = job.client;
+        return_value = obexftp_disconnect(job.client);
+        if (0 > return_value) {
+            
+            /* TODO: Error handling  */
+            perror(errordesc[E_SEND_DISCONNECT_CLIENT].message);
+            close_push_client(&push_client);
+        
+        }
+    
+        queue_enqueue(&idle_clients[job.push_dongle], &push_client, 0);
 
+    }
 
-    while (send_message_cancelled = false) {
+    return NULL;
+}
 
-        for (device_id = 0; device_id < maximum_number_of_devices;
-            device_id++) {
+/*
+*  start_inquiry:
+*
+*  This function starts inquiring for bluetooth devices with the general
+*  inquiry access code. In periodic inquiry mode the controller repeats the
+*  inquiry by itself until it is told to exit the mode, otherwise a single
+*  inquiry is started.
+*
+*  Parameters:
+*
+*  socket - the socket of the scanning dongle
+*  periodic - whether to start the periodic inquiry mode
+*
+*  Return value:
+*
+*  0 - the command was sent
+*  A negative value - the command could not be sent
+*/
+int start_inquiry(int socket, bool periodic) {
 
-            if (device_id == thread_id &&
-                g_idle_handler[device_id].is_waiting_to_send == true) {
-                
-            
-                /* Open socket and use current time as start time to keep 
-                 * of how long has taken to send the message to the device */
-                socket = hci_open_dev(dongle_device_id);
+    inquiry_cp inquiry_copy; /* Parameters of a single inquiry */
+    periodic_inquiry_cp periodic_inquiry_copy; /* Parameters of the periodic
+                                                * inquiry mode */
 
+    if (inquiry_statistics.first_start_time == 0) {
+        inquiry_statistics.first_start_time = get_system_time();
+    }
 
-                if (0 > dongle_device_id || 0 > socket) {
-            
-                    /* Error handling */
-                    perror(errordesc[E_SEND_OPEN_SOCKET].message);
-                    strncpy(
-                            g_idle_handler[device_id].scanned_mac_address,
-                            "0",
-                            LENGTH_OF_MAC_ADDRESS);
-            
-                    g_idle_handler[device_id].idle = true;
-                    g_idle_handler[device_id].is_waiting_to_send = false;
-                    break;
-                
-                }
-            
-                long long start = get_system_time();
-                address = 
-                    (char *)g_idle_handler[device_id].scanned_mac_address;
-                channel = obexftp_browse_bt_push(address);
-            
-                /* Extract basename from file path */
-                file_name = strrchr(g_push_file_path, '/');
-                file_name[g_config.file_name_length] = '\0';
-                
-                if (!file_name) {
-                    
-                    file_name = g_push_file_path;
-                
-                }
-                else {
-                    
-                    file_name++;
-                
-                }
-                printf("Sending file %s to %s\n", file_name, address);
-            
-                /* Open connection */
-                client = obexftp_open(OBEX_TRANS_BLUETOOTH, NULL, NULL,
-                                      NULL);
-                long long end = get_system_time();
-                printf("Time to open connection: %lld ms\n", end - start);
-                
-                if (client == NULL) {
-                    
-                    /* Error handling */
-                    perror(errordesc[E_SEND_OBEXFTP_CLIENT].message);
-                    strncpy(
-                            g_idle_handler[device_id].scanned_mac_address,
-                            "0",
-                            LENGTH_OF_MAC_ADDRESS);
-            
-                    g_idle_handler[device_id].idle = true;
-                    g_idle_handler[device_id].is_waiting_to_send = false;
-                    close(socket);
-                    break;
-                
-                }
-            
-                /* Connect to the scanned device */
-                return_value = obexftp_connect_push(client, address,
-                                                    channel);
-            
-                /* If obexftp_connect_push returns a negative integer, then 
-                 * it goes into error handling */
-                if (0 > return_value) {
-                    
-                    /* Error handling */
-                    perror(errordesc[E_SEND_CONNECT_DEVICE].message);
-                    obexftp_close(client);
-                    client = NULL;
-                    strncpy(
-                            g_idle_handler[device_id].scanned_mac_address,
-                            "0",
-                            LENGTH_OF_MAC_ADDRESS);
-                    
-                    g_idle_handler[device_id].idle = true;
-                    g_idle_handler[device_id].is_waiting_to_send = false;
-                    close(socket);
-                    break;
-                
-                }
-            
-                /* Push file to the scanned device */
-                return_value = obexftp_put_file(client, g_push_file_path,
-                                                file_name);
-                if (0 > return_value) {
-                    
-                    /* TODO: Error handling */
-                    perror(errordesc[E_SEND_PUT_FILE].message);
-                }
-            
-                /* Disconnect connection */
-                return_value = obexftp_disconnect(client);
-                if (0 > return_value) {
-                    
-                    /* TODO: Error handling  */
-                    perror(errordesc[E_SEND_DISCONNECT_CLIENT].message);
-                    pthread_exit(NULL);
-                    return;
-                
-                }
-            
-               /* Leave the socket open */
-                obexftp_close(client);
-                client = NULL;
-                strncpy(g_idle_handler[device_id].scanned_mac_address,
-                        "0",
-                        LENGTH_OF_MAC_ADDRESS);
-                
-                g_idle_handler[device_id].idle = true;
-                g_idle_handler[device_id].is_waiting_to_send = false;
-                close(socket);
-            
-            }//end if
-        
-        }//end for loop
-    
-    } //end while loop
+    if (periodic == true) {
+
+        memset(&periodic_inquiry_copy, 0, sizeof(periodic_inquiry_copy));
+        periodic_inquiry_copy.max_period =
+            htobs(PERIODIC_INQUIRY_MAXIMUM_PERIOD);
+        periodic_inquiry_copy.min_period =
+            htobs(PERIODIC_INQUIRY_MINIMUM_PERIOD);
+        periodic_inquiry_copy.lap[2] = 0x9e;
+        periodic_inquiry_copy.lap[1] = 0x8b;
+        periodic_inquiry_copy.lap[0] = 0x33;
+        periodic_inquiry_copy.length = INQUIRY_LENGTH;
+        periodic_inquiry_copy.num_rsp = 0;
+        printf("Starting periodic inquiry with RSSI...\n");
+
+        return g_hci_transport->send_cmd(socket, OGF_LINK_CTL,
+                                         OCF_PERIODIC_INQUIRY,
+                                         PERIODIC_INQUIRY_CP_SIZE,
+                                         &periodic_inquiry_copy);
 
-    /* Exit forcibly by main thread */
-    if(ready_to_work == false){
-        
-        pthread_exit(NULL);
+    }
+
+    memset(&inquiry_copy, 0, sizeof(inquiry_copy));
+    inquiry_copy.lap[2] = 0x9e;
+    inquiry_copy.lap[1] = 0x8b;
+    inquiry_copy.lap[0] = 0x33;
+    inquiry_copy.num_rsp = 0;
+    inquiry_copy.length = INQUIRY_LENGTH;
+
+    return g_hci_transport->send_cmd(socket, OGF_LINK_CTL, OCF_INQUIRY,
+                                     INQUIRY_CP_SIZE, &inquiry_copy);
+}
+
+
+/*
+*  record_inquiry_complete:
+*
+*  This function measures the gap between the end of an inquiry and the
+*  start of the next one, which is the time between two inquiry complete
+*  events minus the length of an inquiry, and reports the duty cycle of
+*  the scanning dongle every INQUIRY_REPORT_INTERVAL inquiries.
+*
+*  Parameters:
+*
+*  None
+*
+*  Return value:
+*
+*  None
+*/
+void record_inquiry_complete() {
+
+    long long now = get_system_time();
+    long long gap;
+
+    if (inquiry_statistics.last_complete_time != 0) {
+
+        gap = now - inquiry_statistics.last_complete_time -
+              INQUIRY_LENGTH * INQUIRY_LENGTH_UNIT;
+
+        if (gap < 0) {
+            gap = 0;
+        }
+
+        inquiry_statistics.total_gap += gap;
+
+        if (gap > inquiry_statistics.maximum_gap) {
+            inquiry_statistics.maximum_gap = gap;
+        }
+
+    }
+
+    inquiry_statistics.last_complete_time = now;
+    inquiry_statistics.number_of_inquiries++;
+
+    if (inquiry_statistics.number_of_inquiries %
+        INQUIRY_REPORT_INTERVAL == 0) {
+        print_inquiry_statistics();
+    }
+}
+
+
+/*
+*  print_inquiry_statistics:
+*
+*  This function prints the number of inquiries, the average and maximum
+*  gap between them, and the share of time the dongle spent inquiring.
+*
+*  Parameters:
+*
+*  None
+*
+*  Return value:
+*
+*  None
+*/
+void print_inquiry_statistics() {
+
+    long long elapsed_time = inquiry_statistics.last_complete_time -
+                             inquiry_statistics.first_start_time;
+    long long number_of_gaps = inquiry_statistics.number_of_inquiries - 1;
+    double duty_cycle = 0;
+
+    if (number_of_gaps < 1) {
         return;
-    
     }
 
+    if (elapsed_time > 0) {
+        duty_cycle = 100.0 * inquiry_statistics.number_of_inquiries *
+                     INQUIRY_LENGTH * INQUIRY_LENGTH_UNIT / elapsed_time;
+    }
+
+    if (duty_cycle > 100) {
+        duty_cycle = 100;
+    }
+
+    printf("Inquiries (%s): %lld, gap average %lld ms, maximum %lld ms, "
+           "duty cycle %.1f%%\n",
+           g_use_periodic_inquiry == true ? "periodic" : "back to back",
+           inquiry_statistics.number_of_inquiries,
+           inquiry_statistics.total_gap / number_of_gaps,
+           inquiry_statistics.maximum_gap, duty_cycle);
+}
+
+
+/*
+*  get_number_of_waiting_pushes:
+*
+*  This function counts the devices waiting for a push: those in the
+*  waiting queue, in the queues of the push dongles and waiting for a
+*  retry.
+*
+*  Parameters:
+*
+*  None
+*
+*  Return value:
+*
+*  Number of devices waiting for a push
+*/
+int get_number_of_waiting_pushes() {
+
+    int number_of_waiting = 0;
+    int push_dongle_id; /* An iterator through the push dongles */
+
+    if (waiting_queue.levels != NULL) {
+        number_of_waiting += queue_get_length(&waiting_queue, -1);
+    }
+
+    for (push_dongle_id = 0;
+         push_dongle_id < push_balancer.number_of_dongles;
+         push_dongle_id++) {
+        number_of_waiting +=
+            queue_get_length(&push_balancer.dongles[push_dongle_id].queue,
+                             -1);
+    }
+
+    if (retry_queue.heap != NULL) {
+        number_of_waiting += retry_queue_get_length(&retry_queue);
+    }
+
+    return number_of_waiting;
+}
+
+
+/*
+*  count_inquiry_results:
+*
+*  This function returns the number of results of an inquiry result event,
+*  limited to the records that fit in the event read. A corrupt count,
+*  such as one from a damaged capture file, would otherwise make the scan
+*  read past the event.
+*
+*  Parameters:
+*
+*  event_buffer - the event, starting with its packet type
+*  event_buffer_length - number of bytes read in the event buffer
+*  record_size - size of one result record of the event
+*
+*  Return value:
+*
+*  Number of result records to read from the event
+*/
+int count_inquiry_results(unsigned char *event_buffer,
+                          int event_buffer_length, int record_size) {
+
+    /* Packet type, event header, then the number of results */
+    int header_length = 1 + HCI_EVENT_HDR_SIZE + 1;
+    int results;
+    int fitting_results;
+
+    if (event_buffer_length < header_length) {
+        return 0;
+    }
+
+    results = event_buffer[header_length - 1];
+    fitting_results = (event_buffer_length - header_length) / record_size;
+
+    if (results > fitting_results) {
+        fprintf(stderr, "Inquiry result event of %d bytes claims %d "
+                "results, reading %d\n", event_buffer_length, results,
+                fitting_results);
+        return fitting_results;
+    }
 
+    return results;
 }
 
+
 /*
 *  start_scanning:
 *
 *  This function scans continuously for bluetooth devices under the coverage
-*  of the  beacon until there is a need to cancel scanning. Each scanned
-*  device will fall under one of three cases: a bluetooth device with no RSSI
-*  value and a bluetooth device with a RSSI value, When the device is within 
-*  RSSI value, the bluetooth device will  be added to the linked list so a
-*  message can be sent to the device.
+*  of the  beacon until there is a need to cancel scanning. The socket is
+*  opened once and the inquiries follow each other on it, back to back
+*  unless -p asks for periodic inquiry mode and the dongle supports it. Each
+*  scanned device will fall under one of three cases: a bluetooth device
+*  with no RSSI value and a bluetooth device with a RSSI value, When the
+*  device is within RSSI value, the bluetooth device will  be added to the
+*  linked list so a message can be sent to the device.
 *  
 *  Parameters:
 *
@@ -1152,7 +2564,6 @@ void start_scanning() {
     
 
     struct hci_filter filter; /*Filter for controling the events*/
-    struct pollfd output; /*A callback event from the socket */
     unsigned char event_buffer[HCI_MAX_EVENT_SIZE]; /*A buffer for the 
                                                       *callback event*/
     unsigned char *event_buffer_pointer; /*A pointer for the event buffer */
@@ -1162,14 +2573,16 @@ void start_scanning() {
                                          *EVT_INQUIRY_RESULT_WITH_RSSI message
                                          */
     inquiry_info *info; /*Record an EVT_INQUIRY_RESULT message */
+    evt_cmd_complete *command_complete; /*Record an EVT_CMD_COMPLETE message */
+    evt_cmd_status *command_status; /*Record an EVT_CMD_STATUS message */
     int event_buffer_length; /*Length of the event buffer */
     int dongle_device_id = 0; /*dongle id */
     int socket = 0; /*Number of the socket */
     int results; /*Return the result form the socket */
     int results_id; /*ID of the result */       
 
-    /* Open Bluetooth device */
-    socket = hci_open_dev(dongle_device_id);
+    /* Open Bluetooth device through the selected HCI backend */
+    socket = g_hci_transport->open_dev(dongle_device_id);
     
     if (0 > dongle_device_id || 0 > socket) {
          
@@ -1187,67 +2600,66 @@ void start_scanning() {
     hci_filter_set_event(EVT_INQUIRY_RESULT, &filter);
     hci_filter_set_event(EVT_INQUIRY_RESULT_WITH_RSSI, &filter);
     hci_filter_set_event(EVT_INQUIRY_COMPLETE, &filter);        
+    hci_filter_set_event(EVT_CMD_COMPLETE, &filter);
+    hci_filter_set_event(EVT_CMD_STATUS, &filter);
 
-    if (0 > setsockopt(socket, SOL_HCI, HCI_FILTER, &filter,
-                        sizeof(filter))) {
+    if (0 > g_hci_transport->set_filter(socket, &filter)) {
          
          /* Error handling */
          perror(errordesc[E_SCAN_SET_HCI_FILTER].message);
-         hci_close_dev(socket);
+         g_hci_transport->close_dev(socket);
          return;
      
     }       
 
-    hci_write_inquiry_mode(socket, 0x01, 10);
+    g_hci_transport->write_inquiry_mode(socket, 0x01, 10);
     
-    if (0 > hci_send_cmd(socket, OGF_HOST_CTL, OCF_WRITE_INQUIRY_MODE,
-         WRITE_INQUIRY_MODE_RP_SIZE, &inquiry_copy)) {
+    if (0 > g_hci_transport->send_cmd(socket, OGF_HOST_CTL,
+         OCF_WRITE_INQUIRY_MODE, WRITE_INQUIRY_MODE_RP_SIZE, &inquiry_copy)) {
          
          /* Error handling */
          perror(errordesc[E_SCAN_SET_INQUIRY_MODE].message);
-         hci_close_dev(socket);
+         g_hci_transport->close_dev(socket);
          return;
      
     }
 
-    memset(&inquiry_copy, 0, sizeof(inquiry_copy));
-    inquiry_copy.lap[2] = 0x9e;
-    inquiry_copy.lap[1] = 0x8b;
-    inquiry_copy.lap[0] = 0x33;
-    inquiry_copy.num_rsp = 0;
-    inquiry_copy.length = 0x30; 
-    printf("Starting inquiry with RSSI...\n");  
-    
-    if (0 > hci_send_cmd(socket, OGF_LINK_CTL, OCF_INQUIRY, INQUIRY_CP_SIZE,
-         &inquiry_copy)) {
+    if (0 > start_inquiry(socket, g_use_periodic_inquiry)) {
          
          /* Error handling */
          perror(errordesc[E_SCAN_START_INQUIRY].message);
-         hci_close_dev(socket);
+         g_hci_transport->close_dev(socket);
          return;
      
     }   
     
-    output.fd = socket;
-    output.events = POLLIN | POLLERR | POLLHUP; 
-     
     
-    /* An indicator for continuing to scan the devices. */ 
-    /* After the inquiring events completing, it should jump out of the while 
-     * loop for getting a new socket */
+    /* The socket stays open and the inquiries follow each other until the
+     * beacon shuts down. It is only reopened after an error. */
     bool keep_scanning = true;
     
-    while (keep_scanning == true) {
+    while (keep_scanning == true && ready_to_work == true) {
          
-        output.revents = 0; 
-        /* Poll the bluetooth device for an event */
-        if (0 < poll(&output, 1, -1)) {
+        /* Poll the bluetooth device for an event, waking up now and then to
+         * notice a shutdown */
+        if (0 < g_hci_transport->poll_event(socket, SCAN_POLL_TIMEOUT)) {
             
-            event_buffer_length =
-                    read(socket, event_buffer, sizeof(event_buffer));   
+            event_buffer_length = g_hci_transport->read_event(socket,
+                    event_buffer, sizeof(event_buffer));   
             
+            /* Only interrupted or empty reads are tried again; a broken
+             * socket or a corrupt capture ends the scan */
             if (0 > event_buffer_length) {
+
+                 if (EAGAIN != errno && EINTR != errno) {
+
+                     /* Error handling */
+                     perror("Error reading HCI events");
+                     keep_scanning = false;
+
+                 }
                  continue;
+
              }else if (0 == event_buffer_length) {
               
                  break;
@@ -1256,19 +2668,24 @@ void start_scanning() {
             
             event_handler = (void *)(event_buffer + 1);
             event_buffer_pointer = event_buffer + (1 + HCI_EVENT_HDR_SIZE); 
-            results = event_buffer_pointer[0];  
             
             switch (event_handler->evt) {
              
             /* Scanned device with no RSSI value */
             case EVT_INQUIRY_RESULT: {
                  
+                results = count_inquiry_results(event_buffer,
+                                                event_buffer_length,
+                                                sizeof(*info));
+
                 for (results_id = 0; results_id < results; results_id++) {
                     info = (void *)event_buffer_pointer +
                          (sizeof(*info) * results_id) + 1;
                      
+                    adaptive_advertising_record_discovery(
+                        &adaptive_advertising);
                     print_RSSI_value(&info->bdaddr, 0, 0);
-                    track_devices(&info->bdaddr, "output.txt");
+                    track_devices(&info->bdaddr);
                      
                 }
 
@@ -1278,15 +2695,22 @@ void start_scanning() {
             * message to bluetooth device. */
             case EVT_INQUIRY_RESULT_WITH_RSSI: {
                  
+                results = count_inquiry_results(event_buffer,
+                                                event_buffer_length,
+                                                sizeof(*info_rssi));
+
                 for (results_id = 0; results_id < results; results_id++) {  
                     info_rssi = (void *)event_buffer_pointer +
                          (sizeof(*info_rssi) * results_id) + 1;
                      
-                     track_devices(&info_rssi->bdaddr, "output.txt");
+                     adaptive_advertising_record_discovery(
+                         &adaptive_advertising);
+                     track_devices(&info_rssi->bdaddr);
                      print_RSSI_value(&info_rssi->bdaddr, 1,
                          info_rssi->rssi);
                      
-                     if (info_rssi->rssi > RSSI_RANGE) {
+                     if (info_rssi->rssi >
+                         config_store_get(&config_store)->rssi_coverage) {
                      
                          send_to_push_dongle(&info_rssi->bdaddr);
                      
@@ -1296,15 +2720,78 @@ void start_scanning() {
              
             } break;    
             
-            /* Stop the scanning process */
+            /* One inquiry is over. In periodic inquiry mode the controller
+             * starts the next one by itself, otherwise it is started right
+             * away on the same socket. */
             case EVT_INQUIRY_COMPLETE: {
                 
-                 /* In order to jump out of the while loop. If without this 
-                  * flag, new socket will not been received. */
-                 keep_scanning = false;
+                 record_inquiry_complete();
+
+                 if (adaptive_advertising_update(&adaptive_advertising,
+                                                 get_system_time())) {
+                     adaptive_advertising_write_metrics(
+                         &adaptive_advertising, ADVERTISING_METRIC_FILE_NAME);
+                 }
+
+                 if (g_hci_transport == &simulator_transport) {
+                     crowd_simulator_record_queue_depth(
+                         get_number_of_waiting_pushes());
+                 }
+
+                 if (g_use_periodic_inquiry == false &&
+                     0 > start_inquiry(socket, false)) {
+
+                     /* Error handling */
+                     perror(errordesc[E_SCAN_START_INQUIRY].message);
+                     keep_scanning = false;
+
+                 }
              
             } break;
 
+            /* The controller rejected the periodic inquiry mode */
+            case EVT_CMD_COMPLETE: {
+
+                 command_complete = (void *)event_buffer_pointer;
+
+                 if (command_complete->opcode ==
+                     htobs(cmd_opcode_pack(OGF_LINK_CTL,
+                                           OCF_PERIODIC_INQUIRY)) &&
+                     0 != event_buffer_pointer[EVT_CMD_COMPLETE_SIZE]) {
+
+                     printf("Periodic inquiry not supported, starting "
+                            "inquiries back to back\n");
+                     g_use_periodic_inquiry = false;
+
+                     if (0 > start_inquiry(socket, false)) {
+
+                         /* Error handling */
+                         perror(errordesc[E_SCAN_START_INQUIRY].message);
+                         keep_scanning = false;
+
+                     }
+
+                 }
+
+            } break;
+
+            /* The controller rejected the inquiry */
+            case EVT_CMD_STATUS: {
+
+                 command_status = (void *)event_buffer_pointer;
+
+                 if (command_status->opcode ==
+                     htobs(cmd_opcode_pack(OGF_LINK_CTL, OCF_INQUIRY)) &&
+                     0 != command_status->status) {
+
+                     /* Error handling */
+                     perror(errordesc[E_SCAN_START_INQUIRY].message);
+                     keep_scanning = false;
+
+                 }
+
+            } break;
+
             default:    
             
             break;
@@ -1316,9 +2803,18 @@ void start_scanning() {
     } //end while 
     
     
+    /* Stop the inquiry still running on the controller */
+    if (g_use_periodic_inquiry == true) {
+        g_hci_transport->send_cmd(socket, OGF_LINK_CTL,
+                                  OCF_EXIT_PERIODIC_INQUIRY, 0, NULL);
+    }
+    else {
+        g_hci_transport->send_cmd(socket, OGF_LINK_CTL, OCF_INQUIRY_CANCEL,
+                                  0, NULL);
+    }
 
     printf("Scanning done\n");    
-    close(socket);
+    g_hci_transport->close_dev(socket);
 
     return;
 }
@@ -1327,7 +2823,8 @@ void start_scanning() {
 /*
 *  startThread:
 *
-*  This function initializes the threads.
+*  This function initializes the threads. The threads are joinable, so the
+*  main thread can wait for them to exit on shutdown.
 *
 *  Parameters:
 *
@@ -1339,13 +2836,12 @@ void start_scanning() {
 *
 *  None
 */
-void startThread(pthread_t threads ,void * (*run)(void*), void *arg){
+void startThread(pthread_t *threads ,void * (*run)(void*), void *arg){
 
     pthread_attr_t attr;
     if (pthread_attr_init(&attr) != 0
-      || pthread_create(&threads, &attr, run, arg) != 0
-      || pthread_attr_destroy(&attr) != 0
-      || pthread_detach(threads) != 0) {
+      || pthread_create(threads, &attr, run, arg) != 0
+      || pthread_attr_destroy(&attr) != 0) {
 
     perror(strerror(errno));
     return;
@@ -1370,12 +2866,164 @@ void startThread(pthread_t threads ,void * (*run)(void*), void *arg){
 */
 void cleanup_exit(){
 
+    List_Entry expired; /* Every device left in the scanned list */
+    PushClient push_client; /* Idle client of a push dongle */
+    int push_dongle_id;     /* An iterator through the push dongles */
+
     ready_to_work = false;
     send_message_cancelled = true;
-    free_list(scanned_list);
-    free_list(waiting_list);
+
+    /* Save the scanned list before it is emptied below */
+    if (g_save_state == true && scanned_wheel.slots != NULL &&
+        channel_cache.entries != NULL) {
+        save_state();
+        printf("State snapshots: %lld written, %lld skipped unchanged\n",
+               number_of_snapshots, number_of_unchanged_snapshots);
+    }
+
+    pthread_mutex_lock(&scanned_list_lock);
+    pthread_cond_broadcast(&scanned_list_cond);
+
+    if (scanned_wheel.slots != NULL) {
+
+        expired.next = &expired;
+        expired.prev = &expired;
+        timing_wheel_expire(&scanned_wheel, LLONG_MAX, &expired);
+        remove_scanned_devices(&expired);
+        timing_wheel_free(&scanned_wheel);
+
+    }
+
+    if (scanned_device_pool.chunks != NULL) {
+
+        memory_pool_print_statistics(&scanned_device_pool, "scanned");
+        memory_pool_free(&scanned_device_pool);
+
+    }
+
+    pthread_mutex_unlock(&scanned_list_lock);
+
+    if (waiting_queue.levels != NULL) {
+
+        queue_close(&waiting_queue);
+        queue_print_statistics(&waiting_queue, "waiting");
+
+    }
+
+    if (push_balancer.dongles != NULL) {
+
+        balancer_close(&push_balancer);
+        balancer_print_statistics(&push_balancer);
+
+    }
+
+    if (idle_clients != NULL) {
+
+        printf("OBEX clients opened: %d\n", number_of_opened_clients);
+
+        for (push_dongle_id = 0;
+             push_dongle_id < push_balancer.number_of_dongles;
+             push_dongle_id++) {
+
+            /* Close the clients given back by the threads that exited */
+            while (queue_dequeue_timed(&idle_clients[push_dongle_id],
+                                       &push_client, NULL, 0) == 0) {
+                close_push_client(&push_client);
+            }
+
+        }
+
+    }
+
+    if (transfer_queue.levels != NULL) {
+
+        queue_close(&transfer_queue);
+        queue_print_statistics(&transfer_queue, "transfer");
+
+    }
+
+    print_stage_statistics(&browse_statistics);
+    print_stage_statistics(&idle_client_statistics);
+    print_stage_statistics(&connect_statistics);
+    print_stage_statistics(&transfer_statistics);
+    print_stage_statistics(&push_statistics);
+    print_stage_statistics(&retry_statistics);
+
+    if (channel_cache.entries != NULL) {
+
+        channel_cache_print_statistics(&channel_cache);
+
+    }
+
+    if (retry_queue.heap != NULL) {
+
+        retry_queue_close(&retry_queue);
+        retry_queue_print_statistics(&retry_queue);
+
+    }
+
+    if (blocklist.entries != NULL) {
+
+        blocklist_print_statistics(&blocklist);
+
+    }
+
+    print_inquiry_statistics();
+    print_broadcast_coverage();
+    adaptive_advertising_print_statistics(&adaptive_advertising);
+
+    if (g_hci_transport == &simulator_transport) {
+
+        crowd_simulator_print_report();
+        crowd_simulator_free();
+
+    }
+
+    if (tracking_writer.records != NULL) {
+
+        tracking_writer_print_statistics(&tracking_writer);
+        tracking_writer_free(&tracking_writer);
+
+    }
+
+    device_table_free(&scanned_table);
+
+    /* The queues, cache and lists shared by the threads are freed with the
+     * scanned list, once the threads are joined */
+    queue_free(&waiting_queue);
+    queue_free(&transfer_queue);
+
+    if (idle_clients != NULL) {
+
+        for (push_dongle_id = 0;
+             push_dongle_id <
+                 config_store_get(&config_store)->number_of_push_dongles;
+             push_dongle_id++) {
+            queue_free(&idle_clients[push_dongle_id]);
+        }
+
+        free(idle_clients);
+        idle_clients = NULL;
+
+    }
+
+    balancer_free(&push_balancer);
+
+    if (channel_cache.entries != NULL) {
+        channel_cache_free(&channel_cache);
+    }
+
+    if (blocklist.entries != NULL) {
+        blocklist_free(&blocklist);
+    }
+
+    retry_queue_free(&retry_queue);
+
+    message_store_free(&message_store);
     free(g_idle_handler);
     free(g_push_file_path);
+    config_store_print_statistics(&config_store);
+    config_store_free(&config_store);
     return;
 
 }
@@ -1387,36 +3035,184 @@ int main(int argc, char **argv) {
     /* An iterator through the array of ScannedDevice struct */
     int device_id;
 
+    /* Client of a push dongle given to the idle clients */
+    PushClient push_client;
+
     /* Buffer that contains the location of the beacon */
     char hex_c[CONFIG_BUFFER_SIZE];
 
     /* Return value of pthread_create used to check for errors */
     int return_value;   
 
-    /* Load config struct */
-    g_config = get_config(CONFIG_FILE_NAME);
+    /* Command line option being parsed */
+    int option;
+
+    /* Capture file and replay settings for the replay HCI backend */
+    char *replay_file_path = NULL;
+    double replay_speed = 1.0;
+    bool replay_loop = false;
+
+    /* Crowd played by the simulator HCI backend */
+    int crowd_size = 0;
+    double crowd_arrival_rate = SIMULATOR_DEFAULT_ARRIVAL_RATE;
+    double crowd_dwell_time = SIMULATOR_DEFAULT_DWELL_TIME;
+
+    /* Config in use at startup */
+    Config *config;
+
+    /* Whether the pool of scanned devices refuses to grow when full */
+    bool pool_fail_fast = false;
+
+    /* -r file: scan from a btsnoop or raw capture instead of dongle 0
+     * -x speed: replay or simulation speed factor, 0 replays as fast as
+     *     possible
+     * -l: replay the capture in a loop
+     * -p: use periodic inquiry mode instead of starting the inquiries
+     *     back to back
+     * -f: ignore new devices when the pool of scanned devices is full
+     *     instead of growing it
+     * -a: push with one non-blocking push engine per dongle instead of
+     *     the connect and transfer threads
+     * -o port: push to a stand-in receiver on the loopback port instead
+     *     of the devices
+     * -c devices[:rate[:dwell]]: scan a simulated crowd of that many
+     *     devices instead of dongle 0 */
+    while ((option = getopt(argc, argv, "r:x:lpfao:c:")) != -1) {
+
+        switch (option) {
+
+            case 'r':
+                replay_file_path = optarg;
+                break;
+
+            case 'x':
+                replay_speed = atof(optarg);
+                break;
+
+            case 'l':
+                replay_loop = true;
+                break;
+
+            case 'p':
+                g_use_periodic_inquiry = true;
+                break;
+
+            case 'f':
+                pool_fail_fast = true;
+                break;
+
+            case 'a':
+                g_use_push_engine = true;
+                break;
+
+            case 'o':
+                g_stand_in_port = atoi(optarg);
+                break;
+
+            case 'c':
+                sscanf(optarg, "%d:%lf:%lf", &crowd_size,
+                       &crowd_arrival_rate, &crowd_dwell_time);
+                break;
+
+            default:
+                fprintf(stderr, "Usage: %s [-r capture_file] [-x speed] "
+                        "[-l] [-p] [-f] [-a] [-o port] "
+                        "[-c devices[:rate[:dwell]]]\n", argv[0]);
+                return 1;
+
+        }
+
+    }
+
+    /* Load the config, whose errors are printed by the parser */
+    if (config_store_init(&config_store, CONFIG_FILE_NAME) != 0) {
+        return 1;
+    }
+
+    config = config_store_get(&config_store);
+
+    /* The advertising interval is given to the controller in units of
+     * 0.625 milliseconds */
+    if (adaptive_advertising_init(&adaptive_advertising,
+                                  config->minimum_advertising_interval *
+                                  8 / 5,
+                                  config->maximum_advertising_interval *
+                                  8 / 5,
+                                  config->minimum_tx_power,
+                                  config->maximum_tx_power,
+                                  config->full_discovery_rate,
+                                  config->advertising_hysteresis,
+                                  config->advertising_hold_time) != 0) {
+
+        /* Error handling */
+        perror("Invalid advertising interval bounds");
+        return 1;
+
+    }
+
+    adaptive_advertising_write_metrics(&adaptive_advertising,
+                                       ADVERTISING_METRIC_FILE_NAME);
+
+    if (replay_file_path != NULL) {
+
+        hci_replay_configure(replay_file_path, replay_speed, replay_loop);
+        g_hci_transport = &replay_transport;
+        printf("Replaying HCI events from %s\n", replay_file_path);
+
+    }
+    else if (crowd_size > 0) {
+
+        if (crowd_simulator_configure(crowd_size, crowd_arrival_rate,
+                                      crowd_dwell_time, replay_speed,
+                                      config->rssi_coverage) != 0) {
+
+            /* Error handling */
+            perror("Error simulating the crowd");
+            return 1;
+
+        }
+
+        g_hci_transport = &simulator_transport;
+        printf("Simulating a crowd of %d devices\n", crowd_size);
+
+    }
+
+    /* The message file is named by its directory and its name */
     g_push_file_path =
-        malloc(g_config.file_path_length + g_config.file_name_length);
-    
+        malloc(strlen(config->file_path) + strlen(config->file_name) + 2);
+
     if (g_push_file_path == NULL) {
         
         /* Error handling */
         perror(strerror(errno));
         cleanup_exit();
-        return;
+        return EXIT_FAILURE;
+
+    }
+
+    sprintf(g_push_file_path, "%s%s%s", config->file_path,
+            config->file_path[strlen(config->file_path) - 1] == '/' ?
+            "" : "/", config->file_name);
+
+    /* Load every message in memory so pushes do not read the SD card */
+    if (message_store_load(&message_store, MESSAGE_DIRECTORY,
+                           g_push_file_path) != 0) {
+
+        /* Error handling */
+        perror(errordesc[E_OPEN_FILE].message);
+        cleanup_exit();
+        return EXIT_FAILURE;
 
     }
 
-    memcpy(g_push_file_path, g_config.file_path,
-           g_config.file_path_length - 1);
-    memcpy(g_push_file_path + g_config.file_path_length - 1,
-           g_config.file_name, g_config.file_name_length - 1);
-    coordinate_X.f = (float)atof(g_config.coordinate_X);
-    coordinate_Y.f = (float)atof(g_config.coordinate_Y);
-    coordinate_Z.f = (float)atof(g_config.coordinate_Z);
+    message_store_print(&message_store);
+
+    coordinate_X.f = config->coordinate_X;
+    coordinate_Y.f = config->coordinate_Y;
+    coordinate_Z.f = config->coordinate_Z;
 
     /* Allocate an array with the size of maximum number of devices */
-    int maximum_number_of_devices = atoi(g_config.maximum_number_of_devices);
+    int maximum_number_of_devices = config->maximum_number_of_devices;
     g_idle_handler =
         malloc(maximum_number_of_devices * sizeof(ThreadStatus));
     if (g_idle_handler == NULL) {
@@ -1424,107 +3220,206 @@ int main(int argc, char **argv) {
         /* Error handling */
         perror(strerror(errno));
         cleanup_exit();
-        return;
+        return EXIT_FAILURE;
         
     }
 
     /* Initialize each ThreadStatus struct in the array */
     for (device_id = 0; device_id < maximum_number_of_devices; device_id++) {
-         strncpy(g_idle_handler[device_id].scanned_mac_address, "0",
-         LENGTH_OF_MAC_ADDRESS);
+        bacpy(&g_idle_handler[device_id].scanned_device_address, BDADDR_ANY);
         g_idle_handler[device_id].idle = true;
         g_idle_handler[device_id].is_waiting_to_send = false;
+        g_idle_handler[device_id].dongle_device_id = 0;
+    }
+
+    /* The push dongles use the device IDs after the scanning dongle */
+    int number_of_push_dongles = config->number_of_push_dongles;
+
+    int push_dongle_device_ids[number_of_push_dongles];
+    int push_dongle_id;
+
+    for (push_dongle_id = 0; push_dongle_id < number_of_push_dongles;
+         push_dongle_id++) {
+        push_dongle_device_ids[push_dongle_id] = push_dongle_id + 1;
+    }
+
+    /* Each connect thread brings one client to the idle clients of its
+     * dongle, so there is room for all the clients in each queue */
+    idle_clients = (Queue *)calloc(number_of_push_dongles, sizeof(Queue));
+
+    if (idle_clients == NULL) {
+
+        /* Error handling */
+        perror(strerror(errno));
+        cleanup_exit();
+        return EXIT_FAILURE;
+
+    }
+
+    for (push_dongle_id = 0; push_dongle_id < number_of_push_dongles;
+         push_dongle_id++) {
+
+        if (queue_init(&idle_clients[push_dongle_id],
+                       maximum_number_of_devices, sizeof(PushClient),
+                       1) != 0) {
+            cleanup_exit();
+            return EXIT_FAILURE;
+        }
+
     }
 
-    /*Initialize two lists for the scanned data and waiting queue*/
-    scanned_list = (struct List_Entry*)malloc(sizeof(struct List_Entry));
-    scanned_list->next = scanned_list;
-    scanned_list->prev = scanned_list;
-    waiting_list = (struct List_Entry*)malloc(sizeof(struct List_Entry));
-    waiting_list->next = waiting_list;
-    waiting_list->prev = waiting_list;
+    /* The scanned list holds the devices being sent to and the devices
+     * seen during the last TIMEOUT milliseconds */
+    int scanned_device_capacity =
+        maximum_number_of_devices + EXPECTED_CROWD_SIZE;
+
+    /* Initialize the waiting queue, the pool, the table and the timing 
+     * wheel of the scanned list */
+    if (memory_pool_init(&scanned_device_pool, sizeof(ScannedDevice),
+                         scanned_device_capacity, pool_fail_fast) != 0 ||
+        queue_init(&waiting_queue, WAITING_QUEUE_CAPACITY,
+                   sizeof(PushJob), NUMBER_OF_PRIORITIES) != 0 ||
+        balancer_init(&push_balancer, push_dongle_device_ids,
+                      number_of_push_dongles, WAITING_QUEUE_CAPACITY,
+                      sizeof(PushJob), NUMBER_OF_PRIORITIES) != 0 ||
+        queue_init(&transfer_queue, maximum_number_of_devices,
+                   sizeof(PushJob), NUMBER_OF_PRIORITIES) != 0 ||
+        channel_cache_init(&channel_cache, CHANNEL_CACHE_CAPACITY,
+                           CHANNEL_CACHE_TIME_TO_LIVE) != 0 ||
+        blocklist_init(&blocklist, BLOCKLIST_CAPACITY) != 0 ||
+        retry_queue_init(&retry_queue, RETRY_QUEUE_CAPACITY, sizeof(PushJob),
+                         RETRY_BASE_DELAY, RETRY_MAXIMUM_ATTEMPTS) != 0 ||
+        device_table_init(&scanned_table, 
+                          scanned_device_capacity * 2) != 0 ||
+        timing_wheel_init(&scanned_wheel, TIMEOUT, TIMING_WHEEL_SLOT_LENGTH,
+                          get_system_time()) != 0 ||
+        tracking_writer_init(&tracking_writer, TRACKING_FILE_NAME,
+                             config->uuid, TRACKING_RING_CAPACITY,
+                             TIME_INTERVAL_OF_SEND_TO_GATEWAY) != 0) {
+
+        cleanup_exit();
+        return EXIT_FAILURE;
+
+    }
     
 
+    /* Until an emergency message is activated, the message file of the
+     * config file is pushed */
+    set_active_message(PRIORITY_ADVERTISEMENT, &message_store.messages[0]);
+
+    /* Warm restart from the state saved by the last run with a dongle */
+    g_save_state = (g_hci_transport == &bluez_transport);
+
+    if (g_save_state == true) {
+        restore_state();
+    }
+
+
     /* Store coordinates of the beacon location */
-    sprintf(hex_c,
-            "E2C56DB5DFFB48D2B060D0F5%02x%02x%02x%02x%02x%02x%02x%02x",
-            coordinate_X.b[0], coordinate_X.b[1], coordinate_X.b[2],
-            coordinate_X.b[3], coordinate_Y.b[0], coordinate_Y.b[1],
-            coordinate_Y.b[2], coordinate_Y.b[3]);
+    format_beacon_location(hex_c);
 
    
 
+    /* The signals activating emergency messages, reloading the config and
+     * shutting down are only received by the control_messages thread, so
+     * block them before creating any thread */
+    sigset_t control_signals;
+    sigemptyset(&control_signals);
+    sigaddset(&control_signals, SIGUSR1);
+    sigaddset(&control_signals, SIGUSR2);
+    sigaddset(&control_signals, SIGHUP);
+    sigaddset(&control_signals, SIGINT);
+    sigaddset(&control_signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &control_signals, NULL);
+
+
     /* Create the thread for message advertising to BLE bluetooth devices */
     pthread_t ble_beacon_thread;    
-    startThread(ble_beacon_thread, ble_beacon, hex_c);
+    startThread(&ble_beacon_thread, ble_beacon, hex_c);
     
    
     /* Create the the cleanup_scanned_list thread */
     pthread_t cleanup_scanned_list_thread;    
-    startThread(cleanup_scanned_list_thread,cleanup_scanned_list, NULL);
+    startThread(&cleanup_scanned_list_thread,cleanup_scanned_list, NULL);
 
-  
-    /* Create the thread for sending MAC address in waiting list to an 
-     * available thread */
-    pthread_t queue_to_array_thread;
-    startThread(queue_to_array_thread, queue_to_array, NULL);
 
+    /* Create the thread activating emergency messages on signals */
+    pthread_t control_messages_thread;
+    startThread(&control_messages_thread, control_messages, NULL);
 
-    int number_of_push_dongles = atoi(g_config.number_of_push_dongles);
-    int maximum_number_of_devices_per_dongle =
-        maximum_number_of_devices / number_of_push_dongles;
-    
-    /* An iterator through each push dongle */
-    int push_dongle_id;
 
-    /* An iterator through a block of devices per dongle */
-    int block_id;
+    /* Create the thread saving the state while the LBeacon runs */
+    pthread_t save_state_thread;
+
+    if (g_save_state == true) {
+        startThread(&save_state_thread, save_state_periodically, NULL);
+    }
+
 
-    int dongle_device_id = 0; /*Device ID of dongle */
+    /* Create the thread putting failed pushes back in the waiting queue */
+    pthread_t retry_thread;
+    startThread(&retry_thread, retry_devices, NULL);
 
 
-    /* Create an arrayof threads for sending message to the scanned MAC 
-     * address */
-    pthread_t send_file_thread[maximum_number_of_devices];
+    /* Create the thread writing the output file used for tracking */
+    pthread_t tracking_writer_thread;
+    startThread(&tracking_writer_thread, tracking_writer_run,
+                &tracking_writer);
+
+
+    /* Create the threads of each stage of the push pipeline: searching
+     * for the channel of the scanned MAC address, connecting to it, and
+     * sending the message to it */
+    pthread_t browse_thread[NUMBER_OF_BROWSE_THREADS];
+    pthread_t connect_thread[maximum_number_of_devices];
+    pthread_t transfer_thread[maximum_number_of_devices];
+    pthread_t push_thread[number_of_push_dongles];
+    int thread_id;
+
+    /* The push engine replaces the connect and transfer threads with one
+     * thread per push dongle */
+    int number_of_push_threads =
+        g_use_push_engine == true ? 0 : maximum_number_of_devices;
+    number_of_connect_threads = number_of_push_threads;
 
     /* After all the other threads are ready, set this flag to false. */
     send_message_cancelled = false;
 
     
-   for (device_id = 0; device_id < maximum_number_of_devices; device_id++) {
-        
-         if (g_idle_handler[device_id].is_waiting_to_send == true) {
-            
-            /* Depending on the number of push dongles, split the threads
-             * evenly and assign each thread to a push dongle device ID */
-            for (push_dongle_id = 0;
-                push_dongle_id < number_of_push_dongles;
-                push_dongle_id++) {
-                
-                for (block_id = 0;
-                     block_id < maximum_number_of_devices_per_dongle;
-                     block_id++) {
-                        
-                    if (device_id ==
-                        push_dongle_id *
-                        maximum_number_of_devices_per_dongle +
-                        block_id) {
-                            
-                            dongle_device_id = push_dongle_id + 1;
-                        
-                        }
-                    
-                    }
-                
-                }
-  
-            }
+    /* Connect threads are dealt round-robin to the push dongles, which
+     * use device IDs 1 and up; the balancer decides which dongle serves
+     * each device */
+    for (device_id = 0; device_id < number_of_push_threads; device_id++) {
+
+        g_idle_handler[device_id].dongle_device_id =
+            push_dongle_device_ids[device_id % number_of_push_dongles];
 
-        startThread(send_file_thread[device_id], send_file, 
-                    (void *)dongle_device_id);
+        /* The client is opened by its first push */
+        push_client.socket = -1;
+        push_client.client = NULL;
+        queue_enqueue(&idle_clients[device_id % number_of_push_dongles],
+                      &push_client, 0);
+
+        startThread(&connect_thread[device_id], connect_devices, 
+                    (void *)(intptr_t)device_id);
+        startThread(&transfer_thread[device_id], transfer_files, NULL);
       
     }
 
+    if (g_use_push_engine == true) {
+
+        for (push_dongle_id = 0; push_dongle_id < number_of_push_dongles;
+             push_dongle_id++) {
+            startThread(&push_thread[push_dongle_id], push_devices,
+                        (void *)(intptr_t)push_dongle_id);
+        }
+
+    }
+
+    for (thread_id = 0; thread_id < NUMBER_OF_BROWSE_THREADS; thread_id++) {
+        startThread(&browse_thread[thread_id], browse_devices, NULL);
+    }
+
 
    
     while(ready_to_work == true){
@@ -1533,39 +3428,131 @@ int main(int argc, char **argv) {
     
     }
 
-    /* ready_to_work = false , shut down. 
-     * wait for send_file_thread to exit. */    
+    /* ready_to_work = false , shut down. Wake up the threads sleeping on
+     * the waiting queue and the scanned list, and wait for them to exit. 
+     * Each stage of the push pipeline is closed once the stage feeding it
+     * has exited, so the devices already in the pipeline are finished.
+     * Pushes waiting to be retried are dropped. */    
+    retry_queue_close(&retry_queue);
+    queue_close(&waiting_queue);
+    pthread_mutex_lock(&scanned_list_lock);
+    pthread_cond_broadcast(&scanned_list_cond);
+    pthread_mutex_unlock(&scanned_list_lock);
+
+    return_value = pthread_join(retry_thread, NULL);
+
+    if (return_value != 0) {
+        perror(strerror(errno));
+        cleanup_exit();
+        return EXIT_FAILURE;
+
+    }
+
+    for (thread_id = 0; thread_id < NUMBER_OF_BROWSE_THREADS; thread_id++) {
+
+        return_value = pthread_join(browse_thread[thread_id], NULL);
+
+        if (return_value != 0) {
+            perror(strerror(errno));
+            cleanup_exit();
+            return EXIT_FAILURE;
+
+        }
+    }
+
+    balancer_close(&push_balancer);
+
+    if (g_use_push_engine == true) {
+
+        for (push_dongle_id = 0; push_dongle_id < number_of_push_dongles;
+             push_dongle_id++) {
+
+            return_value = pthread_join(push_thread[push_dongle_id], NULL);
+
+            if (return_value != 0) {
+                perror(strerror(errno));
+                cleanup_exit();
+                return EXIT_FAILURE;
+
+            }
+        }
+
+    }
     
-    for (device_id = 0; device_id < maximum_number_of_devices; device_id++) {
+    for (device_id = 0; device_id < number_of_push_threads; device_id++) {
         
-        return_value = pthread_join(send_file_thread[device_id], NULL);        
+        return_value = pthread_join(connect_thread[device_id], NULL);        
         
         if (return_value != 0) {
             perror(strerror(errno));
             cleanup_exit();
-            return;
+            return EXIT_FAILURE;
            
         }
     }
+
+    queue_close(&transfer_queue);
+
+    for (device_id = 0; device_id < number_of_push_threads; device_id++) {
+
+        return_value = pthread_join(transfer_thread[device_id], NULL);
+
+        if (return_value != 0) {
+            perror(strerror(errno));
+            cleanup_exit();
+            return EXIT_FAILURE;
+
+        }
+    }
     
 
-    return_value = pthread_join(queue_to_array_thread, NULL);
+    return_value = pthread_join(cleanup_scanned_list_thread, NULL);
+     
+    if (return_value != 0) {
+        perror(strerror(errno));
+        cleanup_exit();
+        return EXIT_FAILURE;
+        
+    }
     
+
+    /* Let the tracking writer write the devices scanned last */
+    tracking_writer_stop(&tracking_writer);
+    return_value = pthread_join(tracking_writer_thread, NULL);
+
     if (return_value != 0) {
         perror(strerror(errno));
         cleanup_exit();
-        return;
+        return EXIT_FAILURE;
+
     }
 
-    return_value = pthread_join(cleanup_scanned_list_thread, NULL);
-     
+
+    if (g_save_state == true) {
+
+        pthread_cancel(save_state_thread);
+        return_value = pthread_join(save_state_thread, NULL);
+
+        if (return_value != 0) {
+            perror(strerror(errno));
+            cleanup_exit();
+            return EXIT_FAILURE;
+
+        }
+
+    }
+
+
+    pthread_cancel(control_messages_thread);
+    return_value = pthread_join(control_messages_thread, NULL);
+
     if (return_value != 0) {
         perror(strerror(errno));
         cleanup_exit();
-        return;
-        
+        return EXIT_FAILURE;
+
     }
-    
+
 
     pthread_cancel(ble_beacon_thread);
     return_value = pthread_join(ble_beacon_thread, NULL);
@@ -1573,7 +3560,7 @@ int main(int argc, char **argv) {
     if (return_value != 0) {
         perror(strerror(errno));
         cleanup_exit();
-        return;
+        return EXIT_FAILURE;
         
     }
        
@@ -49,6 +49,7 @@
 * INCLUDES
 */
 
+#include <arpa/inet.h>
 #include <bluetooth/bluetooth.h>
 #include <bluetooth/hci.h>
 #include <bluetooth/hci_lib.h>
@@ -63,6 +64,7 @@
 #include <semaphore.h>
 #include <signal.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -74,7 +76,25 @@
 #include <sys/types.h>
 #include <time.h>
 #include <unistd.h>
+#include "AdaptiveAdvertising.h"
+#include "AdvertisingController.h"
+#include "AdvertisingScheduler.h"
+#include "Blocklist.h"
+#include "DeviceTable.h"
+#include "DongleBalancer.h"
+#include "HCITransport.h"
+#include "ChannelCache.h"
+#include "Config.h"
+#include "CrowdSimulator.h"
 #include "LinkedList.h"
+#include "MemoryPool.h"
+#include "MessageStore.h"
+#include "PushEngine.h"
+#include "Queue.h"
+#include "RetryQueue.h"
+#include "StateSnapshot.h"
+#include "TimingWheel.h"
+#include "TrackingWriter.h"
 #include "Utilities.h"
 
 
@@ -86,51 +106,104 @@
 /* Command opcode pack/unpack from HCI library */
 #define cmd_opcode_pack(ogf, ocf) (uint16_t)((ocf & 0x03ff) | (ogf << 10))
 
-/* Maximum number of characters in each line of config file */
-#define CONFIG_BUFFER_SIZE 64
-
 /* File path of the config file */
 #define CONFIG_FILE_NAME "../config/config.conf"
 
-/* Parameter that determines the start of the config file */
-#define DELIMITER "="
-
-/* BlueZ bluetooth extended inquiry response protocol: flags */
-#define EIR_FLAGS 0X01
-
-/* BlueZ bluetooth extended inquiry response protocol: Manufacturer Specific
- * Data */
-#define EIR_MANUFACTURE_SPECIFIC_DATA 0xFF
-
-/* BlueZ bluetooth extended inquiry response protocol: complete local name */
-#define EIR_NAME_COMPLETE 0x09
-
-/* BlueZ bluetooth extended inquiry response protocol: shorten local name */
-#define EIR_NAME_SHORT 0x08
-
 /* Maximum number of characters in message file names */
 #define FILE_NAME_BUFFER 256
 
-/* Length of time in Epoch */
-#define LENGTH_OF_TIME 10
-
-/* Transmission range limited. Only devices in this RSSI range are allowed
- * to connect */
-#define RSSI_RANGE -60
-
 /* Time interval,maximum length of time in milliseconds, a bluetooth device
 * stays in the push list */
 #define TIMEOUT 30000
 
-/* Maximum number of characters in each line of output file used for tracking
- * scanned devices */
-#define TRACKING_FILE_LINE_LENGTH 1024
+/* Length of time in milliseconds covered by each slot of the timing wheel
+ * expiring scanned devices; devices leave the scanned list at most this late
+ */
+#define TIMING_WHEEL_SLOT_LENGTH 250
+
+/* Output file used for tracking scanned devices */
+#define TRACKING_FILE_NAME "output.txt"
+
+/* Number of scanned devices the scanning thread can hand to the tracking
+ * writer thread before they are dropped */
+#define TRACKING_RING_CAPACITY 4096
+
+/* File holding the scanned list and the channel cache across restarts */
+#define STATE_SNAPSHOT_FILE_NAME "state.snapshot"
 
 /* Length of a Bluetooth MAC address */
 #define LENGTH_OF_MAC_ADDRESS 18
 
-/* Timeout of hci_send_req  */
-#define HCI_SEND_REQUEST_TIMEOUT 1000
+/* Number of threads searching for the Object Push channel of the devices
+ * with SDP, the first stage of the push pipeline */
+#define NUMBER_OF_BROWSE_THREADS 2
+
+/* Number of distinct devices expected within range of the beacon during
+ * TIMEOUT milliseconds, used to size the pool of scanned devices */
+#define EXPECTED_CROWD_SIZE 512
+
+/* Maximum number of devices waiting in the waiting queue for the push
+ * pipeline, and in the queue of the connect stage */
+#define WAITING_QUEUE_CAPACITY 1024
+
+/* Maximum number of devices whose Object Push channel is cached */
+#define CHANNEL_CACHE_CAPACITY 1024
+
+/* Time in milliseconds an Object Push channel found by SDP is reused before
+ * the device is searched again */
+#define CHANNEL_CACHE_TIME_TO_LIVE 3600000
+
+/* Address of the stand-in Object Push receiver used for benchmarks */
+#define STAND_IN_ADDRESS "127.0.0.1"
+
+/* Number of buckets of the histogram of the times of each stage of the
+ * push pipeline; the last bucket counts every job over 2^18 ms */
+#define STAGE_HISTOGRAM_BUCKETS 20
+
+/* Maximum number of devices whose failed pushes are remembered */
+#define BLOCKLIST_CAPACITY 1024
+
+/* Maximum number of failed pushes waiting to be tried again */
+#define RETRY_QUEUE_CAPACITY 256
+
+/* Delay in milliseconds before the first retry of a failed push. Later
+ * retries wait twice as long as the one before. */
+#define RETRY_BASE_DELAY 2000
+
+/* Maximum number of attempts to push to a device, including the first */
+#define RETRY_MAXIMUM_ATTEMPTS 3
+
+/* Time in milliseconds after a device is queued past which it is not
+ * tried again, since it has probably left */
+#define RETRY_DEADLINE 60000
+
+/* Directory holding one subdirectory per message group, such as
+ * advertisement, evacuation and warning */
+#define MESSAGE_DIRECTORY "../messages"
+
+/* Length of each inquiry in units of INQUIRY_LENGTH_UNIT */
+#define INQUIRY_LENGTH 0x30
+
+/* Length of time in milliseconds of one unit of inquiry length and period */
+#define INQUIRY_LENGTH_UNIT 1280
+
+/* Bounds of the random time, in units of INQUIRY_LENGTH_UNIT, between the
+ * starts of two inquiries in periodic inquiry mode. They must be longer
+ * than INQUIRY_LENGTH, so the controller rests one to two units between
+ * inquiries, a duty cycle of about 97%. Inquiries started back to back
+ * only pay a command round trip, so periodic inquiry mode is opt-in. */
+#define PERIODIC_INQUIRY_MINIMUM_PERIOD (INQUIRY_LENGTH + 1)
+#define PERIODIC_INQUIRY_MAXIMUM_PERIOD (INQUIRY_LENGTH + 2)
+
+/* Number of coverage levels reported by the emergency broadcast */
+#define NUMBER_OF_COVERAGE_LEVELS 3
+
+/* Number of inquiries between two reports of the scanning duty cycle */
+#define INQUIRY_REPORT_INTERVAL 10
+
+/* Maximum length of time in milliseconds the scanning thread waits for an
+ * HCI event before checking whether the beacon is shutting down */
+#define SCAN_POLL_TIMEOUT 1000
 
 /* Time interval in seconds for Send to gateway */
 #define TIME_INTERVAL_OF_SEND_TO_GATEWAY 300
@@ -141,6 +214,17 @@
 /* RSSI value of the bluetooth device */
 #define RSSI_VALUE 20
 
+/* Time in milliseconds each advertising frame stays in the payload when
+ * the dongle has no extended advertising sets */
+#define ADVERTISING_ROTATION_INTERVAL 500
+
+/* File receiving the advertising interval chosen for the crowd */
+#define ADVERTISING_METRIC_FILE_NAME "advertising_metrics.txt"
+
+/* Time in milliseconds a connect thread beyond the maximum number of
+ * devices of the config waits before checking it again */
+#define PARKED_THREAD_SLEEP 1000
+
 
 
 /*
@@ -171,89 +255,149 @@ union {
 * TYPEDEF STRUCTS
 */
 
-typedef struct Config {
-    /* A string representation of the X coordinate of the beacon location */
-    char coordinate_X[CONFIG_BUFFER_SIZE];
+typedef struct ThreadStatus {
+    /* Address of the device the thread is sending to, all zeros if idle */
+    bdaddr_t scanned_device_address;
+    bool idle;
+    bool is_waiting_to_send;
 
-    /* A string representation of the Y coordinate of the beacon location */
-    char coordinate_Y[CONFIG_BUFFER_SIZE];
+    /* Device ID of the push dongle used by the thread */
+    int dongle_device_id;
+} ThreadStatus;
 
-    /* A string representation of the Z coordinate of the beacon location */
-    char coordinate_Z[CONFIG_BUFFER_SIZE];
 
-    /* A string representation of the message file name */
-    char file_name[CONFIG_BUFFER_SIZE];
+/* Struct for storing scanned timestamp and MAC address of the user's
+*  device */
+typedef struct ScannedDevice {
+    long long initial_scanned_time;
+    bdaddr_t scanned_device_address;
 
-    /* A string representation of the message file name's file path */
-    char file_path[CONFIG_BUFFER_SIZE];
+    /* Emergency broadcast epoch in which the device was last queued */
+    int epoch;
 
-    /* A string representation of the maximum number of devices to be
-    handled by all push dongles */
-    char maximum_number_of_devices[CONFIG_BUFFER_SIZE];
+    /* Priority level of the push waiting for the device, or
+     * STATE_SNAPSHOT_NOT_PENDING once it is pushed, given up or skipped */
+    int pending_priority;
 
-    /* A string representation of number of message groups */
-    char number_of_groups[CONFIG_BUFFER_SIZE];
+    /* Entry of the device in the timing wheel expiring the scanned list */
+    TimerEntry timer;
+} ScannedDevice;
 
-    /* A string representation of the number of messages */
-    char number_of_messages[CONFIG_BUFFER_SIZE];
 
-    /* A string representation of the number of push dongles */
-    char number_of_push_dongles[CONFIG_BUFFER_SIZE];
+/* Priority levels of the waiting queue, one per message group. A device
+ * is queued at the highest priority whose group has an active message. */
+typedef enum MessagePriority {
+    PRIORITY_EVACUATION = 0,
+    PRIORITY_WARNING = 1,
+    PRIORITY_ADVERTISEMENT = 2,
+    NUMBER_OF_PRIORITIES = 3
+} MessagePriority;
 
-    /* A string representation of the required signal strength */
-    char rssi_coverage[CONFIG_BUFFER_SIZE];
 
-    /* A string representation of the universally unique identifer */
-    char uuid[CONFIG_BUFFER_SIZE];
+/* Struct for the HCI socket and the OBEX client of a push dongle. They
+ * stay open across pushes; only the link to each device is disconnected */
+typedef struct PushClient {
+    /* HCI socket of the dongle, -1 while closed */
+    int socket;
 
-    /* The string length needed to store coordinate_X */
-    int coordinate_X_length;
+    /* OBEX client, NULL while closed */
+    obexftp_client_t *client;
+} PushClient;
 
-    /* The string length needed to store coordinate_Y */
-    int coordinate_Y_length;
 
-    /* The string length needed to store coordinate_Z */
-    int coordinate_Z_length;
+/* Struct for a device going through the queues of the push pipeline */
+typedef struct PushJob {
+    long long initial_scanned_time;
+    bdaddr_t scanned_device_address;
 
-    /* The string length needed to store file name */
-    int file_name_length;
+    /* Emergency broadcast epoch in which the device was queued */
+    int epoch;
 
-    /* The string length needed to store file path */
-    int file_path_length;
+    /* Number of failed attempts to push to the device */
+    int attempts;
 
-    /* The string length needed to store maximum_number_of_devices */
-    int maximum_number_of_devices_length;
+    /* Object Push channel found by the browse stage */
+    int channel;
 
-    /* The string length needed to store number_of_groups */
-    int number_of_groups_length;
+    /* Socket of the push dongle and OBEX client connected to the device by
+     * the connect stage, closed by the transfer stage */
+    int socket;
+    obexftp_client_t *client;
 
-    /* The string length needed to store number_of_messages */
-    int number_of_messages_length;
+    /* Index of the push dongle in the balancer and the time the connect
+     * stage started, so the latency of the dongle can be updated */
+    int push_dongle;
+    long long connect_start_time;
 
-    /* The string length needed to store number_of_push_dongles */
-    int number_of_push_dongles_length;
+    /* Priority level the device was queued at, kept for the push engine */
+    int priority;
+} PushJob;
 
-    /* The string length needed to store rssi_coverage */
-    int rssi_coverage_length;
 
-    /* The string length needed to store uuid */
-    int uuid_length;
-} Config;
+/* Struct for the time jobs spend in a stage of the push pipeline */
+typedef struct StageStatistics {
+    /* Name of the stage used in the output */
+    char *name;
 
+    /* Lock protecting the statistics, shared by the threads of the stage */
+    pthread_mutex_t lock;
 
-typedef struct ThreadStatus {
-    char scanned_mac_address[LENGTH_OF_MAC_ADDRESS];
-    bool idle;
-    bool is_waiting_to_send;
-} ThreadStatus;
+    /* Number of jobs done by the stage, and how many of them failed */
+    long long number_of_jobs;
+    long long number_of_failures;
 
+    /* Sum and maximum of the time in milliseconds of the jobs */
+    long long total_time;
+    long long maximum_time;
+
+    /* Histogram of the times of the jobs: bucket i counts the jobs that
+     * took less than 2^i milliseconds and at least half of that */
+    long long histogram[STAGE_HISTOGRAM_BUCKETS];
+
+    /* Times in milliseconds the first and the last job were recorded */
+    long long first_time;
+    long long last_time;
+} StageStatistics;
+
+
+/* Struct for the state of the emergency broadcast. While it is active,
+ * every device seen is pushed once per epoch, even if it is in the scanned
+ * list already. */
+typedef struct BroadcastStatus {
+    /* Whether an emergency broadcast is going on */
+    bool is_active;
+
+    /* Number of the current broadcast, incremented at each start */
+    int epoch;
+
+    /* Time in milliseconds at which the broadcast started */
+    long long start_time;
+
+    /* Number of devices queued and reached during the broadcast */
+    int number_of_targets;
+    int number_of_reached;
+
+    /* Time in milliseconds after the start at which each coverage level
+     * was reached, 0 if not reached yet */
+    long long coverage_times[NUMBER_OF_COVERAGE_LEVELS];
+} BroadcastStatus;
 
-/* Struct for storing scanned timestamp and MAC address of the user's
-*  device */
-typedef struct ScannedDevice {
-    long long initial_scanned_time;
-    char scanned_mac_address[LENGTH_OF_MAC_ADDRESS];
-} ScannedDevice;
+
+/* Struct for the timing of the inquiries of the scanning dongle */
+typedef struct InquiryStatistics {
+    /* Time in milliseconds at which the first inquiry was started */
+    long long first_start_time;
+
+    /* Time in milliseconds of the last inquiry complete event */
+    long long last_complete_time;
+
+    /* Number of inquiries completed */
+    long long number_of_inquiries;
+
+    /* Sum and maximum of the gaps in milliseconds between two inquiries */
+    long long total_gap;
+    long long maximum_gap;
+} InquiryStatistics;
 
 
 
@@ -318,27 +462,150 @@ extern struct hci_filter;
 /* The path of the object push file */
 char *g_push_file_path;
 
-/* The first timestamp of the output file used for tracking scanned
-* devices */
-unsigned g_initial_timestamp_of_tracking_file = 0;
+/* Config read from the config file, reloaded on SIGHUP */
+ConfigStore config_store;
+
+/* The HCI backend used for scanning, a real dongle unless a capture file is
+ * given on the command line */
+HCITransport *g_hci_transport = &bluez_transport;
+
+/* Whether the scanning dongle uses periodic inquiry mode or starts the
+ * inquiries back to back */
+bool g_use_periodic_inquiry = false;
 
-/* The most recent time of the output file used for tracking scanned
-* devices */
-unsigned g_most_recent_timestamp_of_tracking_file = 0;
+/* Whether the devices are pushed to by one push engine per dongle instead
+ * of the connect and transfer threads */
+bool g_use_push_engine = false;
 
-/* Number of lines in the output file used for tracking scanned devices */
-int g_size_of_file = 0;
+/* Whether the state is saved to STATE_SNAPSHOT_FILE_NAME and restored at
+ * startup, only when scanning with a dongle */
+bool g_save_state = false;
 
-/* Struct for storing config information from the input file */
-Config g_config;
+/* Loopback TCP port of a stand-in Object Push receiver taking every push
+ * instead of the devices, 0 to push to the devices */
+int g_stand_in_port = 0;
+
+/* Timing of the inquiries of the scanning dongle */
+InquiryStatistics inquiry_statistics;
 
 
 /* An array of struct for storing information and status of each thread */
 ThreadStatus *g_idle_handler;
 
-/*Two list of struct for recording scanned devices */
-List_Entry *scanned_list;
-List_Entry *waiting_list;
+/* Number of connect threads started, the most devices a reload of the
+ * config can let them handle at once */
+int number_of_connect_threads;
+
+/* Queue of PushJob struct for scanned devices waiting to be sent to */
+Queue waiting_queue;
+
+/* Devices whose channel is known wait in the queue of the push dongle the
+ * balancer assigned them to, and connected devices wait for a transfer
+ * thread */
+DongleBalancer push_balancer;
+Queue transfer_queue;
+
+/* Clients of each push dongle not used by a push, and the number of times
+ * a client was opened */
+Queue *idle_clients;
+int number_of_opened_clients;
+
+/* Time spent in each stage of the push pipeline */
+StageStatistics browse_statistics = {"browse", PTHREAD_MUTEX_INITIALIZER};
+StageStatistics connect_statistics = {"connect", PTHREAD_MUTEX_INITIALIZER};
+StageStatistics transfer_statistics = {"transfer", PTHREAD_MUTEX_INITIALIZER};
+
+/* Time from the start of a failed push to its retry being queued again.
+ * The retries dropped because the waiting queue was full are failures. */
+StageStatistics retry_statistics = {"retry", PTHREAD_MUTEX_INITIALIZER};
+
+/* Time the connect stage waits for an idle client of its dongle */
+StageStatistics idle_client_statistics =
+    {"idle client wait", PTHREAD_MUTEX_INITIALIZER};
+
+/* Time from the start of the connection to the end of each push */
+StageStatistics push_statistics = {"push", PTHREAD_MUTEX_INITIALIZER};
+
+/* The scanned list: recently scanned devices indexed by device address, and
+ * the timing wheel removing them TIMEOUT milliseconds after they were
+ * scanned */
+DeviceTable scanned_table;
+TimingWheel scanned_wheel;
+
+/* Pool owning the ScannedDevice structs of the scanned list, together with
+ * their timer entries */
+MemoryPool scanned_device_pool;
+
+/* Cache of the Object Push channels found by SDP searches */
+ChannelCache channel_cache;
+
+/* Devices skipped for a while because pushes to them failed */
+Blocklist blocklist;
+
+/* Pushes that failed and are waiting to be tried again */
+RetryQueue retry_queue;
+
+/* Advertisements of the LE dongle */
+AdvertisingController advertising_controller;
+
+/* Advertising interval and TX power adapted to the discovery rate */
+AdaptiveAdvertising adaptive_advertising;
+
+/* Frames sharing the LE dongle, and the index of the Eddystone-UID frame
+ * carrying the floor and the active message, -1 when it is not sent */
+AdvertisingScheduler advertising_scheduler;
+int message_group_frame = -1;
+
+/* Indexes of the iBeacon, AltBeacon and Eddystone-URL frames, compiled
+ * again when a reload changes the location, -1 when they are not sent */
+int ibeacon_frame = -1;
+int altbeacon_frame = -1;
+int location_url_frame = -1;
+
+/* Every push message, loaded in memory at startup */
+MessageStore message_store;
+
+/* Message group of each priority level */
+char *priority_groups[NUMBER_OF_PRIORITIES] = {
+    "evacuation", "warning", "advertisement"
+};
+
+/* Message pushed at each priority level, NULL when the level is not
+ * active. The advertisement level always pushes the message file of the
+ * config file. */
+Message *active_messages[NUMBER_OF_PRIORITIES];
+
+/* Lock protecting the active messages */
+pthread_mutex_t active_message_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* State of the emergency broadcast, protected by the scanned list lock */
+BroadcastStatus broadcast;
+
+/* Percentages of the devices in range whose time to be reached is reported
+ * by the emergency broadcast */
+int coverage_levels[NUMBER_OF_COVERAGE_LEVELS] = {50, 90, 99};
+
+/* Writer thread of the output file used for tracking scanned devices */
+TrackingWriter tracking_writer;
+
+/* Lock protecting the scanned list */
+pthread_mutex_t scanned_list_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Signaled when a device is added to an empty scanned list, or on shutdown */
+pthread_cond_t scanned_list_cond = PTHREAD_COND_INITIALIZER;
+
+/* Lock serializing the snapshots of the state */
+pthread_mutex_t state_snapshot_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Number of changes of the scanned list, of the pending pushes and of the
+ * channel cache, and its value at the last snapshot written, so a state
+ * that has not changed is not written again */
+unsigned int state_generation = 0;
+unsigned int saved_state_generation = 0;
+
+/* Number of snapshots written and skipped because nothing changed */
+long long number_of_snapshots = 0;
+long long number_of_unchanged_snapshots = 0;
 
 /* Two global flags for threads */
 bool ready_to_work = true;
@@ -357,25 +624,60 @@ extern int errno;
 * FUNCTIONS
 */
 
-Config get_config(char *file_name);
 long long get_system_time();
 void send_to_push_dongle(bdaddr_t *bluetooth_device_address);
 void print_RSSI_value(bdaddr_t *bluetooth_device_address, bool has_rssi,
     int rssi);
-void track_devices(bdaddr_t *bluetooth_device_address, char *file_name);
-bool check_is_in_list(List_Entry *list, char address[]);
-void print_list(List_Entry *entry);
-char *get_head_entry(List_Entry *entry);
-void free_list(List_Entry *entry);
+void track_devices(bdaddr_t *bluetooth_device_address);
 int enable_advertising(int advertising_interval, char *advertising_uuid,
     int rssi_value);
 int disable_advertising();
+int compile_message_group_frame(le_set_advertising_data_cp *payload);
+void update_message_group_frame();
+void format_beacon_location(char *beacon_location);
+void update_location_frames();
 void *ble_beacon(void *beacon_location);
+void remove_scanned_devices(List_Entry *expired);
+void mark_state_changed();
+void clear_pending_push(bdaddr_t *bluetooth_device_address);
+void add_channel_to_snapshot(uint64_t key, int channel, long long expiry_time,
+    void *snapshot);
+int save_state();
+void restore_state();
+void *save_state_periodically(void *arg);
 void *cleanup_scanned_list(void);
-void *queue_to_array();
-void *send_file(void *dongle_id);
+Message *get_active_message(int *priority);
+void set_active_message(int priority, Message *message);
+void *control_messages(void *arg);
+void reload_config();
+bool queue_broadcast_push(ScannedDevice *device);
+void start_broadcast();
+void stop_broadcast();
+bool is_push_superseded(PushJob *job);
+void record_broadcast_push(PushJob *job);
+void print_broadcast_coverage();
+void record_stage_time(StageStatistics *statistics, long long time,
+                       bool is_successful);
+void print_stage_statistics(StageStatistics *statistics);
+void finish_push(PushJob *job, bool is_successful);
+void finish_engine_push(void *item, PushResult result, long long connect_time,
+                        long long transfer_time, void *context);
+void *push_devices(void *id);
+void retry_push(PushJob *job, int priority, FailureClass failure_class);
+void *retry_devices(void *arg);
+int open_push_client(PushClient *push_client, int dongle_device_id);
+void close_push_client(PushClient *push_client);
+void *browse_devices(void *arg);
+void *connect_devices(void *id);
+void *transfer_files(void *arg);
+int start_inquiry(int socket, bool periodic);
+void record_inquiry_complete();
+void print_inquiry_statistics();
+int get_number_of_waiting_pushes();
+int count_inquiry_results(unsigned char *event_buffer,
+                          int event_buffer_length, int record_size);
 void start_scanning();
-void startThread(pthread_t threads, void * (*run)(void*), void *arg);
+void startThread(pthread_t *threads, void * (*run)(void*), void *arg);
 void cleanup_exit();
 
 
@@ -42,6 +42,9 @@
 *	   Han Wang, hollywang@iis.sinica.edu.tw
 */
 
+#ifndef LINKEDLIST_H
+#define LINKEDLIST_H
+
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -108,3 +111,5 @@ inline void list_remove_node(List_Entry *removed_node_ptrs);
 
 /* The function returns the length of the list. */
 inline int get_list_length(List_Entry *entry);
+
+#endif
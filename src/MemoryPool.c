@@ -0,0 +1,254 @@
+/*
+* Copyright (c) 2016 Academia Sinica, Institute of Information Science
+*
+* License:
+*
+*      GPL 3.0 : The content of this file is subject to the terms and
+*      conditions defined in file 'COPYING.txt', which is part of this source
+*      code package.
+*
+* Project Name:
+*
+*      BeDIPS
+*
+* File Description:
+*
+*      This file contains the implementation of a pool of fixed-size blocks.
+*      The records of scanned devices are taken from the pool, so the scanning
+*      thread does not go through the heap allocator and long-running beacons
+*      do not fragment their heap.
+*
+* File Name:
+*
+*      MemoryPool.c
+*
+* Abstract:
+*
+*      BeDIPS uses LBeacons to deliver 3D coordinates and textual
+*      descriptions of their locations to users' devices. Basically, a LBeacon
+*      is an inexpensive, Bluetooth Smart Ready device. The 3D coordinates and
+*      location description of every LBeacon are retrieved from BeDIS
+*      (Building/environment Data and Information System) and stored locally
+*      during deployment and maintenance times. Once initialized, each LBeacon
+*      broadcasts its coordinates and location description to Bluetooth
+*      enabled user devices within its coverage area.
+*
+* Authors:
+*
+*      Jake Lee, jakelee@iis.sinica.edu.tw
+*      Johnson Su, johnsonsu@iis.sinica.edu.tw
+*      Shirley Huang, shirley.huang.93@gmail.com
+*      Han Hu, hhu14@illinois.edu
+*      Jeffrey Lin, lin.jeff03@gmail.com
+*      Howard Hsu, haohsu0823@gmail.com
+*      Han Wang, hollywang@iis.sinica.edu.tw
+*/
+
+#include "MemoryPool.h"
+
+
+/*
+*  add_chunk:
+*
+*  This helper function allocates a chunk of blocks and puts every block of
+*  it in the free list.
+*
+*  Parameters:
+*
+*  pool - the pool
+*
+*  Return value:
+*
+*  0 - success
+*  -1 - memory allocation failed
+*/
+static int add_chunk(MemoryPool *pool) {
+
+    void **chunks;
+    unsigned char *chunk;
+    int block_id;
+
+    chunks = (void **)realloc(pool->chunks,
+                              (pool->number_of_chunks + 1) * sizeof(void *));
+
+    if (chunks == NULL) {
+
+        /* Error handling */
+        perror("Failed to allocate memory");
+        return -1;
+
+    }
+
+    pool->chunks = chunks;
+    chunk = (unsigned char *)malloc(pool->chunk_capacity * pool->block_size);
+
+    if (chunk == NULL) {
+
+        /* Error handling */
+        perror("Failed to allocate memory");
+        return -1;
+
+    }
+
+    pool->chunks[pool->number_of_chunks] = chunk;
+    pool->number_of_chunks++;
+
+    /* Thread the blocks in address order so they are handed out in order */
+    for (block_id = pool->chunk_capacity - 1; block_id >= 0; block_id--) {
+
+        void *block = chunk + block_id * pool->block_size;
+
+        *(void **)block = pool->free_list;
+        pool->free_list = block;
+
+    }
+
+    return 0;
+}
+
+
+/*
+*  memory_pool_init:
+*
+*  This function allocates the first chunk of a pool.
+*
+*  Parameters:
+*
+*  pool - the pool to be initialized
+*  block_size - size in bytes of each block
+*  capacity - number of blocks allocated up front, and added each time the
+*             pool grows
+*  fail_fast - whether to refuse allocations instead of growing
+*
+*  Return value:
+*
+*  0 - success
+*  -1 - memory allocation failed
+*/
+int memory_pool_init(MemoryPool *pool, size_t block_size, int capacity,
+                     bool fail_fast) {
+
+    memset(pool, 0, sizeof(MemoryPool));
+
+    /* Every block must hold the link of the free list, aligned */
+    if (block_size < sizeof(void *)) {
+        block_size = sizeof(void *);
+    }
+
+    pool->block_size = (block_size + sizeof(void *) - 1) &
+                       ~(sizeof(void *) - 1);
+    pool->chunk_capacity = (capacity > 0) ? capacity : 1;
+    pool->fail_fast = fail_fast;
+
+    return add_chunk(pool);
+}
+
+
+/*
+*  memory_pool_alloc:
+*
+*  This function takes a block from the free list, growing the pool by one
+*  chunk first if it is empty and the pool is not in fail-fast mode.
+*
+*  Parameters:
+*
+*  pool - the pool
+*
+*  Return value:
+*
+*  block - the block, NULL if the pool is exhausted
+*/
+void *memory_pool_alloc(MemoryPool *pool) {
+
+    void *block;
+
+    if (pool->free_list == NULL &&
+        (pool->fail_fast == true || add_chunk(pool) != 0)) {
+        pool->number_of_failures++;
+        return NULL;
+    }
+
+    block = pool->free_list;
+    pool->free_list = *(void **)block;
+    pool->number_of_used++;
+
+    if (pool->number_of_used > pool->maximum_used) {
+        pool->maximum_used = pool->number_of_used;
+    }
+
+    return block;
+}
+
+
+/*
+*  memory_pool_release:
+*
+*  This function puts a block back in the free list. The memory stays in
+*  the pool.
+*
+*  Parameters:
+*
+*  pool - the pool
+*  block - a block taken from the pool
+*
+*  Return value:
+*
+*  None
+*/
+void memory_pool_release(MemoryPool *pool, void *block) {
+
+    *(void **)block = pool->free_list;
+    pool->free_list = block;
+    pool->number_of_used--;
+}
+
+
+/*
+*  memory_pool_print_statistics:
+*
+*  This function prints the capacity and the use of the pool.
+*
+*  Parameters:
+*
+*  pool - the pool
+*  name - name of the pool used in the output
+*
+*  Return value:
+*
+*  None
+*/
+void memory_pool_print_statistics(MemoryPool *pool, char *name) {
+
+    printf("Pool %s: %d blocks of %zu bytes in %d chunks, %d used, "
+           "maximum %d, %lld refused\n", name,
+           pool->number_of_chunks * pool->chunk_capacity, pool->block_size,
+           pool->number_of_chunks, pool->number_of_used, pool->maximum_used,
+           pool->number_of_failures);
+}
+
+
+/*
+*  memory_pool_free:
+*
+*  This function frees every chunk of the pool. Blocks still in use become
+*  invalid.
+*
+*  Parameters:
+*
+*  pool - the pool
+*
+*  Return value:
+*
+*  None
+*/
+void memory_pool_free(MemoryPool *pool) {
+
+    int chunk_id;
+
+    for (chunk_id = 0; chunk_id < pool->number_of_chunks; chunk_id++) {
+        free(pool->chunks[chunk_id]);
+    }
+
+    free(pool->chunks);
+    memset(pool, 0, sizeof(MemoryPool));
+}
@@ -0,0 +1,102 @@
+/*
+* Copyright (c) 2016 Academia Sinica, Institute of Information Science
+*
+* License:
+*
+*      GPL 3.0 : The content of this file is subject to the terms and
+*      conditions defined in file 'COPYING.txt', which is part of this source
+*      code package.
+*
+* Project Name:
+*
+*      BeDIPS
+*
+* File Description:
+*
+*      This header file contains the function declarations and variables used
+*      in the MemoryPool.c file.
+*
+* File Name:
+*
+*      MemoryPool.h
+*
+* Abstract:
+*
+*      BeDIPS uses LBeacons to deliver 3D coordinates and textual
+*      descriptions of their locations to users' devices. Basically, a LBeacon
+*      is an inexpensive, Bluetooth Smart Ready device. The 3D coordinates and
+*      location description of every LBeacon are retrieved from BeDIS
+*      (Building/environment Data and Information System) and stored locally
+*      during deployment and maintenance times. Once initialized, each LBeacon
+*      broadcasts its coordinates and location description to Bluetooth
+*      enabled user devices within its coverage area.
+*
+* Authors:
+*
+*      Jake Lee, jakelee@iis.sinica.edu.tw
+*      Johnson Su, johnsonsu@iis.sinica.edu.tw
+*      Shirley Huang, shirley.huang.93@gmail.com
+*      Han Hu, hhu14@illinois.edu
+*      Jeffrey Lin, lin.jeff03@gmail.com
+*      Howard Hsu, haohsu0823@gmail.com
+*      Han Wang, hollywang@iis.sinica.edu.tw
+*/
+
+#ifndef MEMORYPOOL_H
+#define MEMORYPOOL_H
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+/*
+* TYPEDEF STRUCTS
+*/
+
+/* Pool of fixed-size blocks carved out of large chunks. Free blocks are
+ * kept in a singly linked list threaded through the blocks themselves, so
+ * allocating and releasing a block never calls malloc or free. When every
+ * block is used, the pool either grows by one more chunk or, in fail-fast
+ * mode, refuses the allocation. The pool has no lock; its user serializes
+ * the calls. */
+typedef struct MemoryPool {
+    /* Chunks of blocks allocated so far */
+    void **chunks;
+    int number_of_chunks;
+
+    /* Number of blocks in each chunk */
+    int chunk_capacity;
+
+    /* Size in bytes of each block, a multiple of the size of a pointer */
+    size_t block_size;
+
+    /* First free block, whose first word points to the next free block */
+    void *free_list;
+
+    /* Set to refuse allocations instead of growing when the pool is full */
+    bool fail_fast;
+
+    /* Number of blocks in use, and the highest it has been */
+    int number_of_used;
+    int maximum_used;
+
+    /* Number of allocations refused in fail-fast mode */
+    long long number_of_failures;
+} MemoryPool;
+
+
+
+/*
+* FUNCTIONS
+*/
+
+int memory_pool_init(MemoryPool *pool, size_t block_size, int capacity,
+                     bool fail_fast);
+void *memory_pool_alloc(MemoryPool *pool);
+void memory_pool_release(MemoryPool *pool, void *block);
+void memory_pool_print_statistics(MemoryPool *pool, char *name);
+void memory_pool_free(MemoryPool *pool);
+
+#endif
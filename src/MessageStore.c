@@ -0,0 +1,485 @@
+/*
+* Copyright (c) 2016 Academia Sinica, Institute of Information Science
+*
+* License:
+*
+*      GPL 3.0 : The content of this file is subject to the terms and
+*      conditions defined in file 'COPYING.txt', which is part of this source
+*      code package.
+*
+* Project Name:
+*
+*      BeDIPS
+*
+* File Description:
+*
+*      This file contains the message store. At startup it loads the message
+*      file given in the config file and every message under the messages
+*      directory, grouped by their subdirectories such as advertisement,
+*      evacuation and warning, into one contiguous read-only arena. Pushes are
+*      then sent from memory, which removes the disk reads and SD card wear
+*      from every push.
+*
+* File Name:
+*
+*      MessageStore.c
+*
+* Abstract:
+*
+*      BeDIPS uses LBeacons to deliver 3D coordinates and textual
+*      descriptions of their locations to users' devices. Basically, a LBeacon
+*      is an inexpensive, Bluetooth Smart Ready device. The 3D coordinates and
+*      location description of every LBeacon are retrieved from BeDIS
+*      (Building/environment Data and Information System) and stored locally
+*      during deployment and maintenance times. Once initialized, each LBeacon
+*      broadcasts its coordinates and location description to Bluetooth
+*      enabled user devices within its coverage area.
+*
+* Authors:
+*
+*      Jake Lee, jakelee@iis.sinica.edu.tw
+*      Johnson Su, johnsonsu@iis.sinica.edu.tw
+*      Shirley Huang, shirley.huang.93@gmail.com
+*      Han Hu, hhu14@illinois.edu
+*      Jeffrey Lin, lin.jeff03@gmail.com
+*      Howard Hsu, haohsu0823@gmail.com
+*      Han Wang, hollywang@iis.sinica.edu.tw
+*/
+
+#include "MessageStore.h"
+
+
+/*
+*  compare_messages:
+*
+*  This helper function orders messages by group and then by name, so the
+*  index does not depend on the order of the directory entries.
+*
+*  Parameters:
+*
+*  first - the first message
+*  second - the second message
+*
+*  Return value:
+*
+*  Negative, zero or positive like strcmp
+*/
+static int compare_messages(const void *first, const void *second) {
+
+    const Message *first_message = (const Message *)first;
+    const Message *second_message = (const Message *)second;
+    int result = strcmp(first_message->group, second_message->group);
+
+    if (result != 0) {
+        return result;
+    }
+
+    return strcmp(first_message->name, second_message->name);
+}
+
+
+/*
+*  add_message:
+*
+*  This helper function appends a message file to the index. The size of
+*  the file is kept in the length field and its content is read later,
+*  once the arena is allocated.
+*
+*  Parameters:
+*
+*  store - the store
+*  group - name of the group of the message
+*  path - path of the message file
+*
+*  Return value:
+*
+*  0 - success or not a regular file
+*  -1 - the file could not be read or memory allocation failed
+*/
+static int add_message(MessageStore *store, char *group, char *path) {
+
+    struct stat file_status;
+    Message *messages;
+    Message *message;
+    char *name = strrchr(path, '/');
+
+    if (stat(path, &file_status) != 0) {
+
+        /* Error handling */
+        perror(path);
+        return -1;
+
+    }
+
+    if (!S_ISREG(file_status.st_mode)) {
+        return 0;
+    }
+
+    messages = (Message *)realloc(store->messages,
+                                  (store->number_of_messages + 1) *
+                                  sizeof(Message));
+
+    if (messages == NULL) {
+
+        /* Error handling */
+        perror("Failed to allocate memory");
+        return -1;
+
+    }
+
+    store->messages = messages;
+    message = &messages[store->number_of_messages];
+    store->number_of_messages++;
+
+    memset(message, 0, sizeof(Message));
+    strncpy(message->group, group, MESSAGE_NAME_LENGTH - 1);
+    strncpy(message->name, (name == NULL) ? path : name + 1,
+            MESSAGE_NAME_LENGTH - 1);
+    message->length = (int)file_status.st_size;
+    store->arena_size += file_status.st_size;
+
+    return 0;
+}
+
+
+/*
+*  read_message:
+*
+*  This helper function reads the whole content of a message file into the
+*  arena.
+*
+*  Parameters:
+*
+*  path - path of the message file
+*  data - where the content is stored
+*  length - size of the file in bytes
+*
+*  Return value:
+*
+*  0 - success
+*  -1 - the file could not be read
+*/
+static int read_message(char *path, unsigned char *data, int length) {
+
+    int file_descriptor = open(path, O_RDONLY);
+    int offset = 0;
+    int return_value;
+
+    if (0 > file_descriptor) {
+
+        /* Error handling */
+        perror(path);
+        return -1;
+
+    }
+
+    while (offset < length) {
+
+        return_value = read(file_descriptor, data + offset, length - offset);
+
+        if (0 > return_value && errno == EINTR) {
+            continue;
+        }
+
+        if (0 >= return_value) {
+
+            /* Error handling */
+            perror(path);
+            close(file_descriptor);
+            return -1;
+
+        }
+
+        offset += return_value;
+
+    }
+
+    close(file_descriptor);
+
+    return 0;
+}
+
+
+/*
+*  get_message_path:
+*
+*  This helper function rebuilds the path of a message file from the
+*  directory of the store and the group and name of the message.
+*
+*  Parameters:
+*
+*  message - the message
+*  directory - directory of the message groups
+*  push_file_path - path of the message file of the config file
+*  path - buffer receiving the path
+*
+*  Return value:
+*
+*  None
+*/
+static void get_message_path(Message *message, char *directory,
+                             char *push_file_path, char *path) {
+
+    if (strcmp(message->group, PUSH_MESSAGE_GROUP) == 0) {
+        snprintf(path, MESSAGE_PATH_LENGTH, "%s", push_file_path);
+    }
+    else {
+        snprintf(path, MESSAGE_PATH_LENGTH, "%s/%s/%s", directory,
+                 message->group, message->name);
+    }
+}
+
+
+/*
+*  message_store_load:
+*
+*  This function indexes the message file of the config file and the files
+*  in each group directory under the messages directory, then reads all of
+*  them into one arena that is made read-only. The message file of the
+*  config file is always the first message of the index.
+*
+*  Parameters:
+*
+*  store - the store to be loaded
+*  directory - directory containing one subdirectory per message group
+*  push_file_path - path of the message file of the config file
+*
+*  Return value:
+*
+*  0 - success
+*  -1 - the message file of the config file could not be loaded
+*/
+int message_store_load(MessageStore *store, char *directory,
+                       char *push_file_path) {
+
+    DIR *groups;              /* Stream of the messages directory */
+    DIR *group;               /* Stream of a group directory */
+    struct dirent *group_entry;
+    struct dirent *message_entry;
+    char path[MESSAGE_PATH_LENGTH];
+    unsigned char *arena;
+    size_t offset = 0;
+    int message_id;
+
+    memset(store, 0, sizeof(MessageStore));
+
+    if (add_message(store, PUSH_MESSAGE_GROUP, push_file_path) != 0 ||
+        store->number_of_messages == 0) {
+        message_store_free(store);
+        return -1;
+    }
+
+    groups = opendir(directory);
+
+    if (groups == NULL) {
+
+        /* The message groups are optional */
+        perror(directory);
+
+    }
+    else {
+
+        while ((group_entry = readdir(groups)) != NULL) {
+
+            if (group_entry->d_name[0] == '.' ||
+                strcmp(group_entry->d_name, PUSH_MESSAGE_GROUP) == 0) {
+                continue;
+            }
+
+            snprintf(path, sizeof(path), "%s/%s", directory,
+                     group_entry->d_name);
+            group = opendir(path);
+
+            if (group == NULL) {
+                continue;
+            }
+
+            while ((message_entry = readdir(group)) != NULL) {
+
+                if (message_entry->d_name[0] == '.') {
+                    continue;
+                }
+
+                snprintf(path, sizeof(path), "%s/%s/%s", directory,
+                         group_entry->d_name, message_entry->d_name);
+                add_message(store, group_entry->d_name, path);
+
+            }
+
+            closedir(group);
+
+        }
+
+        closedir(groups);
+
+        qsort(store->messages + 1, store->number_of_messages - 1,
+              sizeof(Message), compare_messages);
+
+    }
+
+    if (store->arena_size == 0) {
+        return 0;
+    }
+
+    arena = mmap(NULL, store->arena_size, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (arena == MAP_FAILED) {
+
+        /* Error handling */
+        perror("Failed to allocate memory");
+        store->arena_size = 0;
+        message_store_free(store);
+        return -1;
+
+    }
+
+    store->arena = arena;
+
+    for (message_id = 0; message_id < store->number_of_messages;
+         message_id++) {
+
+        Message *message = &store->messages[message_id];
+
+        get_message_path(message, directory, push_file_path, path);
+
+        if (read_message(path, arena + offset, message->length) != 0) {
+
+            /* Only the message file of the config file is required */
+            if (message_id == 0) {
+                message_store_free(store);
+                return -1;
+            }
+
+            message->length = 0;
+
+        }
+
+        message->data = arena + offset;
+        offset += message->length;
+
+    }
+
+    mprotect(arena, store->arena_size, PROT_READ);
+
+    return 0;
+}
+
+
+/*
+*  message_store_find:
+*
+*  This function looks up a message by group and name.
+*
+*  Parameters:
+*
+*  store - the store
+*  group - name of the group of the message
+*  name - file name of the message
+*
+*  Return value:
+*
+*  message - the message, NULL if it is not in the store
+*/
+Message *message_store_find(MessageStore *store, char *group, char *name) {
+
+    int message_id;
+
+    for (message_id = 0; message_id < store->number_of_messages;
+         message_id++) {
+
+        if (strcmp(store->messages[message_id].group, group) == 0 &&
+            strcmp(store->messages[message_id].name, name) == 0) {
+            return &store->messages[message_id];
+        }
+
+    }
+
+    return NULL;
+}
+
+
+/*
+*  message_store_find_group:
+*
+*  This function returns the first message of a group, in the order of
+*  their names.
+*
+*  Parameters:
+*
+*  store - the store
+*  group - name of the group
+*
+*  Return value:
+*
+*  message - the message, NULL if the group has no message
+*/
+Message *message_store_find_group(MessageStore *store, char *group) {
+
+    int message_id;
+
+    for (message_id = 0; message_id < store->number_of_messages;
+         message_id++) {
+
+        if (strcmp(store->messages[message_id].group, group) == 0 &&
+            store->messages[message_id].length > 0) {
+            return &store->messages[message_id];
+        }
+
+    }
+
+    return NULL;
+}
+
+
+/*
+*  message_store_print:
+*
+*  This function prints the index of the store.
+*
+*  Parameters:
+*
+*  store - the store
+*
+*  Return value:
+*
+*  None
+*/
+void message_store_print(MessageStore *store) {
+
+    int message_id;
+
+    printf("Loaded %d messages, %zu bytes\n", store->number_of_messages,
+           store->arena_size);
+
+    for (message_id = 0; message_id < store->number_of_messages;
+         message_id++) {
+        printf("  %s/%s: %d bytes\n", store->messages[message_id].group,
+               store->messages[message_id].name,
+               store->messages[message_id].length);
+    }
+}
+
+
+/*
+*  message_store_free:
+*
+*  This function releases the arena and the index of the store.
+*
+*  Parameters:
+*
+*  store - the store
+*
+*  Return value:
+*
+*  None
+*/
+void message_store_free(MessageStore *store) {
+
+    if (store->arena != NULL) {
+        munmap(store->arena, store->arena_size);
+    }
+
+    free(store->messages);
+    memset(store, 0, sizeof(MessageStore));
+}
@@ -0,0 +1,125 @@
+/*
+* Copyright (c) 2016 Academia Sinica, Institute of Information Science
+*
+* License:
+*
+*      GPL 3.0 : The content of this file is subject to the terms and
+*      conditions defined in file 'COPYING.txt', which is part of this source
+*      code package.
+*
+* Project Name:
+*
+*      BeDIPS
+*
+* File Description:
+*
+*      This header file contains the function declarations and variables used
+*      in the MessageStore.c file.
+*
+* File Name:
+*
+*      MessageStore.h
+*
+* Abstract:
+*
+*      BeDIPS uses LBeacons to deliver 3D coordinates and textual
+*      descriptions of their locations to users' devices. Basically, a LBeacon
+*      is an inexpensive, Bluetooth Smart Ready device. The 3D coordinates and
+*      location description of every LBeacon are retrieved from BeDIS
+*      (Building/environment Data and Information System) and stored locally
+*      during deployment and maintenance times. Once initialized, each LBeacon
+*      broadcasts its coordinates and location description to Bluetooth
+*      enabled user devices within its coverage area.
+*
+* Authors:
+*
+*      Jake Lee, jakelee@iis.sinica.edu.tw
+*      Johnson Su, johnsonsu@iis.sinica.edu.tw
+*      Shirley Huang, shirley.huang.93@gmail.com
+*      Han Hu, hhu14@illinois.edu
+*      Jeffrey Lin, lin.jeff03@gmail.com
+*      Howard Hsu, haohsu0823@gmail.com
+*      Han Wang, hollywang@iis.sinica.edu.tw
+*/
+
+#ifndef MESSAGESTORE_H
+#define MESSAGESTORE_H
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+
+/*
+* CONSTANTS
+*/
+
+/* Maximum number of characters in the name of a message or message group */
+#define MESSAGE_NAME_LENGTH 64
+
+/* Maximum number of characters in the path of a message file */
+#define MESSAGE_PATH_LENGTH 256
+
+/* Name of the group holding the message file given in the config file */
+#define PUSH_MESSAGE_GROUP "push"
+
+
+
+/*
+* TYPEDEF STRUCTS
+*/
+
+/* A message file loaded in memory */
+typedef struct Message {
+    /* Name of the group directory the message belongs to */
+    char group[MESSAGE_NAME_LENGTH];
+
+    /* File name of the message, also used as its name on the device */
+    char name[MESSAGE_NAME_LENGTH];
+
+    /* Content of the message inside the arena of the store */
+    const unsigned char *data;
+
+    /* Size of the message in bytes */
+    int length;
+} Message;
+
+
+/* Every message loaded once at startup into one contiguous, read-only
+ * arena, so pushes are sent from memory without reading the SD card */
+typedef struct MessageStore {
+    /* Index of the messages, the message file of the config file first */
+    Message *messages;
+
+    /* Number of messages in the index */
+    int number_of_messages;
+
+    /* Read-only memory holding the content of every message */
+    unsigned char *arena;
+
+    /* Size of the arena in bytes */
+    size_t arena_size;
+} MessageStore;
+
+
+
+/*
+* FUNCTIONS
+*/
+
+int message_store_load(MessageStore *store, char *directory,
+                       char *push_file_path);
+Message *message_store_find(MessageStore *store, char *group, char *name);
+Message *message_store_find_group(MessageStore *store, char *group);
+void message_store_print(MessageStore *store);
+void message_store_free(MessageStore *store);
+
+#endif
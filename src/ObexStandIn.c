@@ -0,0 +1,412 @@
+/*
+* Copyright (c) 2016 Academia Sinica, Institute of Information Science
+*
+* License:
+*
+*      GPL 3.0 : The content of this file is subject to the terms and
+*      conditions defined in file 'COPYING.txt', which is part of this source
+*      code package.
+*
+* Project Name:
+*
+*      BeDIPS
+*
+* File Description:
+*
+*      This file contains a stand-in OBEX Object Push receiver for benchmarks
+*      of the push pipeline without phones. It speaks OBEX over loopback TCP
+*      and can be told to answer slowly, to read at a limited throughput, to
+*      refuse some objects and to drop some connections in the middle of a
+*      transfer. Run LBeacon with -o and the port of the receiver to push to
+*      it.
+*
+* File Name:
+*
+*      ObexStandIn.c
+*
+* Abstract:
+*
+*      BeDIPS uses LBeacons to deliver 3D coordinates and textual
+*      descriptions of their locations to users' devices. Basically, a LBeacon
+*      is an inexpensive, Bluetooth Smart Ready device. The 3D coordinates and
+*      location description of every LBeacon are retrieved from BeDIS
+*      (Building/environment Data and Information System) and stored locally
+*      during deployment and maintenance times. Once initialized, each LBeacon
+*      broadcasts its coordinates and location description to Bluetooth
+*      enabled user devices within its coverage area.
+*
+* Authors:
+*
+*      Jake Lee, jakelee@iis.sinica.edu.tw
+*      Johnson Su, johnsonsu@iis.sinica.edu.tw
+*      Shirley Huang, shirley.huang.93@gmail.com
+*      Han Hu, hhu14@illinois.edu
+*      Jeffrey Lin, lin.jeff03@gmail.com
+*      Howard Hsu, haohsu0823@gmail.com
+*      Han Wang, hollywang@iis.sinica.edu.tw
+*/
+
+#include "ObexStandIn.h"
+
+
+/* Behavior of the receiver */
+StandInConfig config = {STAND_IN_DEFAULT_PORT, 0, 0, 0.0, 0.0, 1};
+
+/* Counters of the receiver */
+StandInStatistics statistics;
+
+/* Number of connections accepted so far, used to seed each connection */
+unsigned int number_of_accepted = 0;
+
+/* Cleared by SIGINT and SIGTERM to stop accepting connections */
+volatile sig_atomic_t is_running = true;
+
+
+/*
+*  read_obex_packet:
+*
+*  This function reads one whole OBEX packet.
+*
+*  Parameters:
+*
+*  socket - socket of the connection
+*  packet - buffer of STAND_IN_MAXIMUM_PACKET bytes receiving the packet
+*
+*  Return value:
+*
+*  length - length in bytes of the packet
+*  -1 - the connection was closed or the packet is malformed
+*/
+int read_obex_packet(int socket, unsigned char *packet) {
+
+    int length = OBEX_PACKET_HEADER_LENGTH;
+    int received = 0;
+    int return_value;
+
+    while (received < length) {
+
+        return_value = read(socket, packet + received, length - received);
+
+        if (return_value <= 0) {
+            return -1;
+        }
+
+        received += return_value;
+
+        /* The length is known once the header is in */
+        if (received == OBEX_PACKET_HEADER_LENGTH) {
+
+            length = (packet[1] << 8) | packet[2];
+
+            if (length < OBEX_PACKET_HEADER_LENGTH ||
+                STAND_IN_MAXIMUM_PACKET < length) {
+                return -1;
+            }
+
+        }
+
+    }
+
+    return length;
+}
+
+
+/*
+*  send_obex_response:
+*
+*  This function sends an OBEX response packet.
+*
+*  Parameters:
+*
+*  socket - socket of the connection
+*  response - the response code
+*  data - bytes following the header, or NULL
+*  length - number of bytes of data
+*
+*  Return value:
+*
+*  0 - success
+*  -1 - the response could not be sent
+*/
+int send_obex_response(int socket, unsigned char response,
+                       unsigned char *data, int length) {
+
+    unsigned char packet[OBEX_PACKET_HEADER_LENGTH + 4];
+    int packet_length = OBEX_PACKET_HEADER_LENGTH + length;
+
+    packet[0] = response;
+    packet[1] = (unsigned char)(packet_length >> 8);
+    packet[2] = (unsigned char)packet_length;
+
+    if (data != NULL) {
+        memcpy(packet + OBEX_PACKET_HEADER_LENGTH, data, length);
+    }
+
+    if (write(socket, packet, packet_length) != packet_length) {
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/*
+*  serve_connection:
+*
+*  This function answers the requests of one connection until the client
+*  disconnects, applying the configured latency, throughput and faults.
+*
+*  Parameters:
+*
+*  socket - socket of the connection
+*
+*  Return value:
+*
+*  None
+*/
+void *serve_connection(void *socket) {
+
+    int socket_fd = (int)(long)socket;
+    unsigned char packet[STAND_IN_MAXIMUM_PACKET];
+    unsigned char connect_response[4] = {
+        OBEX_VERSION, 0, STAND_IN_MAXIMUM_PACKET >> 8,
+        STAND_IN_MAXIMUM_PACKET & 0xff
+    };
+    unsigned int seed;
+    int length;
+    bool is_connected = true;
+    bool is_dropped;
+
+    /* Each connection draws its faults from its own sequence, so a run
+     * is repeated by giving the same seed */
+    seed = config.seed + __sync_fetch_and_add(&number_of_accepted, 1);
+    is_dropped = rand_r(&seed) < config.disconnect_rate * RAND_MAX;
+
+    __sync_fetch_and_add(&statistics.number_of_connections, 1);
+    usleep(config.accept_latency * 1000);
+
+    while (is_connected == true &&
+           0 < (length = read_obex_packet(socket_fd, packet))) {
+
+        __sync_fetch_and_add(&statistics.number_of_bytes, length);
+
+        if (0 < config.throughput) {
+            usleep((long long)length * 1000000 / config.throughput);
+        }
+
+        switch (packet[0]) {
+
+            case OBEX_OPCODE_CONNECT:
+                send_obex_response(socket_fd, OBEX_RESPONSE_SUCCESS,
+                                   connect_response, 4);
+                break;
+
+            case OBEX_OPCODE_PUT:
+            case OBEX_OPCODE_PUT_FINAL:
+
+                if (is_dropped == true) {
+                    __sync_fetch_and_add(&statistics.number_of_dropped, 1);
+                    is_connected = false;
+                }
+                else if (packet[0] == OBEX_OPCODE_PUT) {
+                    send_obex_response(socket_fd, OBEX_RESPONSE_CONTINUE,
+                                       NULL, 0);
+                }
+                else if (rand_r(&seed) < config.refusal_rate * RAND_MAX) {
+                    __sync_fetch_and_add(&statistics.number_of_refused, 1);
+                    send_obex_response(socket_fd, OBEX_RESPONSE_FORBIDDEN,
+                                       NULL, 0);
+                }
+                else {
+                    __sync_fetch_and_add(&statistics.number_of_objects, 1);
+                    send_obex_response(socket_fd, OBEX_RESPONSE_SUCCESS,
+                                       NULL, 0);
+                }
+                break;
+
+            case OBEX_OPCODE_DISCONNECT:
+                send_obex_response(socket_fd, OBEX_RESPONSE_SUCCESS, NULL,
+                                   0);
+                is_connected = false;
+                break;
+
+            case OBEX_OPCODE_ABORT:
+                send_obex_response(socket_fd, OBEX_RESPONSE_SUCCESS, NULL,
+                                   0);
+                break;
+
+            default:
+                send_obex_response(socket_fd, OBEX_RESPONSE_NOT_IMPLEMENTED,
+                                   NULL, 0);
+                break;
+
+        }
+
+    }
+
+    close(socket_fd);
+
+    pthread_exit(NULL);
+    return NULL;
+}
+
+
+/*
+*  stop_receiver:
+*
+*  This function is the handler of SIGINT and SIGTERM. It stops the
+*  receiver, which then prints its counters.
+*
+*  Parameters:
+*
+*  signal_number - the signal received
+*
+*  Return value:
+*
+*  None
+*/
+void stop_receiver(int signal_number) {
+
+    is_running = false;
+}
+
+
+int main(int argc, char **argv) {
+
+    struct sockaddr_in address;
+    struct sigaction action;
+    pthread_t thread;
+    pthread_attr_t attributes;
+    int listen_socket;
+    int socket_fd;
+    int option;
+    int return_value;
+    int reuse = 1;
+    long long start_time;
+
+    /* -p port: loopback TCP port to listen on
+     * -l latency: milliseconds before answering a new connection
+     * -t throughput: bytes per second read from each connection
+     * -r rate: fraction of the objects refused
+     * -d rate: fraction of the connections dropped during a PUT
+     * -s seed: seed of the random faults */
+    while ((option = getopt(argc, argv, "p:l:t:r:d:s:")) != -1) {
+
+        switch (option) {
+
+            case 'p':
+                config.port = atoi(optarg);
+                break;
+
+            case 'l':
+                config.accept_latency = atoi(optarg);
+                break;
+
+            case 't':
+                config.throughput = atoi(optarg);
+                break;
+
+            case 'r':
+                config.refusal_rate = atof(optarg);
+                break;
+
+            case 'd':
+                config.disconnect_rate = atof(optarg);
+                break;
+
+            case 's':
+                config.seed = (unsigned int)atoi(optarg);
+                break;
+
+            default:
+                fprintf(stderr, "Usage: %s [-p port] [-l latency] "
+                        "[-t throughput] [-r refusal_rate] "
+                        "[-d disconnect_rate] [-s seed]\n", argv[0]);
+                return 1;
+
+        }
+
+    }
+
+    /* Without SA_RESTART, a signal interrupts accept */
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = stop_receiver;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    listen_socket = socket(AF_INET, SOCK_STREAM, 0);
+    setsockopt(listen_socket, SOL_SOCKET, SO_REUSEADDR, &reuse,
+               sizeof(reuse));
+
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(config.port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if (0 > bind(listen_socket, (struct sockaddr *)&address,
+                 sizeof(address)) || 0 > listen(listen_socket, SOMAXCONN)) {
+
+        /* Error handling */
+        perror("Failed to listen on the port");
+        return 1;
+
+    }
+
+    printf("OBEX stand-in listening on 127.0.0.1:%d\n", config.port);
+
+    pthread_attr_init(&attributes);
+    pthread_attr_setdetachstate(&attributes, PTHREAD_CREATE_DETACHED);
+    start_time = time(NULL);
+
+    while (is_running == true) {
+
+        socket_fd = accept(listen_socket, NULL, NULL);
+
+        if (0 > socket_fd) {
+
+            /* A signal asks to stop, and an aborted connection only
+             * concerns that client */
+            if (EINTR == errno || ECONNABORTED == errno) {
+                continue;
+            }
+
+            /* Error handling */
+            perror("Failed to accept a connection");
+
+            /* Running out of descriptors or memory lasts until some
+             * connections end, so retrying at once would only spin */
+            if (EMFILE == errno || ENFILE == errno || ENOBUFS == errno ||
+                ENOMEM == errno) {
+                usleep(STAND_IN_ACCEPT_BACKOFF * 1000);
+                continue;
+            }
+
+            break;
+
+        }
+
+        return_value = pthread_create(&thread, &attributes, serve_connection,
+                                      (void *)(long)socket_fd);
+
+        if (return_value != 0) {
+
+            /* Error handling */
+            fprintf(stderr, "Failed to serve a connection: %s\n",
+                    strerror(return_value));
+            close(socket_fd);
+
+        }
+
+    }
+
+    close(listen_socket);
+
+    printf("%lld connections, %lld objects received, %lld refused, "
+           "%lld dropped, %lld bytes in %lld s\n",
+           statistics.number_of_connections, statistics.number_of_objects,
+           statistics.number_of_refused, statistics.number_of_dropped,
+           statistics.number_of_bytes, (long long)time(NULL) - start_time);
+
+    return 0;
+}
@@ -0,0 +1,148 @@
+/*
+* Copyright (c) 2016 Academia Sinica, Institute of Information Science
+*
+* License:
+*
+*      GPL 3.0 : The content of this file is subject to the terms and
+*      conditions defined in file 'COPYING.txt', which is part of this source
+*      code package.
+*
+* Project Name:
+*
+*      BeDIPS
+*
+* File Description:
+*
+*      This header file contains the function declarations and variables used
+*      in the ObexStandIn.c file.
+*
+* File Name:
+*
+*      ObexStandIn.h
+*
+* Abstract:
+*
+*      BeDIPS uses LBeacons to deliver 3D coordinates and textual
+*      descriptions of their locations to users' devices. Basically, a LBeacon
+*      is an inexpensive, Bluetooth Smart Ready device. The 3D coordinates and
+*      location description of every LBeacon are retrieved from BeDIS
+*      (Building/environment Data and Information System) and stored locally
+*      during deployment and maintenance times. Once initialized, each LBeacon
+*      broadcasts its coordinates and location description to Bluetooth
+*      enabled user devices within its coverage area.
+*
+* Authors:
+*
+*      Jake Lee, jakelee@iis.sinica.edu.tw
+*      Johnson Su, johnsonsu@iis.sinica.edu.tw
+*      Shirley Huang, shirley.huang.93@gmail.com
+*      Han Hu, hhu14@illinois.edu
+*      Jeffrey Lin, lin.jeff03@gmail.com
+*      Howard Hsu, haohsu0823@gmail.com
+*      Han Wang, hollywang@iis.sinica.edu.tw
+*/
+
+#ifndef OBEXSTANDIN_H
+#define OBEXSTANDIN_H
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+
+/*
+* CONSTANTS
+*/
+
+/* Loopback TCP port the receiver listens on by default */
+#define STAND_IN_DEFAULT_PORT 6500
+
+/* Largest OBEX packet the receiver accepts, announced in its CONNECT
+ * response */
+#define STAND_IN_MAXIMUM_PACKET 8192
+
+/* Time in milliseconds the receiver waits before accepting again after
+ * running out of file descriptors or memory */
+#define STAND_IN_ACCEPT_BACKOFF 100
+
+/* Length in bytes of the header of every OBEX packet: the opcode and the
+ * packet length */
+#define OBEX_PACKET_HEADER_LENGTH 3
+
+/* OBEX opcodes of the requests, with the final bit set */
+#define OBEX_OPCODE_CONNECT 0x80
+#define OBEX_OPCODE_DISCONNECT 0x81
+#define OBEX_OPCODE_PUT 0x02
+#define OBEX_OPCODE_PUT_FINAL 0x82
+#define OBEX_OPCODE_ABORT 0xff
+
+/* OBEX response codes, with the final bit set */
+#define OBEX_RESPONSE_CONTINUE 0x90
+#define OBEX_RESPONSE_SUCCESS 0xa0
+#define OBEX_RESPONSE_FORBIDDEN 0xc3
+#define OBEX_RESPONSE_NOT_IMPLEMENTED 0xd1
+
+/* Version of OBEX announced in the CONNECT response */
+#define OBEX_VERSION 0x10
+
+
+
+/*
+* TYPEDEF STRUCTS
+*/
+
+/* Behavior of the receiver, set from the command line */
+typedef struct StandInConfig {
+    /* Loopback TCP port to listen on */
+    int port;
+
+    /* Time in milliseconds the receiver waits before answering a new
+     * connection, like a phone paging and asking its user */
+    int accept_latency;
+
+    /* Bytes per second the receiver reads, 0 for no limit */
+    int throughput;
+
+    /* Fraction of the objects refused with Forbidden */
+    double refusal_rate;
+
+    /* Fraction of the connections dropped in the middle of a PUT */
+    double disconnect_rate;
+
+    /* Seed of the random faults */
+    unsigned int seed;
+} StandInConfig;
+
+
+/* Counters of the receiver, updated with atomic operations since every
+ * connection has its own thread */
+typedef struct StandInStatistics {
+    long long number_of_connections;
+    long long number_of_objects;
+    long long number_of_refused;
+    long long number_of_dropped;
+    long long number_of_bytes;
+} StandInStatistics;
+
+
+
+/*
+* FUNCTIONS
+*/
+
+int read_obex_packet(int socket, unsigned char *packet);
+int send_obex_response(int socket, unsigned char response,
+                       unsigned char *data, int length);
+void *serve_connection(void *socket);
+void stop_receiver(int signal_number);
+
+#endif
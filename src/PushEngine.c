@@ -0,0 +1,1088 @@
+/*
+* Copyright (c) 2016 Academia Sinica, Institute of Information Science
+*
+* License:
+*
+*      GPL 3.0 : The content of this file is subject to the terms and
+*      conditions defined in file 'COPYING.txt', which is part of this source
+*      code package.
+*
+* Project Name:
+*
+*      BeDIPS
+*
+* File Description:
+*
+*      This file contains the implementation of a non-blocking OBEX Object
+*      Push client. One thread drives several transfers at once, each one a
+*      state machine stepping through the connection, the OBEX CONNECT, PUT
+*      and DISCONNECT requests as epoll reports its socket ready, instead of
+*      one thread blocked in obexftp calls per transfer.
+*
+* File Name:
+*
+*      PushEngine.c
+*
+* Abstract:
+*
+*      BeDIPS uses LBeacons to deliver 3D coordinates and textual
+*      descriptions of their locations to users' devices. Basically, a LBeacon
+*      is an inexpensive, Bluetooth Smart Ready device. The 3D coordinates and
+*      location description of every LBeacon are retrieved from BeDIS
+*      (Building/environment Data and Information System) and stored locally
+*      during deployment and maintenance times. Once initialized, each LBeacon
+*      broadcasts its coordinates and location description to Bluetooth
+*      enabled user devices within its coverage area.
+*
+* Authors:
+*
+*      Jake Lee, jakelee@iis.sinica.edu.tw
+*      Johnson Su, johnsonsu@iis.sinica.edu.tw
+*      Shirley Huang, shirley.huang.93@gmail.com
+*      Han Hu, hhu14@illinois.edu
+*      Jeffrey Lin, lin.jeff03@gmail.com
+*      Howard Hsu, haohsu0823@gmail.com
+*      Han Wang, hollywang@iis.sinica.edu.tw
+*/
+
+#include "PushEngine.h"
+
+
+/*
+*  get_time_in_milliseconds:
+*
+*  This helper function returns the time of the realtime clock, the clock
+*  of the times given to the engine by its callers.
+*
+*  Parameters:
+*
+*  None
+*
+*  Return value:
+*
+*  Time in milliseconds since the Epoch
+*/
+static long long get_time_in_milliseconds() {
+
+    struct timespec now;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    return (long long)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+
+/*
+*  fail_transfer:
+*
+*  This helper function ends a transfer that failed. A failure before the
+*  PUT request counts as a connection failure, and a failure of the
+*  DISCONNECT request does not undo a successful PUT.
+*
+*  Parameters:
+*
+*  transfer - the transfer
+*
+*  Return value:
+*
+*  None
+*/
+static void fail_transfer(PushTransfer *transfer) {
+
+    if (transfer->state == PUSH_DONE) {
+        return;
+    }
+
+    if (transfer->state <= PUSH_OBEX_CONNECT) {
+        transfer->result = PUSH_CONNECT_FAILED;
+    }
+    else if (transfer->state == PUSH_PUT) {
+        transfer->result = PUSH_PUT_FAILED;
+    }
+    else {
+        transfer->result = PUSH_SUCCEEDED;
+    }
+
+    transfer->state = PUSH_DONE;
+}
+
+
+/*
+*  send_request:
+*
+*  This helper function sends the OBEX request of the current step of a
+*  transfer. The PUT request carries the name, the length and the whole
+*  body of the object; openobex splits it into packets.
+*
+*  Parameters:
+*
+*  transfer - the transfer
+*
+*  Return value:
+*
+*  None
+*/
+static void send_request(PushTransfer *transfer) {
+
+    obex_object_t *object;
+    obex_headerdata_t header;
+    uint8_t command = OBEX_CMD_CONNECT;
+
+    if (transfer->state == PUSH_PUT) {
+        command = OBEX_CMD_PUT;
+    }
+    else if (transfer->state == PUSH_DISCONNECT) {
+        command = OBEX_CMD_DISCONNECT;
+    }
+
+    object = OBEX_ObjectNew(transfer->handle, command);
+
+    if (object == NULL) {
+        fail_transfer(transfer);
+        return;
+    }
+
+    if (command == OBEX_CMD_PUT) {
+
+        header.bs = transfer->name;
+        OBEX_ObjectAddHeader(transfer->handle, object, OBEX_HDR_NAME, header,
+                             transfer->name_size, 0);
+        header.bq4 = transfer->length;
+        OBEX_ObjectAddHeader(transfer->handle, object, OBEX_HDR_LENGTH,
+                             header, 4, 0);
+        header.bs = transfer->data;
+        OBEX_ObjectAddHeader(transfer->handle, object, OBEX_HDR_BODY, header,
+                             transfer->length, 0);
+
+    }
+
+    if (0 > OBEX_Request(transfer->handle, object)) {
+        fail_transfer(transfer);
+    }
+}
+
+
+/*
+*  handle_obex_event:
+*
+*  This helper function is the event callback of the OBEX handles. When a
+*  request is answered with success, the transfer moves on to its next
+*  request, which the engine sends once openobex has returned; any other
+*  answer or a broken link ends the transfer.
+*
+*  Parameters:
+*
+*  handle - OBEX handle of the transfer
+*  object - the OBEX object of the request
+*  mode - whether the event concerns a client or a server request
+*  event - the OBEX event
+*  obex_cmd - the command of the request
+*  obex_rsp - the response to the request
+*
+*  Return value:
+*
+*  None
+*/
+static void handle_obex_event(obex_t *handle, obex_object_t *object,
+                              int mode, int event, int obex_cmd,
+                              int obex_rsp) {
+
+    PushTransfer *transfer = (PushTransfer *)OBEX_GetUserData(handle);
+
+    switch (event) {
+
+        case OBEX_EV_REQDONE:
+
+            if (obex_rsp != OBEX_RSP_SUCCESS) {
+                fail_transfer(transfer);
+            }
+            else if (transfer->state == PUSH_DISCONNECT) {
+                transfer->result = PUSH_SUCCEEDED;
+                transfer->state = PUSH_DONE;
+            }
+            else if (transfer->state != PUSH_DONE) {
+                transfer->state++;
+                transfer->is_request_due = true;
+            }
+            break;
+
+        case OBEX_EV_LINKERR:
+        case OBEX_EV_PARSEERR:
+        case OBEX_EV_ABORT:
+            fail_transfer(transfer);
+            break;
+
+        default:
+            break;
+
+    }
+}
+
+
+/*
+*  flush_output:
+*
+*  This helper function gives the socket of a transfer as much of the
+*  buffered output as it takes without waiting.
+*
+*  Parameters:
+*
+*  transfer - the transfer
+*
+*  Return value:
+*
+*  0 - the socket took what it could
+*  -1 - the connection is broken
+*/
+static int flush_output(PushTransfer *transfer) {
+
+    ssize_t written;
+
+    while (0 < transfer->output_length) {
+
+        written = send(transfer->socket,
+                       transfer->output + transfer->output_start,
+                       transfer->output_length, MSG_NOSIGNAL);
+
+        if (0 > written) {
+
+            if (errno == EINTR) {
+                continue;
+            }
+
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return 0;
+            }
+
+            return -1;
+
+        }
+
+        transfer->output_start += written;
+        transfer->output_length -= written;
+
+    }
+
+    transfer->output_start = 0;
+
+    return 0;
+}
+
+
+/*
+*  connect_transport:
+*
+*  This helper function is the connect function of the custom openobex
+*  transport of the transfers. The socket is already connected when the
+*  OBEX handle is set up, so there is nothing left to do.
+*
+*  Parameters:
+*
+*  handle - OBEX handle of the transfer
+*  customdata - the transfer
+*
+*  Return value:
+*
+*  0 - success
+*/
+static int connect_transport(obex_t *handle, void *customdata) {
+
+    return 0;
+}
+
+
+/*
+*  disconnect_transport:
+*
+*  This helper function is the disconnect function of the custom openobex
+*  transport of the transfers. The socket is closed by the engine when the
+*  transfer is finished.
+*
+*  Parameters:
+*
+*  handle - OBEX handle of the transfer
+*  customdata - the transfer
+*
+*  Return value:
+*
+*  0 - success
+*/
+static int disconnect_transport(obex_t *handle, void *customdata) {
+
+    return 0;
+}
+
+
+/*
+*  listen_transport:
+*
+*  This helper function is the listen function of the custom openobex
+*  transport of the transfers, which only act as clients.
+*
+*  Parameters:
+*
+*  handle - OBEX handle of the transfer
+*  customdata - the transfer
+*
+*  Return value:
+*
+*  -1 - the transport cannot listen
+*/
+static int listen_transport(obex_t *handle, void *customdata) {
+
+    return -1;
+}
+
+
+/*
+*  write_transport:
+*
+*  This helper function is the write function of the custom openobex
+*  transport of the transfers. The packet is given to the socket without
+*  waiting, and the part the socket does not take is buffered until epoll
+*  reports the socket ready for writing. A device that stops taking data
+*  therefore stalls only its own transfer, which fails when its time is
+*  up, and never the thread of the engine.
+*
+*  Parameters:
+*
+*  handle - OBEX handle of the transfer
+*  customdata - the transfer
+*  buffer - the packet
+*  length - length in bytes of the packet
+*
+*  Return value:
+*
+*  length - the packet is sent or buffered
+*  -1 - the connection is broken or the buffer is full
+*/
+static int write_transport(obex_t *handle, void *customdata,
+                           uint8_t *buffer, int length) {
+
+    PushTransfer *transfer = (PushTransfer *)customdata;
+
+    if (0 > flush_output(transfer)) {
+        return -1;
+    }
+
+    if (length > PUSH_ENGINE_MTU - transfer->output_length) {
+        return -1;
+    }
+
+    memmove(transfer->output, transfer->output + transfer->output_start,
+            transfer->output_length);
+    memcpy(transfer->output + transfer->output_length, buffer, length);
+    transfer->output_start = 0;
+    transfer->output_length += length;
+
+    if (0 > flush_output(transfer)) {
+        return -1;
+    }
+
+    return length;
+}
+
+
+/*
+*  handle_transport_input:
+*
+*  This helper function is the input function of the custom openobex
+*  transport of the transfers. It is called by OBEX_HandleInput when epoll
+*  reports data, and feeds openobex what the socket holds without waiting.
+*
+*  Parameters:
+*
+*  handle - OBEX handle of the transfer
+*  customdata - the transfer
+*  timeout - not used, since the socket is never waited for
+*
+*  Return value:
+*
+*  length - number of bytes given to openobex
+*  -1 - the connection is broken or closed by the device
+*/
+static int handle_transport_input(obex_t *handle, void *customdata,
+                                  int timeout) {
+
+    PushTransfer *transfer = (PushTransfer *)customdata;
+    uint8_t buffer[PUSH_ENGINE_MTU];
+    ssize_t length;
+
+    length = recv(transfer->socket, buffer, sizeof(buffer), 0);
+
+    if (0 > length) {
+
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+            return 0;
+        }
+
+        return -1;
+
+    }
+
+    if (length == 0) {
+        return -1;
+    }
+
+    if (0 > OBEX_CustomDataFeed(handle, buffer, (int)length)) {
+        return -1;
+    }
+
+    return (int)length;
+}
+
+
+/*
+*  watch_output:
+*
+*  This helper function makes epoll report the socket of a transfer ready
+*  for writing exactly while part of its output is buffered.
+*
+*  Parameters:
+*
+*  engine - the engine
+*  transfer - the transfer
+*
+*  Return value:
+*
+*  None
+*/
+static void watch_output(PushEngine *engine, PushTransfer *transfer) {
+
+    struct epoll_event event;
+    bool is_output_pending = (0 < transfer->output_length);
+
+    if (is_output_pending == transfer->is_watching_output) {
+        return;
+    }
+
+    event.events = EPOLLIN;
+
+    if (is_output_pending == true) {
+        event.events |= EPOLLOUT;
+    }
+
+    event.data.ptr = transfer;
+
+    if (0 > epoll_ctl(engine->epoll_fd, EPOLL_CTL_MOD, transfer->socket,
+                      &event)) {
+        fail_transfer(transfer);
+        return;
+    }
+
+    transfer->is_watching_output = is_output_pending;
+}
+
+
+/*
+*  start_obex_session:
+*
+*  This helper function sets up the OBEX handle of a transfer whose
+*  connection is established, so the CONNECT request can be sent. The
+*  handle uses a custom transport over the socket, which stays
+*  non-blocking: packets the socket cannot take at once are buffered and
+*  sent as epoll reports the socket ready for writing.
+*
+*  Parameters:
+*
+*  engine - the engine
+*  transfer - the transfer
+*
+*  Return value:
+*
+*  None
+*/
+static void start_obex_session(PushEngine *engine, PushTransfer *transfer) {
+
+    struct epoll_event event;
+    obex_ctrans_t transport;
+    int error = 0;
+    socklen_t length = sizeof(error);
+
+    if (0 > getsockopt(transfer->socket, SOL_SOCKET, SO_ERROR, &error,
+                       &length) || error != 0) {
+        fail_transfer(transfer);
+        return;
+    }
+
+    transfer->connected_time = get_time_in_milliseconds();
+    transfer->handle = OBEX_Init(OBEX_TRANS_CUSTOM, handle_obex_event, 0);
+
+    if (transfer->handle == NULL) {
+        fail_transfer(transfer);
+        return;
+    }
+
+    OBEX_SetUserData(transfer->handle, transfer);
+
+    memset(&transport, 0, sizeof(transport));
+    transport.connect = connect_transport;
+    transport.disconnect = disconnect_transport;
+    transport.listen = listen_transport;
+    transport.write = write_transport;
+    transport.handleinput = handle_transport_input;
+    transport.customdata = transfer;
+
+    if (0 > OBEX_RegisterCTransport(transfer->handle, &transport) ||
+        0 > OBEX_SetTransportMTU(transfer->handle, PUSH_ENGINE_MTU,
+                                 PUSH_ENGINE_MTU) ||
+        0 > OBEX_TransportConnect(transfer->handle, NULL, 0)) {
+        fail_transfer(transfer);
+        return;
+    }
+
+    /* From now on, wait for the responses of the device */
+    event.events = EPOLLIN;
+    event.data.ptr = transfer;
+    epoll_ctl(engine->epoll_fd, EPOLL_CTL_MOD, transfer->socket, &event);
+
+    transfer->state = PUSH_OBEX_CONNECT;
+    transfer->is_request_due = true;
+}
+
+
+/*
+*  finish_transfer:
+*
+*  This helper function releases the socket and the OBEX handle of a
+*  finished transfer, reports it to the caller and frees its slot.
+*
+*  Parameters:
+*
+*  engine - the engine
+*  transfer - the transfer
+*  now - current time in milliseconds
+*
+*  Return value:
+*
+*  None
+*/
+static void finish_transfer(PushEngine *engine, PushTransfer *transfer,
+                            long long now) {
+
+    long long connect_time;
+    long long transfer_time = 0;
+
+    if (0 <= transfer->socket) {
+        epoll_ctl(engine->epoll_fd, EPOLL_CTL_DEL, transfer->socket, NULL);
+    }
+
+    /* The custom transport of openobex does not close the socket */
+    if (transfer->handle != NULL) {
+        OBEX_Cleanup(transfer->handle);
+    }
+
+    if (0 <= transfer->socket) {
+        close(transfer->socket);
+    }
+
+    if (transfer->connected_time != 0) {
+        connect_time = transfer->connected_time - transfer->start_time;
+        transfer_time = now - transfer->connected_time;
+    }
+    else {
+        connect_time = now - transfer->start_time;
+    }
+
+    if (transfer->result == PUSH_SUCCEEDED) {
+        engine->number_of_succeeded++;
+    }
+    else if (transfer->result == PUSH_CONNECT_FAILED) {
+        engine->number_of_connect_failures++;
+    }
+    else {
+        engine->number_of_put_failures++;
+    }
+
+    transfer->handle = NULL;
+    transfer->socket = -1;
+    transfer->state = PUSH_FREE;
+    engine->number_of_transfers--;
+
+    engine->finish(transfer->job, transfer->result, connect_time,
+                   transfer_time, engine->finish_context);
+}
+
+
+/*
+*  push_engine_init:
+*
+*  This function creates the epoll instance and the job storage of an
+*  engine.
+*
+*  Parameters:
+*
+*  engine - the engine to be initialized
+*  job_size - size in bytes of the jobs given to push_engine_start
+*  connect - function opening the connections to the devices
+*  connect_context - context given to the connect function
+*  finish - function called for each finished transfer
+*  finish_context - context given to the finish function
+*
+*  Return value:
+*
+*  0 - success
+*  -1 - the epoll instance or the memory could not be allocated
+*/
+int push_engine_init(PushEngine *engine, int job_size, PushConnect connect,
+                     void *connect_context, PushFinish finish,
+                     void *finish_context) {
+
+    int transfer_id;
+
+    memset(engine, 0, sizeof(PushEngine));
+
+    engine->jobs = (unsigned char *)malloc(PUSH_ENGINE_MAXIMUM_TRANSFERS *
+                                           job_size);
+
+    if (engine->jobs == NULL) {
+
+        /* Error handling */
+        perror("Failed to allocate memory");
+        return -1;
+
+    }
+
+    engine->epoll_fd = epoll_create(PUSH_ENGINE_MAXIMUM_TRANSFERS);
+
+    if (0 > engine->epoll_fd) {
+
+        /* Error handling */
+        perror("Failed to create the epoll instance");
+        free(engine->jobs);
+        engine->jobs = NULL;
+        return -1;
+
+    }
+
+    for (transfer_id = 0; transfer_id < PUSH_ENGINE_MAXIMUM_TRANSFERS;
+         transfer_id++) {
+        engine->transfers[transfer_id].socket = -1;
+        engine->transfers[transfer_id].job =
+            engine->jobs + transfer_id * job_size;
+    }
+
+    engine->wakeup_fd = -1;
+    engine->job_size = job_size;
+    engine->connect = connect;
+    engine->connect_context = connect_context;
+    engine->finish = finish;
+    engine->finish_context = finish_context;
+
+    return 0;
+}
+
+
+/*
+*  push_engine_start:
+*
+*  This function starts pushing an object to a device. The connection is
+*  opened without waiting; when it cannot be opened at all, the transfer
+*  is reported as failed before the function returns.
+*
+*  Parameters:
+*
+*  engine - the engine
+*  job - job of the caller, copied and given back to the finish function
+*  address - bluetooth device address
+*  channel - RFCOMM channel of the Object Push service of the device
+*  data - content of the object, which must stay valid until the transfer
+*         finishes
+*  length - length in bytes of the content
+*  name - name of the object
+*  now - current time in milliseconds
+*
+*  Return value:
+*
+*  0 - the job is taken
+*  -1 - every transfer slot is in use
+*/
+int push_engine_start(PushEngine *engine, void *job, bdaddr_t *address,
+                      int channel, const unsigned char *data, int length,
+                      char *name, long long now) {
+
+    PushTransfer *transfer = NULL;
+    struct epoll_event event;
+    char short_name[PUSH_ENGINE_NAME_LENGTH + 1];
+    int transfer_id;
+
+    for (transfer_id = 0; transfer_id < PUSH_ENGINE_MAXIMUM_TRANSFERS;
+         transfer_id++) {
+
+        if (engine->transfers[transfer_id].state == PUSH_FREE) {
+            transfer = &engine->transfers[transfer_id];
+            break;
+        }
+
+    }
+
+    if (transfer == NULL) {
+        return -1;
+    }
+
+    memcpy(transfer->job, job, engine->job_size);
+    strncpy(short_name, name, PUSH_ENGINE_NAME_LENGTH);
+    short_name[PUSH_ENGINE_NAME_LENGTH] = '\0';
+    transfer->name_size = OBEX_CharToUnicode(transfer->name,
+                                             (uint8_t *)short_name,
+                                             sizeof(transfer->name));
+    transfer->data = data;
+    transfer->length = length;
+    transfer->start_time = now;
+    transfer->connected_time = 0;
+    transfer->handle = NULL;
+    transfer->output_start = 0;
+    transfer->output_length = 0;
+    transfer->is_watching_output = false;
+    transfer->is_request_due = false;
+    transfer->state = PUSH_CONNECTING;
+
+    engine->number_of_transfers++;
+    engine->number_of_started++;
+
+    if (engine->number_of_transfers > engine->maximum_transfers) {
+        engine->maximum_transfers = engine->number_of_transfers;
+    }
+
+    /* The socket becomes writable once the connection is established */
+    transfer->socket = engine->connect(address, channel,
+                                       engine->connect_context);
+    event.events = EPOLLOUT;
+    event.data.ptr = transfer;
+
+    if (0 > transfer->socket ||
+        0 > epoll_ctl(engine->epoll_fd, EPOLL_CTL_ADD, transfer->socket,
+                      &event)) {
+
+        fail_transfer(transfer);
+        finish_transfer(engine, transfer, now);
+
+    }
+
+    return 0;
+}
+
+
+/*
+*  push_engine_set_wakeup_fd:
+*
+*  This function adds an eventfd to the descriptors the engine waits for,
+*  so push_engine_run returns as soon as the eventfd is signaled, for
+*  instance when new work is waiting for the engine. The engine resets the
+*  eventfd when it returns; the eventfd is not closed by the engine.
+*
+*  Parameters:
+*
+*  engine - the engine
+*  wakeup_fd - the non-blocking eventfd
+*
+*  Return value:
+*
+*  0 - success
+*  -1 - the eventfd could not be added to the epoll instance
+*/
+int push_engine_set_wakeup_fd(PushEngine *engine, int wakeup_fd) {
+
+    struct epoll_event event;
+
+    /* Events of the eventfd are told from the events of the transfers by
+     * their NULL pointer */
+    event.events = EPOLLIN;
+    event.data.ptr = NULL;
+
+    if (0 > epoll_ctl(engine->epoll_fd, EPOLL_CTL_ADD, wakeup_fd, &event)) {
+
+        /* Error handling */
+        perror("Failed to watch the wakeup eventfd");
+        return -1;
+
+    }
+
+    engine->wakeup_fd = wakeup_fd;
+
+    return 0;
+}
+
+
+/*
+*  push_engine_run:
+*
+*  This function waits for the sockets of the transfers to be ready or for
+*  the wakeup eventfd to be signaled, then steps every transfer that can
+*  make progress, sends the requests that
+*  are due and reports the transfers that are over. Transfers taking
+*  longer than PUSH_ENGINE_TIMEOUT fail.
+*
+*  Parameters:
+*
+*  engine - the engine
+*  timeout - maximum time in milliseconds to wait for a socket
+*
+*  Return value:
+*
+*  number_of_finished - number of transfers reported
+*/
+int push_engine_run(PushEngine *engine, int timeout) {
+
+    struct epoll_event events[PUSH_ENGINE_MAXIMUM_TRANSFERS + 1];
+    PushTransfer *transfer;
+    uint64_t wakeups;
+    int number_of_events;
+    int number_of_finished = 0;
+    int event_id;
+    int transfer_id;
+    long long now;
+
+    number_of_events = epoll_wait(engine->epoll_fd, events,
+                                  PUSH_ENGINE_MAXIMUM_TRANSFERS + 1,
+                                  timeout);
+
+    for (event_id = 0; event_id < number_of_events; event_id++) {
+
+        transfer = (PushTransfer *)events[event_id].data.ptr;
+
+        if (transfer == NULL) {
+
+            /* Reset the eventfd; the caller looks for the new work */
+            if (0 > read(engine->wakeup_fd, &wakeups, sizeof(wakeups)) &&
+                errno != EAGAIN) {
+                perror("Failed to reset the wakeup eventfd");
+            }
+
+        }
+        else if (transfer->state == PUSH_CONNECTING) {
+
+            start_obex_session(engine, transfer);
+
+        }
+        else if (transfer->state != PUSH_DONE) {
+
+            /* Send the buffered output before handling the responses */
+            if ((events[event_id].events & EPOLLOUT) &&
+                0 > flush_output(transfer)) {
+                fail_transfer(transfer);
+            }
+            else if ((events[event_id].events & ~EPOLLOUT) &&
+                     0 > OBEX_HandleInput(transfer->handle, 0)) {
+                fail_transfer(transfer);
+            }
+
+        }
+
+    }
+
+    now = get_time_in_milliseconds();
+
+    for (transfer_id = 0; transfer_id < PUSH_ENGINE_MAXIMUM_TRANSFERS;
+         transfer_id++) {
+
+        transfer = &engine->transfers[transfer_id];
+
+        if (transfer->state == PUSH_FREE) {
+            continue;
+        }
+
+        if (transfer->is_request_due == true &&
+            transfer->state != PUSH_DONE) {
+            transfer->is_request_due = false;
+            send_request(transfer);
+        }
+
+        if (transfer->state > PUSH_CONNECTING &&
+            transfer->state != PUSH_DONE) {
+            watch_output(engine, transfer);
+        }
+
+        if (transfer->state != PUSH_DONE &&
+            PUSH_ENGINE_TIMEOUT < now - transfer->start_time) {
+            engine->number_of_timeouts++;
+            fail_transfer(transfer);
+        }
+
+        if (transfer->state == PUSH_DONE) {
+            finish_transfer(engine, transfer, now);
+            number_of_finished++;
+        }
+
+    }
+
+    return number_of_finished;
+}
+
+
+/*
+*  push_engine_get_free_slots:
+*
+*  This function returns the number of transfers the engine can start.
+*
+*  Parameters:
+*
+*  engine - the engine
+*
+*  Return value:
+*
+*  number_of_free_slots - number of unused transfer slots
+*/
+int push_engine_get_free_slots(PushEngine *engine) {
+
+    return PUSH_ENGINE_MAXIMUM_TRANSFERS - engine->number_of_transfers;
+}
+
+
+/*
+*  push_engine_connect_rfcomm:
+*
+*  This function is the connect function of an engine pushing over
+*  Bluetooth. It starts an RFCOMM connection from the dongle to the device
+*  without waiting for it.
+*
+*  Parameters:
+*
+*  address - bluetooth device address
+*  channel - RFCOMM channel of the Object Push service of the device
+*  context - address of the dongle to connect from, or NULL for any
+*
+*  Return value:
+*
+*  socket - the socket with the connection in progress, -1 on error
+*/
+int push_engine_connect_rfcomm(bdaddr_t *address, int channel,
+                               void *context) {
+
+    struct sockaddr_rc local_address;
+    struct sockaddr_rc remote_address;
+    int socket_fd;
+
+    socket_fd = socket(AF_BLUETOOTH, SOCK_STREAM | SOCK_NONBLOCK,
+                       BTPROTO_RFCOMM);
+
+    if (0 > socket_fd) {
+        return -1;
+    }
+
+    if (context != NULL) {
+
+        memset(&local_address, 0, sizeof(local_address));
+        local_address.rc_family = AF_BLUETOOTH;
+        bacpy(&local_address.rc_bdaddr, (bdaddr_t *)context);
+
+        if (0 > bind(socket_fd, (struct sockaddr *)&local_address,
+                     sizeof(local_address))) {
+            close(socket_fd);
+            return -1;
+        }
+
+    }
+
+    memset(&remote_address, 0, sizeof(remote_address));
+    remote_address.rc_family = AF_BLUETOOTH;
+    bacpy(&remote_address.rc_bdaddr, address);
+    remote_address.rc_channel = (uint8_t)channel;
+
+    if (0 > connect(socket_fd, (struct sockaddr *)&remote_address,
+                    sizeof(remote_address)) && errno != EINPROGRESS) {
+        close(socket_fd);
+        return -1;
+    }
+
+    return socket_fd;
+}
+
+
+/*
+*  push_engine_connect_tcp:
+*
+*  This function is the connect function of an engine pushing to a local
+*  stand-in receiver instead of the devices. Every device is connected to
+*  the same TCP address; the channel is ignored.
+*
+*  Parameters:
+*
+*  address - bluetooth device address, not used
+*  channel - not used
+*  context - struct sockaddr_in of the stand-in receiver
+*
+*  Return value:
+*
+*  socket - the socket with the connection in progress, -1 on error
+*/
+int push_engine_connect_tcp(bdaddr_t *address, int channel, void *context) {
+
+    int socket_fd;
+
+    socket_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+
+    if (0 > socket_fd) {
+        return -1;
+    }
+
+    if (0 > connect(socket_fd, (struct sockaddr *)context,
+                    sizeof(struct sockaddr_in)) && errno != EINPROGRESS) {
+        close(socket_fd);
+        return -1;
+    }
+
+    return socket_fd;
+}
+
+
+/*
+*  push_engine_print_statistics:
+*
+*  This function prints the outcomes of the transfers of an engine.
+*
+*  Parameters:
+*
+*  engine - the engine
+*  name - name of the engine used in the output
+*
+*  Return value:
+*
+*  None
+*/
+void push_engine_print_statistics(PushEngine *engine, char *name) {
+
+    printf("Push engine %s: %lld started, %lld succeeded, %lld connect "
+           "failures, %lld put failures, %lld timed out, at most %d at a "
+           "time\n", name, engine->number_of_started,
+           engine->number_of_succeeded, engine->number_of_connect_failures,
+           engine->number_of_put_failures, engine->number_of_timeouts,
+           engine->maximum_transfers);
+}
+
+
+/*
+*  push_engine_free:
+*
+*  This function fails and reports the transfers still running, then frees
+*  the engine.
+*
+*  Parameters:
+*
+*  engine - the engine
+*
+*  Return value:
+*
+*  None
+*/
+void push_engine_free(PushEngine *engine) {
+
+    int transfer_id;
+    PushTransfer *transfer;
+
+    for (transfer_id = 0; transfer_id < PUSH_ENGINE_MAXIMUM_TRANSFERS;
+         transfer_id++) {
+
+        transfer = &engine->transfers[transfer_id];
+
+        if (transfer->state != PUSH_FREE) {
+            fail_transfer(transfer);
+            finish_transfer(engine, transfer, get_time_in_milliseconds());
+        }
+
+    }
+
+    close(engine->epoll_fd);
+    free(engine->jobs);
+    engine->jobs = NULL;
+}
@@ -0,0 +1,236 @@
+/*
+* Copyright (c) 2016 Academia Sinica, Institute of Information Science
+*
+* License:
+*
+*      GPL 3.0 : The content of this file is subject to the terms and
+*      conditions defined in file 'COPYING.txt', which is part of this source
+*      code package.
+*
+* Project Name:
+*
+*      BeDIPS
+*
+* File Description:
+*
+*      This header file contains the function declarations and variables used
+*      in the PushEngine.c file.
+*
+* File Name:
+*
+*      PushEngine.h
+*
+* Abstract:
+*
+*      BeDIPS uses LBeacons to deliver 3D coordinates and textual
+*      descriptions of their locations to users' devices. Basically, a LBeacon
+*      is an inexpensive, Bluetooth Smart Ready device. The 3D coordinates and
+*      location description of every LBeacon are retrieved from BeDIS
+*      (Building/environment Data and Information System) and stored locally
+*      during deployment and maintenance times. Once initialized, each LBeacon
+*      broadcasts its coordinates and location description to Bluetooth
+*      enabled user devices within its coverage area.
+*
+* Authors:
+*
+*      Jake Lee, jakelee@iis.sinica.edu.tw
+*      Johnson Su, johnsonsu@iis.sinica.edu.tw
+*      Shirley Huang, shirley.huang.93@gmail.com
+*      Han Hu, hhu14@illinois.edu
+*      Jeffrey Lin, lin.jeff03@gmail.com
+*      Howard Hsu, haohsu0823@gmail.com
+*      Han Wang, hollywang@iis.sinica.edu.tw
+*/
+
+#ifndef PUSHENGINE_H
+#define PUSHENGINE_H
+
+#include <bluetooth/bluetooth.h>
+#include <bluetooth/rfcomm.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <openobex/obex.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+
+/*
+* CONSTANTS
+*/
+
+/* Maximum number of transfers of an engine at a time. A dongle has at most
+ * seven active links in its piconet. */
+#define PUSH_ENGINE_MAXIMUM_TRANSFERS 7
+
+/* Time in milliseconds a transfer may take, from the start of its
+ * connection to the end of its disconnection */
+#define PUSH_ENGINE_TIMEOUT 20000
+
+/* Maximum length in bytes of the name of a pushed object */
+#define PUSH_ENGINE_NAME_LENGTH 64
+
+/* Size in bytes of the largest OBEX packet exchanged with a device, and of
+ * the buffers holding the packets the sockets have not taken or given
+ * yet */
+#define PUSH_ENGINE_MTU 4096
+
+
+
+/*
+* TYPEDEF STRUCTS
+*/
+
+/* Steps of a transfer */
+typedef enum PushState {
+    /* The transfer slot is not used */
+    PUSH_FREE = 0,
+
+    /* The stream connection to the device is being set up */
+    PUSH_CONNECTING = 1,
+
+    /* The OBEX CONNECT, PUT and DISCONNECT requests are being answered */
+    PUSH_OBEX_CONNECT = 2,
+    PUSH_PUT = 3,
+    PUSH_DISCONNECT = 4,
+
+    /* The transfer is over and waits to be reported */
+    PUSH_DONE = 5
+} PushState;
+
+
+/* Outcomes of a transfer */
+typedef enum PushResult {
+    PUSH_SUCCEEDED = 0,
+
+    /* The device could not be connected to, or refused the OBEX session */
+    PUSH_CONNECT_FAILED = 1,
+
+    /* The device refused the object or the transfer broke */
+    PUSH_PUT_FAILED = 2
+} PushResult;
+
+
+/* Function opening a stream connection to the Object Push service of a
+ * device. It returns a non-blocking socket, connected or with the
+ * connection in progress, or -1 on error. */
+typedef int (*PushConnect)(bdaddr_t *address, int channel, void *context);
+
+
+/* Function called for each finished transfer with the job given to
+ * push_engine_start, the outcome, and the time in milliseconds the
+ * connection and the rest of the transfer took */
+typedef void (*PushFinish)(void *job, PushResult result,
+                           long long connect_time, long long transfer_time,
+                           void *context);
+
+
+/* One transfer of an engine */
+typedef struct PushTransfer {
+    /* Current step of the transfer */
+    PushState state;
+
+    /* Outcome of the transfer, set when it reaches PUSH_DONE */
+    PushResult result;
+
+    /* Set when the request of the current step has to be sent */
+    bool is_request_due;
+
+    /* Socket connected to the device, and the OBEX handle using it */
+    int socket;
+    obex_t *handle;
+
+    /* Part of the packets written by openobex that the socket has not
+     * taken yet, starting at output_start */
+    uint8_t output[PUSH_ENGINE_MTU];
+    int output_start;
+    int output_length;
+
+    /* Set while epoll also reports the socket ready for writing */
+    bool is_watching_output;
+
+    /* Object to be pushed; the data is not copied */
+    const unsigned char *data;
+    int length;
+
+    /* Name of the object in UTF-16 as the OBEX name header carries it */
+    uint8_t name[2 * PUSH_ENGINE_NAME_LENGTH + 2];
+    int name_size;
+
+    /* Times in milliseconds the transfer started and was connected */
+    long long start_time;
+    long long connected_time;
+
+    /* Copy of the job of the caller */
+    unsigned char *job;
+} PushTransfer;
+
+
+/* Non-blocking Object Push client running several transfers on one
+ * thread. Each transfer is a state machine driven by the readiness of its
+ * socket, reported by epoll, and by the events of its OBEX handle. */
+typedef struct PushEngine {
+    /* epoll instance watching the sockets of the transfers */
+    int epoll_fd;
+
+    /* eventfd waking the engine up when it has work besides its sockets,
+     * or -1 */
+    int wakeup_fd;
+
+    /* Transfer slots, and the number of them in use */
+    PushTransfer transfers[PUSH_ENGINE_MAXIMUM_TRANSFERS];
+    int number_of_transfers;
+
+    /* Storage of the jobs of the transfers, job_size bytes each */
+    unsigned char *jobs;
+    int job_size;
+
+    /* Function opening the connections, and its context */
+    PushConnect connect;
+    void *connect_context;
+
+    /* Function reporting the finished transfers, and its context */
+    PushFinish finish;
+    void *finish_context;
+
+    /* Number of transfers started, and of their outcomes */
+    long long number_of_started;
+    long long number_of_succeeded;
+    long long number_of_connect_failures;
+    long long number_of_put_failures;
+
+    /* Number of transfers that failed because they took too long */
+    long long number_of_timeouts;
+
+    /* Highest number of transfers at a time */
+    int maximum_transfers;
+} PushEngine;
+
+
+
+/*
+* FUNCTIONS
+*/
+
+int push_engine_init(PushEngine *engine, int job_size, PushConnect connect,
+                     void *connect_context, PushFinish finish,
+                     void *finish_context);
+int push_engine_start(PushEngine *engine, void *job, bdaddr_t *address,
+                      int channel, const unsigned char *data, int length,
+                      char *name, long long now);
+int push_engine_set_wakeup_fd(PushEngine *engine, int wakeup_fd);
+int push_engine_run(PushEngine *engine, int timeout);
+int push_engine_get_free_slots(PushEngine *engine);
+int push_engine_connect_rfcomm(bdaddr_t *address, int channel,
+                               void *context);
+int push_engine_connect_tcp(bdaddr_t *address, int channel, void *context);
+void push_engine_print_statistics(PushEngine *engine, char *name);
+void push_engine_free(PushEngine *engine);
+
+#endif
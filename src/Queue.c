@@ -0,0 +1,588 @@
+/*
+* Copyright (c) 2016 Academia Sinica, Institute of Information Science
+*
+* License:
+*
+*      GPL 3.0 : The content of this file is subject to the terms and
+*      conditions defined in file 'COPYING.txt', which is part of this source
+*      code package.
+*
+* Project Name:
+*
+*      BeDIPS
+*
+* File Description:
+*
+*      This file contains the implementation of a bounded priority queue
+*      shared by several producer and consumer threads. Consumers block on a
+*      condition variable until an item is enqueued instead of polling and
+*      always take an item of the highest priority level, and the time every
+*      item spends in each level is recorded in a histogram.
+*
+* File Name:
+*
+*      Queue.c
+*
+* Abstract:
+*
+*      BeDIPS uses LBeacons to deliver 3D coordinates and textual
+*      descriptions of their locations to users' devices. Basically, a LBeacon
+*      is an inexpensive, Bluetooth Smart Ready device. The 3D coordinates and
+*      location description of every LBeacon are retrieved from BeDIS
+*      (Building/environment Data and Information System) and stored locally
+*      during deployment and maintenance times. Once initialized, each LBeacon
+*      broadcasts its coordinates and location description to Bluetooth
+*      enabled user devices within its coverage area.
+*
+* Authors:
+*
+*      Jake Lee, jakelee@iis.sinica.edu.tw
+*      Johnson Su, johnsonsu@iis.sinica.edu.tw
+*      Shirley Huang, shirley.huang.93@gmail.com
+*      Han Hu, hhu14@illinois.edu
+*      Jeffrey Lin, lin.jeff03@gmail.com
+*      Howard Hsu, haohsu0823@gmail.com
+*      Han Wang, hollywang@iis.sinica.edu.tw
+*/
+
+#include "Queue.h"
+
+
+/*
+*  get_monotonic_time:
+*
+*  This helper function returns the time of the monotonic clock, which is
+*  not affected by changes of the system time.
+*
+*  Parameters:
+*
+*  None
+*
+*  Return value:
+*
+*  Time in microseconds
+*/
+static long long get_monotonic_time() {
+
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (long long)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+
+/*
+*  queue_init:
+*
+*  This function allocates the ring buffers of an empty queue.
+*
+*  Parameters:
+*
+*  queue - the queue to be initialized
+*  capacity - maximum number of items in each priority level
+*  item_size - size in bytes of each item
+*  number_of_levels - number of priority levels
+*
+*  Return value:
+*
+*  0 - success
+*  -1 - memory allocation failed
+*/
+int queue_init(Queue *queue, int capacity, int item_size,
+               int number_of_levels) {
+
+    int level_id;
+    QueueLevel *level;
+
+    memset(queue, 0, sizeof(Queue));
+
+    queue->levels = (QueueLevel *)calloc(number_of_levels,
+                                         sizeof(QueueLevel));
+
+    if (queue->levels == NULL) {
+
+        /* Error handling */
+        perror("Failed to allocate memory");
+        return -1;
+
+    }
+
+    queue->number_of_levels = number_of_levels;
+
+    for (level_id = 0; level_id < number_of_levels; level_id++) {
+
+        level = &queue->levels[level_id];
+        level->items = (unsigned char *)malloc(capacity * item_size);
+        level->enqueue_times =
+            (long long *)malloc(capacity * sizeof(long long));
+
+        if (level->items == NULL || level->enqueue_times == NULL) {
+
+            /* Error handling */
+            perror("Failed to allocate memory");
+            queue_free(queue);
+            return -1;
+
+        }
+
+    }
+
+    queue->item_size = item_size;
+    queue->capacity = capacity;
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->not_empty, NULL);
+    pthread_cond_init(&queue->not_full, NULL);
+
+    return 0;
+}
+
+
+/*
+*  queue_put_:
+*
+*  This helper function copies the item at the tail of the ring of its
+*  level. The caller holds the lock and has checked that the level is not
+*  full.
+*
+*  Parameters:
+*
+*  queue - the queue
+*  level - the level receiving the item
+*  item - the item to be copied
+*  enqueue_time - time in microseconds at which the item was enqueued
+*
+*  Return value:
+*
+*  None
+*/
+static void queue_put_(Queue *queue, QueueLevel *level, void *item,
+                       long long enqueue_time) {
+
+    int tail = (level->head + level->length) % queue->capacity;
+
+    memcpy(level->items + tail * queue->item_size, item, queue->item_size);
+    level->enqueue_times[tail] = enqueue_time;
+    level->length++;
+    queue->length++;
+
+    if (level->length > level->maximum_length) {
+        level->maximum_length = level->length;
+    }
+}
+
+
+/*
+*  queue_enqueue:
+*
+*  This function adds an item at the tail of its priority level, waiting
+*  for room if the level is full.
+*
+*  Parameters:
+*
+*  queue - the queue
+*  item - the item to be copied into the queue
+*  priority - priority level of the item, 0 being the highest
+*
+*  Return value:
+*
+*  0 - success
+*  -1 - the queue has been closed
+*/
+int queue_enqueue(Queue *queue, void *item, int priority) {
+
+    QueueLevel *level = &queue->levels[priority];
+
+    pthread_mutex_lock(&queue->lock);
+
+    while (level->length == queue->capacity && queue->closed == false) {
+        pthread_cond_wait(&queue->not_full, &queue->lock);
+    }
+
+    if (queue->closed == true) {
+        pthread_mutex_unlock(&queue->lock);
+        return -1;
+    }
+
+    queue_put_(queue, level, item, get_monotonic_time());
+    pthread_cond_signal(&queue->not_empty);
+    pthread_mutex_unlock(&queue->lock);
+
+    return 0;
+}
+
+
+/*
+*  queue_try_enqueue:
+*
+*  This function adds an item at the tail of its priority level without
+*  waiting. Producers that must not stall, such as the scanning thread, use
+*  it.
+*
+*  Parameters:
+*
+*  queue - the queue
+*  item - the item to be copied into the queue
+*  priority - priority level of the item, 0 being the highest
+*
+*  Return value:
+*
+*  0 - success
+*  -1 - the level is full or the queue is closed
+*/
+int queue_try_enqueue(Queue *queue, void *item, int priority) {
+
+    QueueLevel *level = &queue->levels[priority];
+
+    pthread_mutex_lock(&queue->lock);
+
+    if (level->length == queue->capacity || queue->closed == true) {
+        level->number_of_rejected++;
+        pthread_mutex_unlock(&queue->lock);
+        return -1;
+    }
+
+    queue_put_(queue, level, item, get_monotonic_time());
+    pthread_cond_signal(&queue->not_empty);
+    pthread_mutex_unlock(&queue->lock);
+
+    return 0;
+}
+
+
+/*
+*  queue_dequeue_timed:
+*
+*  This function removes the oldest item of the highest priority level
+*  holding items, sleeping at most timeout milliseconds until an item is
+*  enqueued if the queue is empty, and records how long the item waited.
+*
+*  Parameters:
+*
+*  queue - the queue
+*  item - buffer receiving the item
+*  priority - receives the priority level of the item, may be NULL
+*  timeout - time in milliseconds to wait, 0 does not wait and -1 waits
+*            until an item is enqueued or the queue is closed
+*
+*  Return value:
+*
+*  0 - success
+*  1 - the queue is still empty after the timeout
+*  -1 - the queue has been closed and is empty
+*/
+int queue_dequeue_timed(Queue *queue, void *item, int *priority,
+                        int timeout) {
+
+    long long latency;    /* Time in microseconds the item waited */
+    int bucket = 0;       /* Histogram bucket of the latency */
+    int level_id = 0;     /* Highest priority level holding items */
+    QueueLevel *level;
+    struct timespec wake_up_time;
+
+    if (0 < timeout) {
+
+        clock_gettime(CLOCK_REALTIME, &wake_up_time);
+        wake_up_time.tv_sec += timeout / 1000;
+        wake_up_time.tv_nsec += (long)(timeout % 1000) * 1000000;
+
+        if (wake_up_time.tv_nsec >= 1000000000) {
+            wake_up_time.tv_sec++;
+            wake_up_time.tv_nsec -= 1000000000;
+        }
+
+    }
+
+    pthread_mutex_lock(&queue->lock);
+
+    while (queue->length == 0 && queue->closed == false) {
+
+        if (0 > timeout) {
+            pthread_cond_wait(&queue->not_empty, &queue->lock);
+        }
+        else if (0 == timeout ||
+                 pthread_cond_timedwait(&queue->not_empty, &queue->lock,
+                                        &wake_up_time) == ETIMEDOUT) {
+            break;
+        }
+
+    }
+
+    if (queue->length == 0) {
+        pthread_mutex_unlock(&queue->lock);
+        return (queue->closed == true) ? -1 : 1;
+    }
+
+    while (queue->levels[level_id].length == 0) {
+        level_id++;
+    }
+
+    level = &queue->levels[level_id];
+    memcpy(item, level->items + level->head * queue->item_size,
+           queue->item_size);
+    latency = get_monotonic_time() - level->enqueue_times[level->head];
+    level->head = (level->head + 1) % queue->capacity;
+    level->length--;
+    queue->length--;
+
+    while (bucket < QUEUE_HISTOGRAM_BUCKETS - 1 && (latency >> bucket) != 0) {
+        bucket++;
+    }
+
+    level->histogram[bucket]++;
+    level->number_of_dequeued++;
+    level->total_latency += latency;
+
+    if (latency > level->maximum_latency) {
+        level->maximum_latency = latency;
+    }
+
+    if (priority != NULL) {
+        *priority = level_id;
+    }
+
+    /* Producers may be waiting on different levels */
+    pthread_cond_broadcast(&queue->not_full);
+    pthread_mutex_unlock(&queue->lock);
+
+    return 0;
+}
+
+
+/*
+*  queue_dequeue:
+*
+*  This function removes the oldest item of the highest priority level
+*  holding items, sleeping until an item is enqueued if the queue is empty.
+*
+*  Parameters:
+*
+*  queue - the queue
+*  item - buffer receiving the item
+*  priority - receives the priority level of the item, may be NULL
+*
+*  Return value:
+*
+*  0 - success
+*  -1 - the queue has been closed and is empty
+*/
+int queue_dequeue(Queue *queue, void *item, int *priority) {
+
+    return queue_dequeue_timed(queue, item, priority, -1);
+}
+
+
+/*
+*  queue_promote:
+*
+*  This function moves the items of every lower priority level to the
+*  given level, higher levels first and in their order, for as long as the
+*  level has room. The items keep their enqueue time, so their waiting time
+*  is still measured from when they were first enqueued.
+*
+*  Parameters:
+*
+*  queue - the queue
+*  priority - priority level receiving the items
+*
+*  Return value:
+*
+*  number_of_promoted - number of items moved
+*/
+int queue_promote(Queue *queue, int priority) {
+
+    QueueLevel *target = &queue->levels[priority];
+    QueueLevel *level;
+    int level_id;
+    int number_of_promoted = 0;
+
+    pthread_mutex_lock(&queue->lock);
+
+    for (level_id = priority + 1; level_id < queue->number_of_levels;
+         level_id++) {
+
+        level = &queue->levels[level_id];
+
+        while (level->length > 0 && target->length < queue->capacity) {
+
+            queue_put_(queue, target,
+                       level->items + level->head * queue->item_size,
+                       level->enqueue_times[level->head]);
+            level->head = (level->head + 1) % queue->capacity;
+            level->length--;
+            queue->length--;
+            number_of_promoted++;
+
+        }
+
+    }
+
+    target->number_of_promoted += number_of_promoted;
+
+    if (number_of_promoted > 0) {
+        pthread_cond_broadcast(&queue->not_full);
+    }
+
+    pthread_mutex_unlock(&queue->lock);
+
+    return number_of_promoted;
+}
+
+
+/*
+*  queue_get_length:
+*
+*  This function returns the number of items in a priority level or in the
+*  whole queue.
+*
+*  Parameters:
+*
+*  queue - the queue
+*  priority - priority level, -1 for every level
+*
+*  Return value:
+*
+*  length - number of items
+*/
+int queue_get_length(Queue *queue, int priority) {
+
+    int length;
+
+    pthread_mutex_lock(&queue->lock);
+
+    if (0 > priority) {
+        length = queue->length;
+    }
+    else {
+        length = queue->levels[priority].length;
+    }
+
+    pthread_mutex_unlock(&queue->lock);
+
+    return length;
+}
+
+
+/*
+*  queue_close:
+*
+*  This function shuts the queue down. Every waiting thread is woken up,
+*  producers are refused, and consumers return once the queue is empty.
+*
+*  Parameters:
+*
+*  queue - the queue
+*
+*  Return value:
+*
+*  None
+*/
+void queue_close(Queue *queue) {
+
+    pthread_mutex_lock(&queue->lock);
+    queue->closed = true;
+    pthread_cond_broadcast(&queue->not_empty);
+    pthread_cond_broadcast(&queue->not_full);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+
+/*
+*  queue_print_statistics:
+*
+*  This function prints, for every priority level, the depth of the level,
+*  the number of items that went through it and the histogram of the time
+*  they waited between enqueue and dequeue.
+*
+*  Parameters:
+*
+*  queue - the queue
+*  name - name of the queue used in the output
+*
+*  Return value:
+*
+*  None
+*/
+void queue_print_statistics(Queue *queue, char *name) {
+
+    int level_id;
+    int bucket;
+    QueueLevel *level;
+
+    pthread_mutex_lock(&queue->lock);
+
+    for (level_id = 0; level_id < queue->number_of_levels; level_id++) {
+
+        level = &queue->levels[level_id];
+
+        printf("Queue %s, priority %d: %lld dequeued, %lld rejected, "
+               "%lld promoted, %d waiting, maximum %d\n", name, level_id,
+               level->number_of_dequeued, level->number_of_rejected,
+               level->number_of_promoted, level->length,
+               level->maximum_length);
+
+        if (level->number_of_dequeued == 0) {
+            continue;
+        }
+
+        printf("  enqueue to dequeue latency: average %lld us, maximum %lld "
+               "us\n", level->total_latency / level->number_of_dequeued,
+               level->maximum_latency);
+
+        for (bucket = 0; bucket < QUEUE_HISTOGRAM_BUCKETS; bucket++) {
+
+            if (level->histogram[bucket] == 0) {
+                continue;
+            }
+
+            if (bucket < QUEUE_HISTOGRAM_BUCKETS - 1) {
+                printf("  < %9lld us: %lld\n", 1LL << bucket,
+                       level->histogram[bucket]);
+            }
+            else {
+                printf("  >= %8lld us: %lld\n", 1LL << (bucket - 1),
+                       level->histogram[bucket]);
+            }
+
+        }
+
+    }
+
+    pthread_mutex_unlock(&queue->lock);
+}
+
+
+/*
+*  queue_free:
+*
+*  This function frees the ring buffers of the queue. No thread may use the
+*  queue any more.
+*
+*  Parameters:
+*
+*  queue - the queue
+*
+*  Return value:
+*
+*  None
+*/
+void queue_free(Queue *queue) {
+
+    int level_id;
+
+    if (queue->levels == NULL) {
+        return;
+    }
+
+    for (level_id = 0; level_id < queue->number_of_levels; level_id++) {
+        free(queue->levels[level_id].items);
+        free(queue->levels[level_id].enqueue_times);
+    }
+
+    free(queue->levels);
+    queue->levels = NULL;
+    queue->number_of_levels = 0;
+    pthread_mutex_destroy(&queue->lock);
+    pthread_cond_destroy(&queue->not_empty);
+    pthread_cond_destroy(&queue->not_full);
+}
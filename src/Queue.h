@@ -0,0 +1,160 @@
+/*
+* Copyright (c) 2016 Academia Sinica, Institute of Information Science
+*
+* License:
+*
+*      GPL 3.0 : The content of this file is subject to the terms and
+*      conditions defined in file 'COPYING.txt', which is part of this source
+*      code package.
+*
+* Project Name:
+*
+*      BeDIPS
+*
+* File Description:
+*
+*      This header file contains the function declarations and
+*      variables used in the Queue.c file.
+*
+* File Name:
+*
+*      Queue.h
+*
+* Abstract:
+*
+*      BeDIPS uses LBeacons to deliver 3D coordinates and textual
+*      descriptions of their locations to users' devices. Basically, a LBeacon
+*      is an inexpensive, Bluetooth Smart Ready device. The 3D coordinates and
+*      location description of every LBeacon are retrieved from BeDIS
+*      (Building/environment Data and Information System) and stored locally
+*      during deployment and maintenance times. Once initialized, each LBeacon
+*      broadcasts its coordinates and location description to Bluetooth
+*      enabled user devices within its coverage area.
+*
+* Authors:
+*
+*      Jake Lee, jakelee@iis.sinica.edu.tw
+*      Johnson Su, johnsonsu@iis.sinica.edu.tw
+*      Shirley Huang, shirley.huang.93@gmail.com
+*      Han Hu, hhu14@illinois.edu
+*      Jeffrey Lin, lin.jeff03@gmail.com
+*      Howard Hsu, haohsu0823@gmail.com
+*      Han Wang, hollywang@iis.sinica.edu.tw
+*/
+
+#ifndef QUEUE_H
+#define QUEUE_H
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+
+/*
+* CONSTANTS
+*/
+
+/* Number of buckets of the latency histogram. Bucket i counts the items
+ * that waited less than 2^i microseconds and at least half of that; the
+ * last bucket counts everything longer */
+#define QUEUE_HISTOGRAM_BUCKETS 24
+
+
+
+/*
+* TYPEDEF STRUCTS
+*/
+
+/* One priority level of a queue: a ring buffer of items and the waiting
+ * times of the items that left it */
+typedef struct QueueLevel {
+    /* Ring buffer holding capacity items of item_size bytes */
+    unsigned char *items;
+
+    /* Time in microseconds at which each item of the ring was enqueued */
+    long long *enqueue_times;
+
+    /* Position of the oldest item in the ring */
+    int head;
+
+    /* Number of items in the ring */
+    int length;
+
+    /* Highest number of items the ring has held */
+    int maximum_length;
+
+    /* Histogram of the time items waited in the ring */
+    long long histogram[QUEUE_HISTOGRAM_BUCKETS];
+
+    /* Number of items dequeued so far */
+    long long number_of_dequeued;
+
+    /* Number of items rejected because the ring was full */
+    long long number_of_rejected;
+
+    /* Number of items moved here from lower priority levels */
+    long long number_of_promoted;
+
+    /* Sum and maximum of the waiting times in microseconds */
+    long long total_latency;
+    long long maximum_latency;
+} QueueLevel;
+
+
+/* Bounded, blocking queue shared by any number of producer and consumer
+ * threads. Items are copied in and out of one ring buffer per priority
+ * level, so enqueueing does not allocate memory. Level 0 has the highest
+ * priority: consumers always take the oldest item of the highest priority
+ * level holding items, and sleep on a condition variable while the queue
+ * is empty. */
+typedef struct Queue {
+    /* Priority levels, the highest priority first */
+    QueueLevel *levels;
+    int number_of_levels;
+
+    /* Size in bytes of each item */
+    int item_size;
+
+    /* Maximum number of items in each level */
+    int capacity;
+
+    /* Number of items in all the levels */
+    int length;
+
+    /* Set when the queue is shut down; consumers return once it is empty */
+    bool closed;
+
+    /* Lock protecting every field of the queue */
+    pthread_mutex_t lock;
+
+    /* Signaled when an item is enqueued */
+    pthread_cond_t not_empty;
+
+    /* Broadcast when an item is dequeued */
+    pthread_cond_t not_full;
+} Queue;
+
+
+
+/*
+* FUNCTIONS
+*/
+
+int queue_init(Queue *queue, int capacity, int item_size,
+               int number_of_levels);
+int queue_enqueue(Queue *queue, void *item, int priority);
+int queue_try_enqueue(Queue *queue, void *item, int priority);
+int queue_dequeue(Queue *queue, void *item, int *priority);
+int queue_dequeue_timed(Queue *queue, void *item, int *priority,
+                        int timeout);
+int queue_promote(Queue *queue, int priority);
+int queue_get_length(Queue *queue, int priority);
+void queue_close(Queue *queue);
+void queue_print_statistics(Queue *queue, char *name);
+void queue_free(Queue *queue);
+
+#endif
@@ -0,0 +1,448 @@
+/*
+* Copyright (c) 2016 Academia Sinica, Institute of Information Science
+*
+* License:
+*
+*      GPL 3.0 : The content of this file is subject to the terms and
+*      conditions defined in file 'COPYING.txt', which is part of this source
+*      code package.
+*
+* Project Name:
+*
+*      BeDIPS
+*
+* File Description:
+*
+*      This file contains the implementation of the retry queue holding the
+*      pushes that failed for a reason that may pass, such as a refused
+*      connection. Items are kept in a min-heap ordered by the time they are
+*      due, with an exponential, jittered delay, a bounded number of attempts
+*      and a deadline per item.
+*
+* File Name:
+*
+*      RetryQueue.c
+*
+* Abstract:
+*
+*      BeDIPS uses LBeacons to deliver 3D coordinates and textual
+*      descriptions of their locations to users' devices. Basically, a LBeacon
+*      is an inexpensive, Bluetooth Smart Ready device. The 3D coordinates and
+*      location description of every LBeacon are retrieved from BeDIS
+*      (Building/environment Data and Information System) and stored locally
+*      during deployment and maintenance times. Once initialized, each LBeacon
+*      broadcasts its coordinates and location description to Bluetooth
+*      enabled user devices within its coverage area.
+*
+* Authors:
+*
+*      Jake Lee, jakelee@iis.sinica.edu.tw
+*      Johnson Su, johnsonsu@iis.sinica.edu.tw
+*      Shirley Huang, shirley.huang.93@gmail.com
+*      Han Hu, hhu14@illinois.edu
+*      Jeffrey Lin, lin.jeff03@gmail.com
+*      Howard Hsu, haohsu0823@gmail.com
+*      Han Wang, hollywang@iis.sinica.edu.tw
+*/
+
+#include "RetryQueue.h"
+
+
+/*
+*  get_time_in_milliseconds:
+*
+*  This helper function returns the time of the realtime clock, the clock
+*  of the times given to the retry queue by its callers.
+*
+*  Parameters:
+*
+*  None
+*
+*  Return value:
+*
+*  Time in milliseconds since the Epoch
+*/
+static long long get_time_in_milliseconds() {
+
+    struct timespec now;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    return (long long)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+
+/*
+*  sift_up:
+*
+*  This helper function moves the entry at the given position of the heap
+*  up until its parent is due before it.
+*
+*  Parameters:
+*
+*  queue - the retry queue
+*  position - index of the entry in the heap
+*
+*  Return value:
+*
+*  None
+*/
+static void sift_up(RetryQueue *queue, int position) {
+
+    RetryEntry entry = queue->heap[position];
+    int parent;
+
+    while (0 < position) {
+
+        parent = (position - 1) / 2;
+
+        if (queue->heap[parent].due_time <= entry.due_time) {
+            break;
+        }
+
+        queue->heap[position] = queue->heap[parent];
+        position = parent;
+
+    }
+
+    queue->heap[position] = entry;
+}
+
+
+/*
+*  sift_down:
+*
+*  This helper function moves the entry at the given position of the heap
+*  down until both its children are due after it.
+*
+*  Parameters:
+*
+*  queue - the retry queue
+*  position - index of the entry in the heap
+*
+*  Return value:
+*
+*  None
+*/
+static void sift_down(RetryQueue *queue, int position) {
+
+    RetryEntry entry = queue->heap[position];
+    int child;
+
+    while ((child = 2 * position + 1) < queue->size) {
+
+        if (child + 1 < queue->size &&
+            queue->heap[child + 1].due_time < queue->heap[child].due_time) {
+            child++;
+        }
+
+        if (entry.due_time <= queue->heap[child].due_time) {
+            break;
+        }
+
+        queue->heap[position] = queue->heap[child];
+        position = child;
+
+    }
+
+    queue->heap[position] = entry;
+}
+
+
+/*
+*  retry_queue_init:
+*
+*  This function allocates the heap and the items of the retry queue.
+*
+*  Parameters:
+*
+*  queue - the retry queue to be initialized
+*  capacity - maximum number of items waiting
+*  item_size - size in bytes of each item
+*  base_delay - delay in milliseconds before the first retry
+*  maximum_attempts - maximum number of attempts of each item
+*
+*  Return value:
+*
+*  0 - success
+*  -1 - memory allocation failed
+*/
+int retry_queue_init(RetryQueue *queue, int capacity, int item_size,
+                     long long base_delay, int maximum_attempts) {
+
+    int slot;
+
+    memset(queue, 0, sizeof(RetryQueue));
+
+    queue->heap = (RetryEntry *)malloc(capacity * sizeof(RetryEntry));
+    queue->items = (unsigned char *)malloc(capacity * item_size);
+    queue->free_slots = (int *)malloc(capacity * sizeof(int));
+
+    if (queue->heap == NULL || queue->items == NULL ||
+        queue->free_slots == NULL) {
+
+        /* Error handling */
+        perror("Failed to allocate memory");
+        retry_queue_free(queue);
+        return -1;
+
+    }
+
+    for (slot = 0; slot < capacity; slot++) {
+        queue->free_slots[slot] = capacity - 1 - slot;
+    }
+
+    queue->number_of_free_slots = capacity;
+    queue->item_size = item_size;
+    queue->capacity = capacity;
+    queue->base_delay = base_delay;
+    queue->maximum_attempts = maximum_attempts;
+    queue->seed = (unsigned int)get_time_in_milliseconds();
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->changed, NULL);
+
+    return 0;
+}
+
+
+/*
+*  retry_queue_schedule:
+*
+*  This function schedules another attempt of an item after a failure. The
+*  delay doubles with each attempt, and a random part of it is dropped.
+*  The call never waits: an item that cannot be scheduled is given up.
+*
+*  Parameters:
+*
+*  queue - the retry queue
+*  item - the item to be copied into the queue
+*  priority - priority level the item is dispatched at
+*  attempts - number of attempts of the item so far
+*  deadline - time in milliseconds after which the item is not tried
+*  now - current time in milliseconds
+*
+*  Return value:
+*
+*  0 - the item is scheduled
+*  -1 - the item is given up
+*/
+int retry_queue_schedule(RetryQueue *queue, void *item, int priority,
+                         int attempts, long long deadline, long long now) {
+
+    long long delay;
+    int slot;
+
+    pthread_mutex_lock(&queue->lock);
+
+    if (queue->closed == true || queue->maximum_attempts <= attempts) {
+        queue->number_of_exhausted++;
+        pthread_mutex_unlock(&queue->lock);
+        return -1;
+    }
+
+    delay = queue->base_delay << (attempts - 1);
+    delay = delay / 2 + rand_r(&queue->seed) % (delay / 2 + 1);
+
+    if (deadline < now + delay) {
+        queue->number_of_expired++;
+        pthread_mutex_unlock(&queue->lock);
+        return -1;
+    }
+
+    if (queue->number_of_free_slots == 0) {
+        queue->number_of_rejected++;
+        pthread_mutex_unlock(&queue->lock);
+        return -1;
+    }
+
+    queue->number_of_free_slots--;
+    slot = queue->free_slots[queue->number_of_free_slots];
+    memcpy(queue->items + slot * queue->item_size, item, queue->item_size);
+
+    queue->heap[queue->size].due_time = now + delay;
+    queue->heap[queue->size].priority = priority;
+    queue->heap[queue->size].slot = slot;
+    queue->size++;
+    sift_up(queue, queue->size - 1);
+    queue->number_of_scheduled++;
+
+    /* The new item may be due before the one the taker is waiting for */
+    pthread_cond_signal(&queue->changed);
+    pthread_mutex_unlock(&queue->lock);
+
+    return 0;
+}
+
+
+/*
+*  retry_queue_take:
+*
+*  This function waits until the earliest item is due and removes it from
+*  the queue.
+*
+*  Parameters:
+*
+*  queue - the retry queue
+*  item - buffer receiving the item
+*  priority - receives the priority level of the item
+*
+*  Return value:
+*
+*  0 - success
+*  -1 - the queue has been closed
+*/
+int retry_queue_take(RetryQueue *queue, void *item, int *priority) {
+
+    RetryEntry entry;
+    struct timespec wake_up_time;
+
+    pthread_mutex_lock(&queue->lock);
+
+    while (queue->closed == false &&
+           (queue->size == 0 ||
+            get_time_in_milliseconds() < queue->heap[0].due_time)) {
+
+        if (queue->size == 0) {
+
+            pthread_cond_wait(&queue->changed, &queue->lock);
+
+        }
+        else {
+
+            wake_up_time.tv_sec = queue->heap[0].due_time / 1000;
+            wake_up_time.tv_nsec =
+                (long)(queue->heap[0].due_time % 1000) * 1000000;
+            pthread_cond_timedwait(&queue->changed, &queue->lock,
+                                   &wake_up_time);
+
+        }
+
+    }
+
+    if (queue->closed == true) {
+        pthread_mutex_unlock(&queue->lock);
+        return -1;
+    }
+
+    entry = queue->heap[0];
+    queue->size--;
+
+    if (0 < queue->size) {
+        queue->heap[0] = queue->heap[queue->size];
+        sift_down(queue, 0);
+    }
+
+    memcpy(item, queue->items + entry.slot * queue->item_size,
+           queue->item_size);
+    queue->free_slots[queue->number_of_free_slots] = entry.slot;
+    queue->number_of_free_slots++;
+    queue->number_of_taken++;
+
+    if (priority != NULL) {
+        *priority = entry.priority;
+    }
+
+    pthread_mutex_unlock(&queue->lock);
+
+    return 0;
+}
+
+
+/*
+*  retry_queue_get_length:
+*
+*  This function returns the number of items waiting in the retry queue.
+*
+*  Parameters:
+*
+*  queue - the retry queue
+*
+*  Return value:
+*
+*  length - number of items waiting
+*/
+int retry_queue_get_length(RetryQueue *queue) {
+
+    int length;
+
+    pthread_mutex_lock(&queue->lock);
+    length = queue->size;
+    pthread_mutex_unlock(&queue->lock);
+
+    return length;
+}
+
+
+/*
+*  retry_queue_close:
+*
+*  This function shuts the retry queue down. The items still waiting are
+*  dropped, the taker returns, and every later item is given up.
+*
+*  Parameters:
+*
+*  queue - the retry queue
+*
+*  Return value:
+*
+*  None
+*/
+void retry_queue_close(RetryQueue *queue) {
+
+    pthread_mutex_lock(&queue->lock);
+    queue->closed = true;
+    pthread_cond_broadcast(&queue->changed);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+
+/*
+*  retry_queue_print_statistics:
+*
+*  This function prints the counters of the retry queue.
+*
+*  Parameters:
+*
+*  queue - the retry queue
+*
+*  Return value:
+*
+*  None
+*/
+void retry_queue_print_statistics(RetryQueue *queue) {
+
+    pthread_mutex_lock(&queue->lock);
+
+    printf("Retry queue: %lld scheduled, %lld retried, %d waiting\n",
+           queue->number_of_scheduled, queue->number_of_taken, queue->size);
+    printf("  given up: %lld out of attempts, %lld past deadline, "
+           "%lld queue full\n", queue->number_of_exhausted,
+           queue->number_of_expired, queue->number_of_rejected);
+
+    pthread_mutex_unlock(&queue->lock);
+}
+
+
+/*
+*  retry_queue_free:
+*
+*  This function frees the memory of the retry queue. No thread may use
+*  the queue any more.
+*
+*  Parameters:
+*
+*  queue - the retry queue
+*
+*  Return value:
+*
+*  None
+*/
+void retry_queue_free(RetryQueue *queue) {
+
+    free(queue->heap);
+    free(queue->items);
+    free(queue->free_slots);
+    queue->heap = NULL;
+    queue->items = NULL;
+    queue->free_slots = NULL;
+}
@@ -0,0 +1,141 @@
+/*
+* Copyright (c) 2016 Academia Sinica, Institute of Information Science
+*
+* License:
+*
+*      GPL 3.0 : The content of this file is subject to the terms and
+*      conditions defined in file 'COPYING.txt', which is part of this source
+*      code package.
+*
+* Project Name:
+*
+*      BeDIPS
+*
+* File Description:
+*
+*      This header file contains the function declarations and variables used
+*      in the RetryQueue.c file.
+*
+* File Name:
+*
+*      RetryQueue.h
+*
+* Abstract:
+*
+*      BeDIPS uses LBeacons to deliver 3D coordinates and textual
+*      descriptions of their locations to users' devices. Basically, a LBeacon
+*      is an inexpensive, Bluetooth Smart Ready device. The 3D coordinates and
+*      location description of every LBeacon are retrieved from BeDIS
+*      (Building/environment Data and Information System) and stored locally
+*      during deployment and maintenance times. Once initialized, each LBeacon
+*      broadcasts its coordinates and location description to Bluetooth
+*      enabled user devices within its coverage area.
+*
+* Authors:
+*
+*      Jake Lee, jakelee@iis.sinica.edu.tw
+*      Johnson Su, johnsonsu@iis.sinica.edu.tw
+*      Shirley Huang, shirley.huang.93@gmail.com
+*      Han Hu, hhu14@illinois.edu
+*      Jeffrey Lin, lin.jeff03@gmail.com
+*      Howard Hsu, haohsu0823@gmail.com
+*      Han Wang, hollywang@iis.sinica.edu.tw
+*/
+
+#ifndef RETRYQUEUE_H
+#define RETRYQUEUE_H
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+
+/*
+* TYPEDEF STRUCTS
+*/
+
+/* Node of the heap of a retry queue */
+typedef struct RetryEntry {
+    /* Time in milliseconds at which the item is due */
+    long long due_time;
+
+    /* Priority level the item is dispatched at */
+    int priority;
+
+    /* Index of the item in the item array */
+    int slot;
+} RetryEntry;
+
+
+/* Items waiting to be tried again, ordered by the time they are due in a
+ * binary min-heap. The delay before attempt n is drawn at random between
+ * half and all of base_delay * 2^(n - 1), so the devices that failed
+ * together are not tried again together. Items are copied into a fixed
+ * array, so scheduling does not allocate memory. */
+typedef struct RetryQueue {
+    /* Heap of size entries, the earliest due first */
+    RetryEntry *heap;
+    int size;
+
+    /* Array of capacity items of item_size bytes, and a stack of the
+     * indexes of the free items */
+    unsigned char *items;
+    int *free_slots;
+    int number_of_free_slots;
+
+    /* Size in bytes of each item */
+    int item_size;
+
+    /* Maximum number of items waiting */
+    int capacity;
+
+    /* Delay in milliseconds before the first retry */
+    long long base_delay;
+
+    /* Maximum number of attempts of each item, including the first one */
+    int maximum_attempts;
+
+    /* Seed of the random jitter */
+    unsigned int seed;
+
+    /* Set when the queue is shut down */
+    bool closed;
+
+    /* Lock protecting every field of the queue */
+    pthread_mutex_t lock;
+
+    /* Signaled when an item is scheduled or the queue is closed */
+    pthread_cond_t changed;
+
+    /* Number of items scheduled and taken */
+    long long number_of_scheduled;
+    long long number_of_taken;
+
+    /* Number of items given up because they ran out of attempts, would be
+     * due after their deadline, or found the queue full */
+    long long number_of_exhausted;
+    long long number_of_expired;
+    long long number_of_rejected;
+} RetryQueue;
+
+
+
+/*
+* FUNCTIONS
+*/
+
+int retry_queue_init(RetryQueue *queue, int capacity, int item_size,
+                     long long base_delay, int maximum_attempts);
+int retry_queue_schedule(RetryQueue *queue, void *item, int priority,
+                         int attempts, long long deadline, long long now);
+int retry_queue_take(RetryQueue *queue, void *item, int *priority);
+int retry_queue_get_length(RetryQueue *queue);
+void retry_queue_close(RetryQueue *queue);
+void retry_queue_print_statistics(RetryQueue *queue);
+void retry_queue_free(RetryQueue *queue);
+
+#endif
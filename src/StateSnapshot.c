@@ -0,0 +1,443 @@
+/*
+* Copyright (c) 2016 Academia Sinica, Institute of Information Science
+*
+* License:
+*
+*      GPL 3.0 : The content of this file is subject to the terms and
+*      conditions defined in file 'COPYING.txt', which is part of this source
+*      code package.
+*
+* Project Name:
+*
+*      BeDIPS
+*
+* File Description:
+*
+*      This file contains the functions saving the state of the LBeacon to a
+*      snapshot file and mapping it back at startup. A snapshot holds the
+*      devices of the scanned list, with the time they were scanned and the
+*      priority of their pending push, and the channels of the channel cache,
+*      as fixed size records that are used in place once the file is mapped.
+*
+* File Name:
+*
+*      StateSnapshot.c
+*
+* Abstract:
+*
+*      BeDIPS uses LBeacons to deliver 3D coordinates and textual
+*      descriptions of their locations to users' devices. Basically, a LBeacon
+*      is an inexpensive, Bluetooth Smart Ready device. The 3D coordinates and
+*      location description of every LBeacon are retrieved from BeDIS
+*      (Building/environment Data and Information System) and stored locally
+*      during deployment and maintenance times. Once initialized, each LBeacon
+*      broadcasts its coordinates and location description to Bluetooth
+*      enabled user devices within its coverage area.
+*
+* Authors:
+*
+*      Jake Lee, jakelee@iis.sinica.edu.tw
+*      Johnson Su, johnsonsu@iis.sinica.edu.tw
+*      Shirley Huang, shirley.huang.93@gmail.com
+*      Han Hu, hhu14@illinois.edu
+*      Jeffrey Lin, lin.jeff03@gmail.com
+*      Howard Hsu, haohsu0823@gmail.com
+*      Han Wang, hollywang@iis.sinica.edu.tw
+*/
+
+#include "StateSnapshot.h"
+
+
+/*
+*  hash_bytes:
+*
+*  This helper function folds bytes into a 32-bit FNV-1a hash.
+*
+*  Parameters:
+*
+*  hash - the hash of the bytes before
+*  data - the bytes
+*  length - number of bytes
+*
+*  Return value:
+*
+*  The hash including the bytes
+*/
+static uint32_t hash_bytes(uint32_t hash, const void *data, size_t length) {
+
+    const unsigned char *bytes = (const unsigned char *)data;
+    size_t byte_id;
+
+    for (byte_id = 0; byte_id < length; byte_id++) {
+        hash ^= bytes[byte_id];
+        hash *= 16777619;
+    }
+
+    return hash;
+}
+
+
+/*
+*  get_checksum:
+*
+*  This helper function hashes the records of a snapshot.
+*
+*  Parameters:
+*
+*  snapshot - the snapshot
+*
+*  Return value:
+*
+*  The hash of the device records followed by the channel records
+*/
+static uint32_t get_checksum(StateSnapshot *snapshot) {
+
+    uint32_t hash = 2166136261u;
+
+    hash = hash_bytes(hash, snapshot->devices,
+                      snapshot->header.number_of_devices *
+                      sizeof(StateSnapshotDevice));
+    hash = hash_bytes(hash, snapshot->channels,
+                      snapshot->header.number_of_channels *
+                      sizeof(StateSnapshotChannel));
+
+    return hash;
+}
+
+
+/*
+*  compare_devices:
+*
+*  This helper function orders devices by the time they were scanned, so
+*  their pending pushes are queued again in the order they were scanned.
+*
+*  Parameters:
+*
+*  first - the first device
+*  second - the second device
+*
+*  Return value:
+*
+*  Negative, zero or positive like strcmp
+*/
+static int compare_devices(const void *first, const void *second) {
+
+    const StateSnapshotDevice *first_device =
+        (const StateSnapshotDevice *)first;
+    const StateSnapshotDevice *second_device =
+        (const StateSnapshotDevice *)second;
+
+    if (first_device->scanned_time < second_device->scanned_time) {
+        return -1;
+    }
+
+    return first_device->scanned_time > second_device->scanned_time;
+}
+
+
+/*
+*  state_snapshot_init:
+*
+*  This function starts taking a snapshot in memory.
+*
+*  Parameters:
+*
+*  snapshot - the snapshot
+*  maximum_devices - number of device records there is room for
+*  maximum_channels - number of channel records there is room for
+*
+*  Return value:
+*
+*  0 - success
+*  -1 - memory allocation failed
+*/
+int state_snapshot_init(StateSnapshot *snapshot, int maximum_devices,
+                        int maximum_channels) {
+
+    memset(snapshot, 0, sizeof(StateSnapshot));
+
+    /* Keep at least one record, as malloc may return NULL for none */
+    snapshot->devices = (StateSnapshotDevice *)
+        malloc((maximum_devices + 1) * sizeof(StateSnapshotDevice));
+    snapshot->channels = (StateSnapshotChannel *)
+        malloc((maximum_channels + 1) * sizeof(StateSnapshotChannel));
+
+    if (snapshot->devices == NULL || snapshot->channels == NULL) {
+
+        /* Error handling */
+        perror("Failed to allocate memory");
+        state_snapshot_free(snapshot);
+        return -1;
+
+    }
+
+    snapshot->maximum_devices = maximum_devices;
+    snapshot->maximum_channels = maximum_channels;
+
+    return 0;
+}
+
+
+/*
+*  state_snapshot_add_device:
+*
+*  This function adds a device of the scanned list to the snapshot.
+*
+*  Parameters:
+*
+*  snapshot - the snapshot
+*  key - packed address of the device
+*  scanned_time - time in milliseconds the device was first scanned
+*  priority - priority level of its pending push, or
+*             STATE_SNAPSHOT_NOT_PENDING
+*
+*  Return value:
+*
+*  0 - success
+*  -1 - the snapshot is full
+*/
+int state_snapshot_add_device(StateSnapshot *snapshot, uint64_t key,
+                              long long scanned_time, int priority) {
+
+    StateSnapshotDevice *device;
+
+    if (snapshot->header.number_of_devices >= snapshot->maximum_devices) {
+        return -1;
+    }
+
+    device = &snapshot->devices[snapshot->header.number_of_devices];
+    memset(device, 0, sizeof(StateSnapshotDevice));
+    device->key = key;
+    device->scanned_time = scanned_time;
+    device->priority = priority;
+    snapshot->header.number_of_devices++;
+
+    return 0;
+}
+
+
+/*
+*  state_snapshot_add_channel:
+*
+*  This function adds an entry of the channel cache to the snapshot.
+*
+*  Parameters:
+*
+*  snapshot - the snapshot
+*  key - packed address of the device
+*  channel - Object Push channel of the device
+*  expiry_time - time in milliseconds the entry expires
+*
+*  Return value:
+*
+*  0 - success
+*  -1 - the snapshot is full
+*/
+int state_snapshot_add_channel(StateSnapshot *snapshot, uint64_t key,
+                               int channel, long long expiry_time) {
+
+    StateSnapshotChannel *entry;
+
+    if (snapshot->header.number_of_channels >= snapshot->maximum_channels) {
+        return -1;
+    }
+
+    entry = &snapshot->channels[snapshot->header.number_of_channels];
+    memset(entry, 0, sizeof(StateSnapshotChannel));
+    entry->key = key;
+    entry->expiry_time = expiry_time;
+    entry->channel = channel;
+    snapshot->header.number_of_channels++;
+
+    return 0;
+}
+
+
+/*
+*  state_snapshot_write:
+*
+*  This function writes the snapshot to a temporary file, flushes it to
+*  the disk and renames it over the snapshot file, so a crash leaves
+*  either the previous snapshot or the new one.
+*
+*  Parameters:
+*
+*  snapshot - the snapshot taken in memory
+*  file_name - path of the snapshot file
+*  now - time in milliseconds the snapshot was taken
+*
+*  Return value:
+*
+*  0 - success
+*  -1 - the file could not be written
+*/
+int state_snapshot_write(StateSnapshot *snapshot, char *file_name,
+                         long long now) {
+
+    char temporary_name[STATE_SNAPSHOT_PATH_LENGTH];
+    struct iovec parts[3];
+    ssize_t size;
+    int file;
+
+    qsort(snapshot->devices, snapshot->header.number_of_devices,
+          sizeof(StateSnapshotDevice), compare_devices);
+
+    snapshot->header.magic = STATE_SNAPSHOT_MAGIC;
+    snapshot->header.version = STATE_SNAPSHOT_VERSION;
+    snapshot->header.saved_time = now;
+    snapshot->header.checksum = get_checksum(snapshot);
+
+    parts[0].iov_base = &snapshot->header;
+    parts[0].iov_len = sizeof(StateSnapshotHeader);
+    parts[1].iov_base = snapshot->devices;
+    parts[1].iov_len = snapshot->header.number_of_devices *
+                       sizeof(StateSnapshotDevice);
+    parts[2].iov_base = snapshot->channels;
+    parts[2].iov_len = snapshot->header.number_of_channels *
+                       sizeof(StateSnapshotChannel);
+
+    snprintf(temporary_name, sizeof(temporary_name), "%s.tmp", file_name);
+
+    file = open(temporary_name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    if (file < 0) {
+
+        /* Error handling */
+        perror(temporary_name);
+        return -1;
+
+    }
+
+    size = writev(file, parts, 3);
+
+    if (size != (ssize_t)(parts[0].iov_len + parts[1].iov_len +
+                          parts[2].iov_len) ||
+        fsync(file) != 0) {
+
+        /* Error handling */
+        perror(temporary_name);
+        close(file);
+        unlink(temporary_name);
+        return -1;
+
+    }
+
+    close(file);
+
+    if (rename(temporary_name, file_name) != 0) {
+
+        /* Error handling */
+        perror(file_name);
+        unlink(temporary_name);
+        return -1;
+
+    }
+
+    return 0;
+}
+
+
+/*
+*  state_snapshot_map:
+*
+*  This function maps a snapshot file read only and checks it. The
+*  records are read in place from the mapping.
+*
+*  Parameters:
+*
+*  snapshot - the snapshot
+*  file_name - path of the snapshot file
+*
+*  Return value:
+*
+*  0 - success
+*  -1 - there is no snapshot file (errno is ENOENT), or it could not be
+*       read or is not a valid snapshot
+*/
+int state_snapshot_map(StateSnapshot *snapshot, char *file_name) {
+
+    struct stat file_status;
+    size_t expected_size;
+    int file;
+
+    memset(snapshot, 0, sizeof(StateSnapshot));
+
+    file = open(file_name, O_RDONLY);
+
+    if (file < 0) {
+        return -1;
+    }
+
+    if (fstat(file, &file_status) != 0 ||
+        file_status.st_size < (off_t)sizeof(StateSnapshotHeader)) {
+        close(file);
+        errno = EINVAL;
+        return -1;
+    }
+
+    snapshot->mapping_size = file_status.st_size;
+    snapshot->mapping = mmap(NULL, snapshot->mapping_size, PROT_READ,
+                             MAP_PRIVATE, file, 0);
+    close(file);
+
+    if (snapshot->mapping == MAP_FAILED) {
+        snapshot->mapping = NULL;
+        return -1;
+    }
+
+    memcpy(&snapshot->header, snapshot->mapping,
+           sizeof(StateSnapshotHeader));
+    expected_size = sizeof(StateSnapshotHeader) +
+                    (size_t)snapshot->header.number_of_devices *
+                    sizeof(StateSnapshotDevice) +
+                    (size_t)snapshot->header.number_of_channels *
+                    sizeof(StateSnapshotChannel);
+
+    snapshot->devices = (StateSnapshotDevice *)
+        ((char *)snapshot->mapping + sizeof(StateSnapshotHeader));
+    snapshot->channels = (StateSnapshotChannel *)
+        (snapshot->devices + snapshot->header.number_of_devices);
+
+    if (snapshot->header.magic != STATE_SNAPSHOT_MAGIC ||
+        snapshot->header.version != STATE_SNAPSHOT_VERSION ||
+        expected_size != snapshot->mapping_size ||
+        snapshot->header.checksum != get_checksum(snapshot)) {
+
+        state_snapshot_free(snapshot);
+        errno = EINVAL;
+        return -1;
+
+    }
+
+    return 0;
+}
+
+
+/*
+*  state_snapshot_free:
+*
+*  This function frees the records of a snapshot taken in memory, or
+*  unmaps a snapshot file.
+*
+*  Parameters:
+*
+*  snapshot - the snapshot
+*
+*  Return value:
+*
+*  None
+*/
+void state_snapshot_free(StateSnapshot *snapshot) {
+
+    if (snapshot->mapping != NULL) {
+        munmap(snapshot->mapping, snapshot->mapping_size);
+    }
+    else {
+        free(snapshot->devices);
+        free(snapshot->channels);
+    }
+
+    snapshot->mapping = NULL;
+    snapshot->devices = NULL;
+    snapshot->channels = NULL;
+}
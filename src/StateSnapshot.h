@@ -0,0 +1,163 @@
+/*
+* Copyright (c) 2016 Academia Sinica, Institute of Information Science
+*
+* License:
+*
+*      GPL 3.0 : The content of this file is subject to the terms and
+*      conditions defined in file 'COPYING.txt', which is part of this source
+*      code package.
+*
+* Project Name:
+*
+*      BeDIPS
+*
+* File Description:
+*
+*      This header file contains the function declarations and variables used
+*      in the StateSnapshot.c file.
+*
+* File Name:
+*
+*      StateSnapshot.h
+*
+* Abstract:
+*
+*      BeDIPS uses LBeacons to deliver 3D coordinates and textual
+*      descriptions of their locations to users' devices. Basically, a LBeacon
+*      is an inexpensive, Bluetooth Smart Ready device. The 3D coordinates and
+*      location description of every LBeacon are retrieved from BeDIS
+*      (Building/environment Data and Information System) and stored locally
+*      during deployment and maintenance times. Once initialized, each LBeacon
+*      broadcasts its coordinates and location description to Bluetooth
+*      enabled user devices within its coverage area.
+*
+* Authors:
+*
+*      Jake Lee, jakelee@iis.sinica.edu.tw
+*      Johnson Su, johnsonsu@iis.sinica.edu.tw
+*      Shirley Huang, shirley.huang.93@gmail.com
+*      Han Hu, hhu14@illinois.edu
+*      Jeffrey Lin, lin.jeff03@gmail.com
+*      Howard Hsu, haohsu0823@gmail.com
+*      Han Wang, hollywang@iis.sinica.edu.tw
+*/
+
+#ifndef STATESNAPSHOT_H
+#define STATESNAPSHOT_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+
+/*
+* CONSTANTS
+*/
+
+/* First bytes of a snapshot file, "LBSS" in little endian, and version of
+ * its layout */
+#define STATE_SNAPSHOT_MAGIC 0x53534c42
+#define STATE_SNAPSHOT_VERSION 1
+
+/* Maximum number of characters in the path of a snapshot file */
+#define STATE_SNAPSHOT_PATH_LENGTH 256
+
+/* Priority of a device whose push is not pending */
+#define STATE_SNAPSHOT_NOT_PENDING -1
+
+
+
+/*
+* TYPEDEF STRUCTS
+*/
+
+/* Start of a snapshot file. The device records follow it, then the
+ * channel records, so the file is used in place once mapped. */
+typedef struct StateSnapshotHeader {
+    uint32_t magic;
+    uint32_t version;
+
+    /* Time in milliseconds since the epoch the snapshot was taken */
+    int64_t saved_time;
+
+    uint32_t number_of_devices;
+    uint32_t number_of_channels;
+
+    /* FNV-1a hash of the records, to detect a truncated or torn file */
+    uint32_t checksum;
+    uint32_t reserved;
+} StateSnapshotHeader;
+
+
+/* A device of the scanned list */
+typedef struct StateSnapshotDevice {
+    /* Packed address of the device */
+    uint64_t key;
+
+    /* Time in milliseconds since the epoch the device was first scanned */
+    int64_t scanned_time;
+
+    /* Priority level of its pending push, STATE_SNAPSHOT_NOT_PENDING if it
+     * was pushed or needs no push */
+    int32_t priority;
+    int32_t reserved;
+} StateSnapshotDevice;
+
+
+/* An Object Push channel of the channel cache */
+typedef struct StateSnapshotChannel {
+    /* Packed address of the device */
+    uint64_t key;
+
+    /* Time in milliseconds since the epoch the entry expires */
+    int64_t expiry_time;
+
+    int32_t channel;
+    int32_t reserved;
+} StateSnapshotChannel;
+
+
+/* A snapshot being taken in memory, or a snapshot file mapped read only */
+typedef struct StateSnapshot {
+    StateSnapshotHeader header;
+
+    /* Records of the snapshot */
+    StateSnapshotDevice *devices;
+    StateSnapshotChannel *channels;
+
+    /* Number of records there is room for while taking the snapshot */
+    uint32_t maximum_devices;
+    uint32_t maximum_channels;
+
+    /* Mapping of the file and its size, NULL while taking a snapshot */
+    void *mapping;
+    size_t mapping_size;
+} StateSnapshot;
+
+
+
+/*
+* FUNCTIONS
+*/
+
+int state_snapshot_init(StateSnapshot *snapshot, int maximum_devices,
+                        int maximum_channels);
+int state_snapshot_add_device(StateSnapshot *snapshot, uint64_t key,
+                              long long scanned_time, int priority);
+int state_snapshot_add_channel(StateSnapshot *snapshot, uint64_t key,
+                               int channel, long long expiry_time);
+int state_snapshot_write(StateSnapshot *snapshot, char *file_name,
+                         long long now);
+int state_snapshot_map(StateSnapshot *snapshot, char *file_name);
+void state_snapshot_free(StateSnapshot *snapshot);
+
+#endif
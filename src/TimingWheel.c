@@ -0,0 +1,294 @@
+/*
+* Copyright (c) 2016 Academia Sinica, Institute of Information Science
+*
+* License:
+*
+*      GPL 3.0 : The content of this file is subject to the terms and
+*      conditions defined in file 'COPYING.txt', which is part of this source
+*      code package.
+*
+* Project Name:
+*
+*      BeDIPS
+*
+* File Description:
+*
+*      This file contains the implementation of a hashed timing wheel used to
+*      expire entries after a timeout. Adding and removing an entry costs
+*      O(1), and expiring only visits the slots whose time has come, so a
+*      thread can sleep until the next deadline instead of polling every
+*      entry.
+*
+* File Name:
+*
+*      TimingWheel.c
+*
+* Abstract:
+*
+*      BeDIPS uses LBeacons to deliver 3D coordinates and textual
+*      descriptions of their locations to users' devices. Basically, a LBeacon
+*      is an inexpensive, Bluetooth Smart Ready device. The 3D coordinates and
+*      location description of every LBeacon are retrieved from BeDIS
+*      (Building/environment Data and Information System) and stored locally
+*      during deployment and maintenance times. Once initialized, each LBeacon
+*      broadcasts its coordinates and location description to Bluetooth
+*      enabled user devices within its coverage area.
+*
+* Authors:
+*
+*      Jake Lee, jakelee@iis.sinica.edu.tw
+*      Johnson Su, johnsonsu@iis.sinica.edu.tw
+*      Shirley Huang, shirley.huang.93@gmail.com
+*      Han Hu, hhu14@illinois.edu
+*      Jeffrey Lin, lin.jeff03@gmail.com
+*      Howard Hsu, haohsu0823@gmail.com
+*      Han Wang, hollywang@iis.sinica.edu.tw
+*/
+
+#include "TimingWheel.h"
+
+
+/*
+*  timing_wheel_init:
+*
+*  This function allocates the slots of a wheel covering the given span of
+*  time.
+*
+*  Parameters:
+*
+*  wheel - the wheel to be initialized
+*  span - longest timeout in milliseconds the wheel has to hold
+*  slot_length - length of time in milliseconds covered by each slot
+*  now - current time in milliseconds
+*
+*  Return value:
+*
+*  0 - success
+*  -1 - memory allocation failed
+*/
+int timing_wheel_init(TimingWheel *wheel, long long span,
+                      long long slot_length, long long now) {
+
+    int slot_id;
+
+    wheel->number_of_slots = (int)(span / slot_length) + 2;
+    wheel->slots = (List_Entry *)malloc(wheel->number_of_slots *
+                                        sizeof(List_Entry));
+
+    if (wheel->slots == NULL) {
+
+        /* Error handling */
+        perror("Failed to allocate memory");
+        return -1;
+
+    }
+
+    for (slot_id = 0; slot_id < wheel->number_of_slots; slot_id++) {
+        wheel->slots[slot_id].next = &wheel->slots[slot_id];
+        wheel->slots[slot_id].prev = &wheel->slots[slot_id];
+    }
+
+    wheel->slot_length = slot_length;
+    wheel->current_tick = now / slot_length;
+    wheel->size = 0;
+
+    return 0;
+}
+
+
+/*
+*  timing_wheel_add:
+*
+*  This function puts the entry in the slot of its deadline. A deadline in
+*  the past goes into the next slot to be expired, and a deadline beyond the
+*  span of the wheel goes into the last slot, and is put back into the slot
+*  of its deadline when that slot is expired.
+*
+*  Parameters:
+*
+*  wheel - the wheel
+*  entry - the entry to be added
+*  deadline - time in milliseconds at which the entry expires
+*
+*  Return value:
+*
+*  None
+*/
+void timing_wheel_add(TimingWheel *wheel, TimerEntry *entry,
+                      long long deadline) {
+
+    /* The first tick whose start time is not earlier than the deadline */
+    long long tick = (deadline + wheel->slot_length - 1) / wheel->slot_length;
+
+    if (tick < wheel->current_tick) {
+        tick = wheel->current_tick;
+    }
+    else if (tick >= wheel->current_tick + wheel->number_of_slots) {
+        tick = wheel->current_tick + wheel->number_of_slots - 1;
+    }
+
+    entry->deadline = deadline;
+    list_insert_tail(&entry->ptrs,
+                     &wheel->slots[tick % wheel->number_of_slots]);
+    wheel->size++;
+}
+
+
+/*
+*  timing_wheel_remove:
+*
+*  This function removes an entry before it expires.
+*
+*  Parameters:
+*
+*  wheel - the wheel
+*  entry - the entry to be removed
+*
+*  Return value:
+*
+*  None
+*/
+void timing_wheel_remove(TimingWheel *wheel, TimerEntry *entry) {
+
+    list_remove_node(&entry->ptrs);
+    wheel->size--;
+}
+
+
+/*
+*  timing_wheel_expire:
+*
+*  This function moves every entry whose deadline has passed to the list of
+*  expired entries. Only the slots between the last call and now are
+*  visited, and each of them at most once.
+*
+*  Parameters:
+*
+*  wheel - the wheel
+*  now - current time in milliseconds
+*  expired - head of the list receiving the expired entries
+*
+*  Return value:
+*
+*  number_of_expired - number of entries moved to the expired list
+*/
+int timing_wheel_expire(TimingWheel *wheel, long long now,
+                        List_Entry *expired) {
+
+    long long now_tick = now / wheel->slot_length;
+    long long last_tick = now_tick;
+    int number_of_expired = 0;
+    List_Entry pending; /* Entries clamped into a due slot, not due yet */
+    List_Entry *slot;
+    List_Entry *listptrs;
+    List_Entry *next;
+    TimerEntry *entry;
+
+    /* After a long sleep every slot is due, but each is visited only once */
+    if (last_tick >= wheel->current_tick + wheel->number_of_slots) {
+        last_tick = wheel->current_tick + wheel->number_of_slots - 1;
+    }
+
+    pending.next = &pending;
+    pending.prev = &pending;
+
+    for (; wheel->current_tick <= last_tick; wheel->current_tick++) {
+
+        slot = &wheel->slots[wheel->current_tick % wheel->number_of_slots];
+
+        for (listptrs = slot->next; listptrs != slot; listptrs = next) {
+
+            next = listptrs->next;
+            entry = ListEntry(listptrs, TimerEntry, ptrs);
+            list_remove_node(&entry->ptrs);
+            wheel->size--;
+
+            if (entry->deadline <= now) {
+                list_insert_tail(&entry->ptrs, expired);
+                number_of_expired++;
+            }
+            else {
+                list_insert_tail(&entry->ptrs, &pending);
+            }
+
+        }
+
+    }
+
+    if (wheel->current_tick <= now_tick) {
+        wheel->current_tick = now_tick + 1;
+    }
+
+    /* Entries whose deadline was beyond the span of the wheel when they were
+     * added are put back into the slot of their deadline */
+    while (pending.next != &pending) {
+
+        entry = ListEntry(pending.next, TimerEntry, ptrs);
+        list_remove_node(&entry->ptrs);
+        timing_wheel_add(wheel, entry, entry->deadline);
+
+    }
+
+    return number_of_expired;
+}
+
+
+/*
+*  timing_wheel_next_deadline:
+*
+*  This function returns the time at which the next slot holding entries is
+*  due, which is when the caller should call timing_wheel_expire again.
+*
+*  Parameters:
+*
+*  wheel - the wheel
+*
+*  Return value:
+*
+*  Time in milliseconds of the next due slot, -1 if the wheel is empty
+*/
+long long timing_wheel_next_deadline(TimingWheel *wheel) {
+
+    long long tick;
+    List_Entry *slot;
+
+    if (wheel->size == 0) {
+        return -1;
+    }
+
+    for (tick = wheel->current_tick;
+         tick < wheel->current_tick + wheel->number_of_slots; tick++) {
+
+        slot = &wheel->slots[tick % wheel->number_of_slots];
+
+        if (slot->next != slot) {
+            return tick * wheel->slot_length;
+        }
+
+    }
+
+    return -1;
+}
+
+
+/*
+*  timing_wheel_free:
+*
+*  This function frees the slots of the wheel. The entries are owned by the
+*  caller and are not freed.
+*
+*  Parameters:
+*
+*  wheel - the wheel
+*
+*  Return value:
+*
+*  None
+*/
+void timing_wheel_free(TimingWheel *wheel) {
+
+    free(wheel->slots);
+    wheel->slots = NULL;
+    wheel->number_of_slots = 0;
+    wheel->size = 0;
+}
@@ -0,0 +1,105 @@
+/*
+* Copyright (c) 2016 Academia Sinica, Institute of Information Science
+*
+* License:
+*
+*      GPL 3.0 : The content of this file is subject to the terms and
+*      conditions defined in file 'COPYING.txt', which is part of this source
+*      code package.
+*
+* Project Name:
+*
+*      BeDIPS
+*
+* File Description:
+*
+*      This header file contains the function declarations and
+*      variables used in the TimingWheel.c file.
+*
+* File Name:
+*
+*      TimingWheel.h
+*
+* Abstract:
+*
+*      BeDIPS uses LBeacons to deliver 3D coordinates and textual
+*      descriptions of their locations to users' devices. Basically, a LBeacon
+*      is an inexpensive, Bluetooth Smart Ready device. The 3D coordinates and
+*      location description of every LBeacon are retrieved from BeDIS
+*      (Building/environment Data and Information System) and stored locally
+*      during deployment and maintenance times. Once initialized, each LBeacon
+*      broadcasts its coordinates and location description to Bluetooth
+*      enabled user devices within its coverage area.
+*
+* Authors:
+*
+*      Jake Lee, jakelee@iis.sinica.edu.tw
+*      Johnson Su, johnsonsu@iis.sinica.edu.tw
+*      Shirley Huang, shirley.huang.93@gmail.com
+*      Han Hu, hhu14@illinois.edu
+*      Jeffrey Lin, lin.jeff03@gmail.com
+*      Howard Hsu, haohsu0823@gmail.com
+*      Han Wang, hollywang@iis.sinica.edu.tw
+*/
+
+#ifndef TIMINGWHEEL_H
+#define TIMINGWHEEL_H
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "LinkedList.h"
+
+
+/*
+* TYPEDEF STRUCTS
+*/
+
+/* Entry of the wheel, embedded in the struct whose expiry it tracks. The
+ * master struct is recovered from the entry with the ListEntry macro. */
+typedef struct TimerEntry {
+    /* Links of the entry in the list of its slot */
+    List_Entry ptrs;
+
+    /* Time in milliseconds at which the entry expires */
+    long long deadline;
+} TimerEntry;
+
+
+/* Hashed timing wheel. Slot i holds the entries expiring during the i-th
+ * slot_length window, modulo the number of slots. The wheel spans at least
+ * the longest timeout, so every slot only holds entries of one lap. */
+typedef struct TimingWheel {
+    /* Array of list heads, one per slot */
+    List_Entry *slots;
+
+    /* Number of slots in the wheel */
+    int number_of_slots;
+
+    /* Length of time in milliseconds covered by each slot */
+    long long slot_length;
+
+    /* Number of the next tick to be expired */
+    long long current_tick;
+
+    /* Number of entries in the wheel */
+    int size;
+} TimingWheel;
+
+
+
+/*
+* FUNCTIONS
+*/
+
+int timing_wheel_init(TimingWheel *wheel, long long span,
+                      long long slot_length, long long now);
+void timing_wheel_add(TimingWheel *wheel, TimerEntry *entry,
+                      long long deadline);
+void timing_wheel_remove(TimingWheel *wheel, TimerEntry *entry);
+int timing_wheel_expire(TimingWheel *wheel, long long now,
+                        List_Entry *expired);
+long long timing_wheel_next_deadline(TimingWheel *wheel);
+void timing_wheel_free(TimingWheel *wheel);
+
+#endif
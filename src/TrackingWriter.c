@@ -0,0 +1,548 @@
+/*
+* Copyright (c) 2016 Academia Sinica, Institute of Information Science
+*
+* License:
+*
+*      GPL 3.0 : The content of this file is subject to the terms and
+*      conditions defined in file 'COPYING.txt', which is part of this source
+*      code package.
+*
+* Project Name:
+*
+*      BeDIPS
+*
+* File Description:
+*
+*      This file contains the writer of the tracking file. The scanning thread
+*      hands every scanned device to a writer thread through a lock-free ring
+*      buffer, and the writer thread keeps the line of the current second in
+*      memory, appends finished lines in batches and rotates the file at every
+*      interval of sending to the gateway.
+*
+* File Name:
+*
+*      TrackingWriter.c
+*
+* Abstract:
+*
+*      BeDIPS uses LBeacons to deliver 3D coordinates and textual
+*      descriptions of their locations to users' devices. Basically, a LBeacon
+*      is an inexpensive, Bluetooth Smart Ready device. The 3D coordinates and
+*      location description of every LBeacon are retrieved from BeDIS
+*      (Building/environment Data and Information System) and stored locally
+*      during deployment and maintenance times. Once initialized, each LBeacon
+*      broadcasts its coordinates and location description to Bluetooth
+*      enabled user devices within its coverage area.
+*
+* Authors:
+*
+*      Jake Lee, jakelee@iis.sinica.edu.tw
+*      Johnson Su, johnsonsu@iis.sinica.edu.tw
+*      Shirley Huang, shirley.huang.93@gmail.com
+*      Han Hu, hhu14@illinois.edu
+*      Jeffrey Lin, lin.jeff03@gmail.com
+*      Howard Hsu, haohsu0823@gmail.com
+*      Han Wang, hollywang@iis.sinica.edu.tw
+*/
+
+#include "TrackingWriter.h"
+
+
+/*
+*  tracking_writer_init:
+*
+*  This function allocates the ring buffer of a writer. The tracking file is
+*  created when the first record arrives.
+*
+*  Parameters:
+*
+*  writer - the writer to be initialized
+*  file_name - path of the tracking file
+*  uuid - UUID of the LBeacon written on the first line of the file
+*  capacity - minimum number of records the ring buffer can hold
+*  rotation_interval - length of time in seconds covered by each file
+*
+*  Return value:
+*
+*  0 - success
+*  -1 - memory allocation failed
+*/
+int tracking_writer_init(TrackingWriter *writer, char *file_name, char *uuid,
+                         unsigned capacity, unsigned rotation_interval) {
+
+    unsigned ring_capacity = 1;
+
+    memset(writer, 0, sizeof(TrackingWriter));
+
+    /* The ring indices wrap around with a mask */
+    while (ring_capacity < capacity) {
+        ring_capacity <<= 1;
+    }
+
+    writer->records =
+        (TrackingRecord *)malloc(ring_capacity * sizeof(TrackingRecord));
+
+    if (writer->records == NULL) {
+
+        /* Error handling */
+        perror("Failed to allocate memory");
+        return -1;
+
+    }
+
+    writer->capacity = ring_capacity;
+    writer->file_name = file_name;
+    writer->uuid = uuid;
+    writer->file_descriptor = -1;
+    writer->rotation_interval = rotation_interval;
+
+    return 0;
+}
+
+
+/*
+*  tracking_writer_record:
+*
+*  This function hands a scanned device to the writer thread. Only one
+*  thread may call it. It never blocks; the record is dropped if the ring
+*  buffer is full.
+*
+*  Parameters:
+*
+*  writer - the writer
+*  bluetooth_device_address - address of the scanned device
+*  timestamp - time in seconds since the Epoch at which it was scanned
+*
+*  Return value:
+*
+*  true - the record is in the ring buffer
+*  false - the ring buffer is full
+*/
+bool tracking_writer_record(TrackingWriter *writer,
+                            bdaddr_t *bluetooth_device_address,
+                            unsigned timestamp) {
+
+    unsigned tail = writer->tail;
+    unsigned head = __atomic_load_n(&writer->head, __ATOMIC_ACQUIRE);
+    TrackingRecord *record;
+
+    if (tail - head == writer->capacity) {
+        writer->number_of_dropped++;
+        return false;
+    }
+
+    record = &writer->records[tail & (writer->capacity - 1)];
+    bacpy(&record->address, bluetooth_device_address);
+    record->timestamp = timestamp;
+
+    /* Publish the record after its content */
+    __atomic_store_n(&writer->tail, tail + 1, __ATOMIC_RELEASE);
+
+    return true;
+}
+
+
+/*
+*  flush_batch:
+*
+*  This helper function appends the finished lines to the tracking file
+*  with one write.
+*
+*  Parameters:
+*
+*  writer - the writer
+*
+*  Return value:
+*
+*  None
+*/
+static void flush_batch(TrackingWriter *writer) {
+
+    int offset = 0;
+    int return_value;
+
+    while (offset < writer->batch_length) {
+
+        return_value = write(writer->file_descriptor, writer->batch + offset,
+                             writer->batch_length - offset);
+
+        if (0 > return_value) {
+
+            if (errno == EINTR) {
+                continue;
+            }
+
+            /* Error handling */
+            perror(writer->file_name);
+            break;
+
+        }
+
+        offset += return_value;
+
+    }
+
+    if (writer->batch_length > 0) {
+        writer->number_of_writes++;
+    }
+
+    writer->batch_length = 0;
+}
+
+
+/*
+*  append_to_batch:
+*
+*  This helper function copies text to the batch of finished lines, writing
+*  the batch first if it is full.
+*
+*  Parameters:
+*
+*  writer - the writer
+*  text - the text to be copied
+*  length - number of characters of the text
+*
+*  Return value:
+*
+*  None
+*/
+static void append_to_batch(TrackingWriter *writer, char *text, int length) {
+
+    if (writer->batch_length + length > TRACKING_BATCH_SIZE) {
+        flush_batch(writer);
+    }
+
+    memcpy(writer->batch + writer->batch_length, text, length);
+    writer->batch_length += length;
+}
+
+
+/*
+*  finish_line:
+*
+*  This helper function moves the line of the current second to the batch.
+*
+*  Parameters:
+*
+*  writer - the writer
+*
+*  Return value:
+*
+*  None
+*/
+static void finish_line(TrackingWriter *writer) {
+
+    if (writer->line_timestamp == 0) {
+        return;
+    }
+
+    append_to_batch(writer, writer->line, writer->line_length);
+    writer->line_length = 0;
+    writer->line_timestamp = 0;
+}
+
+
+/*
+*  open_file:
+*
+*  This helper function creates a new tracking file starting with the UUID
+*  of the LBeacon.
+*
+*  Parameters:
+*
+*  writer - the writer
+*  timestamp - timestamp of the first line of the file
+*
+*  Return value:
+*
+*  0 - success
+*  -1 - the file could not be created
+*/
+static int open_file(TrackingWriter *writer, unsigned timestamp) {
+
+    char header[TRACKING_LINE_LENGTH];
+    int length;
+
+    writer->file_descriptor = open(writer->file_name,
+                                   O_WRONLY | O_CREAT | O_TRUNC | O_APPEND,
+                                   0644);
+
+    if (0 > writer->file_descriptor) {
+
+        /* Error handling */
+        perror(writer->file_name);
+        return -1;
+
+    }
+
+    writer->initial_timestamp = timestamp;
+    length = snprintf(header, sizeof(header), "LBeacon UUID: %s",
+                      writer->uuid);
+    append_to_batch(writer, header, length);
+
+    return 0;
+}
+
+
+/*
+*  close_file:
+*
+*  This helper function writes everything still in memory, flushes the
+*  tracking file to the storage and closes it.
+*
+*  Parameters:
+*
+*  writer - the writer
+*
+*  Return value:
+*
+*  None
+*/
+static void close_file(TrackingWriter *writer) {
+
+    if (0 > writer->file_descriptor) {
+        return;
+    }
+
+    finish_line(writer);
+    flush_batch(writer);
+    fsync(writer->file_descriptor);
+    close(writer->file_descriptor);
+    writer->file_descriptor = -1;
+}
+
+
+/*
+*  rotate_file:
+*
+*  This helper function closes the tracking file of the interval that has
+*  ended and keeps it under the rotated name until it is sent to the
+*  gateway. The next record creates a new file.
+*
+*  Parameters:
+*
+*  writer - the writer
+*
+*  Return value:
+*
+*  None
+*/
+static void rotate_file(TrackingWriter *writer) {
+
+    char rotated_file_name[FILENAME_MAX];
+
+    close_file(writer);
+
+    snprintf(rotated_file_name, sizeof(rotated_file_name), "%s%s",
+             writer->file_name, TRACKING_ROTATED_SUFFIX);
+
+    if (0 > rename(writer->file_name, rotated_file_name)) {
+
+        /* Error handling */
+        perror(rotated_file_name);
+
+    }
+
+    writer->number_of_rotations++;
+
+    /* @todo: send the rotated file to the gateway */
+}
+
+
+/*
+*  add_record:
+*
+*  This helper function adds a record to the line of its second. A record
+*  of a new second finishes the current line, and a device already on the
+*  line is not added again.
+*
+*  Parameters:
+*
+*  writer - the writer
+*  record - the record
+*
+*  Return value:
+*
+*  None
+*/
+static void add_record(TrackingWriter *writer, TrackingRecord *record) {
+
+    char address[18];
+    int length;
+
+    if (0 <= writer->file_descriptor &&
+        writer->rotation_interval <=
+        record->timestamp - writer->initial_timestamp) {
+        rotate_file(writer);
+    }
+
+    if (0 > writer->file_descriptor &&
+        0 > open_file(writer, record->timestamp)) {
+        return;
+    }
+
+    ba2str(&record->address, address);
+    writer->number_of_records++;
+
+    if (record->timestamp != writer->line_timestamp) {
+
+        finish_line(writer);
+        writer->line_length = snprintf(writer->line, TRACKING_LINE_LENGTH,
+                                       "\n%u - %u - %s", record->timestamp,
+                                       writer->initial_timestamp, address);
+        writer->line_timestamp = record->timestamp;
+        return;
+
+    }
+
+    /* Double check that the MAC address is not already added at a given
+     * timestamp */
+    if (strstr(writer->line, address) != NULL) {
+        return;
+    }
+
+    length = strlen(address) + 2;
+
+    if (writer->line_length + length < TRACKING_LINE_LENGTH) {
+        writer->line_length += sprintf(writer->line + writer->line_length,
+                                       ", %s", address);
+    }
+}
+
+
+/*
+*  tracking_writer_run:
+*
+*  This function is the writer thread. It drains the ring buffer, writes
+*  the lines finished during the drain with one write, and sleeps for
+*  TRACKING_WRITER_INTERVAL milliseconds. The file is synced to the storage
+*  only when it is rotated or closed.
+*
+*  Parameters:
+*
+*  writer - the writer
+*
+*  Return value:
+*
+*  None
+*/
+void *tracking_writer_run(void *writer) {
+
+    TrackingWriter *tracking_writer = (TrackingWriter *)writer;
+    struct timespec interval = {TRACKING_WRITER_INTERVAL / 1000,
+                                (TRACKING_WRITER_INTERVAL % 1000) * 1000000};
+    unsigned head;
+    unsigned tail;
+    unsigned now;
+    bool stopped = false;
+
+    while (stopped == false) {
+
+        stopped = __atomic_load_n(&tracking_writer->stopped,
+                                  __ATOMIC_ACQUIRE);
+        head = tracking_writer->head;
+        tail = __atomic_load_n(&tracking_writer->tail, __ATOMIC_ACQUIRE);
+
+        for (; head != tail; head++) {
+            add_record(tracking_writer,
+                       &tracking_writer->records[head &
+                           (tracking_writer->capacity - 1)]);
+        }
+
+        /* Give the slots back to the scanning thread */
+        __atomic_store_n(&tracking_writer->head, head, __ATOMIC_RELEASE);
+
+        now = (unsigned)time(NULL);
+
+        if (0 <= tracking_writer->file_descriptor) {
+
+            /* No record of an earlier second can arrive any more */
+            if (tracking_writer->line_timestamp != 0 &&
+                now > tracking_writer->line_timestamp) {
+                finish_line(tracking_writer);
+            }
+
+            flush_batch(tracking_writer);
+
+            if (tracking_writer->rotation_interval <=
+                now - tracking_writer->initial_timestamp) {
+                rotate_file(tracking_writer);
+            }
+
+        }
+
+        if (stopped == false) {
+            nanosleep(&interval, NULL);
+        }
+
+    }
+
+    close_file(tracking_writer);
+
+    return NULL;
+}
+
+
+/*
+*  tracking_writer_stop:
+*
+*  This function asks the writer thread to write the records left in the
+*  ring buffer and exit. The caller then joins the thread.
+*
+*  Parameters:
+*
+*  writer - the writer
+*
+*  Return value:
+*
+*  None
+*/
+void tracking_writer_stop(TrackingWriter *writer) {
+
+    __atomic_store_n(&writer->stopped, true, __ATOMIC_RELEASE);
+}
+
+
+/*
+*  tracking_writer_print_statistics:
+*
+*  This function prints the number of records written and dropped, and the
+*  number of writes and rotations of the tracking file.
+*
+*  Parameters:
+*
+*  writer - the writer
+*
+*  Return value:
+*
+*  None
+*/
+void tracking_writer_print_statistics(TrackingWriter *writer) {
+
+    printf("Tracking writer: %llu records, %llu dropped, %llu writes, "
+           "%llu rotations\n", writer->number_of_records,
+           writer->number_of_dropped, writer->number_of_writes,
+           writer->number_of_rotations);
+}
+
+
+/*
+*  tracking_writer_free:
+*
+*  This function frees the ring buffer of the writer. The writer thread
+*  must have exited.
+*
+*  Parameters:
+*
+*  writer - the writer
+*
+*  Return value:
+*
+*  None
+*/
+void tracking_writer_free(TrackingWriter *writer) {
+
+    free(writer->records);
+    writer->records = NULL;
+    writer->capacity = 0;
+}
@@ -0,0 +1,160 @@
+/*
+* Copyright (c) 2016 Academia Sinica, Institute of Information Science
+*
+* License:
+*
+*      GPL 3.0 : The content of this file is subject to the terms and
+*      conditions defined in file 'COPYING.txt', which is part of this source
+*      code package.
+*
+* Project Name:
+*
+*      BeDIPS
+*
+* File Description:
+*
+*      This header file contains the function declarations and variables used
+*      in the TrackingWriter.c file.
+*
+* File Name:
+*
+*      TrackingWriter.h
+*
+* Abstract:
+*
+*      BeDIPS uses LBeacons to deliver 3D coordinates and textual
+*      descriptions of their locations to users' devices. Basically, a LBeacon
+*      is an inexpensive, Bluetooth Smart Ready device. The 3D coordinates and
+*      location description of every LBeacon are retrieved from BeDIS
+*      (Building/environment Data and Information System) and stored locally
+*      during deployment and maintenance times. Once initialized, each LBeacon
+*      broadcasts its coordinates and location description to Bluetooth
+*      enabled user devices within its coverage area.
+*
+* Authors:
+*
+*      Jake Lee, jakelee@iis.sinica.edu.tw
+*      Johnson Su, johnsonsu@iis.sinica.edu.tw
+*      Shirley Huang, shirley.huang.93@gmail.com
+*      Han Hu, hhu14@illinois.edu
+*      Jeffrey Lin, lin.jeff03@gmail.com
+*      Howard Hsu, haohsu0823@gmail.com
+*      Han Wang, hollywang@iis.sinica.edu.tw
+*/
+
+#ifndef TRACKINGWRITER_H
+#define TRACKINGWRITER_H
+
+#include <bluetooth/bluetooth.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+
+/*
+* CONSTANTS
+*/
+
+/* Maximum number of characters in each line of the tracking file */
+#define TRACKING_LINE_LENGTH 1024
+
+/* Size in bytes of the buffer collecting finished lines between two
+ * writes */
+#define TRACKING_BATCH_SIZE 16384
+
+/* Time in milliseconds the writer thread sleeps between two drains of the
+ * ring buffer */
+#define TRACKING_WRITER_INTERVAL 500
+
+/* Suffix of the file holding the previous interval after a rotation */
+#define TRACKING_ROTATED_SUFFIX ".1"
+
+
+
+/*
+* TYPEDEF STRUCTS
+*/
+
+/* A device seen by the scanner */
+typedef struct TrackingRecord {
+    /* Address of the device */
+    bdaddr_t address;
+
+    /* Time in seconds since the Epoch at which the device was seen */
+    unsigned timestamp;
+} TrackingRecord;
+
+
+/* Writer of the tracking file. The scanning thread puts records in a
+ * lock-free ring buffer with one producer and one consumer, and the writer
+ * thread formats them, keeps the line of the current second in memory, and
+ * appends the finished lines with one write() per drain. The file is
+ * rotated every rotation_interval seconds. */
+typedef struct TrackingWriter {
+    /* Ring buffer of records; capacity is a power of two */
+    TrackingRecord *records;
+    unsigned capacity;
+
+    /* Number of records taken by the writer thread, only written by it */
+    unsigned head;
+
+    /* Number of records put by the scanning thread, only written by it */
+    unsigned tail;
+
+    /* Number of records dropped because the ring was full */
+    unsigned long long number_of_dropped;
+
+    /* Path of the tracking file and UUID written on its first line */
+    char *file_name;
+    char *uuid;
+
+    /* Descriptor of the open tracking file, -1 if none */
+    int file_descriptor;
+
+    /* Length of time in seconds covered by each tracking file */
+    unsigned rotation_interval;
+
+    /* Timestamp of the first line of the current file */
+    unsigned initial_timestamp;
+
+    /* Line of the current second and its timestamp, 0 if there is none */
+    char line[TRACKING_LINE_LENGTH];
+    int line_length;
+    unsigned line_timestamp;
+
+    /* Finished lines waiting to be written */
+    char batch[TRACKING_BATCH_SIZE];
+    int batch_length;
+
+    /* Statistics of the writer thread */
+    unsigned long long number_of_records;
+    unsigned long long number_of_writes;
+    unsigned long long number_of_rotations;
+
+    /* Set to make the writer thread flush and exit */
+    bool stopped;
+} TrackingWriter;
+
+
+
+/*
+* FUNCTIONS
+*/
+
+int tracking_writer_init(TrackingWriter *writer, char *file_name, char *uuid,
+                         unsigned capacity, unsigned rotation_interval);
+bool tracking_writer_record(TrackingWriter *writer,
+                            bdaddr_t *bluetooth_device_address,
+                            unsigned timestamp);
+void *tracking_writer_run(void *writer);
+void tracking_writer_stop(TrackingWriter *writer);
+void tracking_writer_print_statistics(TrackingWriter *writer);
+void tracking_writer_free(TrackingWriter *writer);
+
+#endif
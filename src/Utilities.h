@@ -55,6 +55,5 @@ extern bool g_done;
  * FUNCTIONS
  */
 
-unsigned int *uuid_str_to_data(char *uuid);
 unsigned int twoc(int in, int t);
 extern void ctrlc_handler(int stop);
\ No newline at end of file
@@ -0,0 +1,289 @@
+/*
+* Copyright (c) 2016 Academia Sinica, Institute of Information Science
+*
+* License:
+*
+*      GPL 3.0 : The content of this file is subject to the terms and
+*      conditions defined in file 'COPYING.txt', which is part of this source
+*      code package.
+*
+* Project Name:
+*
+*      BeDIPS
+*
+* File Description:
+*
+*      This file contains the microbenchmark of the lookups of the scanned
+*      devices. It compares the DeviceTable keyed by the packed device address
+*      with the linked list of MAC address strings that LBeacon walked before,
+*      at 10,000 and 100,000 devices, and prints the average time of a lookup
+*      of each.
+*
+* File Name:
+*
+*      bench_device_table.c
+*
+* Abstract:
+*
+*      BeDIPS uses LBeacons to deliver 3D coordinates and textual
+*      descriptions of their locations to users' devices. Basically, a LBeacon
+*      is an inexpensive, Bluetooth Smart Ready device. The 3D coordinates and
+*      location description of every LBeacon are retrieved from BeDIS
+*      (Building/environment Data and Information System) and stored locally
+*      during deployment and maintenance times. Once initialized, each LBeacon
+*      broadcasts its coordinates and location description to Bluetooth
+*      enabled user devices within its coverage area.
+*
+* Authors:
+*
+*      Jake Lee, jakelee@iis.sinica.edu.tw
+*      Johnson Su, johnsonsu@iis.sinica.edu.tw
+*      Shirley Huang, shirley.huang.93@gmail.com
+*      Han Hu, hhu14@illinois.edu
+*      Jeffrey Lin, lin.jeff03@gmail.com
+*      Howard Hsu, haohsu0823@gmail.com
+*      Han Wang, hollywang@iis.sinica.edu.tw
+*/
+
+#include <time.h>
+#include "DeviceTable.h"
+#include "LinkedList.h"
+
+
+/*
+* CONSTANTS
+*/
+
+/* Length of a MAC address string, with its terminating null */
+#define BENCH_MAC_ADDRESS_LENGTH 18
+
+/* Number of lookups timed in the list, which is slow, and in the table */
+#define BENCH_LIST_LOOKUPS 1000
+#define BENCH_TABLE_LOOKUPS 1000000
+
+/* Seed of the random addresses and lookups, so runs can be compared */
+#define BENCH_SEED 1
+
+
+
+/*
+* TYPEDEF STRUCTS
+*/
+
+/* Scanned device as the list stored it, with its address as a string */
+typedef struct ListedDevice {
+    long long initial_scanned_time;
+    char scanned_mac_address[BENCH_MAC_ADDRESS_LENGTH];
+} ListedDevice;
+
+
+/* Numbers of devices benchmarked */
+static int bench_sizes[] = {10000, 100000};
+
+
+/*
+*  get_time_in_nanoseconds:
+*
+*  This helper function returns the time of the monotonic clock.
+*
+*  Parameters:
+*
+*  None
+*
+*  Return value:
+*
+*  Time in nanoseconds
+*/
+static long long get_time_in_nanoseconds() {
+
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (long long)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+
+/*
+*  format_address:
+*
+*  This helper function writes a device address as text, like ba2str of
+*  BlueZ did for every device put in the list.
+*
+*  Parameters:
+*
+*  address - bluetooth device address
+*  text - buffer of BENCH_MAC_ADDRESS_LENGTH characters
+*
+*  Return value:
+*
+*  None
+*/
+static void format_address(bdaddr_t *address, char *text) {
+
+    sprintf(text, "%2.2X:%2.2X:%2.2X:%2.2X:%2.2X:%2.2X", address->b[5],
+            address->b[4], address->b[3], address->b[2], address->b[1],
+            address->b[0]);
+}
+
+
+/*
+*  find_in_list:
+*
+*  This helper function walks the list comparing the MAC address strings,
+*  as check_is_in_list did. The comparison is the equality the list
+*  needed, so every lookup walks up to the device.
+*
+*  Parameters:
+*
+*  list - head of the list
+*  address - MAC address string looked for
+*
+*  Return value:
+*
+*  The device, NULL if it is not in the list
+*/
+static ListedDevice *find_in_list(List_Entry *list, char *address) {
+
+    List_Entry *listptrs;
+    ListedDevice *device;
+
+    list_for_each(listptrs, list) {
+
+        device = (ListedDevice *)ListEntry(listptrs, Node, ptrs)->data;
+
+        if (0 == strcmp(address, device->scanned_mac_address)) {
+            return device;
+        }
+
+    }
+
+    return NULL;
+}
+
+
+/*
+*  bench_lookups:
+*
+*  This function fills a list and a table with the same random devices,
+*  then times random lookups of the devices in each.
+*
+*  Parameters:
+*
+*  number_of_devices - number of devices scanned
+*
+*  Return value:
+*
+*  0 - success
+*  -1 - memory allocation failed
+*/
+static int bench_lookups(int number_of_devices) {
+
+    List_Entry list = {&list, &list};
+    DeviceTable table;
+    bdaddr_t *addresses;
+    Node *nodes;
+    ListedDevice *devices;
+    char address[BENCH_MAC_ADDRESS_LENGTH];
+    long long start_time;
+    double list_time;
+    double table_time;
+    long number_of_hits = 0;
+    int device_id;
+    int lookup_id;
+    int byte_id;
+
+    addresses = (bdaddr_t *)malloc(number_of_devices * sizeof(bdaddr_t));
+    nodes = (Node *)malloc(number_of_devices * sizeof(Node));
+    devices = (ListedDevice *)malloc(number_of_devices *
+                                     sizeof(ListedDevice));
+
+    if (addresses == NULL || nodes == NULL || devices == NULL ||
+        0 > device_table_init(&table, DEVICE_TABLE_MINIMUM_CAPACITY)) {
+
+        /* Error handling */
+        perror("Failed to allocate memory");
+        free(addresses);
+        free(nodes);
+        free(devices);
+        return -1;
+
+    }
+
+    for (device_id = 0; device_id < number_of_devices; device_id++) {
+
+        for (byte_id = 0; byte_id < 6; byte_id++) {
+            addresses[device_id].b[byte_id] = rand();
+        }
+
+        devices[device_id].initial_scanned_time = device_id;
+        format_address(&addresses[device_id],
+                       devices[device_id].scanned_mac_address);
+
+        /* The list took new devices at its head */
+        nodes[device_id].data = &devices[device_id];
+        nodes[device_id].ptrs.next = list.next;
+        nodes[device_id].ptrs.prev = &list;
+        list.next->prev = &nodes[device_id].ptrs;
+        list.next = &nodes[device_id].ptrs;
+
+        device_table_insert(&table, bdaddr_to_key(&addresses[device_id]),
+                            &devices[device_id]);
+
+    }
+
+    start_time = get_time_in_nanoseconds();
+
+    for (lookup_id = 0; lookup_id < BENCH_LIST_LOOKUPS; lookup_id++) {
+
+        device_id = rand() % number_of_devices;
+        format_address(&addresses[device_id], address);
+        number_of_hits += find_in_list(&list, address) != NULL;
+
+    }
+
+    list_time = (double)(get_time_in_nanoseconds() - start_time) /
+                BENCH_LIST_LOOKUPS;
+    start_time = get_time_in_nanoseconds();
+
+    for (lookup_id = 0; lookup_id < BENCH_TABLE_LOOKUPS; lookup_id++) {
+
+        device_id = rand() % number_of_devices;
+        number_of_hits += device_table_lookup(
+            &table, bdaddr_to_key(&addresses[device_id])) != NULL;
+
+    }
+
+    table_time = (double)(get_time_in_nanoseconds() - start_time) /
+                 BENCH_TABLE_LOOKUPS;
+
+    printf("%d devices: list %.1f us/lookup, table %.0f ns/lookup "
+           "(%ld found)\n", number_of_devices, list_time / 1000,
+           table_time, number_of_hits);
+
+    device_table_free(&table);
+    free(addresses);
+    free(nodes);
+    free(devices);
+
+    return 0;
+}
+
+
+int main(int argc, char **argv) {
+
+    int size_id;
+
+    srand(BENCH_SEED);
+
+    for (size_id = 0; size_id < (int)(sizeof(bench_sizes) / sizeof(int));
+         size_id++) {
+
+        if (0 > bench_lookups(bench_sizes[size_id])) {
+            return EXIT_FAILURE;
+        }
+
+    }
+
+    return EXIT_SUCCESS;
+}
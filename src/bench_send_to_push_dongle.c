@@ -0,0 +1,260 @@
+/*
+* Copyright (c) 2016 Academia Sinica, Institute of Information Science
+*
+* License:
+*
+*      GPL 3.0 : The content of this file is subject to the terms and
+*      conditions defined in file 'COPYING.txt', which is part of this source
+*      code package.
+*
+* Project Name:
+*
+*      BeDIPS
+*
+* File Description:
+*
+*      This file contains the microbenchmark of the work send_to_push_dongle
+*      does for every sighting before the scanned table lookup. It compares
+*      the device address kept as a MAC address string, formatted with ba2str
+*      and copied into the scanned device and the push job, with the binary
+*      address copied as it is, and prints the cycles and nanoseconds of each
+*      per sighting.
+*
+* File Name:
+*
+*      bench_send_to_push_dongle.c
+*
+* Abstract:
+*
+*      BeDIPS uses LBeacons to deliver 3D coordinates and textual
+*      descriptions of their locations to users' devices. Basically, a LBeacon
+*      is an inexpensive, Bluetooth Smart Ready device. The 3D coordinates and
+*      location description of every LBeacon are retrieved from BeDIS
+*      (Building/environment Data and Information System) and stored locally
+*      during deployment and maintenance times. Once initialized, each LBeacon
+*      broadcasts its coordinates and location description to Bluetooth
+*      enabled user devices within its coverage area.
+*
+* Authors:
+*
+*      Jake Lee, jakelee@iis.sinica.edu.tw
+*      Johnson Su, johnsonsu@iis.sinica.edu.tw
+*      Shirley Huang, shirley.huang.93@gmail.com
+*      Han Hu, hhu14@illinois.edu
+*      Jeffrey Lin, lin.jeff03@gmail.com
+*      Howard Hsu, haohsu0823@gmail.com
+*      Han Wang, hollywang@iis.sinica.edu.tw
+*/
+
+#include <bluetooth/bluetooth.h>
+#include <time.h>
+#include "DeviceTable.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+
+/*
+* CONSTANTS
+*/
+
+/* Length of a MAC address string, with its terminating null */
+#define BENCH_MAC_ADDRESS_LENGTH 18
+
+/* Number of sightings timed, and of distinct devices sighted */
+#define BENCH_SIGHTINGS 5000000
+#define BENCH_DEVICES 64
+
+
+
+/*
+* TYPEDEF STRUCTS
+*/
+
+/* Scanned device and push job holding the address as a string */
+typedef struct StringRecord {
+    long long initial_scanned_time;
+    char scanned_mac_address[BENCH_MAC_ADDRESS_LENGTH];
+} StringRecord;
+
+
+/* Scanned device and push job holding the binary address */
+typedef struct AddressRecord {
+    long long initial_scanned_time;
+    bdaddr_t scanned_device_address;
+} AddressRecord;
+
+
+/* Sum of the results, so the compiler keeps the work timed */
+static volatile uint64_t sink;
+
+
+/*
+*  get_time_in_nanoseconds:
+*
+*  This helper function returns the time of the monotonic clock.
+*
+*  Parameters:
+*
+*  None
+*
+*  Return value:
+*
+*  Time in nanoseconds
+*/
+static long long get_time_in_nanoseconds() {
+
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (long long)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+
+/*
+*  read_cycle_counter:
+*
+*  This helper function reads the time stamp counter of the processor.
+*
+*  Parameters:
+*
+*  None
+*
+*  Return value:
+*
+*  Number of cycles counted, 0 where the processor has no such counter
+*/
+static uint64_t read_cycle_counter() {
+
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+
+/*
+*  bench_strings:
+*
+*  This function times the work of a sighting when the address is a
+*  string: packing the key, formatting the address with ba2str, and
+*  copying the string into the scanned device and the push job.
+*
+*  Parameters:
+*
+*  addresses - addresses of the devices sighted
+*  cycles - receives the number of cycles per sighting
+*
+*  Return value:
+*
+*  Number of nanoseconds per sighting
+*/
+static double bench_strings(bdaddr_t *addresses, double *cycles) {
+
+    StringRecord device;
+    StringRecord job;
+    char address[BENCH_MAC_ADDRESS_LENGTH];
+    long long start_time;
+    uint64_t start_cycles;
+    uint64_t key;
+    int sighting_id;
+
+    start_time = get_time_in_nanoseconds();
+    start_cycles = read_cycle_counter();
+
+    for (sighting_id = 0; sighting_id < BENCH_SIGHTINGS; sighting_id++) {
+
+        bdaddr_t *sighted = &addresses[sighting_id % BENCH_DEVICES];
+
+        key = bdaddr_to_key(sighted);
+        ba2str(sighted, address);
+        strcat(address, "\0");
+        strncpy(device.scanned_mac_address, address,
+                BENCH_MAC_ADDRESS_LENGTH);
+        strncpy(job.scanned_mac_address, address, BENCH_MAC_ADDRESS_LENGTH);
+        sink += key + device.scanned_mac_address[3] +
+                job.scanned_mac_address[4];
+
+    }
+
+    *cycles = (double)(read_cycle_counter() - start_cycles) /
+              BENCH_SIGHTINGS;
+
+    return (double)(get_time_in_nanoseconds() - start_time) /
+           BENCH_SIGHTINGS;
+}
+
+
+/*
+*  bench_addresses:
+*
+*  This function times the work of a sighting when the address stays
+*  binary: packing the key and copying the address into the scanned
+*  device and the push job.
+*
+*  Parameters:
+*
+*  addresses - addresses of the devices sighted
+*  cycles - receives the number of cycles per sighting
+*
+*  Return value:
+*
+*  Number of nanoseconds per sighting
+*/
+static double bench_addresses(bdaddr_t *addresses, double *cycles) {
+
+    AddressRecord device;
+    AddressRecord job;
+    long long start_time;
+    uint64_t start_cycles;
+    uint64_t key;
+    int sighting_id;
+
+    start_time = get_time_in_nanoseconds();
+    start_cycles = read_cycle_counter();
+
+    for (sighting_id = 0; sighting_id < BENCH_SIGHTINGS; sighting_id++) {
+
+        bdaddr_t *sighted = &addresses[sighting_id % BENCH_DEVICES];
+
+        key = bdaddr_to_key(sighted);
+        bacpy(&device.scanned_device_address, sighted);
+        bacpy(&job.scanned_device_address, sighted);
+        sink += key + device.scanned_device_address.b[3] +
+                job.scanned_device_address.b[4];
+
+    }
+
+    *cycles = (double)(read_cycle_counter() - start_cycles) /
+              BENCH_SIGHTINGS;
+
+    return (double)(get_time_in_nanoseconds() - start_time) /
+           BENCH_SIGHTINGS;
+}
+
+
+int main(int argc, char **argv) {
+
+    bdaddr_t addresses[BENCH_DEVICES];
+    double string_cycles;
+    double address_cycles;
+    double string_time;
+    double address_time;
+    int device_id;
+
+    for (device_id = 0; device_id < BENCH_DEVICES; device_id++) {
+        memset(&addresses[device_id], device_id * 3 + 1, sizeof(bdaddr_t));
+    }
+
+    string_time = bench_strings(addresses, &string_cycles);
+    address_time = bench_addresses(addresses, &address_cycles);
+
+    printf("MAC address strings: %.0f cycles, %.1f ns per sighting\n",
+           string_cycles, string_time);
+    printf("Binary addresses: %.0f cycles, %.1f ns per sighting\n",
+           address_cycles, address_time);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,472 @@
+/*
+* Copyright (c) 2016 Academia Sinica, Institute of Information Science
+*
+* License:
+*
+*      GPL 3.0 : The content of this file is subject to the terms and
+*      conditions defined in file 'COPYING.txt', which is part of this source
+*      code package.
+*
+* Project Name:
+*
+*      BeDIPS
+*
+* File Description:
+*
+*      This file contains the unit tests of the advertising controller and
+*      scheduler. The compiled iBeacon, AltBeacon and Eddystone payloads are
+*      compared with fixed bytes, and the HCI library is replaced by stubs
+*      counting the commands, so the tests check that every payload change
+*      costs a single command and that an unchanged payload costs none. The
+*      tests run without a dongle.
+*
+* File Name:
+*
+*      test_advertising.c
+*
+* Abstract:
+*
+*      BeDIPS uses LBeacons to deliver 3D coordinates and textual
+*      descriptions of their locations to users' devices. Basically, a LBeacon
+*      is an inexpensive, Bluetooth Smart Ready device. The 3D coordinates and
+*      location description of every LBeacon are retrieved from BeDIS
+*      (Building/environment Data and Information System) and stored locally
+*      during deployment and maintenance times. Once initialized, each LBeacon
+*      broadcasts its coordinates and location description to Bluetooth
+*      enabled user devices within its coverage area.
+*
+* Authors:
+*
+*      Jake Lee, jakelee@iis.sinica.edu.tw
+*      Johnson Su, johnsonsu@iis.sinica.edu.tw
+*      Shirley Huang, shirley.huang.93@gmail.com
+*      Han Hu, hhu14@illinois.edu
+*      Jeffrey Lin, lin.jeff03@gmail.com
+*      Howard Hsu, haohsu0823@gmail.com
+*      Han Wang, hollywang@iis.sinica.edu.tw
+*/
+
+#include "AdvertisingController.h"
+#include "AdvertisingScheduler.h"
+
+
+/* Number of HCI commands the stubs were sent, and the last one */
+static int number_of_commands = 0;
+static uint16_t last_command = 0;
+
+/* Number of legacy advertising commands the stubs were sent */
+static int number_of_legacy_commands = 0;
+
+/* Whether the stubbed controller supports extended advertising, and its
+ * number of advertising sets */
+static bool has_extended_advertising = false;
+static int number_of_advertising_sets = ADVERTISING_MAXIMUM_FRAMES;
+
+/* Number of checks that failed */
+static int number_of_failures = 0;
+
+/* Payloads compiled for a beacon whose RSSI at one meter is -59 dBm */
+static const uint8_t ibeacon_golden[] = {
+    0x02, 0x01, 0x1A, 0x1A, 0xFF, 0x4C, 0x00, 0x02, 0x15,
+    0xE2, 0xC5, 0x6D, 0xB5, 0xDF, 0xFB, 0x48, 0xD2,
+    0xB0, 0x60, 0xD0, 0xF5, 0x00, 0x00, 0x80, 0x3F,
+    0x00, 0x00, 0x00, 0x40, 0xC5
+};
+
+static const uint8_t altbeacon_golden[] = {
+    0x02, 0x01, 0x1A, 0x1B, 0xFF, 0x18, 0x01, 0xBE, 0xAC,
+    0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0A,
+    0x0B, 0x0C, 0x0D, 0x0E, 0x0F, 0x10, 0x11, 0x12, 0x13, 0x14,
+    0xC5, 0x00
+};
+
+static const uint8_t eddystone_uid_golden[] = {
+    0x02, 0x01, 0x1A, 0x03, 0x03, 0xAA, 0xFE,
+    0x17, 0x16, 0xAA, 0xFE, 0x00, 0xEE,
+    0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0A,
+    0x0B, 0x0C, 0x0D, 0x0E, 0x0F, 0x10, 0x00, 0x00
+};
+
+static const uint8_t eddystone_url_golden[] = {
+    0x02, 0x01, 0x1A, 0x03, 0x03, 0xAA, 0xFE,
+    0x0E, 0x16, 0xAA, 0xFE, 0x10, 0xEE,
+    0x01, 'e', 'x', 'a', 'm', 'p', 'l', 'e', 0x00
+};
+
+
+/*
+*  hci_open_dev:
+*
+*  This stub of the BlueZ function opens no socket.
+*
+*  Parameters:
+*
+*  dev_id - ID of the dongle
+*
+*  Return value:
+*
+*  A handle that is never used as a file descriptor
+*/
+int hci_open_dev(int dev_id) {
+
+    return 3;
+}
+
+
+/*
+*  hci_close_dev:
+*
+*  This stub of the BlueZ function does nothing.
+*
+*  Parameters:
+*
+*  dd - handle returned by hci_open_dev
+*
+*  Return value:
+*
+*  0 - success
+*/
+int hci_close_dev(int dd) {
+
+    return 0;
+}
+
+
+/*
+*  hci_get_route:
+*
+*  This stub of the BlueZ function picks the first dongle.
+*
+*  Parameters:
+*
+*  bdaddr - not used
+*
+*  Return value:
+*
+*  0 - ID of the first dongle
+*/
+int hci_get_route(bdaddr_t *bdaddr) {
+
+    return 0;
+}
+
+
+/*
+*  hci_send_req:
+*
+*  This stub of the BlueZ function counts the commands and answers them
+*  with success. The controller reports the LE extended advertising
+*  feature when has_extended_advertising is set, with
+*  number_of_advertising_sets sets.
+*
+*  Parameters:
+*
+*  dd - handle returned by hci_open_dev
+*  request - the command and the buffer of its return parameters
+*  timeout - not used
+*
+*  Return value:
+*
+*  0 - success
+*/
+int hci_send_req(int dd, struct hci_request *request, int timeout) {
+
+    uint8_t *response = (uint8_t *)request->rparam;
+
+    number_of_commands++;
+    last_command = request->ocf;
+
+    if (request->ocf == OCF_LE_SET_ADVERTISING_PARAMETERS ||
+        request->ocf == OCF_LE_SET_ADVERTISING_DATA ||
+        request->ocf == OCF_LE_SET_ADVERTISE_ENABLE) {
+        number_of_legacy_commands++;
+    }
+
+    memset(response, 0, request->rlen);
+
+    if (request->ocf == OCF_LE_READ_FEATURES &&
+        has_extended_advertising == true) {
+        response[1 + LE_EXTENDED_ADVERTISING_BYTE] =
+            LE_EXTENDED_ADVERTISING_BIT;
+    }
+    else if (request->ocf == OCF_LE_READ_NUMBER_OF_ADVERTISING_SETS) {
+        response[1] = number_of_advertising_sets;
+    }
+
+    return 0;
+}
+
+
+/*
+*  check:
+*
+*  This helper function prints the outcome of a check and counts the
+*  failures.
+*
+*  Parameters:
+*
+*  is_passed - whether the check passed
+*  description - what was checked
+*
+*  Return value:
+*
+*  None
+*/
+static void check(bool is_passed, char *description) {
+
+    printf("%s: %s\n", is_passed == true ? "PASS" : "FAIL", description);
+
+    if (is_passed == false) {
+        number_of_failures++;
+    }
+}
+
+
+/*
+*  check_payload:
+*
+*  This helper function checks that a compiled payload holds exactly the
+*  expected bytes, and prints the first byte that differs.
+*
+*  Parameters:
+*
+*  payload - the compiled advertising data
+*  golden - the expected bytes
+*  length - number of expected bytes
+*  description - the frame checked
+*
+*  Return value:
+*
+*  None
+*/
+static void check_payload(le_set_advertising_data_cp *payload,
+                          const uint8_t *golden, int length,
+                          char *description) {
+
+    int byte_id;
+
+    if (payload->length != length) {
+        printf("%s: length %d instead of %d\n", description,
+               payload->length, length);
+    }
+
+    for (byte_id = 0; byte_id < length && byte_id < payload->length;
+         byte_id++) {
+
+        if (payload->data[byte_id] != golden[byte_id]) {
+            printf("%s: byte %d is 0x%02X instead of 0x%02X\n", description,
+                   byte_id, payload->data[byte_id], golden[byte_id]);
+            break;
+        }
+
+    }
+
+    check(payload->length == length && byte_id == length, description);
+}
+
+
+/*
+*  test_payloads:
+*
+*  This function compiles every kind of frame and compares it with its
+*  fixed bytes, and checks that invalid beacon data is refused.
+*
+*  Parameters:
+*
+*  None
+*
+*  Return value:
+*
+*  None
+*/
+static void test_payloads() {
+
+    le_set_advertising_data_cp payload;
+    uint8_t beacon_id[ALTBEACON_ID_SIZE];
+    int byte_id;
+
+    check(0 == advertising_compile_ibeacon(
+                   &payload, "E2C56DB5DFFB48D2B060D0F50000803F00000040",
+                   -59), "iBeacon data is accepted");
+    check_payload(&payload, ibeacon_golden, sizeof(ibeacon_golden),
+                  "iBeacon payload");
+
+    check(0 > advertising_compile_ibeacon(
+                  &payload, "E2C56DB5DFFB48D2B060D0F50000803F0000004G",
+                  -59), "iBeacon data with a bad digit is refused");
+    check(0 > advertising_compile_ibeacon(&payload, "E2C5", -59),
+          "short iBeacon data is refused");
+
+    for (byte_id = 0; byte_id < ALTBEACON_ID_SIZE; byte_id++) {
+        beacon_id[byte_id] = byte_id + 1;
+    }
+
+    advertising_compile_altbeacon(&payload, beacon_id, -59);
+    check_payload(&payload, altbeacon_golden, sizeof(altbeacon_golden),
+                  "AltBeacon payload");
+
+    advertising_compile_eddystone_uid(&payload, beacon_id,
+                                      &beacon_id[EDDYSTONE_NAMESPACE_SIZE],
+                                      -59);
+    check_payload(&payload, eddystone_uid_golden,
+                  sizeof(eddystone_uid_golden), "Eddystone-UID payload");
+
+    check(0 == advertising_compile_eddystone_url(
+                   &payload, "https://www.example.com/", -59),
+          "Eddystone URL is accepted");
+    check_payload(&payload, eddystone_url_golden,
+                  sizeof(eddystone_url_golden), "Eddystone-URL payload");
+
+    check(0 > advertising_compile_eddystone_url(
+                  &payload, "ftp://example.com/", -59),
+          "Eddystone URL with an unknown scheme is refused");
+    check(0 > advertising_compile_eddystone_url(
+                  &payload, "https://a-very-long-host-name.com/", -59),
+          "Eddystone URL too long for a frame is refused");
+}
+
+
+/*
+*  count_commands:
+*
+*  This helper function resets the number of commands sent to the stubs
+*  and returns the number sent since the last reset.
+*
+*  Parameters:
+*
+*  None
+*
+*  Return value:
+*
+*  Number of commands sent since the last reset
+*/
+static int count_commands() {
+
+    int count = number_of_commands;
+
+    number_of_commands = 0;
+
+    return count;
+}
+
+
+/*
+*  test_commands:
+*
+*  This function starts a scheduler advertising three frames, with legacy
+*  advertising or with advertising sets, and checks the commands every
+*  change of the frames costs.
+*
+*  Parameters:
+*
+*  is_extended - whether the controller supports extended advertising
+*  number_of_sets - number of advertising sets of the controller
+*
+*  Return value:
+*
+*  None
+*/
+static void test_commands(bool is_extended, int number_of_sets) {
+
+    AdvertisingController controller;
+    AdvertisingScheduler scheduler;
+    le_set_advertising_data_cp frames[3];
+    le_set_advertising_data_cp changed;
+    uint8_t beacon_id[ALTBEACON_ID_SIZE];
+    uint16_t data_command = OCF_LE_SET_ADVERTISING_DATA;
+    bool is_rotating = is_extended == false || number_of_sets < 3;
+    int frame_id;
+
+    if (is_extended == true) {
+        printf("With extended advertising and %d sets:\n", number_of_sets);
+        data_command = OCF_LE_SET_EXTENDED_ADVERTISING_DATA;
+    }
+    else {
+        printf("With legacy advertising:\n");
+    }
+
+    has_extended_advertising = is_extended;
+    number_of_advertising_sets = number_of_sets;
+    number_of_legacy_commands = 0;
+    memset(beacon_id, 0x42, sizeof(beacon_id));
+    advertising_compile_ibeacon(&frames[0],
+                                "E2C56DB5DFFB48D2B060D0F50000803F00000040",
+                                -59);
+    advertising_compile_altbeacon(&frames[1], beacon_id, -59);
+    advertising_compile_eddystone_url(&frames[2], "https://www.example.com/",
+                                      -59);
+
+    advertising_init(&controller, -1);
+    advertising_scheduler_init(&scheduler, &controller, 480);
+
+    for (frame_id = 0; frame_id < 3; frame_id++) {
+        advertising_scheduler_add_frame(&scheduler, &frames[frame_id]);
+    }
+
+    check(0 == advertising_scheduler_start(&scheduler),
+          "scheduler starts");
+    check(scheduler.use_extended == is_extended,
+          "advertising sets are used only when supported");
+    count_commands();
+
+    advertising_scheduler_rotate(&scheduler);
+    check(count_commands() == (is_rotating == true ? 1 : 0) &&
+          (is_rotating == false || last_command == data_command),
+          "a rotation costs one data command, none with a set per frame");
+
+    if (is_extended == false) {
+        check(0 == advertising_set_payload(&controller,
+                                           &frames[scheduler.current_frame])
+              && count_commands() == 0,
+              "advertising the current payload again costs no command");
+    }
+
+    check(0 == advertising_scheduler_set_frame(&scheduler, 2, &frames[2]) &&
+          count_commands() == 0,
+          "setting a frame to its own content costs no command");
+
+    frame_id = scheduler.current_frame;
+    memcpy(&changed, &frames[frame_id], sizeof(changed));
+    changed.data[changed.length - 1] ^= 0x01;
+    check(0 == advertising_scheduler_set_frame(&scheduler, frame_id,
+                                               &changed) &&
+          count_commands() == 1 && last_command == data_command,
+          "changing the advertised frame costs one data command");
+
+    frame_id = (scheduler.current_frame + 1) % 3;
+    memcpy(&changed, &frames[frame_id], sizeof(changed));
+    changed.data[changed.length - 1] ^= 0x01;
+    advertising_scheduler_set_frame(&scheduler, frame_id, &changed);
+    check(count_commands() == (is_rotating == true ? 0 : 1),
+          "changing a waiting frame costs one command with a set per "
+          "frame, none until its turn otherwise");
+
+    advertising_scheduler_stop(&scheduler);
+    advertising_scheduler_free(&scheduler);
+    advertising_free(&controller);
+    count_commands();
+
+    if (is_extended == true) {
+        check(number_of_legacy_commands == 0,
+              "no legacy advertising command is sent with extended "
+              "advertising");
+    }
+}
+
+
+int main(int argc, char **argv) {
+
+    test_payloads();
+    test_commands(false, 0);
+    test_commands(true, ADVERTISING_MAXIMUM_FRAMES);
+    test_commands(true, 2);
+
+    if (number_of_failures > 0) {
+        printf("%d checks failed\n", number_of_failures);
+        return EXIT_FAILURE;
+    }
+
+    printf("All checks passed\n");
+
+    return EXIT_SUCCESS;
+}